@@ -69,7 +69,7 @@ static capy_err params_handler(Unused capy_arena *arena, capy_httpreq *request,
         return ErrWrap(err, "Failed to get URI params");
     }
 
-    for (size_t i = 0; i < request->query->capacity; i++)
+    for (size_t i = 0; i < request->query->size; i++)
     {
         for (capy_strkvn *param = capy_strkvnmap_at(request->query, i); param != NULL; param = param->next)
         {
@@ -86,6 +86,78 @@ static capy_err params_handler(Unused capy_arena *arena, capy_httpreq *request,
     return Ok;
 }
 
+static capy_err profile_handler(capy_arena *arena, capy_httpreq *request, capy_httpresp *response)
+{
+    capy_err err;
+
+    uint64_t seconds = 5;
+
+    capy_strkvn *qseconds = capy_strkvnmap_get(request->query, Str("seconds"));
+
+    if (qseconds != NULL)
+    {
+        seconds = strtoull(qseconds->value.data, NULL, 10);
+    }
+
+    err = capy_profiler_start(99);
+
+    if (err.code == EBUSY)
+    {
+        return error_response(response, CAPY_HTTP_CONFLICT, "profiler is running");
+    }
+    else if (err.code)
+    {
+        return ErrWrap(err, "Failed to start profiler");
+    }
+
+    err = capy_sleep(seconds * 1000);
+    capy_profiler_stop();
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    err = capy_profiler_write(arena, response->body);
+
+    if (err.code)
+    {
+        return ErrWrap(err, "Failed to write profile");
+    }
+
+    err = capy_strkvnmap_set(response->headers, Str("Content-Type"), Str("text/plain; charset=UTF-8"));
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    response->status = 200;
+    return Ok;
+}
+
+static capy_err allocs_handler(capy_arena *arena, Unused capy_httpreq *request, capy_httpresp *response)
+{
+    capy_err err;
+
+    err = capy_allocprof_write(arena, response->body);
+
+    if (err.code)
+    {
+        return ErrWrap(err, "Failed to write allocation profile");
+    }
+
+    err = capy_strkvnmap_set(response->headers, Str("Content-Type"), Str("text/plain; charset=UTF-8"));
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    response->status = 200;
+    return Ok;
+}
+
 static capy_err echo_handler(capy_arena *arena, capy_httpreq *request, capy_httpresp *response)
 {
     capy_sleep(50);
@@ -108,7 +180,7 @@ static capy_err echo_handler(capy_arena *arena, capy_httpreq *request, capy_http
         return ErrWrap(err, "Failed to write URI");
     }
 
-    for (size_t i = 0; i < request->headers->capacity; i++)
+    for (size_t i = 0; i < request->headers->size; i++)
     {
         for (capy_strkvn *header = capy_strkvnmap_at(request->headers, i); header != NULL; header = header->next)
         {
@@ -177,7 +249,14 @@ static capy_err echo_handler(capy_arena *arena, capy_httpreq *request, capy_http
 
 int main(int argc, char *argv[])
 {
-    capy_logger_init(stderr);
+    capy_err err = capy_logger_init(stderr, CAPY_LOG_ASYNC_BLOCK | CAPY_LOG_DEFERRED);
+
+    if (err.code)
+    {
+        fprintf(stderr, "Failed to initialize logger: %s\n", err.msg);
+        return 1;
+    }
+
     capy_logger_time_format("%T");
 
     capy_httpserveropt options = {
@@ -186,7 +265,7 @@ int main(int argc, char *argv[])
 
     int opt;
 
-    while ((opt = getopt(argc, argv, "vmsw:c:a:p:")) != -1)
+    while ((opt = getopt(argc, argv, "vmiAqHsw:c:a:p:b:l:e:t:")) != -1)
     {
         switch (opt)
         {
@@ -196,9 +275,34 @@ int main(int argc, char *argv[])
             case 'm':
                 capy_logger_add_level(CAPY_LOG_MEM);
                 break;
+            case 'i':
+                capy_http_instrument(true);
+                break;
+            case 'A':
+                capy_allocprof_enable(true);
+                break;
+            case 'q':
+                options.rx_timestamps = true;
+                break;
+            case 'H':
+                options.arena_flags = CAPY_ARENA_HUGEPAGES;
+                break;
             case 'w':
                 options.workers = (size_t)(strtoull(optarg, NULL, 10));
                 break;
+            case 'b':
+                options.mem_worker_max = MiB((size_t)(strtoull(optarg, NULL, 10)));
+                break;
+            case 'l':
+                options.access_log_sample = (size_t)(strtoull(optarg, NULL, 10));
+                options.access_log_slow = 100;
+                break;
+            case 'e':
+                options.metrics_path = optarg;
+                break;
+            case 't':
+                options.stall_threshold = strtoull(optarg, NULL, 10);
+                break;
             case 'a':
                 options.host = optarg;
                 break;
@@ -218,18 +322,42 @@ int main(int argc, char *argv[])
         {CAPY_HTTP_GET, Str("/^id/"), params_handler},
         {CAPY_HTTP_PUT, Str("/fail/"), fail_handler},
         {CAPY_HTTP_DELETE, Str("/explode/"), explode_handler},
+        {CAPY_HTTP_GET, Str("/profile/"), profile_handler},
+        {CAPY_HTTP_GET, Str("/allocs/"), allocs_handler},
     };
 
     options.routes = routes;
     options.routes_size = ArrLen(routes);
     options.mem_connection_max = MiB(1);
 
-    capy_err err = capy_http_serve(options);
+    err = capy_http_serve(options);
 
     if (err.code)
     {
         LogErr("Server closed: %s", err.msg);
     }
 
+    capy_arena *arena = capy_arena_init(0, MiB(4));
+    capy_httpstate *states;
+    size_t size;
+
+    if (arena != NULL && !capy_http_states(arena, &states, &size).code)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            if (capy_histogram_count(states[i].time) == 0)
+            {
+                continue;
+            }
+
+            LogInf("stats: %-21s count=%-8" PRIu64 " p50=%-8" PRIu64 " p99=%-8" PRIu64 " max=%-8" PRIu64 " mem_p99=%" PRIu64,
+                   states[i].name, capy_histogram_count(states[i].time),
+                   capy_histogram_percentile(states[i].time, 50) / 1000,
+                   capy_histogram_percentile(states[i].time, 99) / 1000,
+                   capy_histogram_max(states[i].time) / 1000,
+                   capy_histogram_percentile(states[i].memory, 99));
+        }
+    }
+
     return 0;
 }
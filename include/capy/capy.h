@@ -88,6 +88,20 @@ typedef struct capy_arena capy_arena;
 // If initialization fails, it returns `NULL`.
 MustCheck capy_arena *capy_arena_init(size_t min, size_t max);
 
+// Flags for `capy_arena_init_flags`.
+enum
+{
+    // Aligns the reservation to 2 MiB and asks for transparent huge pages with madvise(MADV_HUGEPAGE).
+    CAPY_ARENA_HUGEPAGES = 1 << 0,
+    // Backs the arena with pages from the hugetlbfs pool (MAP_HUGETLB), reserving all of `max` up front.
+    // If the pool can't hold it, falls back to CAPY_ARENA_HUGEPAGES.
+    CAPY_ARENA_HUGETLB = 1 << 1,
+};
+
+// Initializes an Arena like `capy_arena_init`. With huge page flags, `min`, `max` and every commit are
+// rounded to 2 MiB. Meant for arenas that grow to hundreds of MiB, where TLB misses dominate.
+MustCheck capy_arena *capy_arena_init_flags(size_t min, size_t max, int flags);
+
 // Destroys an Arena, freeing all memory.
 capy_err capy_arena_destroy(capy_arena *arena);
 
@@ -97,6 +111,10 @@ capy_err capy_arena_destroy(capy_arena *arena);
 // If allocation fails, it returns `NULL`.
 MustCheck void *capy_arena_alloc(capy_arena *arena, size_t size, size_t align, int zeroinit);
 
+// Allocates like `capy_arena_alloc`, recording `size` bytes at the call site `file`:`line` when the allocation
+// profiler is enabled.
+MustCheck void *capy_arena_alloc_at(capy_arena *arena, size_t size, size_t align, int zeroinit, const char *file, int line);
+
 // Reallocates a memory block from `cur_size` bytes to `new_size` bytes in an Arena.
 // If `addr + cur_size` is the end of the Arena, the arena grows and the memory block's address doesn't change.
 // Otherwise, a new memory block is allocated, and the data is copied to the new location.
@@ -119,6 +137,145 @@ size_t capy_arena_available(capy_arena *arena);
 // Creates a stack of size `size` at the end Arena's memory region.
 void *capy_arena_create_stack(capy_arena *arena, size_t size);
 
+// How an Arena returns memory to the system once its usage drops.
+typedef enum capy_arenadecommit
+{
+    CAPY_ARENA_PROTECT,       // mprotect(PROT_NONE), growing back needs mprotect again
+    CAPY_ARENA_MADV_FREE,     // madvise(MADV_FREE), pages are reclaimed lazily under memory pressure
+    CAPY_ARENA_MADV_DONTNEED, // madvise(MADV_DONTNEED), pages are released immediately
+} capy_arenadecommit;
+
+// Memory is decommitted when usage falls to `1 / shrink_ratio` of the committed size (4 if 0 or 1),
+// at least `decay` milliseconds after the arena last grew. The first `retain` bytes (or the arena's
+// `min`) are never decommitted.
+typedef struct capy_arenapolicy
+{
+    capy_arenadecommit decommit;
+    size_t retain;
+    size_t shrink_ratio;
+    uint64_t decay;
+} capy_arenapolicy;
+
+typedef struct capy_arenastats
+{
+    size_t grows;
+    size_t shrinks;
+    size_t syscalls;
+    size_t committed;
+    size_t peak;
+} capy_arenastats;
+
+// Sets the decommit policy of an Arena. Arenas start with `CAPY_ARENA_PROTECT`, ratio 4 and no decay.
+void capy_arena_set_policy(capy_arena *arena, capy_arenapolicy policy);
+
+// Returns how many times an Arena grew and shrank its committed memory, the syscalls it made for it,
+// its committed size and its peak usage in bytes.
+capy_arenastats capy_arena_stats(capy_arena *arena);
+
+// Decommits every page past the arena's usage (and `min`), regardless of its policy.
+MustCheck capy_err capy_arena_trim(capy_arena *arena);
+
+// Memory Budgets bound the memory committed by a group of arenas. Arenas charge their budget, and every
+// parent budget, when they commit memory and refund it when they decommit it or are destroyed. Commits that
+// would exceed the limit of any of them fail, so allocations return NULL. Budgets are thread-safe.
+typedef struct capy_membudget capy_membudget;
+
+typedef struct capy_membudgetstats
+{
+    size_t limit;
+    size_t used;
+    size_t peak;
+    size_t rejected;
+} capy_membudgetstats;
+
+// Initializes a budget of `limit` bytes (unlimited if 0) allocated from `arena`, charging `parent` as well.
+// If initialization fails, it returns `NULL`.
+MustCheck capy_membudget *capy_membudget_init(capy_arena *arena, size_t limit, capy_membudget *parent);
+
+// Makes an Arena draw from `budget`, moving the memory it has already committed to it.
+void capy_arena_set_budget(capy_arena *arena, capy_membudget *budget);
+
+// Returns `true` when less than 1/8 of the limit of `budget`, or of any of its parents, is left.
+bool capy_membudget_pressure(capy_membudget *budget);
+
+// Returns how many bytes can still be committed from `budget` and its parents.
+size_t capy_membudget_available(capy_membudget *budget);
+
+// Returns the budget's limit, the bytes currently committed from it, its peak and how many commits it refused.
+capy_membudgetstats capy_membudget_stats(capy_membudget *budget);
+
+// A position in an Arena, to rewind temporary allocations made after it.
+typedef struct capy_arenamark
+{
+    capy_arena *arena;
+    size_t used;
+} capy_arenamark;
+
+// Returns the current position of an Arena.
+capy_arenamark capy_arena_mark(capy_arena *arena);
+
+// Frees every allocation made after `mark`.
+MustCheck capy_err capy_arena_rewind(capy_arenamark mark);
+
+// Borrows a thread-local scratch arena for temporary work, returning its position to rewind to.
+// Allocate from `mark.arena`, which is never `conflict` (the arena results go to). Scratch arenas
+// nest, but must be returned with `capy_scratch_end` before the task yields. Memory borrowed in an
+// HTTP handler and not returned is rewound when the handler returns.
+// If allocation fails, `mark.arena` is NULL.
+capy_arenamark capy_scratch_begin(capy_arena *conflict);
+
+// Rewinds the scratch arena to `mark`, freeing everything allocated since `capy_scratch_begin`.
+void capy_scratch_end(capy_arenamark mark);
+
+//
+// OBJECT POOLS
+//
+
+// Pools recycle fixed-size objects carved from an Arena. Freed objects go to a free list and are
+// reused by later allocations, so long-lived structures with churn don't keep growing their arena.
+// `capy_pool_alloc` and `capy_pool_free` don't lock, a pool used through them must have a single owner.
+// Pools shared between threads are only used through per-thread caches, and their arena must not be used
+// by anything else.
+typedef struct capy_pool capy_pool;
+
+// Per-thread cache of free objects. Allocations and frees only lock the pool when the cache moves
+// a batch of objects to or from it. When the arena can't fit a full batch, the cache takes what fits.
+typedef struct capy_poolcache
+{
+    capy_pool *pool;
+    void *free;
+    size_t size;
+} capy_poolcache;
+
+// Initializes a pool of objects of `size` bytes with `align` alignment (a power of two) in `arena`.
+// If initialization fails, it returns `NULL`.
+MustCheck capy_pool *capy_pool_init(capy_arena *arena, size_t size, size_t align);
+
+// Allocates an object from a pool with a single owner. If `zeroinit` is `true`, it zero-initializes the object.
+// If allocation fails, it returns `NULL`.
+MustCheck void *capy_pool_alloc(capy_pool *pool, int zeroinit);
+
+// Returns an object allocated from a pool with a single owner to its free list.
+void capy_pool_free(capy_pool *pool, void *addr);
+
+// Returns the number of freed objects waiting in the pool, not counting objects held by caches.
+size_t capy_pool_available(capy_pool *pool);
+
+// Releases the pool's lock. Memory is freed with the pool's arena.
+void capy_pool_destroy(capy_pool *pool);
+
+// Initializes an empty cache for `pool`.
+capy_poolcache capy_poolcache_init(capy_pool *pool);
+
+// Allocates an object like `capy_pool_alloc`, taking it from the cache.
+MustCheck void *capy_poolcache_alloc(capy_poolcache *cache, int zeroinit);
+
+// Returns an object to the cache. Objects can be freed to any cache of the pool they came from.
+void capy_poolcache_free(capy_poolcache *cache, void *addr);
+
+// Returns every object held by the cache to its pool. Call it before a cache is discarded.
+void capy_poolcache_flush(capy_poolcache *cache);
+
 //
 // ASSERTIONS
 //
@@ -144,12 +301,37 @@ typedef enum capy_loglevel
     CAPY_LOG_ERROR = 1 << 6,
 } capy_loglevel;
 
-void capy_logger_init(FILE *file);
+// How records reach the log file. Asynchronous modes buffer records of each thread in a lock-free ring,
+// written by a background thread in batches. When a ring is full, records are dropped and counted, or the
+// thread blocks until the flusher makes room.
+// Combined with an asynchronous mode, CAPY_LOG_DEFERRED moves formatting to the background thread: callers only
+// capture the timestamp, the format pointer and the arguments, copying strings. Formats must outlive the record,
+// as string literals do.
+typedef enum capy_logmode
+{
+    CAPY_LOG_SYNC,
+    CAPY_LOG_ASYNC_DROP,
+    CAPY_LOG_ASYNC_BLOCK,
+    CAPY_LOG_DEFERRED = 1 << 2,
+} capy_logmode;
+
+// Sets the log file and mode. Asynchronous modes start the flusher thread, which writes every buffered
+// record when the process exits. If the flusher can't be started, returns a non-zero error code.
+MustCheck capy_err capy_logger_init(FILE *file, capy_logmode mode);
 void capy_logger_min_level(capy_loglevel level);
 void capy_logger_add_level(capy_loglevel level);
 void capy_logger_time_format(const char *fmt);
 Format(2) void capy_log(capy_loglevel level, const char *fmt, ...);
 
+// Returns `true` if records of `level` are logged.
+bool capy_logger_enabled(capy_loglevel level);
+
+// Writes every record buffered so far.
+void capy_logger_flush(void);
+
+// Returns how many records were dropped because a ring was full or the log file couldn't be written.
+size_t capy_logger_dropped(void);
+
 //
 // CHARACTERS
 //
@@ -238,7 +420,8 @@ capy_string capy_string_shr(capy_string s, size_t size);
 // Hash Function
 //
 
-// Returns a 64-bit hash value for a `key` of `length` bytes.
+// Returns a 64-bit hash value for a `key` of `length` bytes. Hashes are seeded with a random value chosen once per
+// process, so they must not be persisted or shared with other processes.
 uint64_t capy_hash(const void *key, uint64_t length);
 
 //
@@ -263,6 +446,43 @@ MustCheck capy_err capy_vec_insert(capy_arena *arena, capy_vec *vec, size_t posi
 // Deletes `count` elements at index `position` in `vec.items`.
 capy_err capy_vec_delete(capy_vec *vec, size_t position, size_t count);
 
+// Segmented Vectors store elements in a list of segments instead of a single memory block. New segments are
+// at least as large as all previous ones together, and elements never move, so growing a vector while other
+// allocations are made in the same arena doesn't copy or abandon memory.
+typedef struct capy_segment
+{
+    size_t size;
+    size_t capacity;
+    char *items;
+    struct capy_segment *next;
+} capy_segment;
+
+typedef struct capy_segvec
+{
+    size_t size;
+    size_t capacity;
+    size_t element_size;
+    capy_segment *head;
+    capy_segment *tail;
+} capy_segvec;
+
+// Appends `count` values from `values` to the end of `vec`, splitting them between segments if needed.
+// If needed, allocates a new segment using `arena`.
+// If allocation fails, returns `ENOMEM`.
+MustCheck capy_err capy_segvec_push(capy_arena *arena, capy_segvec *vec, size_t count, const void *values);
+
+// Appends `count` uninitialized elements stored contiguously and returns their address.
+// If the last segment can't fit them, its remaining space is skipped and a new segment is allocated.
+// If allocation fails, returns `NULL`.
+MustCheck void *capy_segvec_reserve(capy_arena *arena, capy_segvec *vec, size_t count);
+
+// Returns the address of the element at `index`, or `NULL` if it is out of bounds.
+// Walks the list of segments, which has a logarithmic number of entries.
+void *capy_segvec_at(capy_segvec *vec, size_t index);
+
+// Deletes the `count` leftmost elements.
+void capy_segvec_shl(capy_segvec *vec, size_t count);
+
 //
 // Byte Buffer
 //
@@ -313,22 +533,105 @@ Format(3) MustCheck capy_err capy_buffer_write_fmt(capy_buffer *buffer, size_t m
 // Deletes the `size` leftmost bytes from the Buffer.
 void capy_buffer_shl(capy_buffer *buffer, size_t size);
 
+// Segmented Buffers are Byte Buffers backed by a Segmented Vector. Data is never copied when they grow, and
+// can be sent with a single `writev` call. Iterate from `head` through `next` to read it.
+typedef union capy_segbuf
+{
+    capy_segvec vec;
+    struct
+    {
+        size_t size;
+        size_t capacity;
+        size_t element_size;
+        capy_segment *head;
+        capy_segment *tail;
+        capy_arena *arena;
+    };
+} capy_segbuf;
+
+// Initializes a Segmented Buffer with `arena` as the memory allocator and a first segment of `capacity` bytes.
+// If initialization fails, returns NULL.
+MustCheck capy_segbuf *capy_segbuf_init(capy_arena *arena, size_t capacity);
+
+// Writes a String to the end of the Buffer
+// If allocation fails, returns a non-zero error code.
+MustCheck capy_err capy_segbuf_write_string(capy_segbuf *buffer, capy_string input);
+
+// Writes `size` bytes stored in `bytes` to the end of the Buffer
+// If allocation fails, returns a non-zero error code.
+MustCheck capy_err capy_segbuf_write_bytes(capy_segbuf *buffer, size_t size, const char *bytes);
+
+// Writes a null-terminated string to the end of the Buffer
+// If allocation fails, returns a non-zero error code.
+MustCheck capy_err capy_segbuf_write_cstr(capy_segbuf *buffer, const char *cstr);
+
+// Appends a segment pointing to `size` bytes at `bytes` without copying them.
+// The bytes must not change or be freed until they are removed from the Buffer.
+// If allocation fails, returns a non-zero error code.
+MustCheck capy_err capy_segbuf_write_ref(capy_segbuf *buffer, size_t size, const char *bytes);
+
+// Writes at most `max` bytes to the end of the buffer using `snprintf`, like `capy_buffer_write_fmt`.
+// If allocation fails, returns a non-zero error code.
+Format(3) MustCheck capy_err capy_segbuf_write_fmt(capy_segbuf *buffer, size_t max, const char *fmt, ...);
+
+// Deletes the `size` leftmost bytes from the Buffer.
+void capy_segbuf_shl(capy_segbuf *buffer, size_t size);
+
 //
 // String Map
 //
 
+// Entries are stored in insertion order in `items[0..size)`. Deleting an entry leaves it in place with a key of
+// size SIZE_MAX (see `capy_strmap_deleted`), counted in `dead`, so deletes are O(1) and other entries don't move.
+// Deleted entries are dropped when an insert finds the map full, which grows it only if less than a quarter would
+// be left free. Lookups go through a Swiss table index of `mask + 1` slots probed in groups of 16: `ctrl` holds
+// a 7-bit tag of each slot's hash (or an empty or deleted marker) and `slots` the position of its entry. `hashes`
+// caches the full hash of every entry, so most string compares and all rehashing on growth are skipped.
+// Maps with up to 8 entries have no index (`ctrl` is NULL): lookups scan `items` without hashing, and the index is
+// only built when the map grows past that. Inserting a key whose probe sequence spans more than 8 groups fails with
+// EOVERFLOW, bounding the work done for keys crafted to collide.
+// Each entry must start with its `capy_string` key. Pointers to entries are invalidated by inserts that grow or
+// compact the map.
 typedef struct capy_strmap
 {
     size_t size;
     size_t capacity;
     size_t element_size;
     char *items;
+    capy_arena *arena;
+    size_t mask;
+    uint8_t *ctrl;
+    uint32_t *slots;
+    uint64_t *hashes;
+    size_t dead;
 } capy_strmap;
 
+// Initializes `map` with room for `capacity` entries of `element_size` bytes allocated from `arena`.
+// If allocation fails, returns a non-zero error code.
+MustCheck capy_err capy_strmap_init(capy_arena *arena, capy_strmap *map, size_t element_size, size_t capacity);
 MustCheck capy_err capy_strmap_set(capy_arena *arena, capy_strmap *map, const void *entry);
 void *capy_strmap_get(capy_strmap *map, capy_string key);
 void capy_strmap_delete(capy_strmap *map, capy_string key);
 
+// Returns true if `entry`, one of the map's `items`, was deleted.
+bool capy_strmap_deleted(const void *entry);
+
+// Keys carrying their precomputed `capy_hash`. Hot lookups of constant keys should initialize them once
+// at startup and use the `_hashed` variants, which skip hashing.
+typedef struct capy_strkey
+{
+    capy_string string;
+    uint64_t hash;
+} capy_strkey;
+
+// Returns `string` paired with its hash.
+capy_strkey capy_strkey_init(capy_string string);
+
+// `key` must equal the key `entry` starts with.
+MustCheck capy_err capy_strmap_set_hashed(capy_arena *arena, capy_strmap *map, capy_strkey key, const void *entry);
+void *capy_strmap_get_hashed(capy_strmap *map, capy_strkey key);
+void capy_strmap_delete_hashed(capy_strmap *map, capy_strkey key);
+
 typedef union capy_strset
 {
     capy_strmap strmap;
@@ -397,12 +700,49 @@ typedef union capy_strkvnmap
 
 MustCheck capy_strkvnmap *capy_strkvnmap_init(capy_arena *arena, size_t capacity);
 capy_strkvn *capy_strkvnmap_get(capy_strkvnmap *mm, capy_string key);
+capy_strkvn *capy_strkvnmap_get_hashed(capy_strkvnmap *mm, capy_strkey key);
 MustCheck capy_err capy_strkvnmap_set(capy_strkvnmap *mm, capy_string key, capy_string value);
+MustCheck capy_err capy_strkvnmap_set_hashed(capy_strkvnmap *mm, capy_strkey key, capy_string value);
 MustCheck capy_err capy_strkvnmap_add(capy_strkvnmap *mm, capy_string key, capy_string value);
 void capy_strkvnmap_delete(capy_strkvnmap *mm, capy_string key);
+void capy_strkvnmap_delete_hashed(capy_strkvnmap *mm, capy_strkey key);
 void capy_strkvnmap_clear(capy_strkvnmap *mm);
+
+// Returns the entry at position `index` in insertion order, or NULL if `index` is out of bounds.
 capy_strkvn *capy_strkvnmap_at(capy_strkvnmap *mm, size_t index);
 
+//
+// Concurrent Map
+//
+
+// String map shared between threads, for read-mostly state such as feature flags or tenant configs.
+// Keys are spread over shards, each an immutable `capy_strkvmap` snapshot. Reads never lock: they load the
+// current snapshot of a shard. Writers lock a single shard, copy it with the change into an arena (reused from
+// freed snapshots when possible) and publish the copy, so writes cost O(shard size).
+// Replaced snapshots are freed once every reading thread has passed a quiescent state. Scheduler threads pass
+// one every time they poll, so entries returned to a task stay valid until the task yields. Other threads
+// must call `capy_cmap_quiescent` once they no longer use returned entries.
+typedef struct capy_cmap capy_cmap;
+
+// Initializes a map with `shards` shards (rounded to a power of two, at most 256, 16 if 0), allocated from
+// `arena`. Each snapshot can use up to `memory` bytes (16 MiB if 0). If initialization fails, returns NULL.
+MustCheck capy_cmap *capy_cmap_init(capy_arena *arena, size_t shards, size_t memory);
+
+// Returns the entry of `key`, or NULL if the map has no such entry.
+capy_strkv *capy_cmap_get(capy_cmap *map, capy_string key);
+
+// Sets `key` to `value`. Strings are copied. If allocation fails, returns a non-zero error code.
+MustCheck capy_err capy_cmap_set(capy_cmap *map, capy_string key, capy_string value);
+
+// Deletes `key`. If allocation fails, returns a non-zero error code.
+MustCheck capy_err capy_cmap_delete(capy_cmap *map, capy_string key);
+
+// Announces that the calling thread holds no entries returned by `capy_cmap_get`.
+void capy_cmap_quiescent(void);
+
+// Frees every snapshot. No thread may use the map concurrently.
+void capy_cmap_destroy(capy_cmap *map);
+
 //
 // Base64
 //
@@ -475,14 +815,48 @@ capy_err capy_tcp_connect(struct capy_tcp *tcp, const char *host, const char *po
 capy_err capy_tcp_accept(struct capy_tcp *server, struct capy_tcp *client);
 capy_err capy_tcp_recv(capy_tcp *tcp, capy_buffer *buffer, uint64_t timeout);
 capy_err capy_tcp_send(capy_tcp *tcp, capy_buffer *buffer, uint64_t timeout);
+capy_err capy_tcp_sendv(capy_tcp *tcp, capy_segbuf *buffer, uint64_t timeout);
 capy_err capy_tcp_shutdown(capy_tcp *tcp);
 capy_err capy_tcp_close(capy_tcp *tcp);
 uint16_t capy_tcp_port(capy_tcp *tcp);
 const char *capy_tcp_addr(capy_tcp *tcp);
 capy_err capy_tcp_keepalive(capy_tcp *tcp, bool enabled, int idle, int count, int interval);
 capy_err capy_tcp_nodelay(capy_tcp *tcp, bool enabled);
+
+// Enables software receive timestamps (SO_TIMESTAMPING) on a plain TCP socket. Sockets accepted from a listening
+// socket with timestamps enabled have them enabled too.
+capy_err capy_tcp_timestamping(capy_tcp *tcp, bool enabled);
+
+// Returns the time (ns) the data returned by the last `capy_tcp_recv` waited in the kernel after it was received,
+// or -1 if it carried no timestamp.
+int64_t capy_tcp_rx_delay(capy_tcp *tcp);
 capy_fd capy_tcp_fd(capy_tcp *tcp);
 
+//
+// HISTOGRAMS
+//
+
+// Histogram of non-negative values, with 16 buckets per power of two (6% relative error) up to 2^48.
+// Histograms are recorded by a single thread, other threads can read and merge them concurrently.
+typedef struct capy_histogram capy_histogram;
+
+// Allocates an empty histogram in `arena`. If allocation fails, it returns `NULL`.
+MustCheck capy_histogram *capy_histogram_init(capy_arena *arena);
+void capy_histogram_record(capy_histogram *histogram, uint64_t value);
+
+// Adds the counts of `src` to `dst`. `dst` must not be recorded concurrently.
+void capy_histogram_merge(capy_histogram *dst, capy_histogram *src);
+uint64_t capy_histogram_count(capy_histogram *histogram);
+uint64_t capy_histogram_sum(capy_histogram *histogram);
+uint64_t capy_histogram_max(capy_histogram *histogram);
+
+// Returns the number of values in buckets whose values are all at most `value`. It's exact when `value` is
+// the upper bound of a bucket, otherwise it leaves out the bucket holding `value`.
+uint64_t capy_histogram_below(capy_histogram *histogram, uint64_t value);
+
+// Returns the upper bound of the bucket holding `percentile` (0 to 100), or 0 if the histogram is empty.
+uint64_t capy_histogram_percentile(capy_histogram *histogram, double percentile);
+
 //
 // HTTP
 //
@@ -612,15 +986,54 @@ typedef struct capy_httpserveropt
 
     size_t line_buffer_size;
     size_t mem_connection_max;
+    size_t mem_worker_max;
+    capy_membudget *mem_budget;
     uint64_t inactivity_timeout;
 
+    // Logs one in `access_log_sample` requests at CAPY_LOG_INFO, 0 disables the access log. Server errors and
+    // requests taking at least `access_log_slow` ms are always logged.
+    size_t access_log_sample;
+    uint64_t access_log_slow;
+
+    // Serves metrics in the Prometheus text format to GET requests for `metrics_path`, NULL disables them.
+    // Metrics are counted by each worker and only aggregated when they are requested.
+    const char *metrics_path;
+
+    // Starts the watchdog with a threshold of `stall_threshold` ms while serving, unless it is already running.
+    // Requests whose task stalled are counted by route in the metrics. 0 disables the watchdog.
+    uint64_t stall_threshold;
+
+    // Timestamps received data in the kernel to measure how long requests waited in the accept backlog and the
+    // receive queue before being read, logged as queue_us (-1 if unknown) and counted by route in the metrics.
+    // Only plain HTTP connections are measured.
+    bool rx_timestamps;
+
+    // Flags of the server's long-lived arenas, holding routes, metrics and recycled connection structs, such as
+    // CAPY_ARENA_HUGEPAGES. 0 uses regular pages.
+    int arena_flags;
+
     capy_httpprotocol protocol;
     const char *certificate_chain;
     const char *certificate_key;
 } capy_httpserveropt;
 
+// Time (ns) and memory (bytes allocated) spent by connections in one state of the HTTP state machine.
+typedef struct capy_httpstate
+{
+    const char *name;
+    capy_histogram *time;
+    capy_histogram *memory;
+} capy_httpstate;
+
 capy_err capy_http_serve(capy_httpserveropt options);
 
+// Enables or disables per-state instrumentation of connections, disabled by default. It is compiled out when
+// CAPY_NO_INSTRUMENT is defined.
+void capy_http_instrument(bool enabled);
+
+// Merges the histograms recorded by every worker into `states`, allocated in `arena`, one entry per state.
+capy_err capy_http_states(capy_arena *arena, capy_httpstate **states, size_t *size);
+
 //
 // JSON
 //
@@ -693,8 +1106,102 @@ MustCheck capy_jsonval capy_json_array(capy_arena *arena);
 MustCheck capy_err capy_json_array_push(capy_jsonarr *array, capy_jsonval value);
 
 capy_err capy_json_deserialize(capy_arena *arena, capy_jsonval *value, const char *input);
+// Writes `value` as JSON at the end of `buffer`, escaping strings and keys. Numbers that are NaN or infinite
+// fail with EINVAL.
 capy_err capy_json_serialize(capy_buffer *buffer, capy_jsonval value, int tabsize);
 
+// JSON Schemas describe how a JSON object maps to a C struct.
+// Decoding with a schema writes each property straight into the struct member at `offset`,
+// validating types and required properties in the same pass, without building a `capy_jsonval` tree.
+// Unknown properties are validated and skipped.
+typedef enum capy_jsontype
+{
+    CAPY_JSONTYPE_BOOL,    // bool
+    CAPY_JSONTYPE_NUMBER,  // double
+    CAPY_JSONTYPE_INTEGER, // int64_t
+    CAPY_JSONTYPE_STRING,  // const char *
+    CAPY_JSONTYPE_OBJECT,  // nested struct described by `schema`, embedded by value
+    CAPY_JSONTYPE_VALUE,   // capy_jsonval
+} capy_jsontype;
+
+typedef struct capy_jsonfield
+{
+    capy_string name;
+    capy_jsontype type;
+    size_t offset;
+    bool required;
+    const struct capy_jsonschema *schema;
+} capy_jsonfield;
+
+// A schema can have at most 64 fields.
+typedef struct capy_jsonschema
+{
+    size_t size;
+    size_t fields_size;
+    const capy_jsonfield *fields;
+} capy_jsonschema;
+
+// Decodes the JSON object in `input` into the struct pointed by `output`.
+// The struct is zero-initialized first, so missing optional properties and `null` values are left zeroed.
+// Memory for strings and values is allocated from `arena`.
+// If the input is not valid or doesn't match the schema, returns EINVAL.
+MustCheck capy_err capy_json_decode(capy_arena *arena, const capy_jsonschema *schema, void *output, const char *input);
+
+// Encodes the struct pointed by `input` as a JSON object at the end of `buffer`.
+// If allocation fails, returns a non-zero error code.
+MustCheck capy_err capy_json_encode(capy_buffer *buffer, const capy_jsonschema *schema, const void *input);
+
+// NDJSON pipelines split newline-delimited JSON at line boundaries and parse batches of lines
+// in parallel on a shared pool of helper threads. Each batch owns its arena.
+typedef struct capy_jsonbatch
+{
+    size_t index;          // batch sequence number, starting at 0
+    size_t line;           // line number of the first line in the batch, starting at 1
+    size_t size;           // number of values, blank lines are skipped
+    capy_jsonval *values;  // parsed values, allocated from `arena`
+    capy_arena *arena;     // batch arena, destroyed on the next call to `capy_ndjson_next`
+} capy_jsonbatch;
+
+typedef struct capy_ndjson capy_ndjson;
+
+// Starts a pipeline over `input`, which must outlive it. Batches have up to `batch_lines` lines
+// (0 for 1024) and arenas of up to `batch_memory` bytes (0 for 64MiB), backed by transparent huge pages
+// from 32MiB.
+// The pipeline is allocated from `arena`. If initialization fails, returns NULL.
+MustCheck capy_ndjson *capy_ndjson_init(capy_arena *arena, capy_string input, size_t batch_lines, size_t batch_memory);
+
+// Waits for the next batch in input order, yielding the current task while helper threads parse it.
+// At the end of the input, `*batch` is set to NULL.
+// If a line is not valid JSON, returns EINVAL with its line number.
+MustCheck capy_err capy_ndjson_next(capy_ndjson *ndjson, capy_jsonbatch **batch);
+
+// Cancels pending batches, waits for in-flight ones and releases every batch arena.
+capy_err capy_ndjson_destroy(capy_ndjson *ndjson);
+
+//
+// CBOR
+//
+
+// Encodes `value` as CBOR (RFC 8949) at the end of `buffer`, using definite lengths.
+// Integral numbers are encoded as integers, other numbers as the smallest of float16, float32 and float64
+// that preserves them.
+// If allocation fails, returns a non-zero error code.
+MustCheck capy_err capy_cbor_encode(capy_buffer *buffer, capy_jsonval value);
+
+// Decodes a single CBOR item from `input` into `value`. Memory is allocated from `arena`.
+// Tags are ignored and `undefined` decodes as null.
+// Byte strings, indefinite lengths and non-text map keys have no JSON equivalent, returns EINVAL.
+MustCheck capy_err capy_cbor_decode(capy_arena *arena, capy_jsonval *value, capy_string input);
+
+// Decodes the request content as CBOR when `Content-Type` is `application/cbor`, otherwise as JSON.
+// If the content is not valid, returns EINVAL. If the media type is not supported, returns ENOTSUP.
+MustCheck capy_err capy_http_read_jsonval(capy_arena *arena, capy_httpreq *request, capy_jsonval *value);
+
+// Writes `value` to the response body as CBOR when the request `Accept` header prefers `application/cbor`
+// over `application/json`, otherwise as JSON, and sets `Content-Type` accordingly.
+// If allocation fails, returns a non-zero error code.
+MustCheck capy_err capy_http_write_jsonval(capy_httpreq *request, capy_httpresp *response, capy_jsonval value);
+
 //
 // TASKS
 //
@@ -708,6 +1215,76 @@ bool capy_canceled(void);
 size_t capy_thread_id(void);
 size_t capy_ncpus(void);
 
+// Labels the running task in profiler samples, until it is labeled again. `label` must outlive the samples.
+void capy_task_label(const char *label);
+
+// Returns the time (ns) the running task spent in runs of at least the watchdog threshold since the last call,
+// including the current run. Returns 0 when the watchdog isn't running.
+uint64_t capy_task_stalled(void);
+
+//
+// WATCHDOG
+//
+
+// Starts a thread that watches the heartbeat of every scheduler. Tasks that run for `threshold` ms or more without
+// yielding stall every other task of their thread: they are logged with their label and a sample of their stack, and
+// the time they stall is charged to them (see capy_task_stalled). Stack samples are requested with SIGRTMIN. If the
+// watchdog is running, returns EBUSY.
+MustCheck capy_err capy_watchdog_start(uint64_t threshold);
+
+// Stops the watchdog thread.
+void capy_watchdog_stop(void);
+
+//
+// PROFILER
+//
+
+// Samples the stacks of the tasks running when the process consumes CPU, `frequency` times per CPU second,
+// discarding the samples of previous runs. Stacks are walked through frame pointers and only within the stack of the
+// sampled task. If the profiler is running, returns EBUSY.
+MustCheck capy_err capy_profiler_start(unsigned frequency);
+
+// Stops sampling, samples are kept until the profiler starts again.
+void capy_profiler_stop(void);
+
+// Returns the number of samples dropped since the profiler started because its buffer was full.
+size_t capy_profiler_dropped(void);
+
+// Writes the samples in the collapsed stack format, one line per distinct stack: the task label (or its role when
+// unlabeled), the frames from outermost to innermost separated by ';', and the number of samples. Frames without an
+// exported symbol are written as module+offset.
+MustCheck capy_err capy_profiler_write(capy_arena *arena, capy_buffer *buffer);
+
+//
+// ALLOCATION PROFILER
+//
+
+// Bytes and number of allocations made at one call site during one phase.
+typedef struct capy_allocsite
+{
+    const char *file;
+    int line;
+    const char *phase;
+    uint64_t count;
+    uint64_t bytes;
+} capy_allocsite;
+
+// Enables or disables the allocation profiler, disabled by default. Only allocations made through
+// `capy_arena_alloc_at` are recorded, which Make, MakeNZ and capy_arena_alloc use when CAPY_ALLOC_PROFILE is defined.
+// Each thread records up to 768 sites, allocations at further sites are only counted as dropped.
+void capy_allocprof_enable(bool enabled);
+
+// Tags allocations of the running task with `phase` (NULL for none) until it is tagged again. `phase` must outlive
+// the profiler. HTTP connections tag theirs with "headers", "content", "trailers" and "response".
+void capy_allocprof_phase(const char *phase);
+
+// Returns the sites recorded by every thread, sorted by bytes in decreasing order, and the number of allocations
+// dropped.
+MustCheck capy_err capy_allocprof_sites(capy_arena *arena, capy_allocsite **sites, size_t *size, uint64_t *dropped);
+
+// Writes the sites recorded by every thread as a table sorted by bytes in decreasing order.
+MustCheck capy_err capy_allocprof_write(capy_arena *arena, capy_buffer *buffer);
+
 #undef Format
 #undef Unused
 #undef MustCheck
@@ -58,11 +58,33 @@
 #define MillisecondsNano(v) ((v) * MicrosecondsNano(1000))
 #define SecondsNano(v) ((v) * MillisecondsNano(1000))
 
+// With CAPY_ALLOC_PROFILE, allocations made with Make, MakeNZ and capy_arena_alloc record their call site in
+// the allocation profiler (see capy_allocprof_enable).
+#ifdef CAPY_ALLOC_PROFILE
+#define Make(arena, T, size) \
+    (capy_arena_alloc_at((arena), sizeof(T) * (size), alignof(T), true, __FILE__, __LINE__))
+
+#define MakeNZ(arena, T, size) \
+    (capy_arena_alloc_at((arena), sizeof(T) * (size), alignof(T), false, __FILE__, __LINE__))
+
+#define capy_arena_alloc(arena, size, align, zeroinit) \
+    capy_arena_alloc_at((arena), (size), (align), (zeroinit), __FILE__, __LINE__)
+#else
 #define Make(arena, T, size) \
     (capy_arena_alloc((arena), sizeof(T) * (size), alignof(T), true))
 
 #define MakeNZ(arena, T, size) \
     (capy_arena_alloc((arena), sizeof(T) * (size), alignof(T), false))
+#endif
+
+#define JsonField(T, member, jsontype, req) \
+    {.name = StrIni(#member), .type = CAPY_JSONTYPE_##jsontype, .offset = offsetof(T, member), .required = (req)}
+
+#define JsonFieldObject(T, member, schema_, req) \
+    {.name = StrIni(#member), .type = CAPY_JSONTYPE_OBJECT, .offset = offsetof(T, member), .required = (req), .schema = (schema_)}
+
+#define JsonSchema(T, fields_) \
+    {.size = sizeof(T), .fields_size = ArrLen(fields_), .fields = (fields_)}
 
 #define Cast(T, v) ((T)(v))
 #define ReinterpretCast(T, v) ((T)((char *)(v)))
@@ -78,6 +100,26 @@
 #define LogWrn(...) capy_log(CAPY_LOG_WARNING, __VA_ARGS__)
 #define LogErr(...) capy_log(CAPY_LOG_ERROR, __VA_ARGS__)
 
+// USDT probes of the "capy" provider, for bpftrace and perf. They compile to a nop, and a note describing
+// them, when <sys/sdt.h> is available, and to nothing without it or with CAPY_NO_PROBES.
+//
+//   task_switch(from, to)            waitfd_park(task, fd, write)     waitfd_wake(task, fd)
+//   timer_expire(task)               http_state(conn_id, state)       http_request_end(conn_id, status, bytes)
+//   http_request_start(conn_id, method, path, path_size)              tls_handshake(fd, ok)
+//   arena_grow(arena, from, to)      arena_shrink(arena, from, to)
+//
+// conn_id is the 64-bit id of the connection, not a pointer to it.
+#if !defined(CAPY_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define Probe(name, ...) STAP_PROBEV(capy, name, __VA_ARGS__)
+#endif
+#endif
+
+#ifndef Probe
+#define Probe(name, ...) ((void)0)
+#endif
+
 #define Linux
 #define LinuxAmd64
 #define Platform
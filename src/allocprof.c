@@ -0,0 +1,315 @@
+#include <capy/macros.h>
+
+// Sites recorded per thread, allocations at sites past the table's load limit are only counted as dropped.
+#define ALLOCPROF_SITES 1024
+#define ALLOCPROF_LOAD (ALLOCPROF_SITES * 3 / 4)
+
+// DECLARATIONS
+
+// Allocations of one call site in one phase. Entries are claimed once by the thread that owns their table,
+// `file` is published last so readers never see a partial key.
+struct allocsite
+{
+    _Atomic(const char *) file;
+    _Atomic(const char *) phase;
+    _Atomic int line;
+    _Atomic uint64_t count;
+    _Atomic uint64_t bytes;
+};
+
+// Sites of one thread, allocated on first use and kept until the process exits. Only the owner thread writes
+// them, counts are updated with relaxed loads and stores.
+struct allocsites
+{
+    struct allocsite sites[ALLOCPROF_SITES];
+    size_t size;
+    _Atomic uint64_t dropped;
+    struct allocsites *next;
+};
+
+static void allocprof_init(void);
+static struct allocsites *allocsites_get(void);
+static void allocprof_record(const char *file, int line, size_t size);
+static void allocprof_add(_Atomic uint64_t *counter, uint64_t value);
+static int allocprof_cmp_site(const void *a, const void *b);
+static int allocprof_cmp_bytes(const void *a, const void *b);
+
+// INTERNAL VARIABLES
+
+static struct
+{
+    once_flag once;
+    capy_err err;
+    mtx_t lock;
+    capy_arena *arena;
+    struct allocsites *threads;
+} allocprof = {.once = ONCE_FLAG_INIT};
+
+static atomic_bool allocprof_enabled;
+
+// Phase of the running task, saved and restored by the scheduler on every switch.
+static thread_local const char *allocprof_phase;
+static thread_local struct allocsites *allocprof_sites;
+
+// INTERNAL DEFINITIONS
+
+static void allocprof_init(void)
+{
+    if (mtx_init(&allocprof.lock, mtx_plain) != thrd_success)
+    {
+        allocprof.err = ErrFmt(ENOMEM, "Failed to initialize allocation profiler lock");
+        return;
+    }
+
+    allocprof.arena = capy_arena_init(0, MiB(64));
+
+    if (allocprof.arena == NULL)
+    {
+        allocprof.err = ErrFmt(ENOMEM, "Failed to initialize allocation profiler arena");
+    }
+}
+
+// Returns the sites of the calling thread, registering them on first use, or NULL if they can't be allocated.
+static struct allocsites *allocsites_get(void)
+{
+    if (allocprof_sites != NULL)
+    {
+        return allocprof_sites;
+    }
+
+    call_once(&allocprof.once, allocprof_init);
+
+    if (allocprof.err.code)
+    {
+        return NULL;
+    }
+
+    mtx_lock(&allocprof.lock);
+
+    // allocations made while holding the lock must not be recorded
+    struct allocsites *sites = (capy_arena_alloc)(allocprof.arena, sizeof(struct allocsites), alignof(struct allocsites), true);
+
+    if (sites != NULL)
+    {
+        sites->next = allocprof.threads;
+        allocprof.threads = sites;
+    }
+
+    mtx_unlock(&allocprof.lock);
+
+    allocprof_sites = sites;
+
+    return sites;
+}
+
+static void allocprof_add(_Atomic uint64_t *counter, uint64_t value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+// Call sites are identified by the address of their file name, which the compiler merges within a translation
+// unit, and their line.
+static void allocprof_record(const char *file, int line, size_t size)
+{
+    struct allocsites *sites = allocsites_get();
+
+    if (sites == NULL)
+    {
+        return;
+    }
+
+    const char *phase = allocprof_phase;
+
+    uint64_t hash = Cast(uint64_t, Cast(uintptr_t, file)) ^ Cast(uint64_t, Cast(uintptr_t, phase)) ^ (Cast(uint64_t, line) * 0x9E3779B97F4A7C15);
+    hash ^= hash >> 29;
+
+    for (size_t i = 0; i < ALLOCPROF_SITES; i++)
+    {
+        struct allocsite *site = sites->sites + ((hash + i) & (ALLOCPROF_SITES - 1));
+        const char *site_file = atomic_load_explicit(&site->file, memory_order_relaxed);
+
+        if (site_file == NULL)
+        {
+            if (sites->size >= ALLOCPROF_LOAD)
+            {
+                break;
+            }
+
+            atomic_store_explicit(&site->phase, phase, memory_order_relaxed);
+            atomic_store_explicit(&site->line, line, memory_order_relaxed);
+            atomic_store_explicit(&site->file, file, memory_order_release);
+            sites->size += 1;
+        }
+        else if (site_file != file || atomic_load_explicit(&site->line, memory_order_relaxed) != line ||
+                 atomic_load_explicit(&site->phase, memory_order_relaxed) != phase)
+        {
+            continue;
+        }
+
+        allocprof_add(&site->count, 1);
+        allocprof_add(&site->bytes, size);
+        return;
+    }
+
+    allocprof_add(&sites->dropped, 1);
+}
+
+// Orders sites by key, so the sites of every thread that share one are adjacent. File names are compared by
+// content, as translation units don't share them.
+static int allocprof_cmp_site(const void *a, const void *b)
+{
+    const struct capy_allocsite *sa = a;
+    const struct capy_allocsite *sb = b;
+
+    int cmp = strcmp(sa->file, sb->file);
+
+    if (cmp == 0)
+    {
+        cmp = (sa->line > sb->line) - (sa->line < sb->line);
+    }
+
+    if (cmp == 0)
+    {
+        cmp = strcmp((sa->phase != NULL) ? sa->phase : "", (sb->phase != NULL) ? sb->phase : "");
+    }
+
+    return cmp;
+}
+
+static int allocprof_cmp_bytes(const void *a, const void *b)
+{
+    const struct capy_allocsite *sa = a;
+    const struct capy_allocsite *sb = b;
+
+    if (sa->bytes != sb->bytes)
+    {
+        return (sa->bytes < sb->bytes) ? 1 : -1;
+    }
+
+    return allocprof_cmp_site(a, b);
+}
+
+// PUBLIC DEFINITIONS
+
+void capy_allocprof_enable(bool enabled)
+{
+    atomic_store(&allocprof_enabled, enabled);
+}
+
+void capy_allocprof_phase(const char *phase)
+{
+    allocprof_phase = phase;
+}
+
+capy_err capy_allocprof_sites(capy_arena *arena, capy_allocsite **sites, size_t *size, uint64_t *dropped)
+{
+    call_once(&allocprof.once, allocprof_init);
+
+    if (allocprof.err.code)
+    {
+        return allocprof.err;
+    }
+
+    mtx_lock(&allocprof.lock);
+
+    size_t count = 0;
+
+    for (struct allocsites *thread = allocprof.threads; thread != NULL; thread = thread->next)
+    {
+        count += ALLOCPROF_SITES;
+    }
+
+    capy_allocsite *result = (capy_arena_alloc)(arena, sizeof(capy_allocsite) * ((count) ? count : 1), alignof(capy_allocsite), false);
+
+    if (result == NULL)
+    {
+        mtx_unlock(&allocprof.lock);
+        return ErrStd(ENOMEM);
+    }
+
+    count = 0;
+    *dropped = 0;
+
+    for (struct allocsites *thread = allocprof.threads; thread != NULL; thread = thread->next)
+    {
+        *dropped += atomic_load_explicit(&thread->dropped, memory_order_relaxed);
+
+        for (size_t i = 0; i < ALLOCPROF_SITES; i++)
+        {
+            struct allocsite *site = thread->sites + i;
+            const char *file = atomic_load_explicit(&site->file, memory_order_acquire);
+
+            if (file == NULL)
+            {
+                continue;
+            }
+
+            result[count++] = (capy_allocsite){
+                .file = file,
+                .line = atomic_load_explicit(&site->line, memory_order_relaxed),
+                .phase = atomic_load_explicit(&site->phase, memory_order_relaxed),
+                .count = atomic_load_explicit(&site->count, memory_order_relaxed),
+                .bytes = atomic_load_explicit(&site->bytes, memory_order_relaxed),
+            };
+        }
+    }
+
+    mtx_unlock(&allocprof.lock);
+
+    qsort(result, count, sizeof(capy_allocsite), allocprof_cmp_site);
+
+    size_t merged = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (merged > 0 && allocprof_cmp_site(result + merged - 1, result + i) == 0)
+        {
+            result[merged - 1].count += result[i].count;
+            result[merged - 1].bytes += result[i].bytes;
+            continue;
+        }
+
+        result[merged++] = result[i];
+    }
+
+    qsort(result, merged, sizeof(capy_allocsite), allocprof_cmp_bytes);
+
+    *sites = result;
+    *size = merged;
+
+    return Ok;
+}
+
+capy_err capy_allocprof_write(capy_arena *arena, capy_buffer *buffer)
+{
+    capy_err err;
+
+    capy_allocsite *sites;
+    size_t size;
+    uint64_t dropped;
+
+    err = capy_allocprof_sites(arena, &sites, &size, &dropped);
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    err = capy_buffer_write_fmt(buffer, 0, "%14s %10s  %-8s %s\n", "bytes", "count", "phase", "site");
+
+    for (size_t i = 0; i < size && !err.code; i++)
+    {
+        capy_allocsite *site = sites + i;
+
+        err = capy_buffer_write_fmt(buffer, 0, "%14" PRIu64 " %10" PRIu64 "  %-8s %s:%d\n",
+                                    site->bytes, site->count, (site->phase != NULL) ? site->phase : "-",
+                                    site->file, site->line);
+    }
+
+    if (!err.code && dropped)
+    {
+        err = capy_buffer_write_fmt(buffer, 0, "%" PRIu64 " allocations dropped, too many sites\n", dropped);
+    }
+
+    return err;
+}
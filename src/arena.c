@@ -1,5 +1,15 @@
 #include <capy/macros.h>
 
+#define ARENA_HUGE_PAGE MiB(2)
+
+#define SCRATCH_ARENAS 2
+#define SCRATCH_MAX MiB(64)
+
+// Budgets are under pressure once less than 1/MEMBUDGET_RESERVE of their limit is left.
+#define MEMBUDGET_RESERVE 8
+
+// `capacity` bytes are committed for use. Decommitting with madvise keeps pages up to `mapped` accessible,
+// so growing back within them needs no syscall.
 struct capy_arena
 {
     size_t used;
@@ -8,20 +18,57 @@ struct capy_arena
     size_t max;
     size_t size;
     size_t page_size;
+    size_t mapped;
+    struct timespec grown;
+    capy_arenapolicy policy;
+    capy_arenastats stats;
+    capy_membudget *budget;
+};
+
+struct capy_membudget
+{
+    size_t limit;
+    capy_membudget *parent;
+    atomic_size_t used;
+    atomic_size_t peak;
+    atomic_size_t rejected;
 };
 
-Platform static capy_arena *arena_init(size_t min, size_t max);
+Platform static capy_arena *arena_init(size_t min, size_t max, int flags);
+Platform static void *arena_reserve(size_t size, size_t align, int flags);
 Platform static capy_err arena_destroy(capy_arena *arena);
 Platform static void *arena_create_stack(capy_arena *arena, size_t size);
 Platform static void *arena_alloc(capy_arena *arena, size_t size, size_t align, int zeroinit);
 Platform static capy_err arena_free(capy_arena *arena, void *addr);
+Platform static capy_err arena_commit(capy_arena *arena, size_t capacity);
+Platform static capy_err arena_decommit(capy_arena *arena, size_t capacity);
+
+// Positions of the calling thread's scratch arenas, restored once a handler returns.
+struct scratchstate
+{
+    size_t used[SCRATCH_ARENAS];
+    size_t depth;
+};
 
 static size_t align_to(size_t v, size_t n);
+static size_t arena_shrink_target(capy_arena *arena);
+static bool membudget_charge(capy_membudget *budget, size_t size);
+static void membudget_release(capy_membudget *budget, size_t size);
+static void scratch_init(void);
+static void scratch_exit(void *data);
+static void scratch_save(struct scratchstate *state);
+static void scratch_restore(struct scratchstate *state);
 
 // INTERNAL VARIABLES
 
 static atomic_int arena_allocs = 0;
 
+static once_flag scratch_once = ONCE_FLAG_INIT;
+static tss_t scratch_key;
+static bool scratch_key_valid;
+static thread_local capy_arena *scratch_arenas[SCRATCH_ARENAS];
+static thread_local size_t scratch_depth;
+
 // INTERNAL DEFINITIONS
 
 static size_t align_to(size_t v, size_t n)
@@ -30,11 +77,119 @@ static size_t align_to(size_t v, size_t n)
     return (rem == 0) ? v : v + n - rem;
 }
 
+// Returns the capacity `arena` should shrink to, or its current capacity if the policy keeps it.
+static size_t arena_shrink_target(capy_arena *arena)
+{
+    size_t retain = (arena->policy.retain > arena->min) ? arena->policy.retain : arena->min;
+
+    if (arena->capacity <= retain || arena->used > arena->capacity / arena->policy.shrink_ratio)
+    {
+        return arena->capacity;
+    }
+
+    if (arena->policy.decay && capy_timespec_diff(capy_now(), arena->grown) < MillisecondsNano(Cast(int64_t, arena->policy.decay)))
+    {
+        return arena->capacity;
+    }
+
+    size_t capacity = capy_next_pow2(arena->used << 1);
+
+    return (capacity < retain) ? retain : capacity;
+}
+
+// Charges `size` bytes to `budget` and its parents, or to none of them if any would exceed its limit.
+static bool membudget_charge(capy_membudget *budget, size_t size)
+{
+    for (capy_membudget *current = budget; current != NULL; current = current->parent)
+    {
+        size_t used = atomic_fetch_add(&current->used, size) + size;
+
+        if (current->limit && used > current->limit)
+        {
+            atomic_fetch_sub(&current->used, size);
+            atomic_fetch_add(&current->rejected, 1);
+
+            for (capy_membudget *charged = budget; charged != current; charged = charged->parent)
+            {
+                atomic_fetch_sub(&charged->used, size);
+            }
+
+            return false;
+        }
+
+        size_t peak = atomic_load(&current->peak);
+
+        while (used > peak && !atomic_compare_exchange_weak(&current->peak, &peak, used))
+        {
+        }
+    }
+
+    return true;
+}
+
+static void membudget_release(capy_membudget *budget, size_t size)
+{
+    for (capy_membudget *current = budget; current != NULL && size; current = current->parent)
+    {
+        atomic_fetch_sub(&current->used, size);
+    }
+}
+
+static void scratch_init(void)
+{
+    scratch_key_valid = tss_create(&scratch_key, scratch_exit) == thrd_success;
+}
+
+static void scratch_exit(void *data)
+{
+    capy_arena **arenas = data;
+
+    for (size_t i = 0; i < SCRATCH_ARENAS; i++)
+    {
+        if (arenas[i] != NULL)
+        {
+            arena_destroy(arenas[i]);
+            arenas[i] = NULL;
+        }
+    }
+}
+
+static void scratch_save(struct scratchstate *state)
+{
+    for (size_t i = 0; i < SCRATCH_ARENAS; i++)
+    {
+        state->used[i] = (scratch_arenas[i] != NULL) ? scratch_arenas[i]->used : sizeof(capy_arena);
+    }
+
+    state->depth = scratch_depth;
+}
+
+// Rewinds scratch memory that was borrowed and never returned since `scratch_save`.
+static void scratch_restore(struct scratchstate *state)
+{
+    for (size_t i = 0; i < SCRATCH_ARENAS; i++)
+    {
+        capy_arena *arena = scratch_arenas[i];
+
+        if (arena != NULL && arena->used > state->used[i])
+        {
+            arena_free(arena, Cast(char *, arena) + state->used[i]);
+        }
+    }
+
+    scratch_depth = state->depth;
+}
+
 // PUBLIC DEFINITIONS
 
 capy_arena *capy_arena_init(size_t min, size_t max)
 {
-    return arena_init(min, max);
+    return arena_init(min, max, 0);
+}
+
+capy_arena *capy_arena_init_flags(size_t min, size_t max, int flags)
+{
+    return arena_init(min, max, flags);
 }
 
 capy_err capy_arena_destroy(capy_arena *arena)
@@ -47,11 +202,24 @@ void *capy_arena_create_stack(capy_arena *arena, size_t size)
     return arena_create_stack(arena, size);
 }
 
-void *capy_arena_alloc(capy_arena *arena, size_t size, size_t align, int zeroinit)
+// Parenthesized, so the call-site capturing macro of CAPY_ALLOC_PROFILE doesn't expand here.
+void *(capy_arena_alloc)(capy_arena *arena, size_t size, size_t align, int zeroinit)
 {
     return arena_alloc(arena, size, align, zeroinit);
 }
 
+void *capy_arena_alloc_at(capy_arena *arena, size_t size, size_t align, int zeroinit, const char *file, int line)
+{
+    void *addr = arena_alloc(arena, size, align, zeroinit);
+
+    if (addr != NULL && atomic_load_explicit(&allocprof_enabled, memory_order_relaxed))
+    {
+        allocprof_record(file, line, size);
+    }
+
+    return addr;
+}
+
 capy_err capy_arena_free(capy_arena *arena, void *addr)
 {
     return arena_free(arena, addr);
@@ -107,6 +275,144 @@ void *capy_arena_end(capy_arena *arena)
     return Cast(char *, arena) + arena->used;
 }
 
+void capy_arena_set_policy(capy_arena *arena, capy_arenapolicy policy)
+{
+    policy.retain = align_to(policy.retain, arena->page_size);
+    policy.shrink_ratio = (policy.shrink_ratio > 1) ? policy.shrink_ratio : 4;
+
+    arena->policy = policy;
+}
+
+capy_arenastats capy_arena_stats(capy_arena *arena)
+{
+    capy_arenastats stats = arena->stats;
+    stats.committed = arena->capacity;
+    return stats;
+}
+
+capy_err capy_arena_trim(capy_arena *arena)
+{
+    size_t capacity = align_to(arena->used, arena->page_size);
+    capacity = (capacity > arena->min) ? capacity : arena->min;
+
+    if (capacity < arena->capacity)
+    {
+        return arena_decommit(arena, capacity);
+    }
+
+    return Ok;
+}
+
+void capy_arena_set_budget(capy_arena *arena, capy_membudget *budget)
+{
+    membudget_release(arena->budget, arena->capacity);
+
+    // memory already committed is charged even if it exceeds the limit, only growth is refused
+    for (capy_membudget *current = budget; current != NULL; current = current->parent)
+    {
+        atomic_fetch_add(&current->used, arena->capacity);
+    }
+
+    arena->budget = budget;
+}
+
+capy_membudget *capy_membudget_init(capy_arena *arena, size_t limit, capy_membudget *parent)
+{
+    capy_membudget *budget = Make(arena, capy_membudget, 1);
+
+    if (budget == NULL)
+    {
+        return NULL;
+    }
+
+    budget->limit = limit;
+    budget->parent = parent;
+
+    return budget;
+}
+
+bool capy_membudget_pressure(capy_membudget *budget)
+{
+    for (capy_membudget *current = budget; current != NULL; current = current->parent)
+    {
+        if (current->limit && atomic_load(&current->used) > current->limit - (current->limit / MEMBUDGET_RESERVE))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+size_t capy_membudget_available(capy_membudget *budget)
+{
+    size_t available = SIZE_MAX;
+
+    for (capy_membudget *current = budget; current != NULL; current = current->parent)
+    {
+        size_t used = atomic_load(&current->used);
+        size_t left = (!current->limit) ? SIZE_MAX : (used < current->limit) ? current->limit - used : 0;
+        available = (left < available) ? left : available;
+    }
+
+    return available;
+}
+
+capy_membudgetstats capy_membudget_stats(capy_membudget *budget)
+{
+    return (capy_membudgetstats){
+        .limit = budget->limit,
+        .used = atomic_load(&budget->used),
+        .peak = atomic_load(&budget->peak),
+        .rejected = atomic_load(&budget->rejected),
+    };
+}
+
+capy_arenamark capy_arena_mark(capy_arena *arena)
+{
+    return (capy_arenamark){.arena = arena, .used = arena->used};
+}
+
+capy_err capy_arena_rewind(capy_arenamark mark)
+{
+    return arena_free(mark.arena, Cast(char *, mark.arena) + mark.used);
+}
+
+capy_arenamark capy_scratch_begin(capy_arena *conflict)
+{
+    call_once(&scratch_once, scratch_init);
+
+    // a scratch arena can't be the one results are allocated from, or rewinding it would free them
+    size_t i = (scratch_arenas[0] == conflict && conflict != NULL) ? 1 : 0;
+
+    if (scratch_arenas[i] == NULL)
+    {
+        scratch_arenas[i] = arena_init(0, SCRATCH_MAX, 0);
+
+        if (scratch_arenas[i] == NULL)
+        {
+            return (capy_arenamark){.arena = NULL};
+        }
+
+        if (scratch_key_valid)
+        {
+            tss_set(scratch_key, scratch_arenas);
+        }
+    }
+
+    scratch_depth += 1;
+
+    return capy_arena_mark(scratch_arenas[i]);
+}
+
+void capy_scratch_end(capy_arenamark mark)
+{
+    capy_assert(scratch_depth > 0);
+
+    scratch_depth -= 1;
+    arena_free(mark.arena, Cast(char *, mark.arena) + mark.used);
+}
+
 //
 // LINUX
 //
@@ -116,16 +422,70 @@ void *capy_arena_end(capy_arena *arena)
 #include <sys/mman.h>
 #include <unistd.h>
 
-Linux static capy_arena *arena_init(size_t min, size_t max)
+// Reserves `size` bytes aligned to `align`. Returns NULL if the reservation fails.
+Linux static void *arena_reserve(size_t size, size_t align, int flags)
+{
+    if (flags & CAPY_ARENA_HUGETLB)
+    {
+        // hugetlb pages are reserved up front, without MAP_NORESERVE an empty pool fails here instead of
+        // raising SIGBUS on first touch
+        void *addr = mmap(NULL, size, PROT_NONE, MAP_HUGETLB | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (addr != MAP_FAILED)
+        {
+            return addr;
+        }
+
+        LogMem("capy_arena_init: MAP_HUGETLB failed (%s), using transparent huge pages", strerror(errno));
+    }
+
+    size_t slack = (align > Cast(size_t, sysconf(_SC_PAGE_SIZE))) ? align : 0;
+
+    char *addr = mmap(NULL, size + slack, PROT_NONE, MAP_NORESERVE | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (addr == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    if (slack)
+    {
+        char *begin = Cast(char *, Cast(void *, align_to(Cast(uintptr_t, addr), align)));
+
+        if (begin > addr)
+        {
+            munmap(addr, Cast(size_t, begin - addr));
+        }
+
+        munmap(begin + size, Cast(size_t, addr + slack - begin));
+        addr = begin;
+    }
+
+    // only a hint, kernels without THP or with it disabled keep regular pages
+    if ((flags & (CAPY_ARENA_HUGEPAGES | CAPY_ARENA_HUGETLB)) && madvise(addr, size, MADV_HUGEPAGE) == -1)
+    {
+        LogMem("capy_arena_init: MADV_HUGEPAGE failed (%s)", strerror(errno));
+    }
+
+    return addr;
+}
+
+Linux static capy_arena *arena_init(size_t min, size_t max, int flags)
 {
     size_t page_size = Cast(size_t, sysconf(_SC_PAGE_SIZE));
 
+    // huge page arenas commit whole huge pages, so that every committed region can be backed by them
+    if (flags & (CAPY_ARENA_HUGEPAGES | CAPY_ARENA_HUGETLB))
+    {
+        page_size = ARENA_HUGE_PAGE;
+    }
+
     max = align_to(max, page_size);
     min = (min != 0) ? align_to(min, page_size) : page_size;
 
-    capy_arena *arena = mmap(NULL, max, PROT_NONE, MAP_NORESERVE | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    capy_arena *arena = arena_reserve(max, page_size, flags);
 
-    if (arena == MAP_FAILED)
+    if (arena == NULL)
     {
         return NULL;
     }
@@ -139,12 +499,17 @@ Linux static capy_arena *arena_init(size_t min, size_t max)
     int count = atomic_fetch_add(&arena_allocs, 1);
     LogMem("capy_arena_init: capacity=%zu count=%d", min, count + 1);
 
-    arena->used = sizeof(capy_arena);
-    arena->capacity = min;
-    arena->page_size = page_size;
-    arena->min = min;
-    arena->max = max;
-    arena->size = max;
+    *arena = (capy_arena){
+        .used = sizeof(capy_arena),
+        .capacity = min,
+        .page_size = page_size,
+        .min = min,
+        .max = max,
+        .size = max,
+        .mapped = min,
+        .policy = {.decommit = CAPY_ARENA_PROTECT, .shrink_ratio = 4},
+        .stats = {.peak = sizeof(capy_arena)},
+    };
 
     return arena;
 }
@@ -153,6 +518,8 @@ Linux static capy_err arena_destroy(capy_arena *arena)
 {
     capy_assert(arena != NULL);
 
+    membudget_release(arena->budget, arena->capacity);
+
     if (munmap(arena, arena->size) == -1)
     {
         return ErrStd(errno);
@@ -211,18 +578,19 @@ Linux static void *arena_alloc(capy_arena *arena, size_t size, size_t align, int
             capacity = arena->max;
         }
 
-        if (mprotect(arena, capacity, PROT_READ | PROT_WRITE) == -1)
+        if (arena_commit(arena, capacity).code)
         {
             return NULL;
         }
-
-        LogMem("capy_arena_alloc: ptr=%p from=%zu to=%zu", (void *)arena, arena->capacity, capacity);
-
-        arena->capacity = capacity;
     }
 
     arena->used = end;
 
+    if (end > arena->stats.peak)
+    {
+        arena->stats.peak = end;
+    }
+
     char *data = Cast(char *, arena) + begin;
 
     if (zeroinit)
@@ -240,34 +608,103 @@ Linux static capy_err arena_free(capy_arena *arena, void *addr)
 
     arena->used = Cast(size_t, Cast(char *, addr) - Cast(char *, arena));
 
-    if (arena->capacity > arena->min)
+    size_t capacity = arena_shrink_target(arena);
+
+    if (capacity < arena->capacity)
+    {
+        return arena_decommit(arena, capacity);
+    }
+
+    return Ok;
+}
+
+Linux static capy_err arena_commit(capy_arena *arena, size_t capacity)
+{
+    if (!membudget_charge(arena->budget, capacity - arena->capacity))
     {
-        size_t threshold = arena->capacity >> 2;
+        return ErrStd(ENOMEM);
+    }
 
-        if (arena->used <= threshold)
+    if (capacity > arena->mapped)
+    {
+        if (mprotect(arena, capacity, PROT_READ | PROT_WRITE) == -1)
         {
-            size_t capacity = capy_next_pow2(arena->used << 1);
+            membudget_release(arena->budget, capacity - arena->capacity);
+            return ErrStd(errno);
+        }
 
-            if (capacity < arena->min)
+        arena->mapped = capacity;
+        arena->stats.syscalls += 1;
+    }
+
+    LogMem("capy_arena_alloc: ptr=%p from=%zu to=%zu", (void *)arena, arena->capacity, capacity);
+    Probe(arena_grow, arena, arena->capacity, capacity);
+
+    arena->capacity = capacity;
+    arena->stats.grows += 1;
+
+    if (arena->policy.decay)
+    {
+        arena->grown = capy_now();
+    }
+
+    return Ok;
+}
+
+Linux static capy_err arena_decommit(capy_arena *arena, size_t capacity)
+{
+    char *tail = Cast(char *, arena) + capacity;
+    size_t tail_size = arena->capacity - capacity;
+
+    switch (arena->policy.decommit)
+    {
+        case CAPY_ARENA_MADV_FREE:
+        {
+            // MADV_FREE needs Linux 4.5, older kernels fall through to MADV_DONTNEED
+            if (madvise(tail, tail_size, MADV_FREE) == 0)
             {
-                capacity = arena->min;
+                break;
             }
 
-            char *tail = Cast(char *, arena) + capacity;
+            if (errno != EINVAL)
+            {
+                return ErrStd(errno);
+            }
 
-            size_t tail_size = arena->capacity - capacity;
+            arena->policy.decommit = CAPY_ARENA_MADV_DONTNEED;
+        }
 
-            if (mprotect(tail, tail_size, PROT_NONE))
+        case CAPY_ARENA_MADV_DONTNEED:
+        {
+            if (madvise(tail, tail_size, MADV_DONTNEED) == -1)
             {
                 return ErrStd(errno);
             }
 
-            LogMem("capy_arena_free: ptr=%p from=%zu to=%zu", (void *)arena, arena->capacity, capacity);
+            break;
+        }
+
+        default:
+        {
+            if (mprotect(tail, tail_size, PROT_NONE) == -1)
+            {
+                return ErrStd(errno);
+            }
 
-            arena->capacity = capacity;
+            arena->mapped = capacity;
+            break;
         }
     }
 
+    LogMem("capy_arena_free: ptr=%p from=%zu to=%zu", (void *)arena, arena->capacity, capacity);
+    Probe(arena_shrink, arena, arena->capacity, capacity);
+
+    membudget_release(arena->budget, tail_size);
+
+    arena->capacity = capacity;
+    arena->stats.shrinks += 1;
+    arena->stats.syscalls += 1;
+
     return Ok;
 }
 
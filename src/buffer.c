@@ -100,3 +100,129 @@ void capy_buffer_shl(capy_buffer *buf, size_t size)
 {
     capy_vec_delete(&buf->vec, 0, size);
 }
+
+capy_segbuf *capy_segbuf_init(capy_arena *arena, size_t capacity)
+{
+    capy_segbuf *buf = Make(arena, capy_segbuf, 1);
+
+    if (buf == NULL)
+    {
+        return NULL;
+    }
+
+    buf->element_size = sizeof(char);
+    buf->arena = arena;
+
+    if (capacity > 0)
+    {
+        if (capy_segvec_reserve(arena, &buf->vec, capacity) == NULL)
+        {
+            return NULL;
+        }
+
+        buf->tail->size = 0;
+        buf->size = 0;
+    }
+
+    return buf;
+}
+
+capy_err capy_segbuf_write_bytes(capy_segbuf *buf, size_t size, const char *bytes)
+{
+    return capy_segvec_push(buf->arena, &buf->vec, size, bytes);
+}
+
+capy_err capy_segbuf_write_string(capy_segbuf *buf, capy_string input)
+{
+    return capy_segbuf_write_bytes(buf, input.size, input.data);
+}
+
+capy_err capy_segbuf_write_cstr(capy_segbuf *buf, const char *cstr)
+{
+    return capy_segbuf_write_bytes(buf, strlen(cstr), cstr);
+}
+
+capy_err capy_segbuf_write_ref(capy_segbuf *buf, size_t size, const char *bytes)
+{
+    if (size == 0)
+    {
+        return Ok;
+    }
+
+    capy_segment *segment = Make(buf->arena, capy_segment, 1);
+
+    if (segment == NULL)
+    {
+        return ErrStd(ENOMEM);
+    }
+
+    // full segments are never written to, the referenced bytes stay read-only
+    segment->size = size;
+    segment->capacity = size;
+    segment->items = Cast(char *, bytes);
+
+    if (buf->tail == NULL)
+    {
+        buf->head = segment;
+    }
+    else
+    {
+        buf->tail->next = segment;
+    }
+
+    buf->tail = segment;
+    buf->size += size;
+
+    return Ok;
+}
+
+capy_err capy_segbuf_write_fmt(capy_segbuf *buf, size_t max, const char *fmt, ...)
+{
+    int n;
+
+    if (max == 0)
+    {
+        va_list args;
+        va_start(args, fmt);
+        n = vsnprintf(NULL, 0, fmt, args);
+        va_end(args);
+
+        if (n < 0)
+        {
+            return ErrStd(errno);
+        }
+
+        max = Cast(size_t, n);
+    }
+
+    // snprintf needs contiguous memory, including room for the null-terminator
+    char *data = capy_segvec_reserve(buf->arena, &buf->vec, max + 1);
+
+    if (data == NULL)
+    {
+        return ErrStd(ENOMEM);
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    n = vsnprintf(data, max + 1, fmt, args);
+    va_end(args);
+
+    size_t written = (n < 0) ? 0 : Cast(size_t, n);
+    written = (written < max) ? written : max;
+
+    buf->tail->size -= max + 1 - written;
+    buf->size -= max + 1 - written;
+
+    if (n < 0)
+    {
+        return ErrStd(errno);
+    }
+
+    return Ok;
+}
+
+void capy_segbuf_shl(capy_segbuf *buf, size_t size)
+{
+    capy_segvec_shl(&buf->vec, size);
+}
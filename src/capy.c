@@ -1,15 +1,24 @@
+#include "allocprof.c"
 #include "arena.c"
 #include "assert.c"
 #include "base64.c"
 #include "buffer.c"
+#include "cbor.c"
+#include "cmap.c"
+#include "counters.c"
 #include "error.c"
 #include "hash.c"
+#include "histogram.c"
 #include "http.c"
 #include "json.c"
 #include "logs.c"
+#include "ndjson.c"
+#include "pool.c"
 #include "string.c"
 #include "strmap.c"
 #include "task.c"
+#include "taskprof.c"
+#include "taskwatch.c"
 #include "tcp.c"
 #include "uri.c"
 #include "utils.c"
@@ -0,0 +1,629 @@
+#include <capy/macros.h>
+
+#include <math.h>
+
+#define CBOR_UINT 0
+#define CBOR_NEGINT 1
+#define CBOR_BYTES 2
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_TAG 6
+#define CBOR_SIMPLE 7
+
+#define CBOR_FALSE 20
+#define CBOR_TRUE 21
+#define CBOR_NULL 22
+#define CBOR_UNDEFINED 23
+#define CBOR_FLOAT16 25
+#define CBOR_FLOAT32 26
+#define CBOR_FLOAT64 27
+#define CBOR_INDEFINITE 31
+
+#define CBOR_DEPTH_MAX 512
+
+// DECLARATIONS
+
+static capy_err cbor_write_head(capy_buffer *buffer, uint8_t major, uint64_t value);
+static bool cbor_half(double number, uint16_t *half);
+static capy_err cbor_write_number(capy_buffer *buffer, double number);
+static capy_err cbor_encode(capy_buffer *buffer, capy_jsonval value);
+static capy_err cbor_read_head(capy_string *input, uint8_t *major, uint8_t *info, uint64_t *value);
+static capy_err cbor_read_text(capy_arena *arena, capy_string *text, uint64_t size, capy_string *input);
+static capy_err cbor_decode(capy_arena *arena, capy_jsonval *value, capy_string *input, int depth);
+static double cbor_float16(uint16_t half);
+
+// INTERNAL DEFINITIONS
+
+static capy_err cbor_write_head(capy_buffer *buffer, uint8_t major, uint64_t value)
+{
+    uint8_t head[9];
+    size_t size;
+
+    major = Cast(uint8_t, major << 5);
+
+    if (value < 24)
+    {
+        head[0] = major | Cast(uint8_t, value);
+        size = 1;
+    }
+    else if (value <= UINT8_MAX)
+    {
+        head[0] = major | 24;
+        size = 2;
+    }
+    else if (value <= UINT16_MAX)
+    {
+        head[0] = major | 25;
+        size = 3;
+    }
+    else if (value <= UINT32_MAX)
+    {
+        head[0] = major | 26;
+        size = 5;
+    }
+    else
+    {
+        head[0] = major | 27;
+        size = 9;
+    }
+
+    for (size_t i = size - 1; i > 0; i--, value >>= 8)
+    {
+        head[i] = Cast(uint8_t, value);
+    }
+
+    return capy_buffer_write_bytes(buffer, size, Cast(char *, head));
+}
+
+// Converts `number` to a half-precision float, if it is exact. Infinities are kept and every NaN becomes the
+// quiet NaN 0x7e00, as RFC 8949 preferred serialization does.
+static bool cbor_half(double number, uint16_t *half)
+{
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+
+    uint16_t sign = Cast(uint16_t, (bits >> 48) & 0x8000);
+    uint64_t mantissa = bits & ((UINT64_C(1) << 52) - 1);
+    int exponent = Cast(int, (bits >> 52) & 0x7ff);
+
+    if (exponent == 0x7ff)
+    {
+        *half = (mantissa) ? 0x7e00 : (sign | 0x7c00);
+        return true;
+    }
+
+    if (exponent == 0)
+    {
+        // double subnormals are far below the range of halves
+        *half = sign;
+        return mantissa == 0;
+    }
+
+    exponent -= 1023;
+
+    if (exponent >= -14 && exponent <= 15)
+    {
+        *half = sign | Cast(uint16_t, (exponent + 15) << 10) | Cast(uint16_t, mantissa >> 42);
+        return (mantissa & ((UINT64_C(1) << 42) - 1)) == 0;
+    }
+
+    if (exponent >= -24 && exponent < -14)
+    {
+        // half subnormals count in units of 2^-24
+        int shift = 28 - exponent;
+        mantissa |= UINT64_C(1) << 52;
+
+        *half = sign | Cast(uint16_t, mantissa >> shift);
+        return (mantissa & ((UINT64_C(1) << shift) - 1)) == 0;
+    }
+
+    return false;
+}
+
+static capy_err cbor_write_number(capy_buffer *buffer, double number)
+{
+    // integral numbers use the shortest integer encoding, negative zero stays a float
+    if (number >= 0 && number < 0x1p64 && !(number == 0 && signbit(number)))
+    {
+        uint64_t value = Cast(uint64_t, number);
+
+        if (Cast(double, value) == number)
+        {
+            return cbor_write_head(buffer, CBOR_UINT, value);
+        }
+    }
+    else if (number < 0 && number >= -0x1p63)
+    {
+        uint64_t value = Cast(uint64_t, -1.0 - number);
+
+        if (Cast(double, value) == -1.0 - number)
+        {
+            return cbor_write_head(buffer, CBOR_NEGINT, value);
+        }
+    }
+
+    uint8_t bytes[9];
+    size_t size;
+    uint16_t half;
+    float single = Cast(float, number);
+
+    if (cbor_half(number, &half))
+    {
+        bytes[0] = (CBOR_SIMPLE << 5) | CBOR_FLOAT16;
+        bytes[1] = Cast(uint8_t, half >> 8);
+        bytes[2] = Cast(uint8_t, half);
+        size = 3;
+    }
+    else if (Cast(double, single) == number)
+    {
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+
+        bytes[0] = (CBOR_SIMPLE << 5) | CBOR_FLOAT32;
+        size = 5;
+
+        for (size_t i = size - 1; i > 0; i--, bits >>= 8)
+        {
+            bytes[i] = Cast(uint8_t, bits);
+        }
+    }
+    else
+    {
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+
+        bytes[0] = (CBOR_SIMPLE << 5) | CBOR_FLOAT64;
+        size = 9;
+
+        for (size_t i = size - 1; i > 0; i--, bits >>= 8)
+        {
+            bytes[i] = Cast(uint8_t, bits);
+        }
+    }
+
+    return capy_buffer_write_bytes(buffer, size, Cast(char *, bytes));
+}
+
+static capy_err cbor_encode(capy_buffer *buffer, capy_jsonval value)
+{
+    capy_err err;
+
+    switch (value.kind)
+    {
+        case CAPY_JSON_NULL:
+        {
+            return cbor_write_head(buffer, CBOR_SIMPLE, CBOR_NULL);
+        }
+        break;
+
+        case CAPY_JSON_BOOL:
+        {
+            return cbor_write_head(buffer, CBOR_SIMPLE, (value.boolean) ? CBOR_TRUE : CBOR_FALSE);
+        }
+        break;
+
+        case CAPY_JSON_NUMBER:
+        {
+            return cbor_write_number(buffer, value.number);
+        }
+        break;
+
+        case CAPY_JSON_STRING:
+        {
+            size_t size = strlen(value.string);
+
+            err = cbor_write_head(buffer, CBOR_TEXT, size);
+
+            if (err.code)
+            {
+                return err;
+            }
+
+            return capy_buffer_write_bytes(buffer, size, value.string);
+        }
+        break;
+
+        case CAPY_JSON_OBJECT:
+        {
+            size_t size = (value.object != NULL) ? value.object->size : 0;
+            size_t dead = (value.object != NULL) ? value.object->strmap.dead : 0;
+
+            err = cbor_write_head(buffer, CBOR_MAP, size - dead);
+
+            if (err.code)
+            {
+                return err;
+            }
+
+            for (size_t i = 0; i < size; i++)
+            {
+                capy_jsonkv keyval = value.object->items[i];
+
+                if (capy_strmap_deleted(&keyval))
+                {
+                    continue;
+                }
+
+                err = cbor_write_head(buffer, CBOR_TEXT, keyval.key.size);
+
+                if (err.code)
+                {
+                    return err;
+                }
+
+                err = capy_buffer_write_string(buffer, keyval.key);
+
+                if (err.code)
+                {
+                    return err;
+                }
+
+                err = cbor_encode(buffer, keyval.value);
+
+                if (err.code)
+                {
+                    return err;
+                }
+            }
+
+            return Ok;
+        }
+        break;
+
+        case CAPY_JSON_ARRAY:
+        {
+            size_t size = (value.array != NULL) ? value.array->size : 0;
+
+            err = cbor_write_head(buffer, CBOR_ARRAY, size);
+
+            if (err.code)
+            {
+                return err;
+            }
+
+            for (size_t i = 0; i < size; i++)
+            {
+                err = cbor_encode(buffer, value.array->data[i]);
+
+                if (err.code)
+                {
+                    return err;
+                }
+            }
+
+            return Ok;
+        }
+        break;
+    }
+
+    return ErrFmt(EINVAL, "invalid JSON value kind");
+}
+
+static capy_err cbor_read_head(capy_string *input, uint8_t *major, uint8_t *info, uint64_t *value)
+{
+    if (input->size == 0)
+    {
+        return ErrFmt(EINVAL, "unexpected end of data");
+    }
+
+    uint8_t head = Cast(uint8_t, input->data[0]);
+
+    *major = head >> 5;
+    *info = head & 0x1f;
+    *value = 0;
+
+    size_t size;
+
+    if (*info < 24)
+    {
+        *value = *info;
+        size = 0;
+    }
+    else if (*info <= 27)
+    {
+        size = Cast(size_t, 1) << (*info - 24);
+    }
+    else if (*info == CBOR_INDEFINITE)
+    {
+        return ErrFmt(EINVAL, "indefinite length items are not supported");
+    }
+    else
+    {
+        return ErrFmt(EINVAL, "reserved additional information value");
+    }
+
+    if (input->size < size + 1)
+    {
+        return ErrFmt(EINVAL, "unexpected end of data");
+    }
+
+    for (size_t i = 1; i <= size; i++)
+    {
+        *value = (*value << 8) | Cast(uint8_t, input->data[i]);
+    }
+
+    *input = capy_string_shl(*input, size + 1);
+
+    return Ok;
+}
+
+static capy_err cbor_read_text(capy_arena *arena, capy_string *text, uint64_t size, capy_string *input)
+{
+    // empty strings still need a null-terminated pointer
+    *text = Str("");
+
+    if (size > input->size)
+    {
+        return ErrFmt(EINVAL, "unexpected end of data");
+    }
+
+    if (size > 0)
+    {
+        capy_err err = capy_string_copy(arena, text, capy_string_slice(*input, 0, size));
+
+        if (err.code)
+        {
+            return err;
+        }
+    }
+
+    *input = capy_string_shl(*input, size);
+
+    return Ok;
+}
+
+static double cbor_float16(uint16_t half)
+{
+    uint64_t sign = Cast(uint64_t, half & 0x8000) << 48;
+    uint64_t exponent = (half >> 10) & 0x1f;
+    uint64_t mantissa = half & 0x3ff;
+
+    if (exponent == 0)
+    {
+        double value = Cast(double, mantissa) * 0x1p-24;
+        return (sign) ? -value : value;
+    }
+
+    // rebias the exponent and widen the mantissa into a double
+    exponent = (exponent == 31) ? 0x7ff : exponent - 15 + 1023;
+
+    uint64_t bits = sign | (exponent << 52) | (mantissa << 42);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
+
+static capy_err cbor_decode(capy_arena *arena, capy_jsonval *value, capy_string *input, int depth)
+{
+    if (depth > CBOR_DEPTH_MAX)
+    {
+        return ErrFmt(EINVAL, "maximum nesting depth exceeded");
+    }
+
+    uint8_t major, info;
+    uint64_t argument;
+
+    capy_err err = cbor_read_head(input, &major, &info, &argument);
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    switch (major)
+    {
+        case CBOR_UINT:
+        {
+            *value = capy_json_number(Cast(double, argument));
+            return Ok;
+        }
+        break;
+
+        case CBOR_NEGINT:
+        {
+            *value = capy_json_number(-1.0 - Cast(double, argument));
+            return Ok;
+        }
+        break;
+
+        case CBOR_TEXT:
+        {
+            capy_string text;
+
+            err = cbor_read_text(arena, &text, argument, input);
+
+            if (err.code)
+            {
+                return err;
+            }
+
+            *value = capy_json_string(text.data);
+            return Ok;
+        }
+        break;
+
+        case CBOR_ARRAY:
+        {
+            // every item takes at least one byte
+            if (argument > input->size)
+            {
+                return ErrFmt(EINVAL, "unexpected end of data");
+            }
+
+            *value = capy_json_array(arena);
+
+            if (value->array == NULL)
+            {
+                return ErrStd(ENOMEM);
+            }
+
+            for (uint64_t i = 0; i < argument; i++)
+            {
+                capy_jsonval element;
+
+                err = cbor_decode(arena, &element, input, depth + 1);
+
+                if (err.code)
+                {
+                    return err;
+                }
+
+                err = capy_json_array_push(value->array, element);
+
+                if (err.code)
+                {
+                    return err;
+                }
+            }
+
+            return Ok;
+        }
+        break;
+
+        case CBOR_MAP:
+        {
+            if (argument > input->size / 2)
+            {
+                return ErrFmt(EINVAL, "unexpected end of data");
+            }
+
+            *value = capy_json_object(arena);
+
+            if (value->object == NULL)
+            {
+                return ErrStd(ENOMEM);
+            }
+
+            for (uint64_t i = 0; i < argument; i++)
+            {
+                capy_jsonkv kv;
+                uint64_t size;
+
+                err = cbor_read_head(input, &major, &info, &size);
+
+                if (err.code)
+                {
+                    return err;
+                }
+
+                if (major != CBOR_TEXT)
+                {
+                    return ErrFmt(EINVAL, "map keys must be text strings");
+                }
+
+                err = cbor_read_text(arena, &kv.key, size, input);
+
+                if (err.code)
+                {
+                    return err;
+                }
+
+                err = cbor_decode(arena, &kv.value, input, depth + 1);
+
+                if (err.code)
+                {
+                    return err;
+                }
+
+                err = capy_strmap_set(arena, &value->object->strmap, &kv);
+
+                if (err.code)
+                {
+                    return err;
+                }
+            }
+
+            return Ok;
+        }
+        break;
+
+        case CBOR_TAG:
+        {
+            return cbor_decode(arena, value, input, depth + 1);
+        }
+        break;
+
+        case CBOR_SIMPLE:
+        {
+            switch (info)
+            {
+                case CBOR_FALSE:
+                case CBOR_TRUE:
+                {
+                    *value = capy_json_bool(info == CBOR_TRUE);
+                    return Ok;
+                }
+                break;
+
+                case CBOR_NULL:
+                case CBOR_UNDEFINED:
+                {
+                    *value = capy_json_null();
+                    return Ok;
+                }
+                break;
+
+                case CBOR_FLOAT16:
+                {
+                    *value = capy_json_number(cbor_float16(Cast(uint16_t, argument)));
+                    return Ok;
+                }
+                break;
+
+                case CBOR_FLOAT32:
+                {
+                    uint32_t bits = Cast(uint32_t, argument);
+                    float single;
+                    memcpy(&single, &bits, sizeof(single));
+
+                    *value = capy_json_number(single);
+                    return Ok;
+                }
+                break;
+
+                case CBOR_FLOAT64:
+                {
+                    double number;
+                    memcpy(&number, &argument, sizeof(number));
+
+                    *value = capy_json_number(number);
+                    return Ok;
+                }
+                break;
+            }
+
+            return ErrFmt(EINVAL, "unsupported simple value %d", info);
+        }
+        break;
+    }
+
+    return ErrFmt(EINVAL, "byte strings are not supported");
+}
+
+// PUBLIC DEFINITIONS
+
+capy_err capy_cbor_encode(capy_buffer *buffer, capy_jsonval value)
+{
+    return cbor_encode(buffer, value);
+}
+
+capy_err capy_cbor_decode(capy_arena *arena, capy_jsonval *value, capy_string input)
+{
+    size_t size = input.size;
+
+    capy_err err = cbor_decode(arena, value, &input, 0);
+
+    if (!err.code && input.size > 0)
+    {
+        err = ErrFmt(EINVAL, "unexpected data after CBOR item");
+    }
+
+    if (err.code)
+    {
+        return ErrFmt(err.code, "%s at offset %zu", err.msg, size - input.size);
+    }
+
+    return Ok;
+}
@@ -0,0 +1,475 @@
+#include <capy/macros.h>
+
+#define CMAP_OFFLINE UINT64_MAX
+
+// Reclaimed snapshot arenas kept by each shard for reuse, further ones are destroyed.
+#define CMAP_FREE 2
+
+// DECLARATIONS
+
+// A snapshot of one shard. Snapshots are immutable once published, writers replace them as a whole.
+struct cmapversion
+{
+    capy_arena *arena;
+    capy_strkvmap *map;
+    uint64_t epoch;
+    struct cmapversion *next;
+};
+
+// Snapshots replaced in a shard wait in `retired` until no reader can hold them, then their arenas are reset
+// and kept in `free` for later writes. Both lists are guarded by the shard lock.
+struct cmapshard
+{
+    alignas(64) _Atomic(struct cmapversion *) version;
+    mtx_t lock;
+    struct cmapversion *retired;
+    struct cmapversion *free;
+    size_t free_size;
+};
+
+struct capy_cmap
+{
+    size_t size;
+    size_t memory;
+    struct cmapshard *shards;
+};
+
+// Quiescent state of a thread that reads concurrent maps, linked in a global list while the thread lives.
+struct cmapreader
+{
+    _Atomic uint64_t epoch;
+    bool registered;
+    struct cmapreader *prev;
+    struct cmapreader *next;
+};
+
+static void cmapdomain_init(void);
+static void cmapreader_exit(void *data);
+static void cmapreader_register(void);
+static void cmap_thread_offline(void);
+static void cmap_thread_online(void);
+static uint64_t cmap_safe_epoch(void);
+static void cmap_reclaim(struct cmapshard *shard);
+static void cmap_retire(struct cmapshard *shard, struct cmapversion *version);
+static capy_arena *cmap_arena(capy_cmap *map, struct cmapshard *shard, size_t size);
+static void cmap_destroy_list(struct cmapversion *version);
+static struct cmapshard *cmap_shard(capy_cmap *map, uint64_t hash);
+static capy_err cmap_copy_entry(capy_strkvmap *map, capy_strkey key, capy_string value);
+static capy_err cmap_update(capy_cmap *map, capy_string key, const capy_string *value);
+
+// INTERNAL VARIABLES
+
+static struct
+{
+    once_flag once;
+    capy_err err;
+    mtx_t lock;
+    tss_t exit;
+    atomic_uint_fast64_t epoch;
+    struct cmapreader *readers;
+} cmapdomain = {.once = ONCE_FLAG_INIT};
+
+static thread_local struct cmapreader cmap_reader;
+
+// INTERNAL DEFINITIONS
+
+static void cmapdomain_init(void)
+{
+    if (mtx_init(&cmapdomain.lock, mtx_plain) != thrd_success)
+    {
+        cmapdomain.err = ErrFmt(ENOMEM, "Failed to initialize concurrent map lock");
+        return;
+    }
+
+    // unregisters readers when their thread exits, before thread local storage is released
+    if (tss_create(&cmapdomain.exit, cmapreader_exit) != thrd_success)
+    {
+        cmapdomain.err = ErrFmt(EAGAIN, "Failed to create concurrent map thread key");
+        return;
+    }
+
+    atomic_store(&cmapdomain.epoch, 1);
+}
+
+static void cmapreader_exit(void *data)
+{
+    struct cmapreader *reader = data;
+
+    mtx_lock(&cmapdomain.lock);
+
+    if (reader->prev != NULL)
+    {
+        reader->prev->next = reader->next;
+    }
+    else
+    {
+        cmapdomain.readers = reader->next;
+    }
+
+    if (reader->next != NULL)
+    {
+        reader->next->prev = reader->prev;
+    }
+
+    reader->registered = false;
+
+    mtx_unlock(&cmapdomain.lock);
+}
+
+static void cmapreader_register(void)
+{
+    if (cmap_reader.registered)
+    {
+        return;
+    }
+
+    mtx_lock(&cmapdomain.lock);
+
+    atomic_store(&cmap_reader.epoch, atomic_load(&cmapdomain.epoch));
+    cmap_reader.prev = NULL;
+    cmap_reader.next = cmapdomain.readers;
+
+    if (cmapdomain.readers != NULL)
+    {
+        cmapdomain.readers->prev = &cmap_reader;
+    }
+
+    cmapdomain.readers = &cmap_reader;
+    cmap_reader.registered = true;
+
+    mtx_unlock(&cmapdomain.lock);
+
+    tss_set(cmapdomain.exit, &cmap_reader);
+}
+
+// Offline threads hold no snapshot references, writers don't wait for them.
+static void cmap_thread_offline(void)
+{
+    if (cmap_reader.registered)
+    {
+        atomic_store(&cmap_reader.epoch, CMAP_OFFLINE);
+    }
+}
+
+static void cmap_thread_online(void)
+{
+    if (cmap_reader.registered)
+    {
+        atomic_store(&cmap_reader.epoch, atomic_load(&cmapdomain.epoch));
+    }
+}
+
+// Returns the oldest epoch observed by an online reader. Snapshots retired at or before it are unreachable.
+static uint64_t cmap_safe_epoch(void)
+{
+    uint64_t epoch = CMAP_OFFLINE;
+
+    mtx_lock(&cmapdomain.lock);
+
+    for (struct cmapreader *reader = cmapdomain.readers; reader != NULL; reader = reader->next)
+    {
+        uint64_t reader_epoch = atomic_load(&reader->epoch);
+
+        if (reader_epoch < epoch)
+        {
+            epoch = reader_epoch;
+        }
+    }
+
+    mtx_unlock(&cmapdomain.lock);
+
+    return epoch;
+}
+
+static void cmap_reclaim(struct cmapshard *shard)
+{
+    if (shard->retired == NULL)
+    {
+        return;
+    }
+
+    uint64_t epoch = cmap_safe_epoch();
+    struct cmapversion **link = &shard->retired;
+
+    while (*link != NULL)
+    {
+        struct cmapversion *version = *link;
+
+        if (version->epoch > epoch)
+        {
+            link = &version->next;
+            continue;
+        }
+
+        *link = version->next;
+
+        if (shard->free_size < CMAP_FREE)
+        {
+            version->next = shard->free;
+            shard->free = version;
+            shard->free_size += 1;
+        }
+        else
+        {
+            capy_arena_destroy(version->arena);
+        }
+    }
+}
+
+static void cmap_retire(struct cmapshard *shard, struct cmapversion *version)
+{
+    // readers observing this epoch or later load the snapshot that replaced `version`
+    version->epoch = atomic_fetch_add(&cmapdomain.epoch, 1) + 1;
+    version->next = shard->retired;
+    shard->retired = version;
+
+    cmap_reclaim(shard);
+}
+
+// Returns an empty arena with room for `size` bytes, reusing a reclaimed snapshot arena of the shard if one is
+// big enough. Snapshots are the first allocation of their arena, so freeing them empties it.
+static capy_arena *cmap_arena(capy_cmap *map, struct cmapshard *shard, size_t size)
+{
+    while (shard->free != NULL)
+    {
+        struct cmapversion *version = shard->free;
+        capy_arena *arena = version->arena;
+
+        shard->free = version->next;
+        shard->free_size -= 1;
+
+        if (!capy_arena_free(arena, version).code && capy_arena_available(arena) >= size)
+        {
+            return arena;
+        }
+
+        capy_arena_destroy(arena);
+    }
+
+    return capy_arena_init(0, (size < map->memory) ? size : map->memory);
+}
+
+static void cmap_destroy_list(struct cmapversion *version)
+{
+    while (version != NULL)
+    {
+        struct cmapversion *next = version->next;
+        capy_arena_destroy(version->arena);
+        version = next;
+    }
+}
+
+static struct cmapshard *cmap_shard(capy_cmap *map, uint64_t hash)
+{
+    // top bits pick the shard, strmap probing uses the bottom ones
+    return map->shards + ((hash >> 56) & (map->size - 1));
+}
+
+static capy_err cmap_copy_entry(capy_strkvmap *map, capy_strkey key, capy_string value)
+{
+    capy_strkv kv;
+
+    capy_err err = capy_string_copy(map->arena, &kv.key, key.string);
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    err = capy_string_copy(map->arena, &kv.value, value);
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    return capy_strmap_set_hashed(map->arena, &map->strmap, (capy_strkey){.string = kv.key, .hash = key.hash}, &kv);
+}
+
+// Publishes a copy of the shard holding `key` with `key` set to `value`, or deleted if `value` is NULL.
+static capy_err cmap_update(capy_cmap *map, capy_string key, const capy_string *value)
+{
+    capy_err err;
+    capy_strkey strkey = capy_strkey_init(key);
+    struct cmapshard *shard = cmap_shard(map, strkey.hash);
+
+    mtx_lock(&shard->lock);
+
+    struct cmapversion *current = atomic_load_explicit(&shard->version, memory_order_relaxed);
+    capy_strkvmap *entries = (current != NULL) ? current->map : NULL;
+
+    if (value == NULL && (entries == NULL || capy_strmap_get_hashed(&entries->strmap, strkey) == NULL))
+    {
+        mtx_unlock(&shard->lock);
+        return Ok;
+    }
+
+    // copies take about as much as the snapshot they copy, twice that leaves room for the change
+    size_t used = (current != NULL) ? capy_arena_used(current->arena) : 0;
+    size_t reserve = 2 * (used + key.size + ((value != NULL) ? value->size : 0)) + KiB(4);
+
+    capy_arena *arena = cmap_arena(map, shard, reserve);
+
+    if (arena == NULL)
+    {
+        mtx_unlock(&shard->lock);
+        return ErrStd(ENOMEM);
+    }
+
+    size_t size = (entries != NULL) ? entries->size : 0;
+
+    struct cmapversion *version = Make(arena, struct cmapversion, 1);
+    capy_strkvmap *copy = capy_strkvmap_init(arena, size - ((entries != NULL) ? entries->strmap.dead : 0) + 1);
+
+    if (version == NULL || copy == NULL)
+    {
+        err = ErrStd(ENOMEM);
+        goto fail;
+    }
+
+    version->arena = arena;
+    version->map = copy;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        if (capy_strmap_deleted(entries->items + i) || capy_string_eq(entries->items[i].key, key))
+        {
+            continue;
+        }
+
+        // indexed snapshots carry the hash of every entry, small ones are scanned without hashing
+        uint64_t hash = (entries->strmap.hashes != NULL) ? entries->strmap.hashes[i] : 0;
+
+        err = cmap_copy_entry(copy, (capy_strkey){.string = entries->items[i].key, .hash = hash}, entries->items[i].value);
+
+        if (err.code)
+        {
+            goto fail;
+        }
+    }
+
+    if (value != NULL)
+    {
+        err = cmap_copy_entry(copy, strkey, *value);
+
+        if (err.code)
+        {
+            goto fail;
+        }
+    }
+
+    atomic_store_explicit(&shard->version, version, memory_order_release);
+
+    if (current != NULL)
+    {
+        cmap_retire(shard, current);
+    }
+
+    mtx_unlock(&shard->lock);
+
+    return Ok;
+
+fail:
+    mtx_unlock(&shard->lock);
+    capy_arena_destroy(arena);
+    return err;
+}
+
+// PUBLIC DEFINITIONS
+
+capy_cmap *capy_cmap_init(capy_arena *arena, size_t shards, size_t memory)
+{
+    call_once(&cmapdomain.once, cmapdomain_init);
+
+    if (cmapdomain.err.code)
+    {
+        return NULL;
+    }
+
+    shards = capy_next_pow2((shards) ? shards : 16);
+
+    if (shards > 256)
+    {
+        shards = 256;
+    }
+
+    capy_cmap *map = Make(arena, capy_cmap, 1);
+
+    if (map == NULL)
+    {
+        return NULL;
+    }
+
+    map->size = shards;
+    map->memory = (memory) ? memory : MiB(16);
+    map->shards = capy_arena_alloc(arena, sizeof(struct cmapshard) * shards, alignof(struct cmapshard), true);
+
+    if (map->shards == NULL)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < shards; i++)
+    {
+        if (mtx_init(&map->shards[i].lock, mtx_plain) != thrd_success)
+        {
+            while (i-- > 0)
+            {
+                mtx_destroy(&map->shards[i].lock);
+            }
+
+            return NULL;
+        }
+    }
+
+    return map;
+}
+
+capy_strkv *capy_cmap_get(capy_cmap *map, capy_string key)
+{
+    cmapreader_register();
+
+    capy_strkey strkey = capy_strkey_init(key);
+    struct cmapversion *version = atomic_load_explicit(&cmap_shard(map, strkey.hash)->version, memory_order_acquire);
+
+    if (version == NULL)
+    {
+        return NULL;
+    }
+
+    return capy_strmap_get_hashed(&version->map->strmap, strkey);
+}
+
+capy_err capy_cmap_set(capy_cmap *map, capy_string key, capy_string value)
+{
+    return cmap_update(map, key, &value);
+}
+
+capy_err capy_cmap_delete(capy_cmap *map, capy_string key)
+{
+    return cmap_update(map, key, NULL);
+}
+
+void capy_cmap_quiescent(void)
+{
+    cmap_thread_online();
+}
+
+void capy_cmap_destroy(capy_cmap *map)
+{
+    for (size_t i = 0; i < map->size; i++)
+    {
+        struct cmapshard *shard = map->shards + i;
+        struct cmapversion *version = atomic_load(&shard->version);
+
+        if (version != NULL)
+        {
+            capy_arena_destroy(version->arena);
+        }
+
+        cmap_destroy_list(shard->retired);
+        cmap_destroy_list(shard->free);
+
+        mtx_destroy(&shard->lock);
+    }
+}
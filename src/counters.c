@@ -0,0 +1,151 @@
+#include <capy/macros.h>
+
+// DECLARATIONS
+
+// Counters exported by the metrics endpoint. Gauges hold the value of their thread, the sum over threads is
+// the value of the process.
+typedef enum
+{
+    COUNTER_EPOLL_WAKEUPS,
+    COUNTER_TASKS_READY,
+    COUNTER_TASKS_WAITING,
+    COUNTER_TLS_HANDSHAKES,
+    COUNTER_TLS_FAILURES,
+    COUNTER_BYTES_IN,
+    COUNTER_BYTES_OUT,
+    COUNTER_COUNT,
+} countername;
+
+// Counters of one thread, allocated on first use and kept until the process exits, so totals never go back
+// when threads exit. Each set starts on its own cache line and has a single writer, updates are relaxed loads
+// and stores instead of read-modify-write operations.
+struct counterset
+{
+    alignas(64) _Atomic int64_t values[COUNTER_COUNT];
+    struct counterset *next;
+};
+
+static void counterdomain_init(void);
+static struct counterset *counterset_get(void);
+static void counter_update(_Atomic int64_t *counter, int64_t value);
+static void counter_add(countername name, int64_t value);
+static void counter_store(countername name, int64_t value);
+static void counter_totals(int64_t totals[COUNTER_COUNT]);
+
+// INTERNAL VARIABLES
+
+static struct
+{
+    once_flag once;
+    capy_err err;
+    mtx_t lock;
+    capy_arena *arena;
+    struct counterset *sets;
+} counterdomain = {.once = ONCE_FLAG_INIT};
+
+static thread_local struct counterset *counter_set;
+
+// INTERNAL DEFINITIONS
+
+static void counterdomain_init(void)
+{
+    if (mtx_init(&counterdomain.lock, mtx_plain) != thrd_success)
+    {
+        counterdomain.err = ErrFmt(ENOMEM, "Failed to initialize counters lock");
+        return;
+    }
+
+    counterdomain.arena = capy_arena_init(0, MiB(1));
+
+    if (counterdomain.arena == NULL)
+    {
+        counterdomain.err = ErrFmt(ENOMEM, "Failed to initialize counters arena");
+    }
+}
+
+// Returns the counters of the calling thread, registering them on first use, or NULL if they can't be
+// allocated.
+static struct counterset *counterset_get(void)
+{
+    if (counter_set != NULL)
+    {
+        return counter_set;
+    }
+
+    call_once(&counterdomain.once, counterdomain_init);
+
+    if (counterdomain.err.code)
+    {
+        return NULL;
+    }
+
+    mtx_lock(&counterdomain.lock);
+
+    struct counterset *set = Make(counterdomain.arena, struct counterset, 1);
+
+    if (set != NULL)
+    {
+        set->next = counterdomain.sets;
+        counterdomain.sets = set;
+    }
+
+    mtx_unlock(&counterdomain.lock);
+
+    counter_set = set;
+
+    return set;
+}
+
+// Adds `value` to a counter that only the calling thread writes.
+static void counter_update(_Atomic int64_t *counter, int64_t value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static void counter_add(countername name, int64_t value)
+{
+    struct counterset *set = counterset_get();
+
+    if (set != NULL)
+    {
+        counter_update(&set->values[name], value);
+    }
+}
+
+static void counter_store(countername name, int64_t value)
+{
+    struct counterset *set = counterset_get();
+
+    if (set != NULL)
+    {
+        atomic_store_explicit(&set->values[name], value, memory_order_relaxed);
+    }
+}
+
+// Sums the counters of every thread that ever used them.
+static void counter_totals(int64_t totals[COUNTER_COUNT])
+{
+    for (size_t i = 0; i < COUNTER_COUNT; i++)
+    {
+        totals[i] = 0;
+    }
+
+    call_once(&counterdomain.once, counterdomain_init);
+
+    if (counterdomain.err.code)
+    {
+        return;
+    }
+
+    mtx_lock(&counterdomain.lock);
+
+    for (struct counterset *set = counterdomain.sets; set != NULL; set = set->next)
+    {
+        for (size_t i = 0; i < COUNTER_COUNT; i++)
+        {
+            totals[i] += atomic_load_explicit(&set->values[i], memory_order_relaxed);
+        }
+    }
+
+    mtx_unlock(&counterdomain.lock);
+}
@@ -2,9 +2,45 @@
 
 #include "rapidhash/rapidhash.h"
 
+// DECLARATIONS
+
+static uint64_t hash_seed;
+static once_flag hash_once = ONCE_FLAG_INIT;
+
+Platform static void hash_seed_init(void);
+
 // PUBLIC DEFINITIONS
 
 uint64_t capy_hash(const void *key, uint64_t length)
 {
-    return rapidhashMicro(key, length);
+    // seeded per process, so keys colliding in one process can't be precomputed for another
+    call_once(&hash_once, hash_seed_init);
+    return rapidhashMicro_withSeed(key, length, hash_seed);
+}
+
+//
+// LINUX
+//
+
+#ifdef CAPY_OS_LINUX
+
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+Linux static void hash_seed_init(void)
+{
+    if (getrandom(&hash_seed, sizeof(hash_seed), GRND_NONBLOCK) == sizeof(hash_seed))
+    {
+        return;
+    }
+
+    // entropy pool not ready yet, fall back to weaker sources
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    uint64_t parts[] = {Cast(uint64_t, ts.tv_sec), Cast(uint64_t, ts.tv_nsec), Cast(uint64_t, getpid()), Cast(uint64_t, Cast(uintptr_t, &ts))};
+    hash_seed = rapidhashMicro(parts, sizeof(parts));
 }
+
+#endif
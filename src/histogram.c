@@ -0,0 +1,172 @@
+#include <capy/macros.h>
+
+// Values below HISTOGRAM_SUB_COUNT have their own bucket, larger ones share HISTOGRAM_SUB_COUNT buckets per
+// power of two. Values of HISTOGRAM_MAX_BITS bits or more are counted in the last bucket.
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 48
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT)
+
+// DECLARATIONS
+
+// Counters have a single writer, they are updated with relaxed loads and stores instead of read-modify-write
+// operations, so recording costs the same as on plain integers.
+struct capy_histogram
+{
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+    _Atomic uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+static size_t histogram_index(uint64_t value);
+static uint64_t histogram_upper(size_t index);
+static void histogram_add(_Atomic uint64_t *counter, uint64_t value);
+
+// INTERNAL DEFINITIONS
+
+static size_t histogram_index(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_COUNT)
+    {
+        return Cast(size_t, value);
+    }
+
+    if (value >> HISTOGRAM_MAX_BITS)
+    {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HISTOGRAM_SUB_BITS;
+
+    size_t octave = Cast(size_t, shift + 1) * HISTOGRAM_SUB_COUNT;
+    size_t sub = Cast(size_t, value >> shift) - HISTOGRAM_SUB_COUNT;
+
+    return octave + sub;
+}
+
+// Returns the largest value counted in the bucket.
+static uint64_t histogram_upper(size_t index)
+{
+    if (index < HISTOGRAM_SUB_COUNT)
+    {
+        return index;
+    }
+
+    int shift = Cast(int, index / HISTOGRAM_SUB_COUNT) - 1;
+    uint64_t lower = Cast(uint64_t, HISTOGRAM_SUB_COUNT + (index % HISTOGRAM_SUB_COUNT)) << shift;
+
+    return lower + (UINT64_C(1) << shift) - 1;
+}
+
+static void histogram_add(_Atomic uint64_t *counter, uint64_t value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+// PUBLIC DEFINITIONS
+
+capy_histogram *capy_histogram_init(capy_arena *arena)
+{
+    return Make(arena, capy_histogram, 1);
+}
+
+void capy_histogram_record(capy_histogram *histogram, uint64_t value)
+{
+    histogram_add(&histogram->buckets[histogram_index(value)], 1);
+    histogram_add(&histogram->count, 1);
+    histogram_add(&histogram->sum, value);
+
+    if (value > atomic_load_explicit(&histogram->max, memory_order_relaxed))
+    {
+        atomic_store_explicit(&histogram->max, value, memory_order_relaxed);
+    }
+}
+
+void capy_histogram_merge(capy_histogram *dst, capy_histogram *src)
+{
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        uint64_t count = atomic_load_explicit(&src->buckets[i], memory_order_relaxed);
+
+        if (count)
+        {
+            histogram_add(&dst->buckets[i], count);
+        }
+    }
+
+    histogram_add(&dst->count, atomic_load_explicit(&src->count, memory_order_relaxed));
+    histogram_add(&dst->sum, atomic_load_explicit(&src->sum, memory_order_relaxed));
+
+    uint64_t max = atomic_load_explicit(&src->max, memory_order_relaxed);
+
+    if (max > atomic_load_explicit(&dst->max, memory_order_relaxed))
+    {
+        atomic_store_explicit(&dst->max, max, memory_order_relaxed);
+    }
+}
+
+uint64_t capy_histogram_count(capy_histogram *histogram)
+{
+    return atomic_load_explicit(&histogram->count, memory_order_relaxed);
+}
+
+uint64_t capy_histogram_sum(capy_histogram *histogram)
+{
+    return atomic_load_explicit(&histogram->sum, memory_order_relaxed);
+}
+
+uint64_t capy_histogram_max(capy_histogram *histogram)
+{
+    return atomic_load_explicit(&histogram->max, memory_order_relaxed);
+}
+
+uint64_t capy_histogram_below(capy_histogram *histogram, uint64_t value)
+{
+    uint64_t count = 0;
+
+    // the last bucket is unbounded
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS - 1 && histogram_upper(i) <= value; i++)
+    {
+        count += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+    }
+
+    return count;
+}
+
+uint64_t capy_histogram_percentile(capy_histogram *histogram, double percentile)
+{
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        total += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+    }
+
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    double target = Cast(double, total) * percentile / 100.0;
+    uint64_t rank = Cast(uint64_t, target);
+    rank += (Cast(double, rank) < target || rank == 0);
+
+    uint64_t max = capy_histogram_max(histogram);
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+
+        // the last bucket is unbounded
+        if (seen >= rank && i < HISTOGRAM_BUCKETS - 1)
+        {
+            uint64_t upper = histogram_upper(i);
+            return (upper < max) ? upper : max;
+        }
+    }
+
+    return max;
+}
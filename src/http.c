@@ -1,5 +1,19 @@
 #include <capy/macros.h>
 
+// Request bodies wait up to HTTP_BUDGET_RETRIES * HTTP_BUDGET_DELAY ms for memory pressure to go away.
+#define HTTP_BUDGET_RETRIES 5
+#define HTTP_BUDGET_DELAY 20
+
+// Connection structs are recycled through a pool shared by workers, its arena reserves room for this many bytes.
+#define HTTP_CONN_POOL_MAX GiB(1)
+
+// Per-state histograms and debug traces of connections, compiled out with CAPY_NO_INSTRUMENT.
+#ifdef CAPY_NO_INSTRUMENT
+#define HTTP_INSTRUMENT false
+#else
+#define HTTP_INSTRUMENT true
+#endif
+
 typedef union httproutermap
 {
     capy_strmap strmap;
@@ -17,6 +31,8 @@ typedef struct httprouter
     capy_string segment;
     httproutermap *segments;
     capy_httproute routes[10];
+    size_t ids[10];
+    const char *labels[10];
 } httprouter;
 
 typedef enum
@@ -33,11 +49,23 @@ typedef enum
     STATE_ROUTE_REQUEST,
     STATE_WRITE_RESPONSE,
     STATE_BAD_REQUEST,
+    STATE_UNAVAILABLE,
     STATE_SERVER_FAILURE,
     STATE_SSL_SHUTDOWN,
     STATE_CLOSE,
+    STATE_COUNT,
 } httpconnstate;
 
+// Phases of a request measured for the access log.
+typedef enum
+{
+    PHASE_READ,
+    PHASE_PARSE,
+    PHASE_HANDLER,
+    PHASE_WRITE,
+    PHASE_COUNT,
+} httpconnphase;
+
 typedef struct httpconn
 {
     capy_tcp *tcp;
@@ -46,6 +74,7 @@ typedef struct httpconn
 
     capy_arena *arena;
     void *arena_reset_mark;
+    capy_membudget *budget;
 
     ssize_t mem_headers;
     ssize_t mem_content;
@@ -58,7 +87,7 @@ typedef struct httpconn
     capy_buffer *line_buffer;
 
     capy_buffer *content_buffer;
-    capy_buffer *response_buffer;
+    capy_segbuf *response_buffer;
 
     size_t line_cursor;
     size_t chunk_size;
@@ -72,13 +101,67 @@ typedef struct httpconn
 
     struct timespec created;
     struct timespec timestamp;
+
+    httpconnstate clocked;
+    bool idle;
+    bool responded;
+    size_t response_size;
+    struct timespec started;
+    int64_t phases[PHASE_COUNT];
+    int64_t queued;
+
+    struct httpserver *server;
+    struct httpconn *idle_prev;
+    struct httpconn *idle_next;
+    bool idle_listed;
+    size_t route;
+    bool active;
+    size_t memory;
 } httpconn;
 
+// Histograms of one worker thread, allocated on first use. They are only written by their thread and kept
+// until the process exits, so aggregations can read them at any time.
+typedef struct httpstats
+{
+    capy_arena *arena;
+    _Atomic(capy_histogram *) time[STATE_COUNT];
+    _Atomic(capy_histogram *) memory[STATE_COUNT];
+    struct httpstats *next;
+} httpstats;
+
+// Responses of one route counted by one worker, by status class (0 for statuses outside 100-599), and the
+// time taken to serve them (ns) by status class. Responses whose task stalled its scheduler are counted with the time stalled.
+// Requests whose first bytes were timestamped by the kernel are counted with the time they waited to be read.
+typedef struct httproutemetrics
+{
+    alignas(64) _Atomic int64_t responses[6];
+    _Atomic int64_t stalls;
+    capy_histogram *time[6];
+    capy_histogram *stalled;
+    capy_histogram *queued;
+} httproutemetrics;
+
+// Metrics of one worker. They are only written by the worker's thread and start on their own cache line, so
+// workers never write to the same one. Routes are indexed by their identifier, the last one counts requests
+// for the metrics themselves.
+typedef struct httpmetrics
+{
+    alignas(64) _Atomic int64_t connections;
+    _Atomic int64_t active;
+    _Atomic int64_t memory;
+    httproutemetrics *routes;
+} httpmetrics;
+
 typedef struct httpserver
 {
     capy_tcp *tcp;
     httprouter *router;
     capy_httpserveropt *options;
+    capy_membudget *budget;
+    httpmetrics *metrics;
+    struct httpserver *workers;
+    httpconn *idle;
+    capy_poolcache conns;
 } httpserver;
 
 enum
@@ -91,6 +174,63 @@ enum
 
 // INTERNAL VARIABLES
 
+static atomic_size_t http_conn_ids;
+static thread_local size_t http_access_count;
+
+static atomic_bool http_instrumented;
+static thread_local httpstats *http_stats;
+
+static struct
+{
+    once_flag once;
+    capy_err err;
+    mtx_t lock;
+    httpstats *stats;
+} httpinstrument = {.once = ONCE_FLAG_INIT};
+
+static const char *http_method_cstr[] = {
+    [CAPY_HTTP_INVALID_METHOD] = "-",
+    [CAPY_HTTP_CONNECT] = "CONNECT",
+    [CAPY_HTTP_DELETE] = "DELETE",
+    [CAPY_HTTP_GET] = "GET",
+    [CAPY_HTTP_HEAD] = "HEAD",
+    [CAPY_HTTP_OPTIONS] = "OPTIONS",
+    [CAPY_HTTP_PATCH] = "PATCH",
+    [CAPY_HTTP_POST] = "POST",
+    [CAPY_HTTP_PUT] = "PUT",
+    [CAPY_HTTP_TRACE] = "TRACE",
+};
+
+static const char *http_status_class_cstr[] = {"other", "1xx", "2xx", "3xx", "4xx", "5xx"};
+
+// Upper bounds of the buckets of the latency histograms in the metrics. Values are counted in a bound only
+// when their whole histogram bucket is below it, so counts are exact or short by at most 6%.
+static const struct
+{
+    uint64_t ns;
+    const char *le;
+} httpmetrics_bounds[] = {
+    {10000, "0.00001"},
+    {25000, "0.000025"},
+    {50000, "0.00005"},
+    {100000, "0.0001"},
+    {250000, "0.00025"},
+    {500000, "0.0005"},
+    {1000000, "0.001"},
+    {2500000, "0.0025"},
+    {5000000, "0.005"},
+    {10000000, "0.01"},
+    {25000000, "0.025"},
+    {50000000, "0.05"},
+    {100000000, "0.1"},
+    {250000000, "0.25"},
+    {500000000, "0.5"},
+    {1000000000, "1"},
+    {2500000000, "2.5"},
+    {5000000000, "5"},
+    {10000000000, "10"},
+};
+
 static const char *httpconnstate_cstr[] = {
     [STATE_UNKNOWN] = "STATE_UNKNOWN",
     [STATE_RESET] = "STATE_RESET",
@@ -104,10 +244,26 @@ static const char *httpconnstate_cstr[] = {
     [STATE_ROUTE_REQUEST] = "STATE_ROUTE_REQUEST",
     [STATE_WRITE_RESPONSE] = "STATE_WRITE_RESPONSE",
     [STATE_BAD_REQUEST] = "STATE_BAD_REQUEST",
+    [STATE_UNAVAILABLE] = "STATE_UNAVAILABLE",
     [STATE_SERVER_FAILURE] = "STATE_SERVER_FAILURE",
+    [STATE_SSL_SHUTDOWN] = "STATE_SSL_SHUTDOWN",
     [STATE_CLOSE] = "STATE_CLOSE",
 };
 
+// Allocation profiler phases of the states that allocate on behalf of a request.
+static const char *httpconnstate_allocphase[] = {
+    [STATE_PARSE_REQLINE] = "headers",
+    [STATE_PARSE_HEADERS] = "headers",
+    [STATE_PARSE_CONTENT] = "content",
+    [STATE_PARSE_CHUNKSIZE] = "content",
+    [STATE_PARSE_CHUNKDATA] = "content",
+    [STATE_PARSE_TRAILERS] = "trailers",
+    [STATE_ROUTE_REQUEST] = "response",
+    [STATE_BAD_REQUEST] = "response",
+    [STATE_UNAVAILABLE] = "response",
+    [STATE_CLOSE] = NULL,
+};
+
 static const capy_string http_status_string[600] = {
     [CAPY_HTTP_CONTINUE] = StrIni("Continue"),
     [CAPY_HTTP_SWITCHING_PROTOCOLS] = StrIni("Switching Protocols"),
@@ -303,6 +459,20 @@ static const char *http_months[] = {
     "Dec",
 };
 
+// Hashes depend on the process hash seed, so constant keys are hashed once on first use
+static struct
+{
+    once_flag once;
+    capy_strkey host;
+    capy_strkey transfer_encoding;
+    capy_strkey content_length;
+    capy_strkey connection;
+    capy_strkey content_type;
+    capy_strkey accept;
+    capy_strkey wildcard;
+} httpkeys = {.once = ONCE_FLAG_INIT};
+
+static void httpkeys_init(void);
 static bool http_validate_string(capy_string s, int categories, const char *chars);
 static capy_string http_next_token(capy_string *buffer, const char *delimiters);
 static size_t http_consume_chars(capy_string *buffer, const char *chars, size_t limit);
@@ -310,15 +480,18 @@ static capy_err http_canonicalize_field(capy_arena *arena, capy_string *output,
 static capy_err httpresp_write_status(capy_httpresp *response);
 static capy_err httpresp_write_cstr(capy_httpresp *response, const char *msg);
 static capy_err http_pctdecode_query(capy_arena *arena, capy_string *output, capy_string input);
+static bool http_media_type_is(capy_string value, capy_string type);
+static int http_accept_quality(capy_strkvn *accept, capy_string type);
 
 static httproutermap *httproutermap_init(capy_arena *arena, size_t capacity);
 static httprouter *httproutermap_get(httproutermap *map, capy_string key);
+static httprouter *httproutermap_get_hashed(httproutermap *map, capy_strkey key);
 static MustCheck capy_err httproutermap_set(capy_arena *arena, httproutermap *map, httprouter router);
 
 static httprouter *httprouter_init(capy_arena *arena, int n, capy_httproute *routes);
-static httprouter *httprouter_add_route(capy_arena *arena, httprouter *router, capy_httpmethod method, capy_string suffix, capy_string path, capy_http_handler handler);
-static capy_httproute *httprouter_get_route(httprouter *router, capy_httpmethod method, capy_string path);
-static capy_err httprouter_handle_request(capy_arena *arena, httprouter *router, capy_httpreq *request, capy_httpresp *response);
+static httprouter *httprouter_add_route(capy_arena *arena, httprouter *router, capy_httpmethod method, capy_string suffix, capy_string path, capy_http_handler handler, size_t id);
+static httprouter *httprouter_get_route(httprouter *router, capy_httpmethod method, capy_string path);
+static capy_err httprouter_handle_request(capy_arena *arena, httprouter *router, capy_httpreq *request, capy_httpresp *response, size_t *id);
 
 static capy_httpmethod http_parse_method(capy_string input);
 static capy_httpversion http_parse_version(capy_string input);
@@ -328,7 +501,7 @@ static MustCheck capy_err http_parse_field(capy_strkvnmap *fields, capy_string l
 static MustCheck capy_err http_parse_uriparams(capy_strkvnmap *params, capy_string path, capy_string handler_path);
 static MustCheck capy_err http_parse_query(capy_strkvnmap *fields, capy_string line);
 static MustCheck capy_err http_validate_request(capy_arena *arena, capy_httpreq *request);
-static MustCheck capy_err http_write_response(capy_buffer *buffer, capy_httpresp *response, int close);
+static MustCheck capy_err http_write_response(capy_segbuf *buffer, capy_httpresp *response, int close);
 
 static int httpconn_parse_eol(httpconn *conn, capy_string *line);
 static void httpconn_consume_bytes(httpconn *conn, size_t size);
@@ -339,18 +512,34 @@ static capy_err httpconn_parse_trailers(httpconn *conn);
 static capy_err httpconn_parse_chunksize(httpconn *conn);
 static capy_err httpconn_parse_chunkdata(httpconn *conn);
 static capy_err httpconn_parse_reqbody(httpconn *conn);
-static capy_err httpconn_prepare_badrequest(httpconn *conn);
+static capy_err httpconn_prepare_failure(httpconn *conn, capy_httpstatus status);
+static bool httpconn_admit_content(httpconn *conn);
+static bool httpconn_budget_exhausted(httpconn *conn, capy_err err);
 static capy_err httpconn_route_request(httpconn *conn);
 static capy_err httpconn_reset(httpconn *conn);
-static void httpconn_trace(httpconn *conn);
+static void httpinstrument_init(void);
+static httpstats *httpstats_get(void);
+static void httpstats_record(bool memory, httpconnstate state, uint64_t value);
+static int64_t httpconn_clock(httpconn *conn, bool instrumented);
+static void httpconn_count(httpconn *conn, int64_t total);
+static void httpconn_gauge(httpconn *conn, bool closed);
+static void httpconn_access_log(httpconn *conn, int64_t total);
+static void httpconn_trace(httpconn *conn, int64_t elapsed);
 static capy_err httpconn_write_response(httpconn *conn);
 static capy_err httpconn_read_request(httpconn *conn);
 static capy_err httpconn_run(httpconn *conn);
 static capy_err httpconn_destroy(httpconn *conn);
+static void httpconn_idle_add(httpconn *conn);
+static void httpconn_idle_remove(httpconn *conn);
+static capy_err httpserver_trim_idle(httpserver *server);
 static void httpconn_run_task(void *conn);
 static void httpconn_clean_task(void *conn);
 
 static capy_httpserveropt httpserveropt_default(capy_httpserveropt options);
+static httpmetrics *httpmetrics_init(capy_arena *arena, size_t routes);
+static capy_err httpmetrics_write_label(capy_buffer *buffer, capy_httpserveropt *options, size_t route);
+static capy_err httpserver_write_metrics(httpserver *server, capy_arena *arena, capy_httpresp *response);
+static capy_err httpmetrics_write_histogram(capy_buffer *buffer, const char *name, capy_string label, const char *code, capy_histogram *histogram);
 static capy_err httpserver_accept(httpserver *server);
 static capy_err httpserver_serve(httpserver *server);
 
@@ -359,6 +548,17 @@ httpserver_workers(size_t n, httpserver *servers);
 
 // INTERNAL DEFINITIONS
 
+static void httpkeys_init(void)
+{
+    httpkeys.host = capy_strkey_init(Str("Host"));
+    httpkeys.transfer_encoding = capy_strkey_init(Str("Transfer-Encoding"));
+    httpkeys.content_length = capy_strkey_init(Str("Content-Length"));
+    httpkeys.connection = capy_strkey_init(Str("Connection"));
+    httpkeys.content_type = capy_strkey_init(Str("Content-Type"));
+    httpkeys.accept = capy_strkey_init(Str("Accept"));
+    httpkeys.wildcard = capy_strkey_init(Str("^"));
+}
+
 static bool http_validate_string(capy_string s, int categories, const char *chars)
 {
     capy_string input = s;
@@ -533,21 +733,84 @@ static capy_err http_pctdecode_query(capy_arena *arena, capy_string *output, cap
     return Ok;
 }
 
-static httproutermap *httproutermap_init(capy_arena *arena, size_t capacity)
+static bool http_media_type_is(capy_string value, capy_string type)
 {
-    char *addr = capy_arena_alloc(arena, sizeof(httproutermap) + (sizeof(httprouter) * capacity), 8, true);
+    capy_string media = capy_string_trim(http_next_token(&value, ";"), " \t");
+    return media.size == type.size && strncasecmp(media.data, type.data, type.size) == 0;
+}
+
+static int http_accept_quality(capy_strkvn *accept, capy_string type)
+{
+    capy_string prefix = capy_string_slice(type, 0, Cast(size_t, strchr(type.data, '/') - type.data) + 1);
+
+    int quality = 0;
+    int specificity = 0;
 
-    if (addr == NULL)
+    for (; accept != NULL; accept = accept->next)
     {
-        return NULL;
+        capy_string list = accept->value;
+
+        while (list.size)
+        {
+            capy_string range = http_next_token(&list, ",");
+            list = capy_string_shl(list, (list.size) ? 1 : 0);
+
+            capy_string media = capy_string_trim(http_next_token(&range, ";"), " \t");
+            int q = 1000;
+
+            while (range.size)
+            {
+                range = capy_string_shl(range, 1);
+                capy_string param = capy_string_trim(http_next_token(&range, ";"), " \t");
+
+                if (param.size < 3 || (param.data[0] != 'q' && param.data[0] != 'Q') || param.data[1] != '=')
+                {
+                    continue;
+                }
+
+                // qvalue = ( "0" [ "." 0*3DIGIT ] ) / ( "1" [ "." 0*3("0") ] )
+                q = (param.data[2] == '1') ? 1000 : 0;
+
+                for (size_t i = 4, scale = 100; i < param.size && i < 7 && q < 1000 && capy_char_isdigit(param.data[i]); i++, scale /= 10)
+                {
+                    q += (param.data[i] - '0') * Cast(int, scale);
+                }
+            }
+
+            int s = 0;
+
+            if (http_media_type_is(media, type))
+            {
+                s = 3;
+            }
+            else if (media.size == prefix.size + 1 && strncasecmp(media.data, prefix.data, prefix.size) == 0 && media.data[prefix.size] == '*')
+            {
+                s = 2;
+            }
+            else if (capy_string_eq(media, Str("*/*")))
+            {
+                s = 1;
+            }
+
+            if (s > specificity)
+            {
+                specificity = s;
+                quality = q;
+            }
+        }
     }
 
-    httproutermap *map = Cast(httproutermap *, addr);
+    return quality;
+}
+
+static httproutermap *httproutermap_init(capy_arena *arena, size_t capacity)
+{
+    httproutermap *map = Make(arena, httproutermap, 1);
 
-    map->size = 0;
-    map->capacity = capacity;
-    map->element_size = sizeof(httprouter);
-    map->items = Cast(httprouter *, addr + sizeof(httproutermap));
+    if (map == NULL || capy_strmap_init(arena, &map->strmap, sizeof(httprouter), capacity).code)
+    {
+        return NULL;
+    }
 
     return map;
 }
@@ -557,6 +820,11 @@ static httprouter *httproutermap_get(httproutermap *map, capy_string key)
     return capy_strmap_get(&map->strmap, key);
 }
 
+static httprouter *httproutermap_get_hashed(httproutermap *map, capy_strkey key)
+{
+    return capy_strmap_get_hashed(&map->strmap, key);
+}
+
 static MustCheck capy_err httproutermap_set(capy_arena *arena, httproutermap *map, httprouter router)
 {
     return capy_strmap_set(arena, &map->strmap, &router);
@@ -568,7 +836,7 @@ httprouter *httprouter_init(capy_arena *arena, int n, capy_httproute *routes)
 
     for (int i = 0; i < n; i++)
     {
-        router = httprouter_add_route(arena, router, routes[i].method, routes[i].path, routes[i].path, routes[i].handler);
+        router = httprouter_add_route(arena, router, routes[i].method, routes[i].path, routes[i].path, routes[i].handler, Cast(size_t, i) + 1);
 
         if (router == NULL)
         {
@@ -579,7 +847,9 @@ httprouter *httprouter_init(capy_arena *arena, int n, capy_httproute *routes)
     return router;
 }
 
-static httprouter *httprouter_add_route(capy_arena *arena, httprouter *router, capy_httpmethod method, capy_string suffix, capy_string path, capy_http_handler handler)
+// Routes are identified by their position in the route list, starting from 1, and label the tasks handling
+// them as "METHOD path".
+static httprouter *httprouter_add_route(capy_arena *arena, httprouter *router, capy_httpmethod method, capy_string suffix, capy_string path, capy_http_handler handler, size_t id)
 {
     if (router == NULL)
     {
@@ -603,18 +873,36 @@ static httprouter *httprouter_add_route(capy_arena *arena, httprouter *router, c
 
     if (segment.size == 0)
     {
+        size_t size = strlen(http_method_cstr[method]) + path.size + 2;
+        char *label = Make(arena, char, size);
+
+        if (label == NULL)
+        {
+            return NULL;
+        }
+
+        snprintf(label, size, "%s %.*s", http_method_cstr[method], Cast(int, path.size), path.data);
+
         router->routes[method] = (capy_httproute){.method = method, .path = path, .handler = handler};
+        router->ids[method] = id;
+        router->labels[method] = label;
         return router;
     }
 
+    httprouter *child;
+
     if (segment.data[0] == '^')
     {
-        segment = Str("^");
+        call_once(&httpkeys.once, httpkeys_init);
+        segment = httpkeys.wildcard.string;
+        child = httproutermap_get_hashed(router->segments, httpkeys.wildcard);
+    }
+    else
+    {
+        child = httproutermap_get(router->segments, segment);
     }
 
-    httprouter *child = httproutermap_get(router->segments, segment);
-
-    child = httprouter_add_route(arena, child, method, suffix, path, handler);
+    child = httprouter_add_route(arena, child, method, suffix, path, handler, id);
 
     if (child == NULL)
     {
@@ -631,28 +919,23 @@ static httprouter *httprouter_add_route(capy_arena *arena, httprouter *router, c
     return router;
 }
 
-capy_httproute *httprouter_get_route(httprouter *router, capy_httpmethod method, capy_string path)
+// Returns the node holding the route of `method` for `path`, or NULL if there is none.
+httprouter *httprouter_get_route(httprouter *router, capy_httpmethod method, capy_string path)
 {
     http_consume_chars(&path, "/", 0);
     capy_string segment = http_next_token(&path, "/");
 
     if (segment.size == 0)
     {
-        capy_httproute *route = router->routes + method;
-
-        if (route->handler == NULL)
-        {
-            return NULL;
-        }
-
-        return route;
+        return (router->routes[method].handler != NULL) ? router : NULL;
     }
 
     httprouter *child = httproutermap_get(router->segments, segment);
 
     if (child == NULL)
     {
-        child = httproutermap_get(router->segments, Str("^"));
+        call_once(&httpkeys.once, httpkeys_init);
+        child = httproutermap_get_hashed(router->segments, httpkeys.wildcard);
 
         if (child == NULL)
         {
@@ -663,18 +946,25 @@ capy_httproute *httprouter_get_route(httprouter *router, capy_httpmethod method,
     return httprouter_get_route(child, method, path);
 }
 
-capy_err httprouter_handle_request(capy_arena *arena, httprouter *router, capy_httpreq *request, capy_httpresp *response)
+// Sets `id` to the identifier of the route that handles the request, or 0 if none does.
+capy_err httprouter_handle_request(capy_arena *arena, httprouter *router, capy_httpreq *request, capy_httpresp *response, size_t *id)
 {
     capy_err err;
 
-    capy_httproute *route = httprouter_get_route(router, request->method, request->uri.path);
+    *id = 0;
+
+    httprouter *node = httprouter_get_route(router, request->method, request->uri.path);
 
-    if (route == NULL)
+    if (node == NULL)
     {
         response->status = CAPY_HTTP_NOT_FOUND;
         return httpresp_write_status(response);
     }
 
+    capy_httproute *route = node->routes + request->method;
+    *id = node->ids[request->method];
+    capy_task_label(node->labels[request->method]);
+
     err = http_parse_uriparams(request->params, request->uri.path, route->path);
 
     if (err.code)
@@ -684,13 +974,23 @@ capy_err httprouter_handle_request(capy_arena *arena, httprouter *router, capy_h
 
     err = http_parse_query(request->params, request->uri.query);
 
-    if (err.code)
+    if (err.code == EINVAL)
+    {
+        response->status = CAPY_HTTP_BAD_REQUEST;
+        return httpresp_write_status(response);
+    }
+    else if (err.code)
     {
         return ErrWrap(err, "Failed to parse query params");
     }
 
+    struct scratchstate scratch;
+    scratch_save(&scratch);
+
     err = route->handler(arena, request, response);
 
+    scratch_restore(&scratch);
+
     if (err.code)
     {
         response->status = CAPY_HTTP_INTERNAL_SERVER_ERROR;
@@ -766,6 +1066,9 @@ static capy_err httpconn_parse_reqline(httpconn *conn)
         return ErrWrap(err, "Failed to parse request line");
     }
 
+    Probe(http_request_start, conn->conn_id, http_method_cstr[conn->request.method],
+          conn->request.uri.path.data, conn->request.uri.path.size);
+
     httpconn_consume_line(conn);
     conn->state = STATE_PARSE_HEADERS;
 
@@ -820,7 +1123,11 @@ static capy_err httpconn_parse_headers(httpconn *conn)
         return ErrWrap(err, "Failed to validate request");
     }
 
-    if (conn->request.content_length)
+    if ((conn->request.content_length || conn->request.chunked) && !httpconn_admit_content(conn))
+    {
+        conn->state = STATE_UNAVAILABLE;
+    }
+    else if (conn->request.content_length)
     {
         conn->chunk_size = conn->request.content_length;
         conn->state = STATE_PARSE_CONTENT;
@@ -923,7 +1230,12 @@ static capy_err httpconn_parse_chunkdata(httpconn *conn)
     {
         err = capy_buffer_write_bytes(conn->content_buffer, msg_size, conn->line_buffer->data);
 
-        if (err.code)
+        if (httpconn_budget_exhausted(conn, err))
+        {
+            conn->state = STATE_UNAVAILABLE;
+            return Ok;
+        }
+        else if (err.code)
         {
             return ErrWrap(err, "Failed to read chunk data");
         }
@@ -947,7 +1259,12 @@ static capy_err httpconn_parse_chunkdata(httpconn *conn)
 
     err = capy_buffer_write_bytes(conn->content_buffer, conn->chunk_size, conn->line_buffer->data);
 
-    if (err.code)
+    if (httpconn_budget_exhausted(conn, err))
+    {
+        conn->state = STATE_UNAVAILABLE;
+        return Ok;
+    }
+    else if (err.code)
     {
         return ErrWrap(err, "Failed to read chunk data");
     }
@@ -968,7 +1285,12 @@ static capy_err httpconn_parse_reqbody(httpconn *conn)
     {
         err = capy_buffer_write_bytes(conn->content_buffer, message_size, conn->line_buffer->data);
 
-        if (err.code)
+        if (httpconn_budget_exhausted(conn, err))
+        {
+            conn->state = STATE_UNAVAILABLE;
+            return Ok;
+        }
+        else if (err.code)
         {
             return ErrWrap(err, "Failed to read content data");
         }
@@ -984,7 +1306,12 @@ static capy_err httpconn_parse_reqbody(httpconn *conn)
 
     err = capy_buffer_write_bytes(conn->content_buffer, conn->chunk_size, conn->line_buffer->data);
 
-    if (err.code)
+    if (httpconn_budget_exhausted(conn, err))
+    {
+        conn->state = STATE_UNAVAILABLE;
+        return Ok;
+    }
+    else if (err.code)
     {
         return ErrWrap(err, "Failed to read content data");
     }
@@ -995,18 +1322,28 @@ static capy_err httpconn_parse_reqbody(httpconn *conn)
     return Ok;
 }
 
-static capy_err httpconn_prepare_badrequest(httpconn *conn)
+static capy_err httpconn_prepare_failure(httpconn *conn, capy_httpstatus status)
 {
     capy_err err;
 
     conn->request.close = true;
-    conn->response.status = CAPY_HTTP_BAD_REQUEST;
+    conn->response.status = status;
+
+    if (status == CAPY_HTTP_SERVICE_UNAVAILABLE)
+    {
+        err = capy_strkvnmap_set(conn->response.headers, Str("Retry-After"), Str("1"));
+
+        if (err.code)
+        {
+            return ErrWrap(err, "Failed to generate SERVICE_UNAVAILABLE");
+        }
+    }
 
     err = httpresp_write_status(&conn->response);
 
     if (err.code)
     {
-        return ErrWrap(err, "Failed to generate BAD_REQUEST");
+        return ErrWrap(err, "Failed to generate failure response");
     }
 
     err = http_write_response(conn->response_buffer, &conn->response, true);
@@ -1016,9 +1353,58 @@ static capy_err httpconn_prepare_badrequest(httpconn *conn)
         return ErrWrap(err, "Failed to write to response_buffer");
     }
 
+    conn->response_size = conn->response_buffer->size;
+    conn->state = STATE_WRITE_RESPONSE;
     return Ok;
 }
 
+// Delays request bodies while the memory budget is under pressure. Returns `false` if the body should be
+// rejected, because the pressure didn't go away or the body can't fit in what is left of the budget.
+static bool httpconn_admit_content(httpconn *conn)
+{
+    if (conn->budget == NULL)
+    {
+        return true;
+    }
+
+    if (capy_membudget_pressure(conn->budget) && httpserver_trim_idle(conn->server).code)
+    {
+        return false;
+    }
+
+    // content buffers double as they grow, a body can take up to twice its size
+    if (conn->request.content_length > capy_membudget_available(conn->budget) / 2)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < HTTP_BUDGET_RETRIES; i++)
+    {
+        if (!capy_membudget_pressure(conn->budget))
+        {
+            return true;
+        }
+
+        if (capy_sleep(HTTP_BUDGET_DELAY).code)
+        {
+            return false;
+        }
+    }
+
+    return !capy_membudget_pressure(conn->budget);
+}
+
+// Returns `true` if `err` is an allocation failure caused by the memory budget, not the connection limit.
+static bool httpconn_budget_exhausted(httpconn *conn, capy_err err)
+{
+    if (err.code != ENOMEM || conn->budget == NULL)
+    {
+        return false;
+    }
+
+    return capy_membudget_available(conn->budget) < capy_arena_available(conn->arena);
+}
+
 static capy_err httpconn_route_request(httpconn *conn)
 {
     capy_err err = capy_buffer_write_null(conn->content_buffer);
@@ -1030,7 +1416,18 @@ static capy_err httpconn_route_request(httpconn *conn)
 
     conn->request.content = capy_string_bytes(conn->content_buffer->size, conn->content_buffer->data);
 
-    err = httprouter_handle_request(conn->arena, conn->router, &conn->request, &conn->response);
+    capy_httpserveropt *options = conn->options;
+
+    if (options->metrics_path != NULL && conn->request.method == CAPY_HTTP_GET &&
+        capy_string_eq(conn->request.uri.path, capy_string_cstr(options->metrics_path)))
+    {
+        conn->route = Cast(size_t, options->routes_size) + 1;
+        err = httpserver_write_metrics(conn->server, conn->arena, &conn->response);
+    }
+    else
+    {
+        err = httprouter_handle_request(conn->arena, conn->router, &conn->request, &conn->response, &conn->route);
+    }
 
     if (err.code)
     {
@@ -1044,6 +1441,7 @@ static capy_err httpconn_route_request(httpconn *conn)
         return ErrWrap(err, "Failed to write to response_buffer");
     }
 
+    conn->response_size = conn->response_buffer->size;
     conn->state = STATE_WRITE_RESPONSE;
     return Ok;
 }
@@ -1057,10 +1455,29 @@ static capy_err httpconn_reset(httpconn *conn)
         return err;
     }
 
+    // idle connections give back the capacity cached by their arena policy, including those already waiting
+    // for their next request
+    if (conn->budget != NULL && capy_membudget_pressure(conn->budget))
+    {
+        err = capy_arena_trim(conn->arena);
+
+        if (!err.code)
+        {
+            err = httpserver_trim_idle(conn->server);
+        }
+
+        if (err.code)
+        {
+            return err;
+        }
+    }
+
     conn->line_buffer->size = 0;
     conn->line_cursor = 2;
     conn->after_read = STATE_UNKNOWN;
 
+    capy_task_label(NULL);
+
     conn->request = (capy_httpreq){
         .headers = capy_strkvnmap_init(conn->arena, 16),
         .trailers = capy_strkvnmap_init(conn->arena, 4),
@@ -1074,132 +1491,425 @@ static capy_err httpconn_reset(httpconn *conn)
     };
 
     conn->content_buffer = capy_buffer_init(conn->arena, 256);
-    conn->response_buffer = capy_buffer_init(conn->arena, 512);
+    conn->response_buffer = capy_segbuf_init(conn->arena, 512);
 
     conn->mem_headers = 0;
     conn->mem_content = 0;
     conn->mem_trailers = 0;
     conn->mem_response = 0;
 
+    // waiting for the first bytes of the next request isn't part of it
+    conn->idle = true;
+    httpconn_idle_add(conn);
+    conn->responded = false;
+    conn->response_size = 0;
+    conn->route = 0;
+    conn->queued = -1;
+    memset(conn->phases, 0, sizeof(conn->phases));
+
     conn->state = STATE_PARSE_REQLINE;
 
     return Ok;
 }
 
-static void httpconn_trace(httpconn *conn)
+static void httpinstrument_init(void)
 {
-    struct timespec timestamp = capy_now();
-
-    int64_t elapsed = capy_timespec_diff(timestamp, conn->timestamp);
-    const char *elapsed_unit;
-    capy_normalize_ns(&elapsed, &elapsed_unit);
-
-    conn->timestamp = timestamp;
-
-    size_t mem_total = capy_arena_used(conn->arena);
-    size_t to_read = (conn->line_buffer) ? conn->line_buffer->size : 0;
-    size_t to_write = (conn->response_buffer) ? conn->response_buffer->size : 0;
-
-    LogDbg("worker: %-21s | MH:%-8zu MC:%-8zu MT:%-8zu MR:%-8zu MA:%-8zu RS:%-8zu WS:%-8zu | %3" PRIi64 " %-2s | %s %d",
-           httpconnstate_cstr[conn->state],
-           conn->mem_headers, conn->mem_content, conn->mem_trailers, conn->mem_response, mem_total,
-           to_read, to_write, elapsed, elapsed_unit,
-           capy_tcp_addr(conn->tcp), capy_tcp_port(conn->tcp));
+    if (mtx_init(&httpinstrument.lock, mtx_plain) != thrd_success)
+    {
+        httpinstrument.err = ErrFmt(ENOMEM, "Failed to initialize instrumentation lock");
+    }
 }
 
-static capy_err httpconn_write_response(httpconn *conn)
+// Returns the histograms of the calling thread, registering them on first use, or NULL if they can't be
+// allocated.
+static httpstats *httpstats_get(void)
 {
-    capy_err err;
-
-    size_t old_size = conn->response_buffer->size;
-
-    err = capy_tcp_send(conn->tcp, conn->response_buffer, conn->options->inactivity_timeout);
-
-    if (err.code)
+    if (http_stats != NULL)
     {
-        if (err.code == ECONNRESET || err.code == EPROTO)
-        {
-            conn->state = STATE_CLOSE;
-            return Ok;
-        }
-        else
-        {
-            return ErrWrap(err, "Failed to write response");
-        }
+        return http_stats;
     }
 
-    if (conn->response_buffer->size == old_size)
-    {
-        conn->state = STATE_CLOSE;
-        return Ok;
-    }
+    call_once(&httpinstrument.once, httpinstrument_init);
 
-    if (conn->response_buffer->size > 0)
+    if (httpinstrument.err.code)
     {
-        conn->state = STATE_WRITE_RESPONSE;
+        return NULL;
     }
-    else if (conn->request.close || capy_canceled())
+
+    capy_arena *arena = capy_arena_init(0, MiB(2));
+
+    if (arena == NULL)
     {
-        capy_tcp_shutdown(conn->tcp);
-        conn->state = STATE_CLOSE;
+        return NULL;
     }
-    else
+
+    httpstats *stats = Make(arena, httpstats, 1);
+
+    if (stats == NULL)
     {
-        conn->state = STATE_RESET;
+        capy_arena_destroy(arena);
+        return NULL;
     }
 
-    return Ok;
+    stats->arena = arena;
+
+    mtx_lock(&httpinstrument.lock);
+    stats->next = httpinstrument.stats;
+    httpinstrument.stats = stats;
+    mtx_unlock(&httpinstrument.lock);
+
+    http_stats = stats;
+
+    return stats;
 }
 
-static capy_err httpconn_read_request(httpconn *conn)
+// Records `value` in the time or memory histogram of `state` of the calling thread.
+static void httpstats_record(bool memory, httpconnstate state, uint64_t value)
 {
-    capy_err err;
-
-    size_t bytes_wanted = conn->line_buffer->capacity - conn->line_buffer->size;
+    httpstats *stats = httpstats_get();
 
-    if (bytes_wanted == 0)
+    if (stats == NULL)
     {
-        conn->state = STATE_BAD_REQUEST;
-        return Ok;
+        return;
     }
 
-    size_t old_size = conn->line_buffer->size;
-
-    err = capy_tcp_recv(conn->tcp, conn->line_buffer, conn->options->inactivity_timeout);
+    _Atomic(capy_histogram *) *slot = (memory) ? &stats->memory[state] : &stats->time[state];
+    capy_histogram *histogram = atomic_load_explicit(slot, memory_order_relaxed);
 
-    if (err.code)
+    if (histogram == NULL)
     {
-        if (err.code == ECONNRESET || err.code == EPROTO)
-        {
-            conn->state = STATE_CLOSE;
-            return Ok;
-        }
-        else
+        histogram = capy_histogram_init(stats->arena);
+
+        if (histogram == NULL)
         {
-            return ErrWrap(err, "Failed to read socket");
+            return;
         }
-    }
 
-    if (conn->line_buffer->size == old_size)
-    {
-        conn->state = STATE_CLOSE;
-        return Ok;
+        // aggregations see the histogram zero-initialized
+        atomic_store_explicit(slot, histogram, memory_order_release);
     }
 
-    conn->state = conn->after_read;
-    return Ok;
+    capy_histogram_record(histogram, value);
 }
 
-static capy_err httpconn_run(httpconn *conn)
+// Charges the time spent since the last call to the phase of the state that was running, and to its
+// histogram if `instrumented`. Returns it.
+static int64_t httpconn_clock(httpconn *conn, bool instrumented)
 {
-    for (;;)
-    {
+    struct timespec timestamp = capy_now();
+    int64_t elapsed = capy_timespec_diff(timestamp, conn->timestamp);
+
+    conn->timestamp = timestamp;
+
+    // waiting for a request to start isn't charged to reads
+    bool waited = conn->clocked == STATE_READ_REQUEST && conn->idle;
+
+    if (instrumented && conn->clocked != STATE_UNKNOWN && !waited)
+    {
+        httpstats_record(false, conn->clocked, Cast(uint64_t, (elapsed > 0) ? elapsed : 0));
+    }
+
+    switch (conn->clocked)
+    {
+        case STATE_READ_REQUEST:
+        {
+            if (conn->idle)
+            {
+                conn->idle = false;
+                conn->started = timestamp;
+            }
+            else
+            {
+                conn->phases[PHASE_READ] += elapsed;
+            }
+        }
+        break;
+
+        case STATE_PARSE_REQLINE:
+        case STATE_PARSE_HEADERS:
+        case STATE_PARSE_CONTENT:
+        case STATE_PARSE_CHUNKSIZE:
+        case STATE_PARSE_CHUNKDATA:
+        case STATE_PARSE_TRAILERS:
+        {
+            conn->phases[PHASE_PARSE] += elapsed;
+        }
+        break;
+
+        case STATE_ROUTE_REQUEST:
+        case STATE_BAD_REQUEST:
+        case STATE_UNAVAILABLE:
+        {
+            conn->phases[PHASE_HANDLER] += elapsed;
+        }
+        break;
+
+        case STATE_WRITE_RESPONSE:
+        {
+            conn->phases[PHASE_WRITE] += elapsed;
+        }
+        break;
+
+        default:
+            break;
+    }
+
+    conn->clocked = conn->state;
+
+    return elapsed;
+}
+
+// Counts a request whose response was fully written, and the time taken to serve it, in its route metrics.
+static void httpconn_count(httpconn *conn, int64_t total)
+{
+    httpmetrics *metrics = conn->server->metrics;
+
+    if (metrics == NULL)
+    {
+        return;
+    }
+
+    httproutemetrics *route = metrics->routes + conn->route;
+    int status = conn->response.status;
+
+    size_t class = (status >= 100 && status < 600) ? Cast(size_t, status / 100) : 0;
+
+    counter_update(&route->responses[class], 1);
+    capy_histogram_record(route->time[class], Cast(uint64_t, (total > 0) ? total : 0));
+
+    uint64_t stalled = capy_task_stalled();
+
+    if (stalled)
+    {
+        counter_update(&route->stalls, 1);
+        capy_histogram_record(route->stalled, stalled);
+    }
+
+    if (conn->queued >= 0)
+    {
+        capy_histogram_record(route->queued, Cast(uint64_t, conn->queued));
+    }
+}
+
+// Updates the gauges of the worker with the state of the connection, or removes it from them when `closed`.
+static void httpconn_gauge(httpconn *conn, bool closed)
+{
+    httpmetrics *metrics = conn->server->metrics;
+
+    if (metrics == NULL)
+    {
+        return;
+    }
+
+    bool active = !closed && !conn->idle;
+
+    if (active != conn->active)
+    {
+        counter_update(&metrics->active, (active) ? 1 : -1);
+        conn->active = active;
+    }
+
+    size_t memory = (closed) ? 0 : capy_arena_used(conn->arena);
+    counter_update(&metrics->memory, Cast(int64_t, memory) - Cast(int64_t, conn->memory));
+    conn->memory = memory;
+
+    // connections are counted once they get an identifier
+    if (closed && conn->conn_id)
+    {
+        counter_update(&metrics->connections, -1);
+    }
+}
+
+// Logs a request whose response was fully written, if it is sampled, failed or was slow.
+static void httpconn_access_log(httpconn *conn, int64_t total)
+{
+    capy_httpserveropt *options = conn->options;
+
+    if (options->access_log_sample == 0)
+    {
+        return;
+    }
+
+    bool slow = options->access_log_slow && total >= Cast(int64_t, MillisecondsNano(options->access_log_slow));
+    bool failed = conn->response.status >= 500;
+
+    if (++http_access_count % options->access_log_sample != 0 && !slow && !failed)
+    {
+        return;
+    }
+
+    capy_string path = (conn->request.uri.path.size) ? conn->request.uri.path : Str("-");
+
+    LogInf("access: conn=%zu method=%s path=%.*s status=%d bytes_in=%zu bytes_out=%zu queue_us=%" PRIi64
+           " read_us=%" PRIi64 " parse_us=%" PRIi64 " handler_us=%" PRIi64 " write_us=%" PRIi64 " total_us=%" PRIi64,
+           conn->conn_id, http_method_cstr[conn->request.method], Cast(int, path.size), path.data,
+           conn->response.status, conn->request.content.size, conn->response_size,
+           (conn->queued >= 0) ? conn->queued / 1000 : -1,
+           conn->phases[PHASE_READ] / 1000, conn->phases[PHASE_PARSE] / 1000,
+           conn->phases[PHASE_HANDLER] / 1000, conn->phases[PHASE_WRITE] / 1000, total / 1000);
+}
+
+static void httpconn_trace(httpconn *conn, int64_t elapsed)
+{
+    const char *elapsed_unit;
+    capy_normalize_ns(&elapsed, &elapsed_unit);
+
+    size_t mem_total = capy_arena_used(conn->arena);
+    size_t to_read = (conn->line_buffer) ? conn->line_buffer->size : 0;
+    size_t to_write = (conn->response_buffer) ? conn->response_buffer->size : 0;
+
+    LogDbg("worker: %-21s | MH:%-8zu MC:%-8zu MT:%-8zu MR:%-8zu MA:%-8zu RS:%-8zu WS:%-8zu | %3" PRIi64 " %-2s | %s %d",
+           httpconnstate_cstr[conn->state],
+           conn->mem_headers, conn->mem_content, conn->mem_trailers, conn->mem_response, mem_total,
+           to_read, to_write, elapsed, elapsed_unit,
+           capy_tcp_addr(conn->tcp), capy_tcp_port(conn->tcp));
+}
+
+static capy_err httpconn_write_response(httpconn *conn)
+{
+    capy_err err;
+
+    size_t old_size = conn->response_buffer->size;
+
+    err = capy_tcp_sendv(conn->tcp, conn->response_buffer, conn->options->inactivity_timeout);
+
+    if (err.code)
+    {
+        if (err.code == ECONNRESET || err.code == EPROTO)
+        {
+            conn->state = STATE_CLOSE;
+            return Ok;
+        }
+        else
+        {
+            return ErrWrap(err, "Failed to write response");
+        }
+    }
+
+    if (conn->response_buffer->size == old_size)
+    {
+        conn->state = STATE_CLOSE;
+        return Ok;
+    }
+
+    if (conn->response_buffer->size > 0)
+    {
+        conn->state = STATE_WRITE_RESPONSE;
+    }
+    else if (conn->request.close || capy_canceled())
+    {
+        capy_tcp_shutdown(conn->tcp);
+        conn->responded = true;
+        conn->state = STATE_CLOSE;
+    }
+    else
+    {
+        conn->responded = true;
+        conn->state = STATE_RESET;
+    }
+
+    if (conn->responded)
+    {
+        Probe(http_request_end, conn->conn_id, Cast(int, conn->response.status), conn->response_size);
+    }
+
+    return Ok;
+}
+
+static capy_err httpconn_read_request(httpconn *conn)
+{
+    capy_err err;
+
+    size_t bytes_wanted = conn->line_buffer->capacity - conn->line_buffer->size;
+
+    if (bytes_wanted == 0)
+    {
+        conn->state = STATE_BAD_REQUEST;
+        return Ok;
+    }
+
+    size_t old_size = conn->line_buffer->size;
+
+    err = capy_tcp_recv(conn->tcp, conn->line_buffer, conn->options->inactivity_timeout);
+
+    if (err.code)
+    {
+        if (err.code == ECONNRESET || err.code == EPROTO)
+        {
+            conn->state = STATE_CLOSE;
+            return Ok;
+        }
+        else
+        {
+            return ErrWrap(err, "Failed to read socket");
+        }
+    }
+
+    if (conn->line_buffer->size == old_size)
+    {
+        conn->state = STATE_CLOSE;
+        return Ok;
+    }
+
+    // the first read of a request tells how long it waited in the kernel, pipelined requests are never read
+    if (conn->idle)
+    {
+        conn->queued = capy_tcp_rx_delay(conn->tcp);
+        httpconn_idle_remove(conn);
+    }
+
+    conn->state = conn->after_read;
+    return Ok;
+}
+
+static capy_err httpconn_run(httpconn *conn)
+{
+    for (;;)
+    {
         capy_err err = Ok;
 
-        httpconn_trace(conn);
+        bool instrumented = HTTP_INSTRUMENT && atomic_load_explicit(&http_instrumented, memory_order_relaxed);
+        bool traced = HTTP_INSTRUMENT && capy_logger_enabled(CAPY_LOG_DEBUG);
+        bool metered = conn->server->metrics != NULL;
+
+        if (instrumented || traced || metered || conn->options->access_log_sample)
+        {
+            int64_t elapsed = httpconn_clock(conn, instrumented);
+
+            if (conn->responded)
+            {
+                conn->responded = false;
+
+                // `started` is only set once the first bytes of a request are read
+                int64_t total = capy_timespec_diff(conn->timestamp, (conn->idle) ? conn->created : conn->started);
+
+                httpconn_count(conn, total);
+                httpconn_access_log(conn, total);
+            }
+
+            if (metered)
+            {
+                httpconn_gauge(conn, false);
+            }
+
+            if (traced)
+            {
+                httpconn_trace(conn, elapsed);
+            }
+        }
+        else
+        {
+            // states that run unobserved aren't charged once observation is enabled again
+            conn->clocked = STATE_UNKNOWN;
+        }
 
+        httpconnstate state = conn->state;
         ssize_t begin = (ssize_t)capy_arena_used(conn->arena);
 
+        Probe(http_state, conn->conn_id, Cast(int, state));
+
+        capy_allocprof_phase(httpconnstate_allocphase[state]);
+
         switch (conn->state)
         {
             case STATE_RESET:
@@ -1249,106 +1959,517 @@ static capy_err httpconn_run(httpconn *conn)
             }
             break;
 
-            case STATE_PARSE_TRAILERS:
+            case STATE_PARSE_TRAILERS:
+            {
+                err = httpconn_parse_trailers(conn);
+                conn->mem_trailers += (ssize_t)capy_arena_used(conn->arena) - begin;
+            }
+            break;
+
+            case STATE_ROUTE_REQUEST:
+            {
+                err = httpconn_route_request(conn);
+                conn->mem_response += (ssize_t)capy_arena_used(conn->arena) - begin;
+            }
+            break;
+
+            case STATE_BAD_REQUEST:
+            {
+                err = httpconn_prepare_failure(conn, CAPY_HTTP_BAD_REQUEST);
+                conn->mem_response += (ssize_t)capy_arena_used(conn->arena) - begin;
+            }
+            break;
+
+            case STATE_UNAVAILABLE:
+            {
+                err = httpconn_prepare_failure(conn, CAPY_HTTP_SERVICE_UNAVAILABLE);
+                conn->mem_response += (ssize_t)capy_arena_used(conn->arena) - begin;
+            }
+            break;
+
+            case STATE_WRITE_RESPONSE:
+            {
+                err = httpconn_write_response(conn);
+            }
+            break;
+
+            case STATE_CLOSE:
+            {
+                return Ok;
+            }
+
+            default:
+            {
+                capy_assert(false);
+            }
+        }
+
+        capy_allocprof_phase(NULL);
+
+        if (instrumented)
+        {
+            ssize_t allocated = (ssize_t)capy_arena_used(conn->arena) - begin;
+            httpstats_record(true, state, Cast(uint64_t, (allocated > 0) ? allocated : 0));
+        }
+
+        if (err.code)
+        {
+            return err;
+        }
+    }
+}
+
+static capy_err httpconn_destroy(httpconn *conn)
+{
+    httpconn_idle_remove(conn);
+    httpconn_gauge(conn, true);
+    capy_tcp_close(conn->tcp);
+    capy_arena_destroy(conn->arena);
+
+    // connections run on the worker that accepted them, so they go back to the cache they came from
+    capy_poolcache_free(&conn->server->conns, conn);
+    return Ok;
+}
+
+// Lists a connection waiting for its next request in its worker, so its arena can be trimmed under pressure.
+static void httpconn_idle_add(httpconn *conn)
+{
+    if (conn->idle_listed || conn->server == NULL)
+    {
+        return;
+    }
+
+    conn->idle_prev = NULL;
+    conn->idle_next = conn->server->idle;
+
+    if (conn->server->idle != NULL)
+    {
+        conn->server->idle->idle_prev = conn;
+    }
+
+    conn->server->idle = conn;
+    conn->idle_listed = true;
+}
+
+static void httpconn_idle_remove(httpconn *conn)
+{
+    if (!conn->idle_listed)
+    {
+        return;
+    }
+
+    if (conn->idle_prev != NULL)
+    {
+        conn->idle_prev->idle_next = conn->idle_next;
+    }
+    else
+    {
+        conn->server->idle = conn->idle_next;
+    }
+
+    if (conn->idle_next != NULL)
+    {
+        conn->idle_next->idle_prev = conn->idle_prev;
+    }
+
+    conn->idle_listed = false;
+}
+
+// Decommits the capacity cached by the arenas of the worker's idle connections. They are parked until their
+// next request arrives, and the worker's tasks share its thread, so their arenas aren't in use.
+static capy_err httpserver_trim_idle(httpserver *server)
+{
+    for (httpconn *conn = server->idle; conn != NULL; conn = conn->idle_next)
+    {
+        capy_err err = capy_arena_trim(conn->arena);
+
+        if (err.code)
+        {
+            return err;
+        }
+    }
+
+    return Ok;
+}
+
+static void httpconn_run_task(void *data)
+{
+    capy_err err = httpconn_run(data);
+
+    if (err.code)
+    {
+        LogErr("While processing request: %s", err.msg);
+    }
+}
+
+static void httpconn_clean_task(void *data)
+{
+    httpconn_destroy(data);
+}
+
+static capy_httpserveropt httpserveropt_default(capy_httpserveropt options)
+{
+    if (!options.workers)
+    {
+        options.workers = capy_ncpus();
+    }
+
+    if (options.host == NULL)
+    {
+        options.host = "127.0.0.1";
+    }
+
+    if (options.port == NULL)
+    {
+        options.port = "8080";
+    }
+
+    if (!options.inactivity_timeout)
+    {
+        options.inactivity_timeout = Seconds(30);
+    }
+
+    if (!options.line_buffer_size)
+    {
+        options.line_buffer_size = KiB(8);
+    }
+
+    if (!options.mem_connection_max)
+    {
+        options.mem_connection_max = MiB(2);
+    }
+
+    return options;
+}
+
+static httpmetrics *httpmetrics_init(capy_arena *arena, size_t routes)
+{
+    httpmetrics *metrics = Make(arena, httpmetrics, 1);
+
+    if (metrics == NULL)
+    {
+        return NULL;
+    }
+
+    metrics->routes = Make(arena, httproutemetrics, routes);
+
+    if (metrics->routes == NULL)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < routes; i++)
+    {
+        for (size_t c = 0; c < ArrLen(metrics->routes[i].time); c++)
+        {
+            metrics->routes[i].time[c] = capy_histogram_init(arena);
+
+            if (metrics->routes[i].time[c] == NULL)
+            {
+                return NULL;
+            }
+        }
+
+        metrics->routes[i].stalled = capy_histogram_init(arena);
+        metrics->routes[i].queued = capy_histogram_init(arena);
+
+        if (metrics->routes[i].stalled == NULL || metrics->routes[i].queued == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    return metrics;
+}
+
+// Writes the label of `route`, escaped as a Prometheus label value.
+static capy_err httpmetrics_write_label(capy_buffer *buffer, capy_httpserveropt *options, size_t route)
+{
+    capy_err err;
+
+    size_t routes = Cast(size_t, options->routes_size);
+    capy_string path;
+
+    if (route == 0)
+    {
+        return capy_buffer_write_cstr(buffer, "-");
+    }
+    else if (route > routes)
+    {
+        err = capy_buffer_write_cstr(buffer, "GET ");
+        path = capy_string_cstr(options->metrics_path);
+    }
+    else
+    {
+        err = capy_buffer_write_fmt(buffer, 0, "%s ", http_method_cstr[options->routes[route - 1].method]);
+        path = options->routes[route - 1].path;
+    }
+
+    for (size_t i = 0; i < path.size && !err.code; i++)
+    {
+        char c = path.data[i];
+
+        if (c == '\\' || c == '"')
+        {
+            err = capy_buffer_write_bytes(buffer, 1, "\\");
+        }
+
+        if (!err.code)
+        {
+            err = (c == '\n') ? capy_buffer_write_cstr(buffer, "\\n") : capy_buffer_write_bytes(buffer, 1, &c);
+        }
+    }
+
+    return err;
+}
+
+// Writes the metrics of every worker of the server, and the counters of the process, in the Prometheus text
+// format. Counters are summed here, so serving requests never synchronizes workers.
+static capy_err httpserver_write_metrics(httpserver *server, capy_arena *arena, capy_httpresp *response)
+{
+    capy_err err;
+
+    capy_httpserveropt *options = server->options;
+    size_t routes = Cast(size_t, options->routes_size) + 2;
+
+    httproutemetrics *totals = Make(arena, httproutemetrics, routes);
+    capy_string *labels = Make(arena, capy_string, routes);
+
+    if (totals == NULL || labels == NULL)
+    {
+        return ErrStd(ENOMEM);
+    }
+
+    for (size_t i = 0; i < routes; i++)
+    {
+        for (size_t c = 0; c < ArrLen(totals[i].time); c++)
+        {
+            totals[i].time[c] = capy_histogram_init(arena);
+
+            if (totals[i].time[c] == NULL)
+            {
+                return ErrStd(ENOMEM);
+            }
+        }
+
+        totals[i].stalled = capy_histogram_init(arena);
+        totals[i].queued = capy_histogram_init(arena);
+
+        if (totals[i].stalled == NULL || totals[i].queued == NULL)
+        {
+            return ErrStd(ENOMEM);
+        }
+    }
+
+    int64_t connections = 0;
+    int64_t active = 0;
+    int64_t memory = 0;
+    size_t committed = 0;
+
+    for (size_t w = 0; w < options->workers; w++)
+    {
+        httpserver *worker = server->workers + w;
+
+        connections += atomic_load_explicit(&worker->metrics->connections, memory_order_relaxed);
+        active += atomic_load_explicit(&worker->metrics->active, memory_order_relaxed);
+        memory += atomic_load_explicit(&worker->metrics->memory, memory_order_relaxed);
+        committed += capy_membudget_stats(worker->budget).used;
+
+        for (size_t i = 0; i < routes; i++)
+        {
+            httproutemetrics *route = worker->metrics->routes + i;
+
+            for (size_t c = 0; c < ArrLen(route->responses); c++)
             {
-                err = httpconn_parse_trailers(conn);
-                conn->mem_trailers += (ssize_t)capy_arena_used(conn->arena) - begin;
+                totals[i].responses[c] += atomic_load_explicit(&route->responses[c], memory_order_relaxed);
             }
-            break;
 
-            case STATE_ROUTE_REQUEST:
-            {
-                err = httpconn_route_request(conn);
-                conn->mem_response += (ssize_t)capy_arena_used(conn->arena) - begin;
-            }
-            break;
+            totals[i].stalls += atomic_load_explicit(&route->stalls, memory_order_relaxed);
 
-            case STATE_BAD_REQUEST:
+            for (size_t c = 0; c < ArrLen(route->time); c++)
             {
-                err = httpconn_prepare_badrequest(conn);
-                conn->mem_response += (ssize_t)capy_arena_used(conn->arena) - begin;
+                capy_histogram_merge(totals[i].time[c], route->time[c]);
             }
-            break;
 
-            case STATE_WRITE_RESPONSE:
-            {
-                err = httpconn_write_response(conn);
-            }
-            break;
+            capy_histogram_merge(totals[i].stalled, route->stalled);
+            capy_histogram_merge(totals[i].queued, route->queued);
+        }
+    }
 
-            case STATE_CLOSE:
+    capy_buffer *body = response->body;
+
+    err = capy_buffer_write_cstr(body, "# TYPE capy_http_responses_total counter\n");
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    for (size_t i = 0; i < routes; i++)
+    {
+        capy_buffer *label = capy_buffer_init(arena, 64);
+
+        if (label == NULL)
+        {
+            return ErrStd(ENOMEM);
+        }
+
+        err = httpmetrics_write_label(label, options, i);
+
+        if (err.code)
+        {
+            return err;
+        }
+
+        labels[i] = capy_string_bytes(label->size, label->data);
+
+        for (size_t c = 0; c < ArrLen(totals[i].responses); c++)
+        {
+            if (totals[i].responses[c] == 0)
             {
-                return Ok;
+                continue;
             }
 
-            default:
+            err = capy_buffer_write_fmt(body, 0, "capy_http_responses_total{route=\"%.*s\",code=\"%s\"} %" PRIi64 "\n",
+                                        Cast(int, labels[i].size), labels[i].data,
+                                        http_status_class_cstr[c], totals[i].responses[c]);
+
+            if (err.code)
             {
-                capy_assert(false);
+                return err;
             }
         }
+    }
 
-        if (err.code)
+    err = capy_buffer_write_cstr(body, "# TYPE capy_http_response_seconds histogram\n");
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    for (size_t i = 0; i < routes && !err.code; i++)
+    {
+        for (size_t c = 0; c < ArrLen(totals[i].time) && !err.code; c++)
         {
-            return err;
+            err = httpmetrics_write_histogram(body, "capy_http_response_seconds", labels[i], http_status_class_cstr[c],
+                                              totals[i].time[c]);
         }
     }
-}
 
-static capy_err httpconn_destroy(httpconn *conn)
-{
-    capy_tcp_close(conn->tcp);
-    capy_arena_destroy(conn->arena);
-    return Ok;
-}
+    if (!err.code)
+    {
+        err = capy_buffer_write_cstr(body, "# TYPE capy_http_stalls_total counter\n");
+    }
 
-static void httpconn_run_task(void *data)
-{
-    capy_err err = httpconn_run(data);
+    for (size_t i = 0; i < routes && !err.code; i++)
+    {
+        if (totals[i].stalls)
+        {
+            err = capy_buffer_write_fmt(body, 0, "capy_http_stalls_total{route=\"%.*s\"} %" PRIi64 "\n",
+                                        Cast(int, labels[i].size), labels[i].data, totals[i].stalls);
+        }
+    }
 
-    if (err.code)
+    if (!err.code)
     {
-        LogErr("While processing request: %s", err.msg);
+        err = capy_buffer_write_cstr(body, "# TYPE capy_http_stall_seconds histogram\n");
     }
-}
 
-static void httpconn_clean_task(void *data)
-{
-    httpconn_destroy(data);
-}
+    for (size_t i = 0; i < routes && !err.code; i++)
+    {
+        err = httpmetrics_write_histogram(body, "capy_http_stall_seconds", labels[i], NULL, totals[i].stalled);
+    }
 
-static capy_httpserveropt httpserveropt_default(capy_httpserveropt options)
-{
-    if (!options.workers)
+    if (!err.code)
     {
-        options.workers = capy_ncpus();
+        err = capy_buffer_write_cstr(body, "# TYPE capy_http_queue_seconds histogram\n");
     }
 
-    if (options.host == NULL)
+    for (size_t i = 0; i < routes && !err.code; i++)
     {
-        options.host = "127.0.0.1";
+        err = httpmetrics_write_histogram(body, "capy_http_queue_seconds", labels[i], NULL, totals[i].queued);
     }
 
-    if (options.port == NULL)
+    if (err.code)
     {
-        options.port = "8080";
+        return err;
     }
 
-    if (!options.inactivity_timeout)
+    int64_t counters[COUNTER_COUNT];
+    counter_totals(counters);
+
+    err = capy_buffer_write_fmt(body, 0,
+                                "# TYPE capy_http_connections gauge\n"
+                                "capy_http_connections{state=\"active\"} %" PRIi64 "\n"
+                                "capy_http_connections{state=\"idle\"} %" PRIi64 "\n"
+                                "# TYPE capy_http_memory_bytes gauge\n"
+                                "capy_http_memory_bytes{kind=\"used\"} %" PRIi64 "\n"
+                                "capy_http_memory_bytes{kind=\"committed\"} %zu\n"
+                                "# TYPE capy_arenas gauge\n"
+                                "capy_arenas %d\n"
+                                "# TYPE capy_scheduler_tasks gauge\n"
+                                "capy_scheduler_tasks{state=\"ready\"} %" PRIi64 "\n"
+                                "capy_scheduler_tasks{state=\"waiting\"} %" PRIi64 "\n"
+                                "# TYPE capy_epoll_wakeups_total counter\n"
+                                "capy_epoll_wakeups_total %" PRIi64 "\n"
+                                "# TYPE capy_tls_handshakes_total counter\n"
+                                "capy_tls_handshakes_total{result=\"ok\"} %" PRIi64 "\n"
+                                "capy_tls_handshakes_total{result=\"failed\"} %" PRIi64 "\n"
+                                "# TYPE capy_network_bytes_total counter\n"
+                                "capy_network_bytes_total{direction=\"in\"} %" PRIi64 "\n"
+                                "capy_network_bytes_total{direction=\"out\"} %" PRIi64 "\n",
+                                active, connections - active, memory, committed, atomic_load(&arena_allocs),
+                                counters[COUNTER_TASKS_READY], counters[COUNTER_TASKS_WAITING],
+                                counters[COUNTER_EPOLL_WAKEUPS],
+                                counters[COUNTER_TLS_HANDSHAKES], counters[COUNTER_TLS_FAILURES],
+                                counters[COUNTER_BYTES_IN], counters[COUNTER_BYTES_OUT]);
+
+    if (err.code)
     {
-        options.inactivity_timeout = Seconds(30);
+        return err;
     }
 
-    if (!options.line_buffer_size)
+    response->status = CAPY_HTTP_OK;
+    return capy_strkvnmap_set(response->headers, Str("Content-Type"), Str("text/plain; version=0.0.4"));
+}
+
+// Writes a histogram of ns as Prometheus histogram series in seconds, labelled by route and by status class
+// unless `code` is NULL, nothing if it's empty.
+static capy_err httpmetrics_write_histogram(capy_buffer *buffer, const char *name, capy_string label, const char *code, capy_histogram *histogram)
+{
+    capy_err err;
+
+    uint64_t count = capy_histogram_count(histogram);
+
+    if (count == 0)
     {
-        options.line_buffer_size = KiB(8);
+        return Ok;
     }
 
-    if (!options.mem_connection_max)
+    int size = Cast(int, label.size);
+    const char *sep = (code) ? "\",code=\"" : "";
+    code = (code) ? code : "";
+
+    for (size_t i = 0; i < ArrLen(httpmetrics_bounds); i++)
     {
-        options.mem_connection_max = MiB(2);
+        err = capy_buffer_write_fmt(buffer, 0, "%s_bucket{route=\"%.*s%s%s\",le=\"%s\"} %" PRIu64 "\n",
+                                    name, size, label.data, sep, code, httpmetrics_bounds[i].le,
+                                    capy_histogram_below(histogram, httpmetrics_bounds[i].ns));
+
+        if (err.code)
+        {
+            return err;
+        }
     }
 
-    return options;
+    return capy_buffer_write_fmt(buffer, 0,
+                                 "%s_bucket{route=\"%.*s%s%s\",le=\"+Inf\"} %" PRIu64 "\n"
+                                 "%s_sum{route=\"%.*s%s%s\"} %.9f\n"
+                                 "%s_count{route=\"%.*s%s%s\"} %" PRIu64 "\n",
+                                 name, size, label.data, sep, code, count,
+                                 name, size, label.data, sep, code, Cast(double, capy_histogram_sum(histogram)) / 1e9,
+                                 name, size, label.data, sep, code, count);
 }
 
 static capy_err httpserver_accept(httpserver *server)
@@ -1359,6 +2480,24 @@ static capy_err httpserver_accept(httpserver *server)
 
     for (;;)
     {
+        // accepting is throttled while connections already use most of the budget
+        while (capy_membudget_pressure(server->budget) && !capy_canceled())
+        {
+            err = httpserver_trim_idle(server);
+
+            if (err.code)
+            {
+                return err;
+            }
+
+            err = capy_sleep(HTTP_BUDGET_DELAY);
+
+            if (err.code)
+            {
+                return err;
+            }
+        }
+
         capy_arena *arena = capy_arena_init(server->options->line_buffer_size + KiB(4), server->options->mem_connection_max);
 
         if (arena == NULL)
@@ -1366,11 +2505,27 @@ static capy_err httpserver_accept(httpserver *server)
             return ErrStd(ENOMEM);
         }
 
-        conn = Make(arena, httpconn, 1);
+        // keep-alive connections alternating small and large requests would otherwise release and fault in
+        // memory on every request, it is only released on resets at least a second after the arena grew
+        capy_arena_set_policy(arena, (capy_arenapolicy){.decommit = CAPY_ARENA_MADV_FREE, .shrink_ratio = 8, .decay = Seconds(1)});
+
+        capy_arena_set_budget(arena, server->budget);
+
+        conn = capy_poolcache_alloc(&server->conns, true);
+
+        if (conn == NULL)
+        {
+            capy_arena_destroy(arena);
+            return ErrStd(ENOMEM);
+        }
 
         conn->arena = arena;
+        conn->budget = server->budget;
         conn->router = server->router;
         conn->options = server->options;
+        conn->server = server;
+        conn->idle = true;
+
         conn->line_buffer = capy_buffer_init(arena, server->options->line_buffer_size);
         conn->line_buffer->arena = NULL;
         conn->state = STATE_RESET;
@@ -1415,6 +2570,12 @@ static capy_err httpserver_accept(httpserver *server)
         }
 
         conn->arena_reset_mark = capy_arena_end(arena);
+        conn->conn_id = atomic_fetch_add(&http_conn_ids, 1) + 1;
+
+        if (server->metrics != NULL)
+        {
+            counter_update(&server->metrics->connections, 1);
+        }
         conn->created = capy_now();
         conn->timestamp = conn->created;
     }
@@ -1431,6 +2592,16 @@ static capy_err httpserver_serve(httpserver *server)
         return ErrWrap(err, "Failed to listen for connections");
     }
 
+    if (server->options->rx_timestamps)
+    {
+        err = capy_tcp_timestamping(server->tcp, true);
+
+        if (err.code)
+        {
+            return ErrWrap(err, "Failed to enable receive timestamps");
+        }
+    }
+
     LogDbg("worker: thread %zu listening for connections", capy_thread_id());
 
     err = httpserver_accept(server);
@@ -1443,6 +2614,7 @@ static capy_err httpserver_serve(httpserver *server)
 
     capy_tcp_close(server->tcp);
     capy_shutdown(Seconds(10));
+    capy_poolcache_flush(&server->conns);
 
     return err;
 }
@@ -1580,7 +2752,7 @@ static capy_httpversion http_parse_version(capy_string input)
     return CAPY_HTTP_INVALID_VERSION;
 }
 
-static capy_err http_write_response(capy_buffer *buffer, capy_httpresp *response, int close)
+static capy_err http_write_response(capy_segbuf *buffer, capy_httpresp *response, int close)
 {
     capy_err err;
 
@@ -1591,7 +2763,7 @@ static capy_err http_write_response(capy_buffer *buffer, capy_httpresp *response
     size_t content_length = (response->body) ? response->body->size : 0;
     const char *close_header = (close) ? "Connection: close\r\n" : "";
 
-    err = capy_buffer_write_fmt(buffer, 0,
+    err = capy_segbuf_write_fmt(buffer, 0,
                                 "HTTP/1.1 %d %s\r\n"
                                 "Date: %s, %02d %s %04d %02d:%02d:%02d GMT\r\n"
                                 "Content-Length: %zu\r\n"
@@ -1607,11 +2779,11 @@ static capy_err http_write_response(capy_buffer *buffer, capy_httpresp *response
         return err;
     }
 
-    for (size_t i = 0; i < response->headers->capacity; i++)
+    for (size_t i = 0; i < response->headers->size; i++)
     {
         for (capy_strkvn *header = capy_strkvnmap_at(response->headers, i); header != NULL; header = header->next)
         {
-            err = capy_buffer_write_fmt(buffer, 0, "%s: %s\r\n", header->key.data, header->value.data);
+            err = capy_segbuf_write_fmt(buffer, 0, "%s: %s\r\n", header->key.data, header->value.data);
 
             if (err.code)
             {
@@ -1620,14 +2792,15 @@ static capy_err http_write_response(capy_buffer *buffer, capy_httpresp *response
         }
     }
 
-    err = capy_buffer_write_bytes(buffer, 2, "\r\n");
+    err = capy_segbuf_write_bytes(buffer, 2, "\r\n");
 
     if (err.code)
     {
         return err;
     }
 
-    return capy_buffer_write_bytes(buffer, response->body->size, response->body->data);
+    // the body stays in the arena until the response is sent, it goes out with the head in one writev
+    return capy_segbuf_write_ref(buffer, content_length, (response->body) ? response->body->data : NULL);
 }
 
 static capy_err http_parse_reqline(capy_arena *arena, capy_httpreq *request, capy_string line)
@@ -1798,7 +2971,11 @@ static capy_err http_parse_query(capy_strkvnmap *fields, capy_string query)
 
         err = capy_strkvnmap_add(fields, name, value);
 
-        if (err.code)
+        if (err.code == EOVERFLOW)
+        {
+            return ErrStd(EINVAL);
+        }
+        else if (err.code)
         {
             return err;
         }
@@ -1811,6 +2988,8 @@ static capy_err http_validate_request(capy_arena *arena, capy_httpreq *request)
 {
     capy_err err;
 
+    call_once(&httpkeys.once, httpkeys_init);
+
     request->content_length = 0;
     request->chunked = 0;
 
@@ -1828,7 +3007,7 @@ static capy_err http_validate_request(capy_arena *arena, capy_httpreq *request)
             return ErrStd(EINVAL);
     }
 
-    capy_strkvn *host = capy_strkvnmap_get(request->headers, Str("Host"));
+    capy_strkvn *host = capy_strkvnmap_get_hashed(request->headers, httpkeys.host);
 
     if (host == NULL || host->next != NULL)
     {
@@ -1886,7 +3065,7 @@ static capy_err http_validate_request(capy_arena *arena, capy_httpreq *request)
         return err;
     }
 
-    capy_strkvn *transfer_encoding = capy_strkvnmap_get(request->headers, Str("Transfer-Encoding"));
+    capy_strkvn *transfer_encoding = capy_strkvnmap_get_hashed(request->headers, httpkeys.transfer_encoding);
 
     if (transfer_encoding != NULL)
     {
@@ -1899,7 +3078,7 @@ static capy_err http_validate_request(capy_arena *arena, capy_httpreq *request)
         request->content_length = 0;
     }
 
-    capy_strkvn *content_length = capy_strkvnmap_get(request->headers, Str("Content-Length"));
+    capy_strkvn *content_length = capy_strkvnmap_get_hashed(request->headers, httpkeys.content_length);
 
     if (content_length != NULL)
     {
@@ -1912,7 +3091,7 @@ static capy_err http_validate_request(capy_arena *arena, capy_httpreq *request)
         request->chunked = 0;
     }
 
-    capy_strkvn *connection = capy_strkvnmap_get(request->headers, Str("Connection"));
+    capy_strkvn *connection = capy_strkvnmap_get_hashed(request->headers, httpkeys.connection);
 
     if (connection != NULL)
     {
@@ -1982,7 +3161,14 @@ static capy_err http_parse_field(capy_strkvnmap *fields, capy_string line)
         return err;
     }
 
-    return capy_strkvnmap_add(fields, name, value);
+    err = capy_strkvnmap_add(fields, name, value);
+
+    if (err.code == EOVERFLOW)
+    {
+        return ErrStd(EINVAL);
+    }
+
+    return err;
 }
 
 static capy_err http_parse_uriparams(capy_strkvnmap *params, capy_string path, capy_string handler_path)
@@ -2024,7 +3210,11 @@ capy_err capy_http_serve(capy_httpserveropt options)
 {
     options = httpserveropt_default(options);
 
-    capy_arena *arena = capy_arena_init(0, MiB(1));
+    // each worker counts the requests of every route, plus those for the metrics and those not routed
+    size_t routes = Cast(size_t, options.routes_size) + 2;
+    size_t metrics = (options.metrics_path) ? options.workers * routes * (sizeof(httproutemetrics) + 8 * sizeof(capy_histogram)) : 0;
+
+    capy_arena *arena = capy_arena_init_flags(0, MiB(1) + metrics, options.arena_flags);
 
     if (arena == NULL)
     {
@@ -2045,19 +3235,46 @@ capy_err capy_http_serve(capy_httpserveropt options)
         return ErrStd(ENOMEM);
     }
 
+    capy_arena *conns_arena = capy_arena_init_flags(0, HTTP_CONN_POOL_MAX, options.arena_flags);
+
+    if (conns_arena == NULL)
+    {
+        return ErrStd(ENOMEM);
+    }
+
+    capy_pool *conns = capy_pool_init(conns_arena, sizeof(httpconn), alignof(httpconn));
+
+    if (conns == NULL)
+    {
+        return ErrStd(ENOMEM);
+    }
+
     for (size_t i = 0; i < options.workers; i++)
     {
         httpserver *server = servers + i;
 
         server->options = &options;
         server->router = router;
+        server->workers = servers;
+        server->conns = capy_poolcache_init(conns);
         server->tcp = capy_tcp_init(arena);
+        server->budget = capy_membudget_init(arena, options.mem_worker_max, options.mem_budget);
 
-        if (server->tcp == NULL)
+        if (server->tcp == NULL || server->budget == NULL)
         {
             return ErrStd(ENOMEM);
         }
 
+        if (options.metrics_path != NULL)
+        {
+            server->metrics = httpmetrics_init(arena, routes);
+
+            if (server->metrics == NULL)
+            {
+                return ErrStd(ENOMEM);
+            }
+        }
+
         if (options.protocol == CAPY_HTTPS)
         {
             capy_err err = capy_tcp_tls_server(server->tcp, options.certificate_chain, options.certificate_key);
@@ -2074,13 +3291,144 @@ capy_err capy_http_serve(capy_httpserveropt options)
            (options.protocol == CAPY_HTTPS) ? "https" : "http",
            options.workers);
 
+    bool watchdog = false;
+
+    if (options.stall_threshold)
+    {
+        capy_err err = capy_watchdog_start(options.stall_threshold);
+
+        if (err.code && err.code != EBUSY)
+        {
+            return ErrWrap(err, "Failed to start watchdog");
+        }
+
+        watchdog = !err.code;
+    }
+
     capy_err err = httpserver_workers(options.workers, servers);
 
+    if (watchdog)
+    {
+        capy_watchdog_stop();
+    }
+
+    capy_pool_destroy(conns);
+    capy_arena_destroy(conns_arena);
     capy_arena_destroy(arena);
 
     return err;
 }
 
+void capy_http_instrument(bool enabled)
+{
+    atomic_store(&http_instrumented, HTTP_INSTRUMENT && enabled);
+}
+
+capy_err capy_http_states(capy_arena *arena, capy_httpstate **states, size_t *size)
+{
+    call_once(&httpinstrument.once, httpinstrument_init);
+
+    if (httpinstrument.err.code)
+    {
+        return httpinstrument.err;
+    }
+
+    capy_httpstate *result = Make(arena, capy_httpstate, STATE_COUNT);
+
+    if (result == NULL)
+    {
+        return ErrStd(ENOMEM);
+    }
+
+    for (size_t i = 0; i < STATE_COUNT; i++)
+    {
+        result[i].name = httpconnstate_cstr[i];
+        result[i].time = capy_histogram_init(arena);
+        result[i].memory = capy_histogram_init(arena);
+
+        if (result[i].time == NULL || result[i].memory == NULL)
+        {
+            return ErrStd(ENOMEM);
+        }
+    }
+
+    mtx_lock(&httpinstrument.lock);
+
+    for (httpstats *stats = httpinstrument.stats; stats != NULL; stats = stats->next)
+    {
+        for (size_t i = 0; i < STATE_COUNT; i++)
+        {
+            capy_histogram *time = atomic_load_explicit(&stats->time[i], memory_order_acquire);
+            capy_histogram *memory = atomic_load_explicit(&stats->memory[i], memory_order_acquire);
+
+            if (time != NULL)
+            {
+                capy_histogram_merge(result[i].time, time);
+            }
+
+            if (memory != NULL)
+            {
+                capy_histogram_merge(result[i].memory, memory);
+            }
+        }
+    }
+
+    mtx_unlock(&httpinstrument.lock);
+
+    *states = result;
+    *size = STATE_COUNT;
+
+    return Ok;
+}
+
+capy_err capy_http_read_jsonval(capy_arena *arena, capy_httpreq *request, capy_jsonval *value)
+{
+    call_once(&httpkeys.once, httpkeys_init);
+
+    capy_strkvn *content_type = capy_strkvnmap_get_hashed(request->headers, httpkeys.content_type);
+
+    if (content_type != NULL && http_media_type_is(content_type->value, Str("application/cbor")))
+    {
+        return capy_cbor_decode(arena, value, request->content);
+    }
+
+    if (content_type != NULL && !http_media_type_is(content_type->value, Str("application/json")))
+    {
+        return ErrFmt(ENOTSUP, "unsupported media type");
+    }
+
+    return capy_json_deserialize(arena, value, request->content.data);
+}
+
+capy_err capy_http_write_jsonval(capy_httpreq *request, capy_httpresp *response, capy_jsonval value)
+{
+    capy_err err;
+
+    call_once(&httpkeys.once, httpkeys_init);
+    capy_strkvn *accept = capy_strkvnmap_get_hashed(request->headers, httpkeys.accept);
+
+    if (accept != NULL && http_accept_quality(accept, Str("application/cbor")) > http_accept_quality(accept, Str("application/json")))
+    {
+        err = capy_cbor_encode(response->body, value);
+
+        if (err.code)
+        {
+            return err;
+        }
+
+        return capy_strkvnmap_set_hashed(response->headers, httpkeys.content_type, Str("application/cbor"));
+    }
+
+    err = capy_json_serialize(response->body, value, 0);
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    return capy_strkvnmap_set_hashed(response->headers, httpkeys.content_type, Str("application/json"));
+}
+
 //
 // LINUX
 //
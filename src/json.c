@@ -1,9 +1,20 @@
 #include <capy/macros.h>
 
+#include <math.h>
+
 static capy_err json_serialize(capy_buffer *buffer, capy_jsonval value, int tabsize, int tabs);
 static capy_err json_deserialize(capy_arena *arena, capy_jsonval *value, capy_string *input);
 static capy_err json_parse_number(double *number, capy_string *input);
 static capy_err json_parse_string(capy_arena *arena, const char **cstr, capy_string *input);
+static capy_err json_scan_string(capy_string *content, size_t *size, capy_string *input);
+static capy_err json_decode_string(capy_arena *arena, const char **cstr, capy_string content, size_t size);
+static capy_err json_skip(capy_string *input);
+static capy_err json_decode_object(capy_arena *arena, const capy_jsonschema *schema, char *output, capy_string *input);
+static capy_err json_decode_field(capy_arena *arena, const capy_jsonfield *field, char *member, capy_string *input);
+static capy_err json_encode_object(capy_buffer *buffer, const capy_jsonschema *schema, const char *input);
+static capy_err json_encode_string(capy_buffer *buffer, capy_string string);
+static capy_err json_encode_number(capy_buffer *buffer, double number);
+static capy_err json_error_location(capy_err err, capy_string input, capy_string remainder);
 
 // INTERNAL DEFINITIONS
 
@@ -32,13 +43,13 @@ static capy_err json_serialize(capy_buffer *buffer, capy_jsonval value, int tabs
 
         case CAPY_JSON_NUMBER:
         {
-            return capy_buffer_write_fmt(buffer, 0, "%g", value.number);
+            return json_encode_number(buffer, value.number);
         }
         break;
 
         case CAPY_JSON_STRING:
         {
-            return capy_buffer_write_fmt(buffer, 0, "\"%s\"", value.string);
+            return json_encode_string(buffer, capy_string_cstr(value.string));
         }
         break;
 
@@ -55,11 +66,11 @@ static capy_err json_serialize(capy_buffer *buffer, capy_jsonval value, int tabs
 
             bool first = true;
 
-            for (size_t i = 0; value.object != NULL && i < value.object->capacity; i++)
+            for (size_t i = 0; value.object != NULL && i < value.object->size; i++)
             {
                 capy_jsonkv keyval = value.object->items[i];
 
-                if (keyval.key.size == 0)
+                if (capy_strmap_deleted(&keyval))
                 {
                     continue;
                 }
@@ -84,7 +95,14 @@ static capy_err json_serialize(capy_buffer *buffer, capy_jsonval value, int tabs
                     }
                 }
 
-                err = capy_buffer_write_fmt(buffer, 0, "\"%.*s\":", (int)keyval.key.size, keyval.key.data);
+                err = json_encode_string(buffer, keyval.key);
+
+                if (err.code)
+                {
+                    return err;
+                }
+
+                err = capy_buffer_write_bytes(buffer, 1, ":");
 
                 if (err.code)
                 {
@@ -217,7 +235,7 @@ static capy_err json_deserialize(capy_arena *arena, capy_jsonval *value, capy_st
     {
         case 'n':
         {
-            if (input->size < 4 && !ArrCmp4(input->data, 'n', 'u', 'l', 'l'))
+            if (input->size < 4 || !ArrCmp4(input->data, 'n', 'u', 'l', 'l'))
             {
                 return ErrFmt(EINVAL, "unexpected keyword");
             }
@@ -229,7 +247,7 @@ static capy_err json_deserialize(capy_arena *arena, capy_jsonval *value, capy_st
 
         case 't':
         {
-            if (input->size < 4 && !ArrCmp4(input->data, 't', 'r', 'u', 'e'))
+            if (input->size < 4 || !ArrCmp4(input->data, 't', 'r', 'u', 'e'))
             {
                 return ErrFmt(EINVAL, "unexpected keyword");
             }
@@ -241,7 +259,7 @@ static capy_err json_deserialize(capy_arena *arena, capy_jsonval *value, capy_st
 
         case 'f':
         {
-            if (input->size < 5 && !ArrCmp5(input->data, 'f', 'a', 'l', 's', 'e'))
+            if (input->size < 5 || !ArrCmp5(input->data, 'f', 'a', 'l', 's', 'e'))
             {
                 return ErrFmt(EINVAL, "unexpected keyword");
             }
@@ -578,14 +596,28 @@ static capy_err json_parse_number(double *number, capy_string *input)
 }
 
 static capy_err json_parse_string(capy_arena *arena, const char **cstr, capy_string *input)
+{
+    capy_string content;
+    size_t size;
+
+    capy_err err = json_scan_string(&content, &size, input);
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    return json_decode_string(arena, cstr, content, size);
+}
+
+static capy_err json_scan_string(capy_string *content, size_t *size, capy_string *input)
 {
     // always starts with '"'
 
     *input = capy_string_shl(*input, 1);
 
-    capy_string content = *input;
-
-    size_t size = 0;
+    *content = *input;
+    *size = 0;
 
     while (input->size)
     {
@@ -619,7 +651,7 @@ static capy_err json_parse_string(capy_arena *arena, const char **cstr, capy_str
                 case 't':
                 {
                     *input = capy_string_shl(*input, 2);
-                    size += 1;
+                    *size += 1;
                 }
                 break;
 
@@ -634,7 +666,7 @@ static capy_err json_parse_string(capy_arena *arena, const char **cstr, capy_str
 
                     *input = capy_string_shl(*input, 6);
 
-                    size += 3;
+                    *size += 3;
                 }
                 break;
 
@@ -645,7 +677,7 @@ static capy_err json_parse_string(capy_arena *arena, const char **cstr, capy_str
         else
         {
             *input = capy_string_shl(*input, 1);
-            size += 1;
+            *size += 1;
         }
     }
 
@@ -654,6 +686,14 @@ static capy_err json_parse_string(capy_arena *arena, const char **cstr, capy_str
         return ErrFmt(EINVAL, "unterminated string literal");
     }
 
+    *content = capy_string_slice(*content, 0, content->size - input->size);
+    *input = capy_string_shl(*input, 1);
+
+    return Ok;
+}
+
+static capy_err json_decode_string(capy_arena *arena, const char **cstr, capy_string content, size_t size)
+{
     char *buffer = Make(arena, char, size + 1);
 
     if (buffer == NULL)
@@ -661,10 +701,6 @@ static capy_err json_parse_string(capy_arena *arena, const char **cstr, capy_str
         return ErrStd(ENOMEM);
     }
 
-    content = capy_string_slice(content, 0, content.size - input->size);
-
-    *input = capy_string_shl(*input, 1);
-
     size_t i = 0;
 
     while (content.size)
@@ -677,42 +713,42 @@ static capy_err json_parse_string(capy_arena *arena, const char **cstr, capy_str
             {
                 case '"':
                     buffer[i++] = '"';
-                    content = capy_string_shl(content, 1);
+                    content = capy_string_shl(content, 2);
                     break;
 
                 case '\\':
                     buffer[i++] = '\\';
-                    content = capy_string_shl(content, 1);
+                    content = capy_string_shl(content, 2);
                     break;
 
                 case '/':
                     buffer[i++] = '/';
-                    content = capy_string_shl(content, 1);
+                    content = capy_string_shl(content, 2);
                     break;
 
                 case 'b':
                     buffer[i++] = '\b';
-                    content = capy_string_shl(content, 1);
+                    content = capy_string_shl(content, 2);
                     break;
 
                 case 'f':
                     buffer[i++] = '\f';
-                    content = capy_string_shl(content, 1);
+                    content = capy_string_shl(content, 2);
                     break;
 
                 case 'n':
                     buffer[i++] = '\n';
-                    content = capy_string_shl(content, 1);
+                    content = capy_string_shl(content, 2);
                     break;
 
                 case 'r':
                     buffer[i++] = '\r';
-                    content = capy_string_shl(content, 1);
+                    content = capy_string_shl(content, 2);
                     break;
 
                 case 't':
                     buffer[i++] = '\t';
-                    content = capy_string_shl(content, 1);
+                    content = capy_string_shl(content, 2);
                     break;
 
                 case 'u':
@@ -729,7 +765,12 @@ static capy_err json_parse_string(capy_arena *arena, const char **cstr, capy_str
                         content = capy_string_shl(content, 6);
                     }
 
-                    uint32_t code = capy_unicode_utf16(Cast(uint16_t, high), Cast(uint16_t, low));
+                    uint32_t code = Cast(uint32_t, high);
+
+                    if (high >= 0xD800 && high <= 0xDFFF)
+                    {
+                        code = capy_unicode_utf16(Cast(uint16_t, high), Cast(uint16_t, low));
+                    }
                     i += capy_unicode_utf8encode(buffer + i, code);
                 }
                 break;
@@ -749,6 +790,553 @@ static capy_err json_parse_string(capy_arena *arena, const char **cstr, capy_str
     return Ok;
 }
 
+static capy_err json_skip(capy_string *input)
+{
+    capy_err err;
+
+    *input = capy_string_ltrim(*input, " \t\r\n");
+
+    if (input->size == 0)
+    {
+        return ErrFmt(EINVAL, "unexpected end of data");
+    }
+
+    switch (input->data[0])
+    {
+        case '"':
+        {
+            capy_string content;
+            size_t size;
+
+            return json_scan_string(&content, &size, input);
+        }
+
+        case '[':
+        {
+            *input = capy_string_shl(*input, 1);
+            *input = capy_string_ltrim(*input, " \t\r\n");
+
+            if (input->size > 0 && input->data[0] == ']')
+            {
+                *input = capy_string_shl(*input, 1);
+                return Ok;
+            }
+
+            for (;;)
+            {
+                err = json_skip(input);
+
+                if (err.code)
+                {
+                    return err;
+                }
+
+                *input = capy_string_ltrim(*input, " \t\r\n");
+
+                if (input->size == 0)
+                {
+                    return ErrFmt(EINVAL, "end of data when ',' or ']' was expected");
+                }
+
+                if (input->data[0] == ']')
+                {
+                    *input = capy_string_shl(*input, 1);
+                    return Ok;
+                }
+
+                if (input->data[0] != ',')
+                {
+                    return ErrFmt(EINVAL, "expected ',' or ']' after array element");
+                }
+
+                *input = capy_string_shl(*input, 1);
+            }
+        }
+
+        case '{':
+        {
+            *input = capy_string_shl(*input, 1);
+            *input = capy_string_ltrim(*input, " \t\r\n");
+
+            if (input->size > 0 && input->data[0] == '}')
+            {
+                *input = capy_string_shl(*input, 1);
+                return Ok;
+            }
+
+            for (;;)
+            {
+                *input = capy_string_ltrim(*input, " \t\r\n");
+
+                if (input->size == 0 || input->data[0] != '"')
+                {
+                    return ErrFmt(EINVAL, "expected property name or '}'");
+                }
+
+                err = json_skip(input);
+
+                if (err.code)
+                {
+                    return err;
+                }
+
+                *input = capy_string_ltrim(*input, " \t\r\n");
+
+                if (input->size == 0 || input->data[0] != ':')
+                {
+                    return ErrFmt(EINVAL, "expected ':' after property name in object");
+                }
+
+                *input = capy_string_shl(*input, 1);
+
+                err = json_skip(input);
+
+                if (err.code)
+                {
+                    return err;
+                }
+
+                *input = capy_string_ltrim(*input, " \t\r\n");
+
+                if (input->size == 0)
+                {
+                    return ErrFmt(EINVAL, "end of data after property value in object");
+                }
+
+                if (input->data[0] == '}')
+                {
+                    *input = capy_string_shl(*input, 1);
+                    return Ok;
+                }
+
+                if (input->data[0] != ',')
+                {
+                    return ErrFmt(EINVAL, "expected double-quoted property name");
+                }
+
+                *input = capy_string_shl(*input, 1);
+            }
+        }
+
+        default:
+        {
+            // keywords and numbers never touch the arena
+            capy_jsonval value;
+            return json_deserialize(NULL, &value, input);
+        }
+    }
+}
+
+static capy_err json_decode_object(capy_arena *arena, const capy_jsonschema *schema, char *output, capy_string *input)
+{
+    capy_assert(schema->fields_size <= 64);
+
+    capy_err err;
+    uint64_t seen = 0;
+
+    memset(output, 0, schema->size);
+
+    *input = capy_string_ltrim(*input, " \t\r\n");
+
+    if (input->size == 0 || input->data[0] != '{')
+    {
+        return ErrFmt(EINVAL, "expected object");
+    }
+
+    *input = capy_string_shl(*input, 1);
+    *input = capy_string_ltrim(*input, " \t\r\n");
+
+    if (input->size > 0 && input->data[0] == '}')
+    {
+        *input = capy_string_shl(*input, 1);
+    }
+    else
+    {
+        for (;;)
+        {
+            *input = capy_string_ltrim(*input, " \t\r\n");
+
+            if (input->size == 0)
+            {
+                return ErrFmt(EINVAL, "end of data when property name was expected");
+            }
+
+            if (input->data[0] != '"')
+            {
+                return ErrFmt(EINVAL, "expected property name or '}'");
+            }
+
+            capy_string key;
+            size_t key_size;
+
+            err = json_scan_string(&key, &key_size, input);
+
+            if (err.code)
+            {
+                return err;
+            }
+
+            if (key_size != key.size)
+            {
+                const char *cstr;
+
+                err = json_decode_string(arena, &cstr, key, key_size);
+
+                if (err.code)
+                {
+                    return err;
+                }
+
+                key = capy_string_cstr(cstr);
+            }
+
+            *input = capy_string_ltrim(*input, " \t\r\n");
+
+            if (input->size == 0 || input->data[0] != ':')
+            {
+                return ErrFmt(EINVAL, "expected ':' after property name in object");
+            }
+
+            *input = capy_string_shl(*input, 1);
+
+            size_t i;
+
+            for (i = 0; i < schema->fields_size; i++)
+            {
+                if (capy_string_eq(schema->fields[i].name, key))
+                {
+                    break;
+                }
+            }
+
+            if (i == schema->fields_size)
+            {
+                err = json_skip(input);
+            }
+            else
+            {
+                err = json_decode_field(arena, schema->fields + i, output + schema->fields[i].offset, input);
+                seen |= 1ULL << i;
+            }
+
+            if (err.code)
+            {
+                return err;
+            }
+
+            *input = capy_string_ltrim(*input, " \t\r\n");
+
+            if (input->size == 0)
+            {
+                return ErrFmt(EINVAL, "end of data after property value in object");
+            }
+
+            if (input->data[0] == ',')
+            {
+                *input = capy_string_shl(*input, 1);
+            }
+            else if (input->data[0] == '}')
+            {
+                *input = capy_string_shl(*input, 1);
+                break;
+            }
+            else
+            {
+                return ErrFmt(EINVAL, "expected double-quoted property name");
+            }
+        }
+    }
+
+    for (size_t i = 0; i < schema->fields_size; i++)
+    {
+        const capy_jsonfield *field = schema->fields + i;
+
+        if (field->required && !(seen & (1ULL << i)))
+        {
+            return ErrFmt(EINVAL, "missing required property \"%.*s\"", (int)field->name.size, field->name.data);
+        }
+    }
+
+    return Ok;
+}
+
+static capy_err json_decode_field(capy_arena *arena, const capy_jsonfield *field, char *member, capy_string *input)
+{
+    capy_err err;
+
+    *input = capy_string_ltrim(*input, " \t\r\n");
+
+    if (input->size == 0)
+    {
+        return ErrFmt(EINVAL, "unexpected end of data");
+    }
+
+    if (field->type == CAPY_JSONTYPE_VALUE)
+    {
+        return json_deserialize(arena, Cast(capy_jsonval *, Cast(void *, member)), input);
+    }
+
+    if (field->type == CAPY_JSONTYPE_OBJECT && input->data[0] == '{')
+    {
+        return json_decode_object(arena, field->schema, member, input);
+    }
+
+    if (input->data[0] == '{' || input->data[0] == '[')
+    {
+        return ErrFmt(EINVAL, "unexpected type for property \"%.*s\"", (int)field->name.size, field->name.data);
+    }
+
+    capy_jsonval value;
+
+    err = json_deserialize(arena, &value, input);
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    if (value.kind == CAPY_JSON_NULL)
+    {
+        if (field->required)
+        {
+            return ErrFmt(EINVAL, "required property \"%.*s\" is null", (int)field->name.size, field->name.data);
+        }
+
+        return Ok;
+    }
+
+    switch (field->type)
+    {
+        case CAPY_JSONTYPE_BOOL:
+        {
+            if (value.kind != CAPY_JSON_BOOL)
+            {
+                break;
+            }
+
+            *Cast(bool *, Cast(void *, member)) = value.boolean;
+            return Ok;
+        }
+
+        case CAPY_JSONTYPE_NUMBER:
+        {
+            if (value.kind != CAPY_JSON_NUMBER)
+            {
+                break;
+            }
+
+            *Cast(double *, Cast(void *, member)) = value.number;
+            return Ok;
+        }
+
+        case CAPY_JSONTYPE_INTEGER:
+        {
+            if (value.kind != CAPY_JSON_NUMBER)
+            {
+                break;
+            }
+
+            if (value.number < Cast(double, INT64_MIN) || value.number >= Cast(double, INT64_MAX) ||
+                Cast(double, Cast(int64_t, value.number)) != value.number)
+            {
+                return ErrFmt(EINVAL, "property \"%.*s\" is not an integer", (int)field->name.size, field->name.data);
+            }
+
+            *Cast(int64_t *, Cast(void *, member)) = Cast(int64_t, value.number);
+            return Ok;
+        }
+
+        case CAPY_JSONTYPE_STRING:
+        {
+            if (value.kind != CAPY_JSON_STRING)
+            {
+                break;
+            }
+
+            *Cast(const char **, Cast(void *, member)) = value.string;
+            return Ok;
+        }
+
+        default:
+            break;
+    }
+
+    return ErrFmt(EINVAL, "unexpected type for property \"%.*s\"", (int)field->name.size, field->name.data);
+}
+
+static capy_err json_encode_object(capy_buffer *buffer, const capy_jsonschema *schema, const char *input)
+{
+    capy_err err = capy_buffer_write_bytes(buffer, 1, "{");
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    for (size_t i = 0; i < schema->fields_size; i++)
+    {
+        const capy_jsonfield *field = schema->fields + i;
+        const void *member = input + field->offset;
+
+        err = capy_buffer_write_fmt(buffer, 0, "%s\"%.*s\":", (i == 0) ? "" : ",", (int)field->name.size, field->name.data);
+
+        if (err.code)
+        {
+            return err;
+        }
+
+        switch (field->type)
+        {
+            case CAPY_JSONTYPE_BOOL:
+                err = capy_buffer_write_cstr(buffer, (*Cast(const bool *, member)) ? "true" : "false");
+                break;
+
+            case CAPY_JSONTYPE_NUMBER:
+                err = json_encode_number(buffer, *Cast(const double *, member));
+                break;
+
+            case CAPY_JSONTYPE_INTEGER:
+                err = capy_buffer_write_fmt(buffer, 0, "%" PRIi64, *Cast(const int64_t *, member));
+                break;
+
+            case CAPY_JSONTYPE_STRING:
+            {
+                const char *string = *Cast(const char *const *, member);
+
+                if (string == NULL)
+                {
+                    err = capy_buffer_write_cstr(buffer, "null");
+                }
+                else
+                {
+                    err = json_encode_string(buffer, capy_string_cstr(string));
+                }
+            }
+            break;
+
+            case CAPY_JSONTYPE_OBJECT:
+                err = json_encode_object(buffer, field->schema, member);
+                break;
+
+            case CAPY_JSONTYPE_VALUE:
+                err = json_serialize(buffer, *Cast(const capy_jsonval *, member), 0, 0);
+                break;
+        }
+
+        if (err.code)
+        {
+            return err;
+        }
+    }
+
+    return capy_buffer_write_bytes(buffer, 1, "}");
+}
+
+// Writes `string` as a JSON string, escaping quotes, backslashes and control characters. Other bytes are
+// copied as they are.
+static capy_err json_encode_string(capy_buffer *buffer, capy_string string)
+{
+    const char *data = string.data;
+    const char *end = string.data + string.size;
+
+    capy_err err = capy_buffer_write_bytes(buffer, 1, "\"");
+
+    while (!err.code && data < end)
+    {
+        size_t size = 0;
+
+        while (data + size < end && data[size] != '"' && data[size] != '\\' && Cast(uint8_t, data[size]) >= 0x20)
+        {
+            size++;
+        }
+
+        if (size)
+        {
+            err = capy_buffer_write_bytes(buffer, size, data);
+            data += size;
+            continue;
+        }
+
+        uint8_t c = Cast(uint8_t, *data++);
+
+        switch (c)
+        {
+            case '"':
+                err = capy_buffer_write_bytes(buffer, 2, "\\\"");
+                break;
+
+            case '\\':
+                err = capy_buffer_write_bytes(buffer, 2, "\\\\");
+                break;
+
+            case '\n':
+                err = capy_buffer_write_bytes(buffer, 2, "\\n");
+                break;
+
+            case '\r':
+                err = capy_buffer_write_bytes(buffer, 2, "\\r");
+                break;
+
+            case '\t':
+                err = capy_buffer_write_bytes(buffer, 2, "\\t");
+                break;
+
+            default:
+                err = capy_buffer_write_fmt(buffer, 0, "\\u%04x", c);
+                break;
+        }
+    }
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    return capy_buffer_write_bytes(buffer, 1, "\"");
+}
+
+// Writes the shortest of 15 or 17 significant digits that reads back as `number`. JSON has no representation for
+// NaN and infinities.
+static capy_err json_encode_number(capy_buffer *buffer, double number)
+{
+    if (!isfinite(number))
+    {
+        return ErrFmt(EINVAL, "non-finite number can't be encoded as JSON");
+    }
+
+    char digits[32];
+    snprintf(digits, sizeof(digits), "%.15g", number);
+
+    if (strtod(digits, NULL) != number)
+    {
+        snprintf(digits, sizeof(digits), "%.17g", number);
+    }
+
+    return capy_buffer_write_cstr(buffer, digits);
+}
+
+static capy_err json_error_location(capy_err err, capy_string input, capy_string remainder)
+{
+    size_t index = input.size - remainder.size;
+    size_t line = 1;
+    size_t column = 1;
+
+    for (size_t i = 0; i < index; i++)
+    {
+        if (input.data[i] == '\n')
+        {
+            line += 1;
+            column = 1;
+        }
+        else
+        {
+            column += 1;
+        }
+    }
+
+    return ErrFmt(err.code, "%s at line %zu column %zu", err.msg, line, column);
+}
+
 // PUBLIC DEFINITIONS
 
 capy_jsonval capy_json_null(void)
@@ -773,23 +1361,13 @@ capy_jsonval capy_json_bool(int boolean)
 
 capy_jsonval capy_json_object(capy_arena *arena)
 {
-    size_t capacity = 8;
+    capy_jsonobj *obj = Make(arena, capy_jsonobj, 1);
 
-    char *addr = capy_arena_alloc(arena, sizeof(capy_jsonobj) + (sizeof(capy_jsonkv) * capacity), 8, true);
-
-    if (addr == NULL)
+    if (obj == NULL || capy_strmap_init(arena, &obj->strmap, sizeof(capy_jsonkv), 8).code)
     {
         return (capy_jsonval){.kind = CAPY_JSON_OBJECT, .object = NULL};
     }
 
-    capy_jsonobj *obj = Cast(capy_jsonobj *, addr);
-
-    obj->size = 0;
-    obj->capacity = capacity;
-    obj->element_size = sizeof(capy_jsonkv);
-    obj->arena = arena;
-    obj->items = Cast(capy_jsonkv *, addr + sizeof(capy_jsonobj));
-
     return (capy_jsonval){.kind = CAPY_JSON_OBJECT, .object = obj};
 }
 
@@ -801,7 +1379,8 @@ capy_err capy_json_object_set(capy_jsonobj *object, const char *key, capy_jsonva
 
 capy_jsonval *capy_json_object_get(capy_jsonobj *object, const char *key)
 {
-    return capy_strmap_get(&object->strmap, capy_string_cstr(key));
+    capy_jsonkv *kv = capy_strmap_get(&object->strmap, capy_string_cstr(key));
+    return (kv == NULL) ? NULL : &kv->value;
 }
 
 capy_jsonval capy_json_array(capy_arena *arena)
@@ -855,25 +1434,38 @@ capy_err capy_json_deserialize(capy_arena *arena, capy_jsonval *value, const cha
 
     if (err.code)
     {
-        size_t index = input.size - remainder.size;
-        size_t line = 1;
-        size_t column = 1;
+        return json_error_location(err, input, remainder);
+    }
+
+    return Ok;
+}
+
+capy_err capy_json_decode(capy_arena *arena, const capy_jsonschema *schema, void *output, const char *in)
+{
+    capy_string input = capy_string_cstr(in);
+    capy_string remainder = input;
+
+    capy_err err = json_decode_object(arena, schema, output, &remainder);
+
+    if (!err.code)
+    {
+        remainder = capy_string_ltrim(remainder, " \t\r\n");
 
-        for (size_t i = 0; i < index; i++)
+        if (remainder.size > 0)
         {
-            if (input.data[i] == '\n')
-            {
-                line += 1;
-                column = 1;
-            }
-            else
-            {
-                column += 1;
-            }
+            err = ErrFmt(EINVAL, "unexpected non-whitespace character after JSON data");
         }
+    }
 
-        return ErrFmt(err.code, "%s at line %zu column %zu", err.msg, line, column);
+    if (err.code)
+    {
+        return json_error_location(err, input, remainder);
     }
 
     return Ok;
 }
+
+capy_err capy_json_encode(capy_buffer *buffer, const capy_jsonschema *schema, const void *input)
+{
+    return json_encode_object(buffer, schema, input);
+}
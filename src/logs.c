@@ -1,16 +1,129 @@
 #include <capy/macros.h>
 
-// INTERNAL VARIABLES
+#define LOG_RECORD_MAX KiB(2)
+#define LOG_RING_SIZE KiB(64)
+#define LOG_FLUSH_INTERVAL 10
+#define LOG_IOV_MAX 64
+
+// DECLARATIONS
+
+// Single-producer single-consumer byte ring holding formatted lines of one thread. `head` and `tail` only grow,
+// positions in `data` are taken modulo LOG_RING_SIZE.
+struct logring
+{
+    alignas(64) atomic_size_t head;
+    alignas(64) atomic_size_t tail;
+    atomic_bool closed;
+    capy_arena *arena;
+    char *data;
+    struct logring *next;
+};
+
+// A contiguous run of buffered bytes, written with a single writev.
+struct logspan
+{
+    char *data;
+    size_t size;
+};
+
+// Header of a deferred record, followed by the arguments of `format` in the order they are consumed. Integers,
+// pointers, widths and precisions are stored as 64 bits, floating point values with their own type, strings as
+// a 32 bits length followed by their bytes.
+struct logrecord
+{
+    uint32_t size;
+    uint32_t level;
+    struct timespec timestamp;
+    const char *format;
+};
+
+enum loglength
+{
+    LOG_LEN_NONE,
+    LOG_LEN_HH,
+    LOG_LEN_H,
+    LOG_LEN_L,
+    LOG_LEN_LL,
+    LOG_LEN_J,
+    LOG_LEN_Z,
+    LOG_LEN_T,
+    LOG_LEN_LD,
+};
+
+// A conversion specification of a format string.
+struct logspec
+{
+    char flags[8];
+    bool width_star;
+    bool precision_star;
+    bool has_precision;
+    int width;
+    int precision;
+    enum loglength length;
+    char conversion;
+};
 
 struct logger
 {
     FILE *file;
     unsigned int mask;
     const char *timefmt;
+    capy_logmode mode;
+    bool deferred;
 };
 
+static size_t logger_header(char *buffer, size_t max, capy_loglevel level, struct timespec timestamp);
+static size_t logger_format(char *buffer, capy_loglevel level, const char *format, va_list args);
+static void logger_write(struct logring *ring, const char *data, size_t size);
+static const char *logspec_parse(const char *format, struct logspec *spec);
+static size_t logspec_prefix(char *buffer, size_t max, struct logspec *spec, int width, int precision);
+static bool logrecord_put(char *buffer, size_t *size, const void *value, size_t length);
+static bool logrecord_get(const char *record, size_t *offset, void *value, size_t length);
+static size_t logrecord_encode(char *buffer, capy_loglevel level, const char *format, va_list args);
+static size_t logrecord_message(const char *record, char *buffer, size_t max);
+static struct logring *logring_get(void);
+static struct logring *logring_create(void);
+static void logring_exit(void *data);
+static bool logring_push(struct logring *ring, const char *data, size_t size);
+static void logring_read(struct logring *ring, size_t position, void *data, size_t size);
+static void logflusher_wake(void);
+static void logflusher_wait(struct logring *ring, const char *data, size_t size, bool *pushed);
+static void logflusher_notify(void);
+static size_t logflusher_write(struct logspan *spans, int count);
+static void logflusher_output(char *data, size_t size);
+static size_t logflusher_decode(struct logring **sources, size_t *heads, struct logspan *spans, int count);
+static size_t logflusher_drain(void);
+static int logflusher_run(void *data);
+static void logflusher_stop(void);
+
+Platform static ssize_t logger_writev(struct logspan *spans, int count);
+Platform static void logflusher_block_signals(void);
+
+// INTERNAL VARIABLES
+
 static struct logger logger = {.file = NULL, .mask = 0};
 
+static struct
+{
+    atomic_bool running;
+    atomic_bool sleeping;
+    atomic_size_t waiting;
+    atomic_size_t dropped;
+    size_t reported;
+    bool initialized;
+    thrd_t thread;
+    mtx_t lock;
+    mtx_t drain;
+    cnd_t wake;
+    cnd_t drained;
+    tss_t exit;
+    struct logring *rings;
+    char text[LOG_RING_SIZE];
+} logflusher;
+
+static thread_local struct logring *log_ring;
+static thread_local bool log_ring_bypass;
+
 static const char *levelmsg[] = {
     [CAPY_LOG_MEM] = "\x1b[32m[MEM]\x1b[0m",
     [CAPY_LOG_DEBUG] = "\x1b[35m[DBG]\x1b[0m",
@@ -19,14 +132,973 @@ static const char *levelmsg[] = {
     [CAPY_LOG_ERROR] = "\x1b[31m[ERR]\x1b[0m",
 };
 
+// INTERNAL DEFINITIONS
+
+// Writes the timestamp and level of a record. Returns its size, less than `max`.
+static size_t logger_header(char *buffer, size_t max, capy_loglevel level, struct timespec timestamp)
+{
+    struct tm tm;
+    size_t n = strftime(buffer, max, logger.timefmt, gmtime_r(&timestamp.tv_sec, &tm));
+
+    int w = snprintf(buffer + n, max - n, ".%03ld %s ", timestamp.tv_nsec / 1000000, levelmsg[level]);
+    n += (w > 0) ? Cast(size_t, w) : 0;
+
+    return (n < max) ? n : max - 1;
+}
+
+// Formats a record into `buffer` (LOG_RECORD_MAX bytes), truncating long messages. Returns its size including
+// the line break.
+static size_t logger_format(char *buffer, capy_loglevel level, const char *format, va_list args)
+{
+    size_t max = LOG_RECORD_MAX - 1;
+    size_t n = logger_header(buffer, max, level, capy_now());
+
+    int w = vsnprintf(buffer + n, max - n, format, args);
+    n += (w > 0) ? Cast(size_t, w) : 0;
+    n = (n < max) ? n : max - 1;
+
+    buffer[n++] = '\n';
+
+    return n;
+}
+
+static void logger_write(struct logring *ring, const char *data, size_t size)
+{
+    if (ring == NULL)
+    {
+        fwrite(data, 1, size, logger.file);
+        return;
+    }
+
+    bool pushed = logring_push(ring, data, size);
+
+    while (!pushed)
+    {
+        if (logger.mode == CAPY_LOG_ASYNC_DROP)
+        {
+            atomic_fetch_add(&logflusher.dropped, 1);
+            return;
+        }
+
+        logflusher_wait(ring, data, size, &pushed);
+    }
+
+    // a full ring is drained right away, otherwise records wait for the next flush interval
+    if (atomic_load_explicit(&ring->head, memory_order_relaxed) - atomic_load(&ring->tail) > LOG_RING_SIZE / 2)
+    {
+        logflusher_wake();
+    }
+}
+
+// Parses the conversion specification following a '%'. Returns the position after it.
+static const char *logspec_parse(const char *format, struct logspec *spec)
+{
+    *spec = (struct logspec){.length = LOG_LEN_NONE};
+
+    for (size_t i = 0; *format != 0 && strchr("-+ #0'", *format) != NULL; format++)
+    {
+        if (i < sizeof(spec->flags) - 1)
+        {
+            spec->flags[i++] = *format;
+        }
+    }
+
+    if (*format == '*')
+    {
+        spec->width_star = true;
+        format++;
+    }
+
+    for (; *format >= '0' && *format <= '9'; format++)
+    {
+        spec->width = (spec->width * 10) + (*format - '0');
+    }
+
+    if (*format == '.')
+    {
+        spec->has_precision = true;
+        format++;
+
+        if (*format == '*')
+        {
+            spec->precision_star = true;
+            format++;
+        }
+
+        for (; *format >= '0' && *format <= '9'; format++)
+        {
+            spec->precision = (spec->precision * 10) + (*format - '0');
+        }
+    }
+
+    switch (*format)
+    {
+        case 'h':
+            spec->length = (format[1] == 'h') ? LOG_LEN_HH : LOG_LEN_H;
+            format += (format[1] == 'h') ? 2 : 1;
+            break;
+        case 'l':
+            spec->length = (format[1] == 'l') ? LOG_LEN_LL : LOG_LEN_L;
+            format += (format[1] == 'l') ? 2 : 1;
+            break;
+        case 'j':
+            spec->length = LOG_LEN_J;
+            format++;
+            break;
+        case 'z':
+            spec->length = LOG_LEN_Z;
+            format++;
+            break;
+        case 't':
+            spec->length = LOG_LEN_T;
+            format++;
+            break;
+        case 'L':
+            spec->length = LOG_LEN_LD;
+            format++;
+            break;
+    }
+
+    spec->conversion = *format;
+
+    return (*format != 0) ? format + 1 : format;
+}
+
+// Writes '%', flags, width and precision of `spec` as a format string prefix. A negative precision is omitted.
+static size_t logspec_prefix(char *buffer, size_t max, struct logspec *spec, int width, int precision)
+{
+    int n = (spec->has_precision && precision >= 0)
+                ? snprintf(buffer, max, "%%%s%d.%d", spec->flags, width, precision)
+                : snprintf(buffer, max, "%%%s%d", spec->flags, width);
+
+    return (n > 0) ? Cast(size_t, n) : 0;
+}
+
+static bool logrecord_put(char *buffer, size_t *size, const void *value, size_t length)
+{
+    if (LOG_RECORD_MAX - *size < length)
+    {
+        return false;
+    }
+
+    memcpy(buffer + *size, value, length);
+    *size += length;
+
+    return true;
+}
+
+static bool logrecord_get(const char *record, size_t *offset, void *value, size_t length)
+{
+    struct logrecord header;
+    memcpy(&header, record, sizeof(header));
+
+    if (header.size - *offset < length)
+    {
+        return false;
+    }
+
+    memcpy(value, record + *offset, length);
+    *offset += length;
+
+    return true;
+}
+
+// Captures the timestamp, format and arguments of a record into `buffer` (LOG_RECORD_MAX bytes), copying the
+// bytes of strings. Arguments that don't fit are left out, formatting stops before them. Returns its size.
+static size_t logrecord_encode(char *buffer, capy_loglevel level, const char *format, va_list args)
+{
+    size_t size = sizeof(struct logrecord);
+    bool fits = true;
+
+    for (const char *cursor = format; fits && (cursor = strchr(cursor, '%')) != NULL;)
+    {
+        struct logspec spec;
+        cursor = logspec_parse(cursor + 1, &spec);
+
+        int64_t star;
+
+        if (spec.width_star)
+        {
+            star = va_arg(args, int);
+            fits = logrecord_put(buffer, &size, &star, sizeof(star));
+        }
+
+        if (spec.precision_star)
+        {
+            star = va_arg(args, int);
+            spec.precision = Cast(int, star);
+            fits = fits && logrecord_put(buffer, &size, &star, sizeof(star));
+        }
+
+        switch (spec.conversion)
+        {
+            case 'c':
+            {
+                int64_t value = va_arg(args, int);
+                fits = fits && logrecord_put(buffer, &size, &value, sizeof(value));
+                break;
+            }
+
+            case 'd':
+            case 'i':
+            {
+                int64_t value;
+
+                switch (spec.length)
+                {
+                    case LOG_LEN_HH:
+                        value = Cast(signed char, va_arg(args, int));
+                        break;
+                    case LOG_LEN_H:
+                        value = Cast(short, va_arg(args, int));
+                        break;
+                    case LOG_LEN_L:
+                        value = va_arg(args, long);
+                        break;
+                    case LOG_LEN_LL:
+                        value = va_arg(args, long long);
+                        break;
+                    case LOG_LEN_J:
+                        value = va_arg(args, intmax_t);
+                        break;
+                    case LOG_LEN_Z:
+                        value = Cast(int64_t, va_arg(args, size_t));
+                        break;
+                    case LOG_LEN_T:
+                        value = va_arg(args, ptrdiff_t);
+                        break;
+                    default:
+                        value = va_arg(args, int);
+                        break;
+                }
+
+                fits = fits && logrecord_put(buffer, &size, &value, sizeof(value));
+                break;
+            }
+
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+            {
+                uint64_t value;
+
+                switch (spec.length)
+                {
+                    case LOG_LEN_HH:
+                        value = Cast(unsigned char, va_arg(args, unsigned int));
+                        break;
+                    case LOG_LEN_H:
+                        value = Cast(unsigned short, va_arg(args, unsigned int));
+                        break;
+                    case LOG_LEN_L:
+                        value = va_arg(args, unsigned long);
+                        break;
+                    case LOG_LEN_LL:
+                        value = va_arg(args, unsigned long long);
+                        break;
+                    case LOG_LEN_J:
+                        value = va_arg(args, uintmax_t);
+                        break;
+                    case LOG_LEN_Z:
+                        value = va_arg(args, size_t);
+                        break;
+                    case LOG_LEN_T:
+                        value = Cast(uint64_t, va_arg(args, ptrdiff_t));
+                        break;
+                    default:
+                        value = va_arg(args, unsigned int);
+                        break;
+                }
+
+                fits = fits && logrecord_put(buffer, &size, &value, sizeof(value));
+                break;
+            }
+
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+            {
+                if (spec.length == LOG_LEN_LD)
+                {
+                    long double value = va_arg(args, long double);
+                    fits = fits && logrecord_put(buffer, &size, &value, sizeof(value));
+                }
+                else
+                {
+                    double value = va_arg(args, double);
+                    fits = fits && logrecord_put(buffer, &size, &value, sizeof(value));
+                }
+
+                break;
+            }
+
+            case 'p':
+            {
+                uint64_t value = Cast(uintptr_t, va_arg(args, void *));
+                fits = fits && logrecord_put(buffer, &size, &value, sizeof(value));
+                break;
+            }
+
+            case 's':
+            {
+                const char *value = va_arg(args, const char *);
+                value = (value != NULL) ? value : "(null)";
+
+                size_t length = (spec.has_precision && spec.precision >= 0) ? strnlen(value, Cast(size_t, spec.precision))
+                                                                             : strlen(value);
+
+                // long strings are truncated to the space left
+                size_t room = LOG_RECORD_MAX - size;
+                room = (room > sizeof(uint32_t)) ? room - sizeof(uint32_t) : 0;
+                uint32_t stored = Cast(uint32_t, (length < room) ? length : room);
+
+                fits = fits && logrecord_put(buffer, &size, &stored, sizeof(stored)) && logrecord_put(buffer, &size, value, stored);
+                break;
+            }
+
+            case 'n':
+                Ignore(va_arg(args, void *));
+                break;
+        }
+    }
+
+    struct logrecord header = {
+        .size = Cast(uint32_t, size),
+        .level = Cast(uint32_t, level),
+        .timestamp = capy_now(),
+        .format = format,
+    };
+
+    memcpy(buffer, &header, sizeof(header));
+
+    return size;
+}
+
+// Formats the message of a deferred record into `buffer`. Returns its size, less than `max`.
+static size_t logrecord_message(const char *record, char *buffer, size_t max)
+{
+    struct logrecord header;
+    memcpy(&header, record, sizeof(header));
+
+    const char *format = header.format;
+    size_t offset = sizeof(header);
+    size_t n = 0;
+
+    while (n < max - 1)
+    {
+        const char *percent = strchr(format, '%');
+        size_t literal = (percent != NULL) ? Cast(size_t, percent - format) : strlen(format);
+        literal = (literal < max - 1 - n) ? literal : max - 1 - n;
+
+        memcpy(buffer + n, format, literal);
+        n += literal;
+
+        if (percent == NULL || n == max - 1)
+        {
+            break;
+        }
+
+        struct logspec spec;
+        format = logspec_parse(percent + 1, &spec);
+
+        int64_t width = spec.width;
+        int64_t precision = spec.precision;
+        bool complete = true;
+
+        if (spec.width_star)
+        {
+            complete = logrecord_get(record, &offset, &width, sizeof(width));
+        }
+
+        if (spec.precision_star)
+        {
+            complete = complete && logrecord_get(record, &offset, &precision, sizeof(precision));
+        }
+
+        char prefix[64];
+        size_t p = logspec_prefix(prefix, sizeof(prefix) - 8, &spec, Cast(int, width), Cast(int, precision));
+        int w = 0;
+
+        switch (spec.conversion)
+        {
+            case '%':
+                w = snprintf(buffer + n, max - n, "%%");
+                break;
+
+            case 'd':
+            case 'i':
+            case 'c':
+            {
+                int64_t value;
+
+                if (!(complete = complete && logrecord_get(record, &offset, &value, sizeof(value))))
+                {
+                    break;
+                }
+
+                if (spec.conversion == 'c')
+                {
+                    memcpy(prefix + p, "c", 2);
+                    w = snprintf(buffer + n, max - n, prefix, Cast(int, value));
+                }
+                else
+                {
+                    memcpy(prefix + p, "lld", 4);
+                    w = snprintf(buffer + n, max - n, prefix, Cast(long long, value));
+                }
+
+                break;
+            }
+
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+            {
+                uint64_t value;
+
+                if (!(complete = complete && logrecord_get(record, &offset, &value, sizeof(value))))
+                {
+                    break;
+                }
+
+                memcpy(prefix + p, (char[]){'l', 'l', spec.conversion, 0}, 4);
+                w = snprintf(buffer + n, max - n, prefix, Cast(unsigned long long, value));
+                break;
+            }
+
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+            {
+                if (spec.length == LOG_LEN_LD)
+                {
+                    long double value;
+
+                    if (!(complete = complete && logrecord_get(record, &offset, &value, sizeof(value))))
+                    {
+                        break;
+                    }
+
+                    memcpy(prefix + p, (char[]){'L', spec.conversion, 0}, 3);
+                    w = snprintf(buffer + n, max - n, prefix, value);
+                }
+                else
+                {
+                    double value;
+
+                    if (!(complete = complete && logrecord_get(record, &offset, &value, sizeof(value))))
+                    {
+                        break;
+                    }
+
+                    memcpy(prefix + p, (char[]){spec.conversion, 0}, 2);
+                    w = snprintf(buffer + n, max - n, prefix, value);
+                }
+
+                break;
+            }
+
+            case 'p':
+            {
+                uint64_t value;
+
+                if (!(complete = complete && logrecord_get(record, &offset, &value, sizeof(value))))
+                {
+                    break;
+                }
+
+                memcpy(prefix + p, "p", 2);
+                w = snprintf(buffer + n, max - n, prefix, Cast(void *, Cast(uintptr_t, value)));
+                break;
+            }
+
+            case 's':
+            {
+                uint32_t length;
+
+                if (!(complete = complete && logrecord_get(record, &offset, &length, sizeof(length))) ||
+                    header.size - offset < length)
+                {
+                    complete = false;
+                    break;
+                }
+
+                // stored bytes aren't null terminated, their length replaces the precision
+                spec.has_precision = false;
+                p = logspec_prefix(prefix, sizeof(prefix) - 8, &spec, Cast(int, width), 0);
+                memcpy(prefix + p, ".*s", 4);
+                w = snprintf(buffer + n, max - n, prefix, Cast(int, length), record + offset);
+                offset += length;
+                break;
+            }
+
+            case 'n':
+                break;
+
+            default:
+            {
+                // unknown conversions are written as they are
+                int size = Cast(int, format - percent);
+                w = snprintf(buffer + n, max - n, "%.*s", size, percent);
+                break;
+            }
+        }
+
+        if (!complete)
+        {
+            break;
+        }
+
+        n += (w > 0) ? Cast(size_t, w) : 0;
+        n = (n < max) ? n : max - 1;
+    }
+
+    return n;
+}
+
+// Returns the ring of the calling thread, registering it on first use, or NULL if logging is synchronous.
+static struct logring *logring_get(void)
+{
+    if (!atomic_load(&logflusher.running))
+    {
+        return NULL;
+    }
+
+    // records of the flusher, or logged by arenas while the ring is allocated, are written synchronously
+    if (log_ring != NULL || log_ring_bypass)
+    {
+        return log_ring;
+    }
+
+    log_ring_bypass = true;
+    log_ring = logring_create();
+    log_ring_bypass = false;
+
+    return log_ring;
+}
+
+static struct logring *logring_create(void)
+{
+    capy_arena *arena = capy_arena_init(0, LOG_RING_SIZE + KiB(4));
+
+    if (arena == NULL)
+    {
+        return NULL;
+    }
+
+    struct logring *ring = Make(arena, struct logring, 1);
+    char *data = Make(arena, char, LOG_RING_SIZE);
+
+    if (ring == NULL || data == NULL)
+    {
+        capy_arena_destroy(arena);
+        return NULL;
+    }
+
+    ring->arena = arena;
+    ring->data = data;
+
+    mtx_lock(&logflusher.lock);
+    ring->next = logflusher.rings;
+    logflusher.rings = ring;
+    mtx_unlock(&logflusher.lock);
+
+    tss_set(logflusher.exit, ring);
+
+    return ring;
+}
+
+// The flusher drains and releases rings of threads that exited.
+static void logring_exit(void *data)
+{
+    struct logring *ring = data;
+
+    log_ring = NULL;
+    atomic_store(&ring->closed, true);
+}
+
+static bool logring_push(struct logring *ring, const char *data, size_t size)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (LOG_RING_SIZE - (head - tail) < size)
+    {
+        return false;
+    }
+
+    size_t offset = head % LOG_RING_SIZE;
+    size_t first = (size < LOG_RING_SIZE - offset) ? size : LOG_RING_SIZE - offset;
+
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, data + first, size - first);
+
+    atomic_store_explicit(&ring->head, head + size, memory_order_release);
+
+    return true;
+}
+
+// Copies `size` bytes at `position` of the ring, wrapping around its end.
+static void logring_read(struct logring *ring, size_t position, void *data, size_t size)
+{
+    size_t offset = position % LOG_RING_SIZE;
+    size_t first = (size < LOG_RING_SIZE - offset) ? size : LOG_RING_SIZE - offset;
+
+    memcpy(data, ring->data + offset, first);
+    memcpy(Cast(char *, data) + first, ring->data, size - first);
+}
+
+static void logflusher_wake(void)
+{
+    if (atomic_load(&logflusher.sleeping))
+    {
+        mtx_lock(&logflusher.lock);
+        cnd_signal(&logflusher.wake);
+        mtx_unlock(&logflusher.lock);
+    }
+}
+
+// Wakes the flusher and parks the producer of a full ring until a drain makes room, pushing the record then.
+// The wait is bounded, so a drain that happened before the producer parked is never missed for long.
+static void logflusher_wait(struct logring *ring, const char *data, size_t size, bool *pushed)
+{
+    logflusher_wake();
+
+    struct timespec deadline;
+    timespec_get(&deadline, TIME_UTC);
+    deadline = capy_timespec_addms(deadline, LOG_FLUSH_INTERVAL);
+
+    mtx_lock(&logflusher.lock);
+    atomic_fetch_add(&logflusher.waiting, 1);
+
+    // drains notify under the lock after releasing room, so checking under it doesn't miss them
+    *pushed = logring_push(ring, data, size);
+
+    if (!*pushed)
+    {
+        cnd_timedwait(&logflusher.drained, &logflusher.lock, &deadline);
+        *pushed = logring_push(ring, data, size);
+    }
+
+    atomic_fetch_sub(&logflusher.waiting, 1);
+    mtx_unlock(&logflusher.lock);
+}
+
+static void logflusher_notify(void)
+{
+    if (atomic_load(&logflusher.waiting))
+    {
+        mtx_lock(&logflusher.lock);
+        cnd_broadcast(&logflusher.drained);
+        mtx_unlock(&logflusher.lock);
+    }
+}
+
+// Writes spans of formatted records. Records that can't be written are discarded and counted as dropped,
+// blocking producers would otherwise wait forever on a broken file. Returns the number of bytes consumed.
+static size_t logflusher_write(struct logspan *spans, int count)
+{
+    ssize_t written = logger_writev(spans, count);
+
+    if (written >= 0)
+    {
+        return Cast(size_t, written);
+    }
+
+    size_t size = 0;
+    size_t records = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        size += spans[i].size;
+
+        for (const char *end = spans[i].data + spans[i].size, *c = spans[i].data; (c = memchr(c, '\n', Cast(size_t, end - c))) != NULL; c++)
+        {
+            records += 1;
+        }
+    }
+
+    atomic_fetch_add(&logflusher.dropped, records);
+
+    return size;
+}
+
+// Writes everything buffered in the rings with writev, releasing rings of exited threads once empty.
+// Returns the number of bytes written. Rings have a single consumer, concurrent drains are serialized.
+static size_t logflusher_drain(void)
+{
+    struct logspan spans[LOG_IOV_MAX];
+    struct logring *sources[LOG_IOV_MAX];
+    size_t heads[LOG_IOV_MAX];
+    int count = 0;
+    struct logring *released = NULL;
+
+    mtx_lock(&logflusher.drain);
+    mtx_lock(&logflusher.lock);
+
+    for (struct logring **link = &logflusher.rings; *link != NULL;)
+    {
+        struct logring *ring = *link;
+
+        // `closed` is read first, so a ring seen empty after it was closed has no more records coming
+        bool closed = atomic_load(&ring->closed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+        if (head == tail && closed)
+        {
+            *link = ring->next;
+            ring->next = released;
+            released = ring;
+            continue;
+        }
+
+        link = &ring->next;
+
+        if (head == tail || count > LOG_IOV_MAX - 2)
+        {
+            continue;
+        }
+
+        size_t offset = tail % LOG_RING_SIZE;
+        size_t size = head - tail;
+        size_t first = (size < LOG_RING_SIZE - offset) ? size : LOG_RING_SIZE - offset;
+
+        sources[count] = ring;
+        heads[count] = tail + first;
+        spans[count++] = (struct logspan){.data = ring->data + offset, .size = first};
+
+        if (first < size)
+        {
+            sources[count] = ring;
+            heads[count] = head;
+            spans[count++] = (struct logspan){.data = ring->data, .size = size - first};
+        }
+    }
+
+    mtx_unlock(&logflusher.lock);
+
+    size_t written;
+
+    if (logger.deferred)
+    {
+        written = logflusher_decode(sources, heads, spans, count);
+    }
+    else
+    {
+        written = (count > 0) ? logflusher_write(spans, count) : 0;
+        size_t remaining = written;
+
+        for (int i = 0; i < count; i++)
+        {
+            size_t consumed = (remaining < spans[i].size) ? remaining : spans[i].size;
+            atomic_store_explicit(&sources[i]->tail, heads[i] - spans[i].size + consumed, memory_order_release);
+
+            if (consumed < spans[i].size)
+            {
+                break;
+            }
+
+            remaining -= consumed;
+        }
+    }
+
+    mtx_unlock(&logflusher.drain);
+
+    // destroying arenas may log, a thread flushing with a full ring would otherwise wait for its own drain
+    while (released != NULL)
+    {
+        struct logring *ring = released;
+        released = ring->next;
+        capy_arena_destroy(ring->arena);
+    }
+
+    if (written > 0)
+    {
+        logflusher_notify();
+    }
+
+    return written;
+}
+
+static void logflusher_output(char *data, size_t size)
+{
+    while (size > 0)
+    {
+        size_t written = logflusher_write(&(struct logspan){.data = data, .size = size}, 1);
+
+        if (written == 0)
+        {
+            return;
+        }
+
+        data += written;
+        size -= written;
+    }
+}
+
+// Formats the deferred records of the spans gathered by logflusher_drain, writing them in batches of up to
+// LOG_RING_SIZE bytes. Returns the number of bytes written.
+static size_t logflusher_decode(struct logring **sources, size_t *heads, struct logspan *spans, int count)
+{
+    char record[LOG_RECORD_MAX];
+    size_t written = 0;
+    size_t used = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        struct logring *ring = sources[i];
+        size_t position = heads[i] - spans[i].size;
+
+        // a ring wrapping around its end has two spans
+        if (i + 1 < count && sources[i + 1] == ring)
+        {
+            i++;
+        }
+
+        while (position < heads[i])
+        {
+            struct logrecord header;
+            logring_read(ring, position, &header, sizeof(header));
+            logring_read(ring, position, record, header.size);
+
+            size_t max = sizeof(logflusher.text) - used;
+            size_t n = logger_header(logflusher.text + used, max - 1, header.level, header.timestamp);
+            n += logrecord_message(record, logflusher.text + used + n, max - 1 - n);
+            logflusher.text[used + n] = '\n';
+
+            used += n + 1;
+            position += header.size;
+
+            if (sizeof(logflusher.text) - used < LOG_RECORD_MAX || position == heads[i])
+            {
+                logflusher_output(logflusher.text, used);
+                atomic_store_explicit(&ring->tail, position, memory_order_release);
+
+                written += used;
+                used = 0;
+            }
+        }
+    }
+
+    return written;
+}
+
+static int logflusher_run(Unused void *data)
+{
+    // the flusher can't wait for room in its own ring
+    log_ring_bypass = true;
+
+    // termination signals are handled by the threads that wait for them
+    logflusher_block_signals();
+
+    while (atomic_load(&logflusher.running))
+    {
+        if (logflusher_drain() > 0)
+        {
+            continue;
+        }
+
+        size_t dropped = atomic_load(&logflusher.dropped);
+
+        if (dropped > logflusher.reported)
+        {
+            char line[128];
+            int n = snprintf(line, sizeof(line), "%s logger: dropped %zu records\n", levelmsg[CAPY_LOG_WARNING], dropped - logflusher.reported);
+            // the report itself isn't counted when it can't be written, it would be reported forever
+            Ignore logger_writev(&(struct logspan){.data = line, .size = Cast(size_t, n)}, 1);
+            logflusher.reported = dropped;
+        }
+
+        struct timespec deadline;
+        timespec_get(&deadline, TIME_UTC);
+        deadline = capy_timespec_addms(deadline, LOG_FLUSH_INTERVAL);
+
+        mtx_lock(&logflusher.lock);
+        atomic_store(&logflusher.sleeping, true);
+        cnd_timedwait(&logflusher.wake, &logflusher.lock, &deadline);
+        atomic_store(&logflusher.sleeping, false);
+        mtx_unlock(&logflusher.lock);
+    }
+
+    while (logflusher_drain() > 0)
+    {
+    }
+
+    return 0;
+}
+
+static void logflusher_stop(void)
+{
+    if (!atomic_exchange(&logflusher.running, false))
+    {
+        return;
+    }
+
+    mtx_lock(&logflusher.lock);
+    cnd_signal(&logflusher.wake);
+    mtx_unlock(&logflusher.lock);
+
+    thrd_join(logflusher.thread, NULL);
+}
+
 // PUBLIC DEFINIITIONS
 
-void capy_logger_init(FILE *file)
+capy_err capy_logger_init(FILE *file, capy_logmode mode)
 {
+    logflusher_stop();
+
     logger.file = file;
     logger.timefmt = "%F %T";
+    logger.mode = Cast(capy_logmode, mode & (CAPY_LOG_DEFERRED - 1));
+    logger.deferred = (mode & CAPY_LOG_DEFERRED) && logger.mode != CAPY_LOG_SYNC;
     setvbuf(stdout, NULL, _IOLBF, 0);
     capy_logger_min_level(CAPY_LOG_INFO);
+
+    if (logger.mode == CAPY_LOG_SYNC)
+    {
+        return Ok;
+    }
+
+    if (!logflusher.initialized)
+    {
+        if (mtx_init(&logflusher.lock, mtx_plain) != thrd_success ||
+            mtx_init(&logflusher.drain, mtx_plain) != thrd_success ||
+            cnd_init(&logflusher.wake) != thrd_success ||
+            cnd_init(&logflusher.drained) != thrd_success ||
+            tss_create(&logflusher.exit, logring_exit) != thrd_success)
+        {
+            return ErrFmt(ENOMEM, "Failed to initialize logger");
+        }
+
+        atexit(logflusher_stop);
+        logflusher.initialized = true;
+    }
+
+    // records already buffered by stdio must not be reordered with the ones written by the flusher
+    fflush(file);
+
+    atomic_store(&logflusher.running, true);
+
+    if (thrd_create(&logflusher.thread, logflusher_run, NULL) != thrd_success)
+    {
+        atomic_store(&logflusher.running, false);
+        return ErrFmt(EAGAIN, "Failed to start logger thread");
+    }
+
+    return Ok;
 }
 
 void capy_logger_min_level(capy_loglevel level)
@@ -58,31 +1130,75 @@ void capy_logger_time_format(const char *fmt)
     logger.timefmt = fmt;
 }
 
-void capy_log(capy_loglevel level, const char *format, ...)
+void capy_logger_flush(void)
 {
-    thread_local static char log_buffer[KiB(2)];
+    if (!atomic_load(&logflusher.running))
+    {
+        fflush(logger.file);
+        return;
+    }
 
-    if (level & logger.mask)
+    while (logflusher_drain() > 0)
     {
-        ssize_t max = KiB(2);
-        ssize_t n = 0;
+    }
+}
 
-        struct timespec timestamp = capy_now();
+bool capy_logger_enabled(capy_loglevel level)
+{
+    return (level & logger.mask) != 0;
+}
 
-        n += (ssize_t)strftime(log_buffer + n, (size_t)max, logger.timefmt, gmtime(&timestamp.tv_sec));
-        max = max - n;
+size_t capy_logger_dropped(void)
+{
+    return atomic_load(&logflusher.dropped);
+}
 
-        n += snprintf(log_buffer + n, (size_t)max, ".%03ld", timestamp.tv_nsec / 1000000);
-        max = max - n;
+void capy_log(capy_loglevel level, const char *format, ...)
+{
+    thread_local static char log_buffer[LOG_RECORD_MAX];
 
-        n += snprintf(log_buffer + n, (size_t)max, " %s ", levelmsg[level]);
-        max = max - n;
+    if (level & logger.mask)
+    {
+        struct logring *ring = logring_get();
 
         va_list args;
         va_start(args, format);
-        n += vsnprintf(log_buffer + n, (size_t)max, format, args);
+        size_t n = (ring != NULL && logger.deferred) ? logrecord_encode(log_buffer, level, format, args)
+                                                     : logger_format(log_buffer, level, format, args);
         va_end(args);
 
-        fprintf(logger.file, "%.*s\n", (int)n, log_buffer);
+        logger_write(ring, log_buffer, n);
     }
 }
+
+//
+// LINUX
+//
+
+#ifdef CAPY_OS_LINUX
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/uio.h>
+
+// Returns the number of bytes written, or -1 if writing failed.
+Linux static ssize_t logger_writev(struct logspan *spans, int count)
+{
+    struct iovec iov[LOG_IOV_MAX];
+
+    for (int i = 0; i < count; i++)
+    {
+        iov[i] = (struct iovec){.iov_base = spans[i].data, .iov_len = spans[i].size};
+    }
+
+    return writev(fileno(logger.file), iov, count);
+}
+
+Linux static void logflusher_block_signals(void)
+{
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+}
+
+#endif
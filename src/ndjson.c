@@ -0,0 +1,461 @@
+#include <capy/macros.h>
+
+#define NDJSON_ERRSIZE 256
+
+// Batch arenas of at least this size ask for huge pages, parsing a large batch touches most of its arena.
+#define NDJSON_HUGE_MIN MiB(32)
+
+// DECLARATIONS
+
+struct ndjsonjob
+{
+    struct ndjsonjob *next;
+    capy_ndjson *ndjson;
+    capy_string input;
+    capy_jsonbatch batch;
+    capy_err err;
+    char errmsg[NDJSON_ERRSIZE];
+    atomic_bool done;
+};
+
+struct capy_ndjson
+{
+    capy_string input;
+    size_t line;
+    size_t batch_lines;
+    size_t batch_memory;
+    size_t window;
+    size_t submitted;
+    size_t delivered;
+    struct ndjsonjob *jobs;
+    struct ndjsonjob *current;
+    atomic_bool canceled;
+    atomic_size_t signaling;
+    capy_fd fd;
+};
+
+Platform static capy_err ndjsonpool_submit(struct ndjsonjob *job);
+Platform static size_t ndjsonpool_size(void);
+Platform static capy_err ndjson_event_init(capy_ndjson *ndjson);
+Platform static void ndjson_event_signal(capy_ndjson *ndjson);
+Platform static capy_err ndjson_event_wait(capy_ndjson *ndjson);
+Platform static void ndjson_event_close(capy_ndjson *ndjson);
+
+static void ndjson_parse(struct ndjsonjob *job);
+static capy_err ndjson_submit(capy_ndjson *ndjson);
+static capy_err ndjson_wait(capy_ndjson *ndjson, struct ndjsonjob *job);
+static void ndjson_release(struct ndjsonjob *job);
+
+// INTERNAL DEFINITIONS
+
+static void ndjson_parse(struct ndjsonjob *job)
+{
+    capy_err err = Ok;
+    capy_ndjson *ndjson = job->ndjson;
+    capy_string input = job->input;
+    size_t line = job->batch.line;
+
+    int flags = (ndjson->batch_memory >= NDJSON_HUGE_MIN) ? CAPY_ARENA_HUGEPAGES : 0;
+    job->batch.arena = capy_arena_init_flags(0, ndjson->batch_memory, flags);
+
+    if (job->batch.arena == NULL)
+    {
+        err = ErrStd(ENOMEM);
+        goto done;
+    }
+
+    capy_jsonval values = capy_json_array(job->batch.arena);
+
+    if (values.array == NULL)
+    {
+        err = ErrStd(ENOMEM);
+        goto done;
+    }
+
+    while (input.size && !atomic_load_explicit(&ndjson->canceled, memory_order_relaxed))
+    {
+        const char *eol = memchr(input.data, '\n', input.size);
+        size_t size = (eol == NULL) ? input.size : Cast(size_t, eol - input.data);
+
+        capy_string remainder = capy_string_ltrim(capy_string_slice(input, 0, size), " \t\r");
+        input = capy_string_shl(input, (eol == NULL) ? size : size + 1);
+
+        if (remainder.size > 0)
+        {
+            capy_jsonval value;
+
+            err = json_deserialize(job->batch.arena, &value, &remainder);
+
+            if (!err.code && capy_string_ltrim(remainder, " \t\r").size > 0)
+            {
+                err = ErrFmt(EINVAL, "unexpected non-whitespace character after JSON data");
+            }
+
+            if (!err.code)
+            {
+                err = capy_json_array_push(values.array, value);
+            }
+
+            if (err.code)
+            {
+                err = ErrFmt(err.code, "%s at line %zu", err.msg, line);
+                goto done;
+            }
+        }
+
+        line += 1;
+    }
+
+    job->batch.size = values.array->size;
+    job->batch.values = values.array->data;
+
+done:
+    job->err = err;
+
+    if (err.code)
+    {
+        // error messages live in thread-local buffers of the helper thread
+        snprintf(job->errmsg, NDJSON_ERRSIZE, "%s", err.msg);
+        job->err.msg = job->errmsg;
+    }
+
+    // once done is visible the job slot can be reused, and the ndjson destroyed once no helper is signaling
+    atomic_fetch_add(&ndjson->signaling, 1);
+    atomic_store_explicit(&job->done, true, memory_order_release);
+    ndjson_event_signal(ndjson);
+    atomic_fetch_sub(&ndjson->signaling, 1);
+}
+
+static capy_err ndjson_submit(capy_ndjson *ndjson)
+{
+    while (ndjson->input.size > 0 && ndjson->submitted - ndjson->delivered < ndjson->window)
+    {
+        capy_string input = ndjson->input;
+        size_t lines = 0;
+        size_t size = 0;
+
+        while (size < input.size && lines < ndjson->batch_lines)
+        {
+            const char *eol = memchr(input.data + size, '\n', input.size - size);
+            size = (eol == NULL) ? input.size : Cast(size_t, eol - input.data) + 1;
+            lines += 1;
+        }
+
+        struct ndjsonjob *job = ndjson->jobs + (ndjson->submitted % ndjson->window);
+
+        *job = (struct ndjsonjob){
+            .ndjson = ndjson,
+            .input = capy_string_slice(input, 0, size),
+            .batch = {.index = ndjson->submitted, .line = ndjson->line},
+        };
+
+        capy_err err = ndjsonpool_submit(job);
+
+        if (err.code)
+        {
+            return err;
+        }
+
+        ndjson->input = capy_string_shl(input, size);
+        ndjson->line += lines;
+        ndjson->submitted += 1;
+    }
+
+    return Ok;
+}
+
+static capy_err ndjson_wait(capy_ndjson *ndjson, struct ndjsonjob *job)
+{
+    while (!atomic_load_explicit(&job->done, memory_order_acquire))
+    {
+        capy_err err = ndjson_event_wait(ndjson);
+
+        if (err.code)
+        {
+            return err;
+        }
+    }
+
+    return Ok;
+}
+
+static void ndjson_release(struct ndjsonjob *job)
+{
+    if (job->batch.arena != NULL)
+    {
+        capy_arena_destroy(job->batch.arena);
+        job->batch.arena = NULL;
+    }
+}
+
+// PUBLIC DEFINITIONS
+
+capy_ndjson *capy_ndjson_init(capy_arena *arena, capy_string input, size_t batch_lines, size_t batch_memory)
+{
+    capy_ndjson *ndjson = Make(arena, capy_ndjson, 1);
+
+    if (ndjson == NULL)
+    {
+        return NULL;
+    }
+
+    ndjson->input = input;
+    ndjson->line = 1;
+    ndjson->batch_lines = (batch_lines) ? batch_lines : 1024;
+    ndjson->batch_memory = (batch_memory) ? batch_memory : MiB(64);
+    ndjson->window = 2 * ndjsonpool_size();
+    ndjson->jobs = Make(arena, struct ndjsonjob, ndjson->window);
+
+    if (ndjson->jobs == NULL)
+    {
+        return NULL;
+    }
+
+    if (ndjson_event_init(ndjson).code)
+    {
+        return NULL;
+    }
+
+    return ndjson;
+}
+
+capy_err capy_ndjson_next(capy_ndjson *ndjson, capy_jsonbatch **batch)
+{
+    *batch = NULL;
+
+    // the delivered batch keeps its slot until it is released
+    if (ndjson->current != NULL)
+    {
+        ndjson_release(ndjson->current);
+        ndjson->current = NULL;
+        ndjson->delivered += 1;
+    }
+
+    capy_err err = ndjson_submit(ndjson);
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    if (ndjson->delivered == ndjson->submitted)
+    {
+        return Ok;
+    }
+
+    struct ndjsonjob *job = ndjson->jobs + (ndjson->delivered % ndjson->window);
+
+    err = ndjson_wait(ndjson, job);
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    ndjson->current = job;
+
+    if (job->err.code)
+    {
+        return job->err;
+    }
+
+    *batch = &job->batch;
+
+    return Ok;
+}
+
+capy_err capy_ndjson_destroy(capy_ndjson *ndjson)
+{
+    capy_err err = Ok;
+
+    atomic_store_explicit(&ndjson->canceled, true, memory_order_relaxed);
+
+    ndjson->current = NULL;
+
+    for (; ndjson->delivered < ndjson->submitted; ndjson->delivered++)
+    {
+        struct ndjsonjob *job = ndjson->jobs + (ndjson->delivered % ndjson->window);
+
+        // jobs must finish before their memory can be reused, even when waiting fails
+        while (ndjson_wait(ndjson, job).code)
+        {
+            err = ErrStd(ECANCELED);
+        }
+
+        ndjson_release(job);
+    }
+
+    // helpers of finished jobs may still be writing to the event, which only takes a syscall
+    while (atomic_load(&ndjson->signaling) != 0)
+    {
+        thrd_yield();
+    }
+
+    ndjson_event_close(ndjson);
+
+    return err;
+}
+
+//
+// LINUX
+//
+
+#ifdef CAPY_OS_LINUX
+
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+struct ndjsonpool
+{
+    pthread_once_t once;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct ndjsonjob *head;
+    struct ndjsonjob *tail;
+    size_t size;
+    capy_err err;
+};
+
+Linux static void *ndjsonpool_worker(void *data);
+Linux static void ndjsonpool_init(void);
+
+static struct ndjsonpool ndjsonpool = {
+    .once = PTHREAD_ONCE_INIT,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+Linux static void *ndjsonpool_worker(Unused void *data)
+{
+    for (;;)
+    {
+        pthread_mutex_lock(&ndjsonpool.lock);
+
+        while (ndjsonpool.head == NULL)
+        {
+            pthread_cond_wait(&ndjsonpool.cond, &ndjsonpool.lock);
+        }
+
+        struct ndjsonjob *job = ndjsonpool.head;
+        ndjsonpool.head = job->next;
+
+        if (ndjsonpool.head == NULL)
+        {
+            ndjsonpool.tail = NULL;
+        }
+
+        pthread_mutex_unlock(&ndjsonpool.lock);
+
+        ndjson_parse(job);
+    }
+
+    return NULL;
+}
+
+Linux static void ndjsonpool_init(void)
+{
+    size_t size = capy_ncpus();
+
+    if (size == 0)
+    {
+        size = 1;
+    }
+
+    for (size_t i = 0; i < size; i++)
+    {
+        pthread_t id;
+
+        if (pthread_create(&id, NULL, ndjsonpool_worker, NULL) != 0)
+        {
+            break;
+        }
+
+        pthread_detach(id);
+        ndjsonpool.size += 1;
+    }
+
+    if (ndjsonpool.size == 0)
+    {
+        ndjsonpool.err = ErrFmt(EAGAIN, "Failed to start NDJSON helper threads");
+    }
+}
+
+Linux static size_t ndjsonpool_size(void)
+{
+    pthread_once(&ndjsonpool.once, ndjsonpool_init);
+    return (ndjsonpool.size) ? ndjsonpool.size : 1;
+}
+
+Linux static capy_err ndjsonpool_submit(struct ndjsonjob *job)
+{
+    pthread_once(&ndjsonpool.once, ndjsonpool_init);
+
+    if (ndjsonpool.err.code)
+    {
+        return ndjsonpool.err;
+    }
+
+    job->next = NULL;
+
+    pthread_mutex_lock(&ndjsonpool.lock);
+
+    if (ndjsonpool.tail == NULL)
+    {
+        ndjsonpool.head = job;
+    }
+    else
+    {
+        ndjsonpool.tail->next = job;
+    }
+
+    ndjsonpool.tail = job;
+
+    pthread_cond_signal(&ndjsonpool.cond);
+    pthread_mutex_unlock(&ndjsonpool.lock);
+
+    return Ok;
+}
+
+Linux static capy_err ndjson_event_init(capy_ndjson *ndjson)
+{
+    ndjson->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (ndjson->fd == -1)
+    {
+        return ErrStd(errno);
+    }
+
+    return Ok;
+}
+
+Linux static void ndjson_event_signal(capy_ndjson *ndjson)
+{
+    uint64_t value = 1;
+    Ignore write(ndjson->fd, &value, sizeof(value));
+}
+
+Linux static capy_err ndjson_event_wait(capy_ndjson *ndjson)
+{
+    uint64_t value;
+
+    if (read(ndjson->fd, &value, sizeof(value)) == sizeof(value))
+    {
+        return Ok;
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+        return ErrStd(errno);
+    }
+
+    return capy_waitfd(ndjson->fd, false, 0);
+}
+
+Linux static void ndjson_event_close(capy_ndjson *ndjson)
+{
+    close(ndjson->fd);
+    ndjson->fd = -1;
+}
+
+#endif
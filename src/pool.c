@@ -0,0 +1,256 @@
+#include <capy/macros.h>
+
+#define POOL_BATCH 32
+
+// DECLARATIONS
+
+// Free objects hold the link to the next free object in their first bytes.
+struct poolnode
+{
+    struct poolnode *next;
+};
+
+struct capy_pool
+{
+    capy_arena *arena;
+    size_t size;
+    size_t align;
+    size_t available;
+    struct poolnode *free;
+    mtx_t lock;
+};
+
+static struct poolnode *pool_carve(capy_pool *pool, size_t count);
+static size_t pool_take(capy_pool *pool, struct poolnode **list, size_t count);
+static void pool_give(capy_pool *pool, struct poolnode *head, struct poolnode *tail, size_t count);
+
+// INTERNAL DEFINITIONS
+
+// Allocates `count` contiguous objects from the pool's arena, linked in address order.
+static struct poolnode *pool_carve(capy_pool *pool, size_t count)
+{
+    char *block = capy_arena_alloc(pool->arena, pool->size * count, pool->align, false);
+
+    if (block == NULL)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        struct poolnode *node = Cast(struct poolnode *, block + (i * pool->size));
+        node->next = (i + 1 < count) ? Cast(struct poolnode *, block + ((i + 1) * pool->size)) : NULL;
+    }
+
+    return Cast(struct poolnode *, block);
+}
+
+// Moves up to `count` objects to `list`, carving new ones when the free list runs out. Returns how many were moved.
+// Callers moving objects for a cache hold the pool's lock.
+static size_t pool_take(capy_pool *pool, struct poolnode **list, size_t count)
+{
+    size_t taken = 0;
+
+    while (taken < count && pool->free != NULL)
+    {
+        struct poolnode *node = pool->free;
+        pool->free = node->next;
+        node->next = *list;
+        *list = node;
+        taken++;
+    }
+
+    pool->available -= taken;
+
+    // an arena that can't fit the whole batch may still fit a few objects
+    for (size_t n = count - taken; n > 0; n /= 2)
+    {
+        struct poolnode *head = pool_carve(pool, n);
+
+        if (head != NULL)
+        {
+            struct poolnode *tail = Cast(struct poolnode *, Cast(char *, head) + ((n - 1) * pool->size));
+            tail->next = *list;
+            *list = head;
+            taken += n;
+            break;
+        }
+    }
+
+    return taken;
+}
+
+static void pool_give(capy_pool *pool, struct poolnode *head, struct poolnode *tail, size_t count)
+{
+    tail->next = pool->free;
+    pool->free = head;
+    pool->available += count;
+}
+
+// PUBLIC DEFINITIONS
+
+capy_pool *capy_pool_init(capy_arena *arena, size_t size, size_t align)
+{
+    align = (align > alignof(struct poolnode)) ? align : alignof(struct poolnode);
+    capy_assert((align & (align - 1)) == 0);
+
+    size = (size > sizeof(struct poolnode)) ? size : sizeof(struct poolnode);
+
+    capy_pool *pool = Make(arena, capy_pool, 1);
+
+    if (pool == NULL || mtx_init(&pool->lock, mtx_plain) != thrd_success)
+    {
+        return NULL;
+    }
+
+    pool->arena = arena;
+    pool->size = align_to(size, align);
+    pool->align = align;
+
+    return pool;
+}
+
+void *capy_pool_alloc(capy_pool *pool, int zeroinit)
+{
+    struct poolnode *node = pool->free;
+
+    if (node != NULL)
+    {
+        pool->free = node->next;
+        pool->available -= 1;
+    }
+    else
+    {
+        node = pool_carve(pool, 1);
+
+        if (node == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    if (zeroinit)
+    {
+        memset(node, 0, pool->size);
+    }
+
+    return node;
+}
+
+void capy_pool_free(capy_pool *pool, void *addr)
+{
+    if (addr == NULL)
+    {
+        return;
+    }
+
+    struct poolnode *node = addr;
+    node->next = pool->free;
+    pool->free = node;
+    pool->available += 1;
+}
+
+size_t capy_pool_available(capy_pool *pool)
+{
+    mtx_lock(&pool->lock);
+    size_t available = pool->available;
+    mtx_unlock(&pool->lock);
+
+    return available;
+}
+
+void capy_pool_destroy(capy_pool *pool)
+{
+    mtx_destroy(&pool->lock);
+}
+
+capy_poolcache capy_poolcache_init(capy_pool *pool)
+{
+    return (capy_poolcache){.pool = pool};
+}
+
+void *capy_poolcache_alloc(capy_poolcache *cache, int zeroinit)
+{
+    if (cache->free == NULL)
+    {
+        struct poolnode *list = NULL;
+
+        mtx_lock(&cache->pool->lock);
+        cache->size = pool_take(cache->pool, &list, POOL_BATCH);
+        mtx_unlock(&cache->pool->lock);
+
+        cache->free = list;
+
+        if (list == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    struct poolnode *node = cache->free;
+    cache->free = node->next;
+    cache->size -= 1;
+
+    if (zeroinit)
+    {
+        memset(node, 0, cache->pool->size);
+    }
+
+    return node;
+}
+
+void capy_poolcache_free(capy_poolcache *cache, void *addr)
+{
+    if (addr == NULL)
+    {
+        return;
+    }
+
+    struct poolnode *node = addr;
+    node->next = cache->free;
+    cache->free = node;
+    cache->size += 1;
+
+    // keeps one batch cached, so alternating frees and allocations never reach the pool
+    if (cache->size < 2 * POOL_BATCH)
+    {
+        return;
+    }
+
+    struct poolnode *tail = node;
+
+    for (size_t i = 1; i < POOL_BATCH; i++)
+    {
+        tail = tail->next;
+    }
+
+    cache->free = tail->next;
+    cache->size -= POOL_BATCH;
+
+    mtx_lock(&cache->pool->lock);
+    pool_give(cache->pool, node, tail, POOL_BATCH);
+    mtx_unlock(&cache->pool->lock);
+}
+
+void capy_poolcache_flush(capy_poolcache *cache)
+{
+    if (cache->free == NULL)
+    {
+        return;
+    }
+
+    struct poolnode *head = cache->free;
+    struct poolnode *tail = head;
+
+    while (tail->next != NULL)
+    {
+        tail = tail->next;
+    }
+
+    mtx_lock(&cache->pool->lock);
+    pool_give(cache->pool, head, tail, cache->size);
+    mtx_unlock(&cache->pool->lock);
+
+    cache->free = NULL;
+    cache->size = 0;
+}
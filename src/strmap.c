@@ -1,147 +1,510 @@
 #include <capy/macros.h>
 
-static const char *DELETED = Cast(const char *, -1);
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define STRMAP_GROUP 16
+#define STRMAP_EMPTY 0x80
+#define STRMAP_DELETED 0xfe
+#define STRMAP_SMALL 8
+#define STRMAP_PROBES 8
+
+// DECLARATIONS
+
+static uint32_t strmap_match(const uint8_t *group, uint8_t ctrl);
+static size_t strmap_probe(capy_strmap *map, capy_string key, uint64_t hash, bool *found, size_t *probes);
+static size_t strmap_probe_empty(capy_strmap *map, uint64_t hash, size_t *probes);
+static size_t strmap_scan(capy_strmap *map, capy_string key);
+static void strmap_reindex(capy_strmap *map);
+static capy_err strmap_index(capy_arena *arena, capy_strmap *map, size_t capacity);
+static capy_err strmap_grow(capy_arena *arena, capy_strmap *map);
+static void strmap_compact(capy_strmap *map);
+static void strmap_remove(capy_strmap *map, size_t slot);
+static uint64_t strmap_hash(capy_strkey *key);
+static void *strmap_get(capy_strmap *map, capy_strkey key);
+static capy_err strmap_set(capy_arena *arena, capy_strmap *map, const void *kv, capy_strkey key);
+static void strmap_delete(capy_strmap *map, capy_strkey key);
+
+// INTERNAL DEFINITIONS
+
+// Returns a bitmask of the slots in the 16-slot `group` whose control byte equals `ctrl`.
+static uint32_t strmap_match(const uint8_t *group, uint8_t ctrl)
+{
+#ifdef __SSE2__
+    __m128i bytes = _mm_loadu_si128(Cast(const __m128i *, Cast(const void *, group)));
+    __m128i match = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(Cast(char, ctrl)));
+    return Cast(uint32_t, _mm_movemask_epi8(match));
+#else
+    uint32_t mask = 0;
+
+    for (uint32_t i = 0; i < STRMAP_GROUP; i++)
+    {
+        mask |= Cast(uint32_t, group[i] == ctrl) << i;
+    }
 
-// PUBLIC DEFINITIONS
+    return mask;
+#endif
+}
 
-MustCheck void *capy_strmap_get(capy_strmap *map, capy_string key)
+// Returns the slot of `key`, or the first empty slot on its probe sequence. `probes` is set to the number of
+// groups visited. Slots of deleted entries are never empty, so probing goes past them.
+static size_t strmap_probe(capy_strmap *map, capy_string key, uint64_t hash, bool *found, size_t *probes)
 {
-    size_t k = capy_hash(key.data, key.size) % map->capacity;
-    size_t j = 1;
+    uint8_t tag = hash & 0x7f;
+    size_t groups = (map->mask + 1) / STRMAP_GROUP;
+    size_t g = (hash >> 7) & (groups - 1);
 
-    while (j <= map->capacity)
+    // the index is at most half full, so triangular probing over groups always reaches an empty slot
+    for (size_t j = 1;; j++)
     {
-        char *item = map->items + (map->element_size * k);
-        capy_string *item_key = Cast(capy_string *, item);
+        const uint8_t *group = map->ctrl + (g * STRMAP_GROUP);
 
-        if (item_key->data == DELETED)
+        for (uint32_t match = strmap_match(group, tag); match != 0; match &= match - 1)
         {
+            size_t k = (g * STRMAP_GROUP) + Cast(size_t, __builtin_ctz(match));
+            uint32_t slot = map->slots[k];
+
+            if (map->hashes[slot] != hash)
+            {
+                continue;
+            }
+
+            capy_string *item_key = ReinterpretCast(capy_string *, map->items + (map->element_size * slot));
+
+            if (capy_string_eq(key, *item_key))
+            {
+                *found = true;
+                *probes = j;
+                return k;
+            }
         }
-        else if (item_key->size == 0)
+
+        uint32_t empty = strmap_match(group, STRMAP_EMPTY);
+
+        if (empty != 0)
         {
-            return NULL;
+            *found = false;
+            *probes = j;
+            return (g * STRMAP_GROUP) + Cast(size_t, __builtin_ctz(empty));
         }
-        else if (capy_string_eq(key, *item_key))
+
+        g = (g + j) & (groups - 1);
+    }
+}
+
+static size_t strmap_probe_empty(capy_strmap *map, uint64_t hash, size_t *probes)
+{
+    size_t groups = (map->mask + 1) / STRMAP_GROUP;
+    size_t g = (hash >> 7) & (groups - 1);
+
+    for (size_t j = 1;; j++)
+    {
+        uint32_t empty = strmap_match(map->ctrl + (g * STRMAP_GROUP), STRMAP_EMPTY);
+
+        if (empty != 0)
         {
-            return item;
+            *probes = j;
+            return (g * STRMAP_GROUP) + Cast(size_t, __builtin_ctz(empty));
         }
 
-        k = (k + j) % map->capacity;
-        j += 1;
+        g = (g + j) & (groups - 1);
     }
+}
 
-    return NULL;
+// Returns the position of `key` in a map without index, or `size` if it is not in the map.
+static size_t strmap_scan(capy_strmap *map, capy_string key)
+{
+    size_t i;
+
+    for (i = 0; i < map->size; i++)
+    {
+        capy_string *item_key = ReinterpretCast(capy_string *, map->items + (map->element_size * i));
+
+        if (capy_string_eq(key, *item_key))
+        {
+            break;
+        }
+    }
+
+    return i;
 }
 
-capy_err capy_strmap_set(capy_arena *arena, capy_strmap *map, const void *kv)
+static void strmap_reindex(capy_strmap *map)
 {
-    const capy_string *key = ReinterpretCast(const capy_string *, kv);
+    memset(map->ctrl, STRMAP_EMPTY, map->mask + 1);
+
+    for (size_t i = 0; i < map->size; i++)
+    {
+        if (capy_strmap_deleted(map->items + (map->element_size * i)))
+        {
+            continue;
+        }
+
+        size_t probes;
+        size_t k = strmap_probe_empty(map, map->hashes[i], &probes);
 
-    void *dest = capy_strmap_get(map, *key);
+        map->ctrl[k] = map->hashes[i] & 0x7f;
+        map->slots[k] = Cast(uint32_t, i);
+    }
+}
+
+// Allocates an index sized for `capacity` entries, reusing cached hashes or hashing every key on promotion.
+static capy_err strmap_index(capy_arena *arena, capy_strmap *map, size_t capacity)
+{
+    size_t slots = capy_next_pow2(capacity * 2);
 
-    if (dest != NULL)
+    if (slots < STRMAP_GROUP)
     {
-        memcpy(dest, kv, map->element_size);
-        return Ok;
+        slots = STRMAP_GROUP;
+    }
+
+    uint64_t *hashes = MakeNZ(arena, uint64_t, capacity);
+    uint32_t *index = MakeNZ(arena, uint32_t, slots);
+    uint8_t *ctrl = capy_arena_alloc(arena, slots, STRMAP_GROUP, false);
+
+    if (hashes == NULL || index == NULL || ctrl == NULL)
+    {
+        return ErrStd(ENOMEM);
+    }
+
+    for (size_t i = 0; i < map->size; i++)
+    {
+        if (map->hashes != NULL)
+        {
+            hashes[i] = map->hashes[i];
+        }
+        else
+        {
+            capy_string *item_key = ReinterpretCast(capy_string *, map->items + (map->element_size * i));
+            hashes[i] = capy_hash(item_key->data, item_key->size);
+        }
     }
 
-    if (map->size >= (map->capacity * 2) / 3)
+    map->mask = slots - 1;
+    map->ctrl = ctrl;
+    map->slots = index;
+    map->hashes = hashes;
+
+    strmap_reindex(map);
+
+    return Ok;
+}
+
+static capy_err strmap_grow(capy_arena *arena, capy_strmap *map)
+{
+    size_t capacity = map->capacity * 2;
+
+    char *items = capy_arena_alloc(arena, map->element_size * capacity, 8, false);
+
+    if (items == NULL)
     {
-        capy_strmap tmp = {
-            .capacity = map->capacity * 2,
-            .element_size = map->element_size,
-        };
+        return ErrStd(ENOMEM);
+    }
 
-        tmp.items = capy_arena_alloc(arena, tmp.element_size * tmp.capacity, 8, true);
+    if (map->ctrl != NULL)
+    {
+        capy_err err = strmap_index(arena, map, capacity);
 
-        if (tmp.items == NULL)
+        if (err.code)
         {
-            return ErrStd(ENOMEM);
+            return err;
         }
+    }
+
+    memcpy(items, map->items, map->size * map->element_size);
+
+    map->capacity = capacity;
+    map->items = items;
+
+    return Ok;
+}
 
-        for (size_t i = 0; i < map->capacity; i++)
+// Drops deleted entries, moving live ones down in insertion order, and rebuilds the index without them.
+static void strmap_compact(capy_strmap *map)
+{
+    if (map->dead == 0)
+    {
+        return;
+    }
+
+    size_t size = 0;
+
+    for (size_t i = 0; i < map->size; i++)
+    {
+        char *item = map->items + (map->element_size * i);
+
+        if (capy_strmap_deleted(item))
+        {
+            continue;
+        }
+
+        if (i != size)
         {
-            char *item = map->items + (i * map->element_size);
-            capy_string *item_key = Cast(capy_string *, item);
+            memcpy(map->items + (map->element_size * size), item, map->element_size);
 
-            if (item_key->size != 0)
+            if (map->hashes != NULL)
             {
-                Ignore capy_strmap_set(arena, &tmp, item).code;
+                map->hashes[size] = map->hashes[i];
             }
         }
 
-        map->capacity = tmp.capacity;
-        map->size = tmp.size;
-        map->items = tmp.items;
+        size += 1;
+    }
+
+    map->size = size;
+    map->dead = 0;
+
+    if (map->ctrl != NULL)
+    {
+        strmap_reindex(map);
+    }
+}
+
+// Marks the entry at position `slot` as deleted, other entries keep their position until the map compacts.
+static void strmap_remove(capy_strmap *map, size_t slot)
+{
+    capy_string *item_key = ReinterpretCast(capy_string *, map->items + (map->element_size * slot));
+    *item_key = (capy_string){.data = NULL, .size = SIZE_MAX};
+    map->dead += 1;
+}
+
+// Keys with a zero hash are hashed on demand, only once the map has an index.
+static uint64_t strmap_hash(capy_strkey *key)
+{
+    if (key->hash == 0)
+    {
+        key->hash = capy_hash(key->string.data, key->string.size);
+    }
+
+    return key->hash;
+}
+
+static void *strmap_get(capy_strmap *map, capy_strkey key)
+{
+    if (map->ctrl == NULL)
+    {
+        size_t i = strmap_scan(map, key.string);
+        return (i < map->size) ? map->items + (map->element_size * i) : NULL;
+    }
+
+    bool found;
+    size_t probes;
+    size_t k = strmap_probe(map, key.string, strmap_hash(&key), &found, &probes);
+
+    if (!found)
+    {
+        return NULL;
     }
 
-    size_t k = capy_hash(key->data, key->size) % map->capacity;
-    size_t j = 1;
+    return map->items + (map->element_size * map->slots[k]);
+}
 
-    char *data = map->items;
+static capy_err strmap_set(capy_arena *arena, capy_strmap *map, const void *kv, capy_strkey key)
+{
+    capy_err err;
 
-    while (j <= map->capacity)
+    if (map->ctrl == NULL)
     {
-        char *item = data + (map->element_size * k);
-        capy_string *item_key = Cast(capy_string *, item);
+        size_t i = strmap_scan(map, key.string);
 
-        if (item_key->data == DELETED)
+        if (i < map->size)
         {
-            dest = item;
+            memcpy(map->items + (map->element_size * i), kv, map->element_size);
+            return Ok;
         }
-        else if (item_key->size == 0)
+
+        // small maps hold at most STRMAP_SMALL entries, compacting them is cheap
+        if (map->size == map->capacity || map->size == STRMAP_SMALL)
+        {
+            strmap_compact(map);
+        }
+
+        if (map->size < STRMAP_SMALL)
         {
-            if (dest == NULL)
+            if (map->size == map->capacity)
             {
-                dest = item;
+                err = strmap_grow(arena, map);
+
+                if (err.code)
+                {
+                    return err;
+                }
             }
 
-            break;
+            memcpy(map->items + (map->element_size * map->size), kv, map->element_size);
+            map->size += 1;
+
+            return Ok;
         }
 
-        k = (k + j) % map->capacity;
-        j += 1;
+        err = strmap_index(arena, map, map->capacity);
+
+        if (err.code)
+        {
+            return err;
+        }
     }
 
-    memcpy(dest, kv, map->element_size);
+    uint64_t hash = strmap_hash(&key);
+
+    bool found;
+    size_t probes;
+    size_t k = strmap_probe(map, key.string, hash, &found, &probes);
+
+    if (found)
+    {
+        memcpy(map->items + (map->element_size * map->slots[k]), kv, map->element_size);
+        return Ok;
+    }
+
+    // a random hash seed keeps probe sequences short, only colliding keys crafted against it reach the limit,
+    // checked before growing so rejected keys can't make the map allocate
+    if (probes > STRMAP_PROBES && map->dead == 0)
+    {
+        return ErrFmt(EOVERFLOW, "too many colliding keys");
+    }
+
+    if (map->size == map->capacity || probes > STRMAP_PROBES)
+    {
+        bool full = map->size == map->capacity;
+
+        // deleted entries are only dropped here, the map grows if that leaves less than a quarter of it free
+        strmap_compact(map);
+
+        if (full && map->size > map->capacity - (map->capacity / 4))
+        {
+            err = strmap_grow(arena, map);
+
+            if (err.code)
+            {
+                return err;
+            }
+        }
+
+        k = strmap_probe_empty(map, hash, &probes);
+
+        if (probes > STRMAP_PROBES)
+        {
+            return ErrFmt(EOVERFLOW, "too many colliding keys");
+        }
+    }
+
+    memcpy(map->items + (map->element_size * map->size), kv, map->element_size);
+    map->hashes[map->size] = hash;
+    map->ctrl[k] = hash & 0x7f;
+    map->slots[k] = Cast(uint32_t, map->size);
     map->size += 1;
 
     return Ok;
 }
 
-void capy_strmap_delete(capy_strmap *map, capy_string key)
+static void strmap_delete(capy_strmap *map, capy_strkey key)
 {
-    char *item = capy_strmap_get(map, key);
+    if (map->ctrl == NULL)
+    {
+        size_t i = strmap_scan(map, key.string);
+
+        if (i < map->size)
+        {
+            strmap_remove(map, i);
+        }
+
+        return;
+    }
+
+    bool found;
+    size_t probes;
+    size_t k = strmap_probe(map, key.string, strmap_hash(&key), &found, &probes);
 
-    if (item != NULL)
+    if (found)
     {
-        capy_string *key = Cast(capy_string *, item);
+        strmap_remove(map, map->slots[k]);
+        map->ctrl[k] = STRMAP_DELETED;
+    }
+}
+
+// PUBLIC DEFINITIONS
+
+capy_err capy_strmap_init(capy_arena *arena, capy_strmap *map, size_t element_size, size_t capacity)
+{
+    if (capacity == 0)
+    {
+        capacity = 1;
+    }
+
+    char *items = capy_arena_alloc(arena, element_size * capacity, 8, false);
 
-        key->data = DELETED;
-        key->size = 0;
-        map->size -= 1;
+    if (items == NULL)
+    {
+        return ErrStd(ENOMEM);
     }
+
+    // maps start without index, lookups scan entries until the map holds more than STRMAP_SMALL of them
+    *map = (capy_strmap){
+        .size = 0,
+        .capacity = capacity,
+        .element_size = element_size,
+        .items = items,
+        .arena = arena,
+    };
+
+    return Ok;
+}
+
+bool capy_strmap_deleted(const void *entry)
+{
+    const capy_string *key = ReinterpretCast(const capy_string *, entry);
+    return key->size == SIZE_MAX;
+}
+
+capy_strkey capy_strkey_init(capy_string string)
+{
+    return (capy_strkey){.string = string, .hash = capy_hash(string.data, string.size)};
+}
+
+MustCheck void *capy_strmap_get(capy_strmap *map, capy_string key)
+{
+    return strmap_get(map, (capy_strkey){.string = key});
+}
+
+void *capy_strmap_get_hashed(capy_strmap *map, capy_strkey key)
+{
+    return strmap_get(map, key);
+}
+
+capy_err capy_strmap_set(capy_arena *arena, capy_strmap *map, const void *kv)
+{
+    const capy_string *key = ReinterpretCast(const capy_string *, kv);
+    return strmap_set(arena, map, kv, (capy_strkey){.string = *key});
+}
+
+capy_err capy_strmap_set_hashed(capy_arena *arena, capy_strmap *map, capy_strkey key, const void *kv)
+{
+    return strmap_set(arena, map, kv, key);
+}
+
+void capy_strmap_delete(capy_strmap *map, capy_string key)
+{
+    strmap_delete(map, (capy_strkey){.string = key});
+}
+
+void capy_strmap_delete_hashed(capy_strmap *map, capy_strkey key)
+{
+    strmap_delete(map, key);
 }
 
 // capy_strset
 
 capy_strset *capy_strset_init(capy_arena *arena, size_t capacity)
 {
-    char *addr = capy_arena_alloc(arena, sizeof(capy_strset) + (sizeof(capy_string) * capacity), 8, true);
+    capy_strset *set = Make(arena, capy_strset, 1);
 
-    if (addr == NULL)
+    if (set == NULL || capy_strmap_init(arena, &set->strmap, sizeof(capy_string), capacity).code)
     {
         return NULL;
     }
 
-    capy_strset *set = Cast(capy_strset *, addr);
-
-    set->size = 0;
-    set->capacity = capacity;
-    set->element_size = sizeof(capy_string);
-    set->arena = arena;
-    set->items = Cast(capy_string *, addr + sizeof(capy_strset));
-
     return set;
 }
 
@@ -164,21 +527,13 @@ void capy_strset_delete(capy_strset *s, capy_string key)
 
 capy_strkvmap *capy_strkvmap_init(capy_arena *arena, size_t capacity)
 {
-    char *addr = capy_arena_alloc(arena, sizeof(capy_strkvmap) + (sizeof(capy_strkv) * capacity), 8, true);
+    capy_strkvmap *m = Make(arena, capy_strkvmap, 1);
 
-    if (addr == NULL)
+    if (m == NULL || capy_strmap_init(arena, &m->strmap, sizeof(capy_strkv), capacity).code)
     {
         return NULL;
     }
 
-    capy_strkvmap *m = Cast(capy_strkvmap *, addr);
-
-    m->size = 0;
-    m->capacity = capacity;
-    m->element_size = sizeof(capy_strkv);
-    m->arena = arena;
-    m->items = Cast(capy_strkv *, addr + sizeof(capy_strkvmap));
-
     return m;
 }
 
@@ -202,21 +557,13 @@ void capy_strkvmap_delete(capy_strkvmap *m, capy_string key)
 
 capy_strkvnmap *capy_strkvnmap_init(capy_arena *arena, size_t capacity)
 {
-    char *addr = capy_arena_alloc(arena, sizeof(capy_strkvnmap) + (sizeof(capy_strkvn) * capacity), 8, true);
+    capy_strkvnmap *mm = Make(arena, capy_strkvnmap, 1);
 
-    if (addr == NULL)
+    if (mm == NULL || capy_strmap_init(arena, &mm->strmap, sizeof(capy_strkvn), capacity).code)
     {
         return NULL;
     }
 
-    capy_strkvnmap *mm = Cast(capy_strkvnmap *, addr);
-
-    mm->size = 0;
-    mm->capacity = capacity;
-    mm->element_size = sizeof(capy_strkvn);
-    mm->arena = arena;
-    mm->items = Cast(capy_strkvn *, addr + sizeof(capy_strkvnmap));
-
     return mm;
 }
 
@@ -225,12 +572,23 @@ capy_strkvn *capy_strkvnmap_get(capy_strkvnmap *mm, capy_string key)
     return capy_strmap_get(&mm->strmap, key);
 }
 
+capy_strkvn *capy_strkvnmap_get_hashed(capy_strkvnmap *mm, capy_strkey key)
+{
+    return capy_strmap_get_hashed(&mm->strmap, key);
+}
+
 capy_err capy_strkvnmap_set(capy_strkvnmap *mm, capy_string key, capy_string value)
 {
     capy_strkvn pair = {.key = key, .value = value, .next = NULL};
     return capy_strmap_set(mm->arena, &mm->strmap, &pair);
 }
 
+capy_err capy_strkvnmap_set_hashed(capy_strkvnmap *mm, capy_strkey key, capy_string value)
+{
+    capy_strkvn pair = {.key = key.string, .value = value, .next = NULL};
+    return capy_strmap_set_hashed(mm->arena, &mm->strmap, key, &pair);
+}
+
 capy_err capy_strkvnmap_add(capy_strkvnmap *mm, capy_string key, capy_string value)
 {
     capy_strkvn *item = capy_strmap_get(&mm->strmap, key);
@@ -265,20 +623,28 @@ void capy_strkvnmap_delete(capy_strkvnmap *mm, capy_string key)
     capy_strmap_delete(&mm->strmap, key);
 }
 
+void capy_strkvnmap_delete_hashed(capy_strkvnmap *mm, capy_strkey key)
+{
+    capy_strmap_delete_hashed(&mm->strmap, key);
+}
+
 void capy_strkvnmap_clear(capy_strkvnmap *mm)
 {
     mm->size = 0;
-    memset(mm->items, 0, mm->capacity * sizeof(capy_strkvn));
+    mm->strmap.dead = 0;
+
+    if (mm->strmap.ctrl != NULL)
+    {
+        memset(mm->strmap.ctrl, STRMAP_EMPTY, mm->strmap.mask + 1);
+    }
 }
 
 capy_strkvn *capy_strkvnmap_at(capy_strkvnmap *mm, size_t index)
 {
-    capy_strkvn *item = mm->items + index;
-
-    if (item->key.size == 0)
+    if (index >= mm->size || capy_strmap_deleted(mm->items + index))
     {
         return NULL;
     }
 
-    return item;
+    return mm->items + index;
 }
@@ -22,6 +22,7 @@
 #include <capy/macros.h>
 
 #define TASKQUEUE_REMOVED Cast(size_t, -1)
+#define TASKWATCH_DEPTH 32
 
 // DECLARATIONS
 
@@ -36,6 +37,11 @@ struct task
     bool write;
     bool ready;
     size_t queuepos;
+    const char *label;
+    uintptr_t stack_top;
+    size_t stack_size;
+    uint64_t stalled;
+    const char *alloc_phase;
 };
 
 union taskqueue
@@ -63,11 +69,30 @@ struct taskscheduler
     struct task *active;
     struct task *previous;
     union taskqueue *queue;
+    struct taskwatch *watch;
+};
+
+// Heartbeat of the schedulers of one thread, read by the watchdog. `since` is the time (ns) the running task
+// was switched to by the poller, 0 while the poller runs. The stack sample is written by the thread itself when
+// the watchdog signals it. Records are kept until the process exits, so the watchdog never reads freed memory.
+struct taskwatch
+{
+    alignas(64) _Atomic uint64_t since;
+    _Atomic uint64_t runs;
+    _Atomic(const char *) label;
+    _Atomic bool sampled;
+    size_t depth;
+    uintptr_t frames[TASKWATCH_DEPTH];
+    size_t thread_id;
+    uint64_t reported;
+    struct taskwatch *next;
 };
 
 Platform static size_t task_thread_id(void);
 Platform static size_t task_ncpus(void);
 Platform static void task_cancel(void);
+Platform static void task_thread_stack(struct task *task);
+Platform static uint64_t task_clock(void);
 
 Platform static void taskpoll_wait(void *data);
 Platform static capy_err taskpoll_init(struct taskscheduler *scheduler);
@@ -83,6 +108,10 @@ static capy_err scheduler_shutdown(struct taskscheduler *scheduler, uint64_t tim
 static capy_err scheduler_waitfd(struct taskscheduler *scheduler, struct task *task, capy_fd fd, bool write, uint64_t timeout);
 static capy_err scheduler_sleep(struct taskscheduler *scheduler, struct task *task, uint64_t timeout);
 static void scheduler_clean(void *data);
+static void scheduler_watch(struct taskscheduler *scheduler, struct task *task);
+
+static void taskwatchdomain_init(void);
+static struct taskwatch *taskwatch_get(void);
 
 static struct task *task_init(capy_arena *arena, size_t size, void (*entrypoint)(void *data), void (*cleanup)(void *data), void *data);
 static void task_entrypoint(void);
@@ -101,6 +130,18 @@ static int64_t taskqueue_timeout(union taskqueue *queue);
 
 static thread_local struct taskscheduler *task_scheduler = NULL;
 
+static struct
+{
+    once_flag once;
+    capy_err err;
+    mtx_t lock;
+    capy_arena *arena;
+    struct taskwatch *watches;
+    _Atomic uint64_t threshold;
+} taskwatchdomain = {.once = ONCE_FLAG_INIT};
+
+static thread_local struct taskwatch *task_watch;
+
 // PUBLIC DEFINITINOS
 
 capy_err capy_task_init(capy_arena *arena, size_t size, void (*entrypoint)(void *ctx), void (*cleanup)(void *ctx), void *data)
@@ -142,8 +183,12 @@ capy_err capy_waitfd(capy_fd fd, bool write, uint64_t timeout)
         return err;
     }
 
+    Probe(waitfd_park, task, fd, Cast(int, write));
+
     scheduler_switch(task_scheduler, task_scheduler->poller);
 
+    Probe(waitfd_wake, task, fd);
+
     if (capy_timespec_diff(task->deadline, capy_now()) <= 0)
     {
         return ErrStd(ETIMEDOUT);
@@ -221,6 +266,50 @@ size_t capy_ncpus(void)
     return task_ncpus();
 }
 
+void capy_task_label(const char *label)
+{
+    if (task_scheduler != NULL)
+    {
+        task_scheduler->active->label = label;
+
+        if (task_scheduler->watch != NULL)
+        {
+            atomic_store_explicit(&task_scheduler->watch->label, label, memory_order_relaxed);
+        }
+    }
+}
+
+uint64_t capy_task_stalled(void)
+{
+    if (task_scheduler == NULL || task_scheduler->watch == NULL)
+    {
+        return 0;
+    }
+
+    struct task *task = task_scheduler->active;
+    struct taskwatch *watch = task_scheduler->watch;
+
+    uint64_t threshold = atomic_load_explicit(&taskwatchdomain.threshold, memory_order_relaxed);
+    uint64_t since = atomic_load_explicit(&watch->since, memory_order_relaxed);
+
+    if (threshold && since)
+    {
+        uint64_t now = task_clock();
+
+        // the rest of the run is measured from now, so it isn't charged twice
+        if (now - since >= threshold)
+        {
+            task->stalled += now - since;
+            atomic_store_explicit(&watch->since, now, memory_order_relaxed);
+        }
+    }
+
+    uint64_t stalled = task->stalled;
+    task->stalled = 0;
+
+    return stalled;
+}
+
 // INTERNAL DEFINITIONS
 
 static union taskqueue *taskqueue_init(capy_arena *arena)
@@ -411,7 +500,13 @@ static capy_err scheduler_init(void)
         return ErrStd(ENOMEM);
     }
 
+    // the main task runs on the thread stack, it isn't created by task_init
+    task_scheduler->main->fd = -1;
+    task_scheduler->main->queuepos = TASKQUEUE_REMOVED;
+    task_thread_stack(task_scheduler->main);
+
     task_scheduler->active = task_scheduler->main;
+    task_scheduler->watch = taskwatch_get();
 
     task_scheduler->poller = task_init(arena, KiB(64), taskpoll_wait, NULL, task_scheduler);
 
@@ -465,12 +560,65 @@ static void scheduler_clean(void *data)
 
 static void scheduler_switch(struct taskscheduler *scheduler, struct task *task)
 {
+    // scratch arenas are shared by every task of the thread
+    capy_assert(scratch_depth == 0);
+
+    if (scheduler->watch != NULL)
+    {
+        scheduler_watch(scheduler, task);
+    }
+
+    // allocation profiler phases belong to the task that set them
+    scheduler->active->alloc_phase = allocprof_phase;
+    allocprof_phase = task->alloc_phase;
+
     scheduler->previous = scheduler->active;
     scheduler->previous->ready = false;
     scheduler->active = task;
+
+    Probe(task_switch, scheduler->previous, task);
+
     task_switch(scheduler->active->ctx, scheduler->previous->ctx);
 }
 
+// Beats the heartbeat of the scheduler when the poller switches to `task`, and charges the time the running
+// task took to yield back to the poller when it exceeds the watchdog threshold.
+static void scheduler_watch(struct taskscheduler *scheduler, struct task *task)
+{
+    struct taskwatch *watch = scheduler->watch;
+    uint64_t threshold = atomic_load_explicit(&taskwatchdomain.threshold, memory_order_relaxed);
+
+    if (threshold == 0)
+    {
+        // runs started before the watchdog stopped must not be reported when it starts again
+        if (atomic_load_explicit(&watch->since, memory_order_relaxed) != 0)
+        {
+            atomic_store_explicit(&watch->since, 0, memory_order_relaxed);
+        }
+
+        return;
+    }
+
+    if (scheduler->active == scheduler->poller)
+    {
+        atomic_store_explicit(&watch->label, task->label, memory_order_relaxed);
+        atomic_store_explicit(&watch->runs, atomic_load_explicit(&watch->runs, memory_order_relaxed) + 1, memory_order_relaxed);
+        atomic_store_explicit(&watch->since, task_clock(), memory_order_release);
+    }
+    else if (task == scheduler->poller)
+    {
+        uint64_t since = atomic_load_explicit(&watch->since, memory_order_relaxed);
+        uint64_t elapsed = (since) ? task_clock() - since : 0;
+
+        if (elapsed >= threshold)
+        {
+            scheduler->active->stalled += elapsed;
+        }
+
+        atomic_store_explicit(&watch->since, 0, memory_order_relaxed);
+    }
+}
+
 static capy_err scheduler_shutdown(struct taskscheduler *scheduler, uint64_t timeout)
 {
     if (scheduler->active != scheduler->main)
@@ -479,9 +627,22 @@ static capy_err scheduler_shutdown(struct taskscheduler *scheduler, uint64_t tim
     }
 
     capy_sleep(timeout);
+
+    if (scheduler->watch != NULL)
+    {
+        atomic_store_explicit(&scheduler->watch->since, 0, memory_order_relaxed);
+    }
+
+    // signal handlers read the scheduler of the thread they interrupt
+    task_scheduler = NULL;
+    atomic_signal_fence(memory_order_seq_cst);
+
     taskpoll_destroy(scheduler);
     capy_arena_destroy(scheduler->arena);
 
+    counter_store(COUNTER_TASKS_READY, 0);
+    counter_store(COUNTER_TASKS_WAITING, 0);
+
     return Ok;
 }
 
@@ -553,10 +714,64 @@ static struct task *task_init(capy_arena *arena, size_t size, void (*entrypoint)
     task->cleanup = cleanup;
     task->data = data;
     task->queuepos = TASKQUEUE_REMOVED;
+    task->fd = -1;
+    task->stack_top = Cast(uintptr_t, stack);
+    task->stack_size = size;
 
     return task;
 }
 
+// WATCH
+
+static void taskwatchdomain_init(void)
+{
+    if (mtx_init(&taskwatchdomain.lock, mtx_plain) != thrd_success)
+    {
+        taskwatchdomain.err = ErrFmt(ENOMEM, "Failed to initialize watchdog lock");
+        return;
+    }
+
+    taskwatchdomain.arena = capy_arena_init(0, MiB(1));
+
+    if (taskwatchdomain.arena == NULL)
+    {
+        taskwatchdomain.err = ErrFmt(ENOMEM, "Failed to initialize watchdog arena");
+    }
+}
+
+// Returns the heartbeat of the calling thread, registering it on first use, or NULL if it can't be allocated.
+static struct taskwatch *taskwatch_get(void)
+{
+    if (task_watch != NULL)
+    {
+        return task_watch;
+    }
+
+    call_once(&taskwatchdomain.once, taskwatchdomain_init);
+
+    if (taskwatchdomain.err.code)
+    {
+        return NULL;
+    }
+
+    mtx_lock(&taskwatchdomain.lock);
+
+    struct taskwatch *watch = Make(taskwatchdomain.arena, struct taskwatch, 1);
+
+    if (watch != NULL)
+    {
+        watch->thread_id = task_thread_id();
+        watch->next = taskwatchdomain.watches;
+        taskwatchdomain.watches = watch;
+    }
+
+    mtx_unlock(&taskwatchdomain.lock);
+
+    task_watch = watch;
+
+    return watch;
+}
+
 //
 // LINUX DEFINITIONS
 //
@@ -601,6 +816,8 @@ Linux static void taskpoll_wait(void *data)
             if (ms <= 0)
             {
                 struct task *task = taskqueue_pop(scheduler->queue);
+                Probe(timer_expire, task);
+
                 scheduler->err = taskpoll_remove(scheduler, task);
 
                 if (scheduler->err.code)
@@ -634,7 +851,12 @@ Linux static void taskpoll_wait(void *data)
 
         if (available)
         {
+            // every task is suspended while polling, none holds concurrent map entries
+            cmap_thread_offline();
             int count = epoll_wait(scheduler->poll->fd, events, available, timeout);
+            cmap_thread_online();
+
+            counter_add(COUNTER_EPOLL_WAKEUPS, 1);
 
             if (count == -1)
             {
@@ -675,6 +897,9 @@ Linux static void taskpoll_wait(void *data)
             }
         }
 
+        counter_store(COUNTER_TASKS_READY, ready_count);
+        counter_store(COUNTER_TASKS_WAITING, Cast(int64_t, scheduler->queue->size));
+
         for (int i = 0; i < ready_count; i++)
         {
             scheduler_switch(scheduler, ready[i]);
@@ -800,6 +1025,35 @@ Linux static void task_cancel(void)
     kill(getpid(), SIGTERM);
 }
 
+Linux static uint64_t task_clock(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return Cast(uint64_t, now.tv_sec) * 1000000000 + Cast(uint64_t, now.tv_nsec);
+}
+
+// Main tasks run on the stack of their thread.
+Linux static void task_thread_stack(struct task *task)
+{
+    pthread_attr_t attr;
+
+    if (pthread_getattr_np(pthread_self(), &attr) != 0)
+    {
+        return;
+    }
+
+    void *addr;
+    size_t size;
+
+    if (pthread_attr_getstack(&attr, &addr, &size) == 0)
+    {
+        task->stack_top = Cast(uintptr_t, addr) + size;
+        task->stack_size = size;
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
 #endif
 
 //
@@ -0,0 +1,439 @@
+#include <capy/macros.h>
+
+#define PROFILER_DEPTH 32
+#define PROFILER_SAMPLES 16384
+
+// DECLARATIONS
+
+typedef enum
+{
+    PROFILER_ROLE_THREAD,
+    PROFILER_ROLE_MAIN,
+    PROFILER_ROLE_POLLER,
+    PROFILER_ROLE_CLEANER,
+    PROFILER_ROLE_TASK,
+} profilerrole;
+
+// Samples are written by signal handlers, `ready` is set once the rest of the sample is.
+struct profilersample
+{
+    _Atomic bool ready;
+    profilerrole role;
+    const char *label;
+    size_t depth;
+    uintptr_t frames[PROFILER_DEPTH];
+};
+
+Platform static capy_err profiler_arm(unsigned frequency);
+Platform static void profiler_disarm(void);
+Platform static capy_err profiler_write_frame(capy_buffer *buffer, uintptr_t address);
+Platform static size_t profiler_unwind(void *context, uintptr_t low, uintptr_t high, uintptr_t *frames, size_t max);
+
+static void profiler_init(void);
+static void profiler_sample(void *context);
+static int profiler_compare(const void *a, const void *b);
+
+// INTERNAL VARIABLES
+
+static const char *profilerrole_cstr[] = {
+    [PROFILER_ROLE_THREAD] = "thread",
+    [PROFILER_ROLE_MAIN] = "main",
+    [PROFILER_ROLE_POLLER] = "poller",
+    [PROFILER_ROLE_CLEANER] = "cleaner",
+    [PROFILER_ROLE_TASK] = "task",
+};
+
+static struct
+{
+    once_flag once;
+    capy_err err;
+    mtx_t lock;
+    capy_arena *arena;
+    struct profilersample *samples;
+    atomic_bool running;
+    atomic_size_t next;
+    atomic_size_t sampling;
+} profiler = {.once = ONCE_FLAG_INIT};
+
+// INTERNAL DEFINITIONS
+
+static void profiler_init(void)
+{
+    if (mtx_init(&profiler.lock, mtx_plain) != thrd_success)
+    {
+        profiler.err = ErrFmt(ENOMEM, "Failed to initialize profiler lock");
+        return;
+    }
+
+    profiler.arena = capy_arena_init(0, sizeof(struct profilersample) * PROFILER_SAMPLES + MiB(1));
+
+    if (profiler.arena == NULL)
+    {
+        profiler.err = ErrFmt(ENOMEM, "Failed to initialize profiler arena");
+        return;
+    }
+
+    profiler.samples = Make(profiler.arena, struct profilersample, PROFILER_SAMPLES);
+
+    if (profiler.samples == NULL)
+    {
+        profiler.err = ErrFmt(ENOMEM, "Failed to allocate profiler samples");
+    }
+}
+
+// Records the task interrupted by a profiling signal. Only walks the stack of the task, so frames switched
+// to by other tasks, or outside any stack, are never read.
+static void profiler_sample(void *context)
+{
+    atomic_fetch_add(&profiler.sampling, 1);
+
+    if (!atomic_load(&profiler.running))
+    {
+        atomic_fetch_sub(&profiler.sampling, 1);
+        return;
+    }
+
+    size_t index = atomic_fetch_add_explicit(&profiler.next, 1, memory_order_relaxed);
+
+    if (index >= PROFILER_SAMPLES)
+    {
+        atomic_fetch_sub(&profiler.sampling, 1);
+        return;
+    }
+
+    struct profilersample *sample = profiler.samples + index;
+    struct taskscheduler *scheduler = task_scheduler;
+    struct task *task = (scheduler != NULL) ? scheduler->active : NULL;
+
+    sample->role = PROFILER_ROLE_THREAD;
+    sample->label = NULL;
+
+    uintptr_t low = 0;
+    uintptr_t high = 0;
+
+    if (task != NULL)
+    {
+        sample->role = (task == scheduler->main)      ? PROFILER_ROLE_MAIN
+                       : (task == scheduler->poller)  ? PROFILER_ROLE_POLLER
+                       : (task == scheduler->cleaner) ? PROFILER_ROLE_CLEANER
+                                                      : PROFILER_ROLE_TASK;
+        sample->label = task->label;
+
+        low = task->stack_top - task->stack_size;
+        high = task->stack_top;
+    }
+
+    sample->depth = profiler_unwind(context, low, high, sample->frames, PROFILER_DEPTH);
+
+    atomic_store_explicit(&sample->ready, true, memory_order_release);
+    atomic_fetch_sub(&profiler.sampling, 1);
+}
+
+// Orders collapsed stacks so identical ones are adjacent.
+static int profiler_compare(const void *a, const void *b)
+{
+    const capy_string *sa = a;
+    const capy_string *sb = b;
+
+    size_t size = (sa->size < sb->size) ? sa->size : sb->size;
+    int cmp = memcmp(sa->data, sb->data, size);
+
+    if (cmp != 0)
+    {
+        return cmp;
+    }
+
+    return (sa->size > sb->size) - (sa->size < sb->size);
+}
+
+// PUBLIC DEFINITIONS
+
+capy_err capy_profiler_start(unsigned frequency)
+{
+    call_once(&profiler.once, profiler_init);
+
+    if (profiler.err.code)
+    {
+        return profiler.err;
+    }
+
+    if (frequency == 0)
+    {
+        return ErrStd(EINVAL);
+    }
+
+    mtx_lock(&profiler.lock);
+
+    if (atomic_load(&profiler.running))
+    {
+        mtx_unlock(&profiler.lock);
+        return ErrStd(EBUSY);
+    }
+
+    for (size_t i = 0; i < PROFILER_SAMPLES; i++)
+    {
+        atomic_store_explicit(&profiler.samples[i].ready, false, memory_order_relaxed);
+    }
+
+    atomic_store(&profiler.next, 0);
+    atomic_store(&profiler.running, true);
+
+    capy_err err = profiler_arm(frequency);
+
+    if (err.code)
+    {
+        atomic_store(&profiler.running, false);
+    }
+
+    mtx_unlock(&profiler.lock);
+
+    return err;
+}
+
+void capy_profiler_stop(void)
+{
+    call_once(&profiler.once, profiler_init);
+
+    if (profiler.err.code)
+    {
+        return;
+    }
+
+    mtx_lock(&profiler.lock);
+
+    if (atomic_load(&profiler.running))
+    {
+        profiler_disarm();
+        atomic_store(&profiler.running, false);
+
+        // handlers already past the running check finish their sample before it can be reused
+        while (atomic_load(&profiler.sampling) != 0)
+        {
+            thrd_yield();
+        }
+    }
+
+    mtx_unlock(&profiler.lock);
+}
+
+size_t capy_profiler_dropped(void)
+{
+    size_t next = atomic_load(&profiler.next);
+    return (next > PROFILER_SAMPLES) ? next - PROFILER_SAMPLES : 0;
+}
+
+capy_err capy_profiler_write(capy_arena *arena, capy_buffer *buffer)
+{
+    capy_err err;
+
+    call_once(&profiler.once, profiler_init);
+
+    if (profiler.err.code)
+    {
+        return profiler.err;
+    }
+
+    size_t count = atomic_load(&profiler.next);
+    count = (count < PROFILER_SAMPLES) ? count : PROFILER_SAMPLES;
+
+    capy_string *stacks = Make(arena, capy_string, (count) ? count : 1);
+
+    if (stacks == NULL)
+    {
+        return ErrStd(ENOMEM);
+    }
+
+    size_t size = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        struct profilersample *sample = profiler.samples + i;
+
+        if (!atomic_load_explicit(&sample->ready, memory_order_acquire))
+        {
+            continue;
+        }
+
+        capy_buffer *stack = capy_buffer_init(arena, 256);
+
+        if (stack == NULL)
+        {
+            return ErrStd(ENOMEM);
+        }
+
+        const char *name = (sample->label != NULL) ? sample->label : profilerrole_cstr[sample->role];
+        err = capy_buffer_write_cstr(stack, name);
+
+        for (size_t j = sample->depth; j > 0 && !err.code; j--)
+        {
+            err = capy_buffer_write_bytes(stack, 1, ";");
+
+            if (!err.code)
+            {
+                // return addresses point past their call, symbolized as the call itself
+                uintptr_t address = sample->frames[j - 1] - (j > 1);
+                err = profiler_write_frame(stack, address);
+            }
+        }
+
+        if (err.code)
+        {
+            return err;
+        }
+
+        stacks[size++] = capy_string_bytes(stack->size, stack->data);
+    }
+
+    qsort(stacks, size, sizeof(capy_string), profiler_compare);
+
+    for (size_t i = 0; i < size;)
+    {
+        size_t j = i + 1;
+
+        while (j < size && profiler_compare(stacks + i, stacks + j) == 0)
+        {
+            j++;
+        }
+
+        err = capy_buffer_write_fmt(buffer, 0, "%.*s %zu\n", Cast(int, stacks[i].size), stacks[i].data, j - i);
+
+        if (err.code)
+        {
+            return err;
+        }
+
+        i = j;
+    }
+
+    return Ok;
+}
+
+//
+// LINUX
+//
+
+#ifdef CAPY_OS_LINUX
+
+#include <dlfcn.h>
+#include <signal.h>
+#include <sys/time.h>
+
+Linux static void profiler_handler(int signal, siginfo_t *info, void *context);
+
+//
+
+Linux static void profiler_handler(Unused int signal, Unused siginfo_t *info, void *context)
+{
+    int saved = errno;
+    profiler_sample(context);
+    errno = saved;
+}
+
+// The handler stays installed once the profiler stops, so late signals are ignored instead of killing the
+// process.
+Linux static capy_err profiler_arm(unsigned frequency)
+{
+    struct sigaction action = {.sa_sigaction = profiler_handler, .sa_flags = SA_SIGINFO | SA_RESTART};
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGPROF, &action, NULL) == -1)
+    {
+        return ErrStd(errno);
+    }
+
+    long interval = 1000000 / Cast(long, frequency);
+    interval = (interval > 0) ? interval : 1;
+
+    struct itimerval timer = {
+        .it_interval = {.tv_sec = interval / 1000000, .tv_usec = interval % 1000000},
+        .it_value = {.tv_sec = interval / 1000000, .tv_usec = interval % 1000000},
+    };
+
+    if (setitimer(ITIMER_PROF, &timer, NULL) == -1)
+    {
+        return ErrStd(errno);
+    }
+
+    return Ok;
+}
+
+Linux static void profiler_disarm(void)
+{
+    struct itimerval timer = {0};
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+// Writes the symbol of `address` if its module exports one, otherwise the module name and offset, which
+// addr2line resolves.
+Linux static capy_err profiler_write_frame(capy_buffer *buffer, uintptr_t address)
+{
+    Dl_info info;
+
+    if (dladdr(Cast(void *, address), &info) == 0 || info.dli_fname == NULL)
+    {
+        return capy_buffer_write_fmt(buffer, 0, "0x%" PRIxPTR, address);
+    }
+
+    if (info.dli_sname != NULL)
+    {
+        return capy_buffer_write_cstr(buffer, info.dli_sname);
+    }
+
+    const char *module = strrchr(info.dli_fname, '/');
+    module = (module != NULL) ? module + 1 : info.dli_fname;
+
+    return capy_buffer_write_fmt(buffer, 0, "%s+0x%" PRIxPTR, module, address - Cast(uintptr_t, info.dli_fbase));
+}
+
+#endif
+
+//
+// LINUX AMD64
+//
+
+#ifdef CAPY_LINUX_AMD64
+
+#include <ucontext.h>
+
+// Walks frame pointers from the interrupted frame, reading only frames between the interrupted stack pointer
+// and `high`. Code built without frame pointers ends the walk early instead of reading outside the stack.
+LinuxAmd64 static size_t profiler_unwind(void *context, uintptr_t low, uintptr_t high, uintptr_t *frames, size_t max)
+{
+    ucontext_t *uc = context;
+
+    uintptr_t pc = Cast(uintptr_t, uc->uc_mcontext.gregs[REG_RIP]);
+    uintptr_t sp = Cast(uintptr_t, uc->uc_mcontext.gregs[REG_RSP]);
+    uintptr_t fp = Cast(uintptr_t, uc->uc_mcontext.gregs[REG_RBP]);
+
+    size_t depth = 0;
+    frames[depth++] = pc;
+
+    // signals interrupting a task switch run on a stack that isn't the active task's
+    if (sp < low || sp >= high)
+    {
+        return depth;
+    }
+
+    while (depth < max && fp >= sp && fp + (2 * sizeof(uintptr_t)) <= high && (fp % sizeof(uintptr_t)) == 0)
+    {
+        uintptr_t *frame = Cast(uintptr_t *, fp);
+
+        if (frame[1] == 0)
+        {
+            break;
+        }
+
+        frames[depth++] = frame[1];
+
+        if (frame[0] <= fp)
+        {
+            break;
+        }
+
+        fp = frame[0];
+    }
+
+    return depth;
+}
+
+#endif
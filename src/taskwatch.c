@@ -0,0 +1,303 @@
+#include <capy/macros.h>
+
+#define WATCHDOG_SAMPLE_TIMEOUT 10
+
+// DECLARATIONS
+
+Platform static capy_err watchdog_arm(void);
+Platform static bool watchdog_signal(struct taskwatch *watch);
+Platform static void watchdog_block_signals(void);
+
+static void watchdog_init(void);
+static int watchdog_run(void *data);
+static void watchdog_report(struct taskwatch *watch, uint64_t elapsed);
+
+// INTERNAL VARIABLES
+
+static struct
+{
+    once_flag once;
+    capy_err err;
+    mtx_t lock;
+    mtx_t wake_lock;
+    cnd_t wake;
+    thrd_t thread;
+    atomic_bool running;
+    capy_arena *arena;
+} watchdog = {.once = ONCE_FLAG_INIT};
+
+// INTERNAL DEFINITIONS
+
+static void watchdog_init(void)
+{
+    if (mtx_init(&watchdog.lock, mtx_plain) != thrd_success ||
+        mtx_init(&watchdog.wake_lock, mtx_plain) != thrd_success ||
+        cnd_init(&watchdog.wake) != thrd_success)
+    {
+        watchdog.err = ErrFmt(ENOMEM, "Failed to initialize watchdog");
+        return;
+    }
+
+    watchdog.arena = capy_arena_init(0, MiB(1));
+
+    if (watchdog.arena == NULL)
+    {
+        watchdog.err = ErrFmt(ENOMEM, "Failed to initialize watchdog arena");
+    }
+}
+
+// Checks the heartbeat of every scheduler twice per threshold, so stalls are reported at most 1.5 thresholds
+// after they start. Each run of a task is reported once.
+static int watchdog_run(Unused void *data)
+{
+    watchdog_block_signals();
+
+    while (atomic_load(&watchdog.running))
+    {
+        uint64_t threshold = atomic_load_explicit(&taskwatchdomain.threshold, memory_order_relaxed);
+        uint64_t now = task_clock();
+
+        mtx_lock(&taskwatchdomain.lock);
+
+        for (struct taskwatch *watch = taskwatchdomain.watches; watch != NULL; watch = watch->next)
+        {
+            uint64_t since = atomic_load_explicit(&watch->since, memory_order_acquire);
+            uint64_t runs = atomic_load_explicit(&watch->runs, memory_order_relaxed);
+
+            if (since == 0 || now < since || now - since < threshold || runs == watch->reported)
+            {
+                continue;
+            }
+
+            watch->reported = runs;
+            watchdog_report(watch, now - since);
+        }
+
+        mtx_unlock(&taskwatchdomain.lock);
+
+        struct timespec deadline;
+        timespec_get(&deadline, TIME_UTC);
+        deadline = capy_timespec_addms(deadline, (threshold > MillisecondsNano(2)) ? threshold / MillisecondsNano(2) : 1);
+
+        mtx_lock(&watchdog.wake_lock);
+
+        if (atomic_load(&watchdog.running))
+        {
+            cnd_timedwait(&watchdog.wake, &watchdog.wake_lock, &deadline);
+        }
+
+        mtx_unlock(&watchdog.wake_lock);
+    }
+
+    return 0;
+}
+
+// Logs a stalled task with a sample of its stack, taken by its own thread. Frames are written from the
+// outermost, as the profiler does.
+static void watchdog_report(struct taskwatch *watch, uint64_t elapsed)
+{
+    capy_err err = Ok;
+
+    const char *label = atomic_load_explicit(&watch->label, memory_order_relaxed);
+    size_t depth = 0;
+
+    atomic_store_explicit(&watch->sampled, false, memory_order_relaxed);
+
+    if (watchdog_signal(watch))
+    {
+        for (int i = 0; i < WATCHDOG_SAMPLE_TIMEOUT * 10; i++)
+        {
+            if (atomic_load_explicit(&watch->sampled, memory_order_acquire))
+            {
+                depth = watch->depth;
+                break;
+            }
+
+            thrd_sleep(&(struct timespec){.tv_nsec = 100000}, NULL);
+        }
+    }
+
+    void *mark = capy_arena_end(watchdog.arena);
+    capy_buffer *stack = capy_buffer_init(watchdog.arena, 256);
+
+    if (stack == NULL)
+    {
+        err = ErrStd(ENOMEM);
+    }
+
+    for (size_t i = depth; i > 0 && !err.code; i--)
+    {
+        if (i < depth)
+        {
+            err = capy_buffer_write_bytes(stack, 1, ";");
+        }
+
+        if (!err.code)
+        {
+            err = profiler_write_frame(stack, watch->frames[i - 1] - (i > 1));
+        }
+    }
+
+    if (!err.code)
+    {
+        err = capy_buffer_write_null(stack);
+    }
+
+    const char *frames = (!err.code && depth) ? stack->data : "no stack sample";
+
+    LogWrn("watchdog: thread %zu stalled for %" PRIu64 " ms in %s: %s",
+           watch->thread_id, elapsed / Cast(uint64_t, MillisecondsNano(1)),
+           (label != NULL) ? label : "task", frames);
+
+    err = capy_arena_free(watchdog.arena, mark);
+
+    if (err.code)
+    {
+        LogErr("watchdog: failed to free report: %s", err.msg);
+    }
+}
+
+// PUBLIC DEFINITIONS
+
+capy_err capy_watchdog_start(uint64_t threshold)
+{
+    capy_err err;
+
+    call_once(&watchdog.once, watchdog_init);
+
+    if (watchdog.err.code)
+    {
+        return watchdog.err;
+    }
+
+    if (threshold == 0)
+    {
+        return ErrStd(EINVAL);
+    }
+
+    call_once(&taskwatchdomain.once, taskwatchdomain_init);
+
+    if (taskwatchdomain.err.code)
+    {
+        return taskwatchdomain.err;
+    }
+
+    mtx_lock(&watchdog.lock);
+
+    if (atomic_load(&watchdog.running))
+    {
+        mtx_unlock(&watchdog.lock);
+        return ErrStd(EBUSY);
+    }
+
+    err = watchdog_arm();
+
+    if (err.code)
+    {
+        mtx_unlock(&watchdog.lock);
+        return err;
+    }
+
+    atomic_store(&taskwatchdomain.threshold, threshold * Cast(uint64_t, MillisecondsNano(1)));
+    atomic_store(&watchdog.running, true);
+
+    if (thrd_create(&watchdog.thread, watchdog_run, NULL) != thrd_success)
+    {
+        atomic_store(&watchdog.running, false);
+        atomic_store(&taskwatchdomain.threshold, 0);
+        mtx_unlock(&watchdog.lock);
+        return ErrFmt(EAGAIN, "Failed to start watchdog thread");
+    }
+
+    mtx_unlock(&watchdog.lock);
+
+    return Ok;
+}
+
+void capy_watchdog_stop(void)
+{
+    call_once(&watchdog.once, watchdog_init);
+
+    if (watchdog.err.code)
+    {
+        return;
+    }
+
+    mtx_lock(&watchdog.lock);
+
+    if (atomic_load(&watchdog.running))
+    {
+        mtx_lock(&watchdog.wake_lock);
+        atomic_store(&watchdog.running, false);
+        cnd_signal(&watchdog.wake);
+        mtx_unlock(&watchdog.wake_lock);
+
+        thrd_join(watchdog.thread, NULL);
+
+        atomic_store(&taskwatchdomain.threshold, 0);
+    }
+
+    mtx_unlock(&watchdog.lock);
+}
+
+//
+// LINUX
+//
+
+#ifdef CAPY_OS_LINUX
+
+#include <pthread.h>
+#include <signal.h>
+
+Linux static void watchdog_handler(int signal, siginfo_t *info, void *context);
+
+//
+
+// Samples the stack of the running task on the thread signaled by the watchdog.
+Linux static void watchdog_handler(Unused int signal, Unused siginfo_t *info, void *context)
+{
+    int saved = errno;
+
+    struct taskscheduler *scheduler = task_scheduler;
+
+    if (scheduler != NULL && scheduler->watch != NULL)
+    {
+        struct taskwatch *watch = scheduler->watch;
+        struct task *task = scheduler->active;
+
+        watch->depth = profiler_unwind(context, task->stack_top - task->stack_size, task->stack_top,
+                                       watch->frames, TASKWATCH_DEPTH);
+
+        atomic_store_explicit(&watch->sampled, true, memory_order_release);
+    }
+
+    errno = saved;
+}
+
+// Stack samples are requested with SIGRTMIN, the handler stays installed once the watchdog stops.
+Linux static capy_err watchdog_arm(void)
+{
+    struct sigaction action = {.sa_sigaction = watchdog_handler, .sa_flags = SA_SIGINFO | SA_RESTART};
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGRTMIN, &action, NULL) == -1)
+    {
+        return ErrStd(errno);
+    }
+
+    return Ok;
+}
+
+Linux static bool watchdog_signal(struct taskwatch *watch)
+{
+    return pthread_kill(Cast(pthread_t, watch->thread_id), SIGRTMIN) == 0;
+}
+
+Linux static void watchdog_block_signals(void)
+{
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+}
+
+#endif
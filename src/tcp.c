@@ -8,10 +8,13 @@ Platform static capy_err tcp_connect(struct capy_tcp *tcp, const char *host, con
 Platform static capy_err tcp_accept(struct capy_tcp *server, struct capy_tcp *client);
 Platform static capy_err tcp_recv(capy_tcp *tcp, capy_buffer *buffer, uint64_t timeout);
 Platform static capy_err tcp_send(capy_tcp *tcp, capy_buffer *buffer, uint64_t timeout);
+Platform static capy_err tcp_sendv(capy_tcp *tcp, capy_segbuf *buffer, uint64_t timeout);
 Platform static capy_err tcp_shutdown(capy_tcp *tcp);
 Platform static capy_err tcp_close(capy_tcp *tcp);
 Platform static capy_err tcp_keepalive(capy_tcp *tcp, int enabled, int idle, int count, int interval);
 Platform static capy_err tcp_nodelay(capy_tcp *tcp, int enabled);
+Platform static capy_err tcp_timestamping(capy_tcp *tcp, int enabled);
+Platform static int64_t tcp_rx_delay(capy_tcp *tcp);
 Platform static capy_err tcp_tls_server(capy_tcp *server, const char *chain, const char *key);
 Platform static capy_err tcp_tls_client(capy_tcp *client, bool insecure);
 Platform static capy_fd tcp_fd(capy_tcp *tcp);
@@ -52,12 +55,26 @@ capy_err capy_tcp_accept(struct capy_tcp *server, struct capy_tcp *client)
 
 capy_err capy_tcp_recv(capy_tcp *tcp, capy_buffer *buffer, uint64_t timeout)
 {
-    return tcp_recv(tcp, buffer, timeout);
+    size_t size = buffer->size;
+    capy_err err = tcp_recv(tcp, buffer, timeout);
+    counter_add(COUNTER_BYTES_IN, Cast(int64_t, buffer->size - size));
+    return err;
 }
 
 capy_err capy_tcp_send(capy_tcp *tcp, capy_buffer *buffer, uint64_t timeout)
 {
-    return tcp_send(tcp, buffer, timeout);
+    size_t size = buffer->size;
+    capy_err err = tcp_send(tcp, buffer, timeout);
+    counter_add(COUNTER_BYTES_OUT, Cast(int64_t, size - buffer->size));
+    return err;
+}
+
+capy_err capy_tcp_sendv(capy_tcp *tcp, capy_segbuf *buffer, uint64_t timeout)
+{
+    size_t size = buffer->size;
+    capy_err err = tcp_sendv(tcp, buffer, timeout);
+    counter_add(COUNTER_BYTES_OUT, Cast(int64_t, size - buffer->size));
+    return err;
 }
 
 const char *capy_tcp_addr(capy_tcp *tcp)
@@ -95,6 +112,16 @@ capy_err capy_tcp_nodelay(capy_tcp *tcp, bool enabled)
     return tcp_nodelay(tcp, enabled);
 }
 
+capy_err capy_tcp_timestamping(capy_tcp *tcp, bool enabled)
+{
+    return tcp_timestamping(tcp, enabled);
+}
+
+int64_t capy_tcp_rx_delay(capy_tcp *tcp)
+{
+    return tcp_rx_delay(tcp);
+}
+
 capy_fd capy_tcp_fd(capy_tcp *tcp)
 {
     return tcp_fd(tcp);
@@ -108,6 +135,8 @@ capy_fd capy_tcp_fd(capy_tcp *tcp)
 
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -117,21 +146,30 @@ capy_fd capy_tcp_fd(capy_tcp *tcp)
 #include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#define TCP_IOV_MAX 64
+
 Linux struct capy_tcp
 {
     int fd;
     struct ssl_ctx_st *ssl_ctx;
     struct ssl_st *ssl;
     bool ssl_fatal;
+    bool ssl_counted;
+    bool timestamping;
+    int64_t rx_delay;
     char addr[INET6_ADDRSTRLEN];
     uint16_t port;
 };
 
 Linux static capy_err tcp_recv_tls(capy_tcp *tcp, capy_buffer *buffer, uint64_t timeout);
+Linux static ssize_t tcp_recv_timestamped(capy_tcp *tcp, void *data, size_t size);
 Linux static capy_err tcp_send_tls(capy_tcp *tcp, capy_buffer *buffer, uint64_t timeout);
+Linux static capy_err tcp_sendv_tls(capy_tcp *tcp, capy_segbuf *buffer, uint64_t timeout);
 Linux static capy_err tcp_err_openssl(const char *msg);
+Linux static void tcp_tls_count(capy_tcp *tcp, bool failed);
 Linux static void tcp_get_address(char *output, uint16_t *port, struct sockaddr *sa);
 
 //
@@ -159,6 +197,28 @@ Linux static capy_err tcp_err_openssl(const char *msg)
     return ErrWrap(err, msg);
 }
 
+// Counts the handshake of `tcp` once it completes, or once an error ends it.
+Linux static void tcp_tls_count(capy_tcp *tcp, bool failed)
+{
+    if (tcp->ssl_counted)
+    {
+        return;
+    }
+
+    if (failed)
+    {
+        tcp->ssl_counted = true;
+        counter_add(COUNTER_TLS_FAILURES, 1);
+        Probe(tls_handshake, tcp->fd, 0);
+    }
+    else if (SSL_is_init_finished(tcp->ssl))
+    {
+        tcp->ssl_counted = true;
+        counter_add(COUNTER_TLS_HANDSHAKES, 1);
+        Probe(tls_handshake, tcp->fd, 1);
+    }
+}
+
 Linux static capy_tcp *tcp_init(capy_arena *arena)
 {
     struct capy_tcp *tcp = Make(arena, capy_tcp, 1);
@@ -169,6 +229,7 @@ Linux static capy_tcp *tcp_init(capy_arena *arena)
     }
 
     tcp->fd = -1;
+    tcp->rx_delay = -1;
 
     return tcp;
 }
@@ -455,6 +516,10 @@ Linux static capy_err tcp_accept(struct capy_tcp *server, struct capy_tcp *clien
 
     tcp_get_address(client->addr, &client->port, address);
 
+    // accepted sockets inherit SO_TIMESTAMPING from the listener
+    client->timestamping = server->timestamping && server->ssl_ctx == NULL;
+    client->rx_delay = -1;
+
     if (server->ssl_ctx != NULL)
     {
         client->ssl = SSL_new(server->ssl_ctx);
@@ -492,7 +557,8 @@ Linux static capy_err tcp_recv(capy_tcp *tcp, capy_buffer *buffer, uint64_t time
 
     for (;;)
     {
-        ssize_t bytes_read = recv(tcp->fd, buffer->data + buffer->size, bytes_wanted, 0);
+        ssize_t bytes_read = (tcp->timestamping) ? tcp_recv_timestamped(tcp, buffer->data + buffer->size, bytes_wanted)
+                                                 : recv(tcp->fd, buffer->data + buffer->size, bytes_wanted, 0);
 
         if (bytes_read >= 0)
         {
@@ -516,6 +582,58 @@ Linux static capy_err tcp_recv(capy_tcp *tcp, capy_buffer *buffer, uint64_t time
     }
 }
 
+// Receives like recv, setting the delay between the kernel receiving the data read and now, or -1 if the read
+// carried no software timestamp.
+Linux static ssize_t tcp_recv_timestamped(capy_tcp *tcp, void *data, size_t size)
+{
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(struct scm_timestamping))];
+        struct cmsghdr align;
+    } control;
+
+    struct iovec iov = {.iov_base = data, .iov_len = size};
+
+    struct msghdr message = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof(control.buffer),
+    };
+
+    ssize_t bytes_read = recvmsg(tcp->fd, &message, 0);
+
+    if (bytes_read <= 0)
+    {
+        return bytes_read;
+    }
+
+    tcp->rx_delay = -1;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPING)
+        {
+            continue;
+        }
+
+        struct scm_timestamping timestamps;
+        memcpy(&timestamps, CMSG_DATA(cmsg), sizeof(timestamps));
+
+        // software timestamps are taken with the realtime clock
+        if (timestamps.ts[0].tv_sec || timestamps.ts[0].tv_nsec)
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+
+            int64_t delay = capy_timespec_diff(now, timestamps.ts[0]);
+            tcp->rx_delay = (delay > 0) ? delay : 0;
+        }
+    }
+
+    return bytes_read;
+}
+
 Linux static capy_err tcp_recv_tls(capy_tcp *tcp, capy_buffer *buffer, uint64_t timeout)
 {
     capy_err err;
@@ -534,6 +652,7 @@ Linux static capy_err tcp_recv_tls(capy_tcp *tcp, capy_buffer *buffer, uint64_t
 
         if (SSL_read_ex(tcp->ssl, buffer->data + buffer->size, bytes_wanted, &bytes_read))
         {
+            tcp_tls_count(tcp, false);
             buffer->size += Cast(size_t, bytes_read);
             return Ok;
         }
@@ -551,10 +670,12 @@ Linux static capy_err tcp_recv_tls(capy_tcp *tcp, capy_buffer *buffer, uint64_t
 
             case SSL_ERROR_SYSCALL:
                 tcp->ssl_fatal = true;
+                tcp_tls_count(tcp, true);
                 return ErrStd(errno);
 
             default:
                 tcp->ssl_fatal = true;
+                tcp_tls_count(tcp, true);
                 return tcp_err_openssl("TLS receive error");
         }
 
@@ -614,6 +735,7 @@ Linux static capy_err tcp_send_tls(capy_tcp *tcp, capy_buffer *buffer, uint64_t
 
         if (SSL_write_ex(tcp->ssl, buffer->data, buffer->size, &bytes_written))
         {
+            tcp_tls_count(tcp, false);
             capy_buffer_shl(buffer, Cast(size_t, bytes_written));
             return Ok;
         }
@@ -631,10 +753,12 @@ Linux static capy_err tcp_send_tls(capy_tcp *tcp, capy_buffer *buffer, uint64_t
 
             case SSL_ERROR_SYSCALL:
                 tcp->ssl_fatal = true;
+                tcp_tls_count(tcp, true);
                 return ErrStd(errno);
 
             default:
                 tcp->ssl_fatal = true;
+                tcp_tls_count(tcp, true);
                 return tcp_err_openssl("TLS send error");
         }
 
@@ -647,6 +771,85 @@ Linux static capy_err tcp_send_tls(capy_tcp *tcp, capy_buffer *buffer, uint64_t
     }
 }
 
+Linux static capy_err tcp_sendv(capy_tcp *tcp, capy_segbuf *buffer, uint64_t timeout)
+{
+    if (tcp->ssl != NULL)
+    {
+        return tcp_sendv_tls(tcp, buffer, timeout);
+    }
+
+    capy_err err;
+
+    struct iovec iov[TCP_IOV_MAX];
+    int count = 0;
+
+    for (capy_segment *segment = buffer->head; segment != NULL && count < TCP_IOV_MAX; segment = segment->next)
+    {
+        if (segment->size > 0)
+        {
+            iov[count++] = (struct iovec){.iov_base = segment->items, .iov_len = segment->size};
+        }
+    }
+
+    if (count == 0)
+    {
+        return Ok;
+    }
+
+    for (;;)
+    {
+        ssize_t bytes_written = writev(tcp->fd, iov, count);
+
+        if (bytes_written >= 0)
+        {
+            capy_segbuf_shl(buffer, Cast(size_t, bytes_written));
+            return Ok;
+        }
+
+        err = ErrStd(errno);
+
+        if (err.code != EWOULDBLOCK && err.code != EAGAIN)
+        {
+            return err;
+        }
+
+        err = capy_waitfd(tcp->fd, true, timeout);
+
+        if (err.code)
+        {
+            return err;
+        }
+    }
+}
+
+// TLS records are written one segment at a time, OpenSSL has no scatter-gather write.
+Linux static capy_err tcp_sendv_tls(capy_tcp *tcp, capy_segbuf *buffer, uint64_t timeout)
+{
+    capy_segment *segment = buffer->head;
+
+    while (segment != NULL && segment->size == 0)
+    {
+        segment = segment->next;
+    }
+
+    if (segment == NULL)
+    {
+        return Ok;
+    }
+
+    capy_buffer view = {.size = segment->size, .capacity = segment->capacity, .element_size = 1, .data = segment->items};
+
+    capy_err err = tcp_send_tls(tcp, &view, timeout);
+
+    if (err.code)
+    {
+        return err;
+    }
+
+    capy_segbuf_shl(buffer, segment->size - view.size);
+    return Ok;
+}
+
 Linux static capy_err tcp_shutdown(capy_tcp *tcp)
 {
     if (tcp->ssl != NULL)
@@ -714,6 +917,28 @@ Linux static capy_err tcp_nodelay(capy_tcp *tcp, int enabled)
     return Ok;
 }
 
+// Software receive timestamps only need the kernel, they work on loopback too. TLS sockets are read by OpenSSL,
+// so their timestamps are never collected.
+Linux static capy_err tcp_timestamping(capy_tcp *tcp, int enabled)
+{
+    int flags = (enabled) ? SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE : 0;
+
+    if (setsockopt(tcp->fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(int)) == -1)
+    {
+        return ErrWrap(ErrStd(errno), "Failed to set SO_TIMESTAMPING value");
+    }
+
+    tcp->timestamping = enabled && tcp->ssl == NULL;
+    tcp->rx_delay = -1;
+
+    return Ok;
+}
+
+Linux static int64_t tcp_rx_delay(capy_tcp *tcp)
+{
+    return tcp->rx_delay;
+}
+
 Linux static capy_fd tcp_fd(capy_tcp *tcp)
 {
     return tcp->fd;
@@ -1,5 +1,59 @@
 #include <capy/macros.h>
 
+#define SEGVEC_MIN 16
+
+// DECLARATIONS
+
+static capy_err segvec_grow(capy_arena *arena, capy_segvec *vec, size_t count);
+static void segvec_link(capy_segvec *vec, capy_segment *segment);
+
+// INTERNAL DEFINITIONS
+
+// Appends an empty segment with room for at least `count` elements, doubling the vector's capacity.
+static capy_err segvec_grow(capy_arena *arena, capy_segvec *vec, size_t count)
+{
+    if (arena == NULL)
+    {
+        return ErrStd(ENOMEM);
+    }
+
+    size_t capacity = (vec->capacity > SEGVEC_MIN) ? vec->capacity : SEGVEC_MIN;
+    capacity = (capacity > count) ? capacity : count;
+
+    char *addr = capy_arena_alloc(arena, sizeof(capy_segment) + (capacity * vec->element_size), 16, false);
+
+    if (addr == NULL)
+    {
+        return ErrStd(ENOMEM);
+    }
+
+    capy_segment *segment = Cast(capy_segment *, addr);
+
+    segment->size = 0;
+    segment->capacity = capacity;
+    segment->items = addr + sizeof(capy_segment);
+    segment->next = NULL;
+
+    segvec_link(vec, segment);
+    vec->capacity += capacity;
+
+    return Ok;
+}
+
+static void segvec_link(capy_segvec *vec, capy_segment *segment)
+{
+    if (vec->tail == NULL)
+    {
+        vec->head = segment;
+    }
+    else
+    {
+        vec->tail->next = segment;
+    }
+
+    vec->tail = segment;
+}
+
 // PUBLIC DEFINITIONS
 
 MustCheck capy_err capy_vec_insert(capy_arena *arena, capy_vec *vec, size_t position, size_t count, const void *values)
@@ -79,3 +133,97 @@ capy_err capy_vec_delete(capy_vec *vec, size_t position, size_t count)
 
     return Ok;
 }
+
+capy_err capy_segvec_push(capy_arena *arena, capy_segvec *vec, size_t count, const void *values)
+{
+    const char *input = values;
+
+    while (count > 0)
+    {
+        capy_segment *tail = vec->tail;
+
+        if (tail == NULL || tail->size == tail->capacity)
+        {
+            capy_err err = segvec_grow(arena, vec, count);
+
+            if (err.code)
+            {
+                return err;
+            }
+
+            tail = vec->tail;
+        }
+
+        size_t available = tail->capacity - tail->size;
+        size_t n = (count < available) ? count : available;
+
+        memcpy(tail->items + (vec->element_size * tail->size), input, vec->element_size * n);
+
+        input += vec->element_size * n;
+        tail->size += n;
+        vec->size += n;
+        count -= n;
+    }
+
+    return Ok;
+}
+
+void *capy_segvec_reserve(capy_arena *arena, capy_segvec *vec, size_t count)
+{
+    capy_segment *tail = vec->tail;
+
+    if (tail == NULL || tail->capacity - tail->size < count)
+    {
+        if (segvec_grow(arena, vec, count).code)
+        {
+            return NULL;
+        }
+
+        tail = vec->tail;
+    }
+
+    void *addr = tail->items + (vec->element_size * tail->size);
+
+    tail->size += count;
+    vec->size += count;
+
+    return addr;
+}
+
+void *capy_segvec_at(capy_segvec *vec, size_t index)
+{
+    for (capy_segment *segment = vec->head; segment != NULL; segment = segment->next)
+    {
+        if (index < segment->size)
+        {
+            return segment->items + (vec->element_size * index);
+        }
+
+        index -= segment->size;
+    }
+
+    return NULL;
+}
+
+void capy_segvec_shl(capy_segvec *vec, size_t count)
+{
+    count = (count < vec->size) ? count : vec->size;
+    vec->size -= count;
+
+    while (count > 0)
+    {
+        capy_segment *head = vec->head;
+        size_t n = (count < head->size) ? count : head->size;
+
+        // consumed elements are dropped from the front, the rest of the segment stays writable
+        head->items += vec->element_size * n;
+        head->size -= n;
+        head->capacity -= n;
+        count -= n;
+
+        if (head->size == 0 && head != vec->tail)
+        {
+            vec->head = head->next;
+        }
+    }
+}
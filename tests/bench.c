@@ -0,0 +1,804 @@
+#include <capy/test.h>
+
+#include "../src/capy.c"
+
+typedef void(bench_definition)(size_t iterations);
+
+static volatile size_t bench_sink;
+
+static void runbench(bench_definition *bench, size_t iterations, const char *msg)
+{
+    struct timespec begin = capy_now();
+    bench(iterations);
+    int64_t elapsed = capy_timespec_diff(capy_now(), begin);
+
+    printf("%-60s %10zu ops %12.1f ns/op\n", msg, iterations, Cast(double, elapsed) / Cast(double, iterations));
+}
+
+// JSON
+
+typedef struct bench_jsonorder
+{
+    const char *id;
+    const char *customer;
+    int64_t quantity;
+    double price;
+    bool express;
+} bench_jsonorder;
+
+static const capy_jsonfield bench_jsonorder_fields[] = {
+    JsonField(bench_jsonorder, id, STRING, true),
+    JsonField(bench_jsonorder, customer, STRING, true),
+    JsonField(bench_jsonorder, quantity, INTEGER, true),
+    JsonField(bench_jsonorder, price, NUMBER, true),
+    JsonField(bench_jsonorder, express, BOOL, false),
+};
+
+static const capy_jsonschema bench_jsonorder_schema = JsonSchema(bench_jsonorder, bench_jsonorder_fields);
+
+static const char *bench_jsonorder_input =
+    "{\"id\": \"fe037abd-a9b8-4881-b875-a2f667e2e4ed\", \"customer\": \"capybara\", \"quantity\": 12,"
+    " \"price\": 149.99, \"express\": true, \"notes\": [\"fragile\", \"gift\"]}";
+
+static void bench_json_deserialize(size_t iterations)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+    void *mark = capy_arena_end(arena);
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        capy_jsonval value;
+        bench_jsonorder order;
+
+        Assert(ok, capy_json_deserialize(arena, &value, bench_jsonorder_input));
+
+        order.id = capy_json_object_get(value.object, "id")->string;
+        order.customer = capy_json_object_get(value.object, "customer")->string;
+        order.quantity = Cast(int64_t, capy_json_object_get(value.object, "quantity")->number);
+        order.price = capy_json_object_get(value.object, "price")->number;
+        order.express = capy_json_object_get(value.object, "express")->boolean;
+
+        bench_sink += Cast(size_t, order.quantity);
+        Assert(ok, capy_arena_free(arena, mark));
+    }
+
+    capy_arena_destroy(arena);
+}
+
+static void bench_json_decode(size_t iterations)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+    void *mark = capy_arena_end(arena);
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        bench_jsonorder order;
+
+        Assert(ok, capy_json_decode(arena, &bench_jsonorder_schema, &order, bench_jsonorder_input));
+
+        bench_sink += Cast(size_t, order.quantity);
+        Assert(ok, capy_arena_free(arena, mark));
+    }
+
+    capy_arena_destroy(arena);
+}
+
+static void bench_json_serialize(size_t iterations)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+
+    capy_jsonval value;
+    Assert(ok, capy_json_deserialize(arena, &value, bench_jsonorder_input));
+
+    capy_buffer *buffer = capy_buffer_init(arena, KiB(1));
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        buffer->size = 0;
+        Assert(ok, capy_json_serialize(buffer, value, 0));
+        bench_sink += buffer->size;
+    }
+
+    capy_arena_destroy(arena);
+}
+
+static void bench_json_encode(size_t iterations)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+
+    bench_jsonorder order;
+    Assert(ok, capy_json_decode(arena, &bench_jsonorder_schema, &order, bench_jsonorder_input));
+
+    capy_buffer *buffer = capy_buffer_init(arena, KiB(1));
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        buffer->size = 0;
+        Assert(ok, capy_json_encode(buffer, &bench_jsonorder_schema, &order));
+        bench_sink += buffer->size;
+    }
+
+    capy_arena_destroy(arena);
+}
+
+static void bench_json_deserialize_value(size_t iterations)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+    void *mark = capy_arena_end(arena);
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        capy_jsonval value;
+        Assert(ok, capy_json_deserialize(arena, &value, bench_jsonorder_input));
+
+        bench_sink += value.object->size;
+        Assert(ok, capy_arena_free(arena, mark));
+    }
+
+    capy_arena_destroy(arena);
+}
+
+static void bench_cbor_decode(size_t iterations)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+
+    capy_jsonval value;
+    Assert(ok, capy_json_deserialize(arena, &value, bench_jsonorder_input));
+
+    capy_buffer *buffer = capy_buffer_init(arena, KiB(1));
+    Assert(ok, capy_cbor_encode(buffer, value));
+
+    capy_string input = capy_string_bytes(buffer->size, buffer->data);
+    void *mark = capy_arena_end(arena);
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        Assert(ok, capy_cbor_decode(arena, &value, input));
+
+        bench_sink += value.object->size;
+        Assert(ok, capy_arena_free(arena, mark));
+    }
+
+    capy_arena_destroy(arena);
+}
+
+static void bench_cbor_encode(size_t iterations)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+
+    capy_jsonval value;
+    Assert(ok, capy_json_deserialize(arena, &value, bench_jsonorder_input));
+
+    capy_buffer *buffer = capy_buffer_init(arena, KiB(1));
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        buffer->size = 0;
+        Assert(ok, capy_cbor_encode(buffer, value));
+        bench_sink += buffer->size;
+    }
+
+    capy_arena_destroy(arena);
+}
+
+static capy_string bench_ndjson_input(capy_arena *arena, size_t lines)
+{
+    capy_buffer *buffer = capy_buffer_init(arena, MiB(4));
+
+    for (size_t i = 0; i < lines; i++)
+    {
+        Assert(ok, capy_buffer_write_cstr(buffer, bench_jsonorder_input));
+        Assert(ok, capy_buffer_write_cstr(buffer, "\n"));
+    }
+
+    return capy_string_bytes(buffer->size, buffer->data);
+}
+
+static void bench_ndjson_sequential(size_t iterations)
+{
+    capy_arena *arena = capy_arena_init(0, GiB(1));
+    capy_string input = bench_ndjson_input(arena, iterations);
+
+    while ((input = capy_string_ltrim(input, "\n")).size)
+    {
+        capy_jsonval value;
+        Assert(ok, json_deserialize(arena, &value, &input));
+        bench_sink += value.kind;
+    }
+
+    capy_arena_destroy(arena);
+}
+
+static void bench_ndjson_pipeline(size_t iterations)
+{
+    capy_arena *arena = capy_arena_init(0, GiB(1));
+    capy_string input = bench_ndjson_input(arena, iterations);
+
+    capy_ndjson *ndjson = capy_ndjson_init(arena, input, 0, 0);
+    capy_jsonbatch *batch;
+
+    for (;;)
+    {
+        Assert(ok, capy_ndjson_next(ndjson, &batch));
+
+        if (batch == NULL)
+        {
+            break;
+        }
+
+        bench_sink += batch->size;
+    }
+
+    Assert(ok, capy_ndjson_destroy(ndjson));
+    capy_arena_destroy(arena);
+}
+
+// STRING MAPS
+
+#define BENCH_STRMAP_KEYS 1000
+
+static void bench_strmap_keys(capy_arena *arena, capy_string *keys, const char *prefix)
+{
+    for (size_t i = 0; i < BENCH_STRMAP_KEYS; i++)
+    {
+        capy_buffer *buffer = capy_buffer_init(arena, 32);
+        Assert(ok, capy_buffer_write_fmt(buffer, 0, "%s-%zu", prefix, i));
+        keys[i] = capy_string_bytes(buffer->size, buffer->data);
+    }
+}
+
+static void bench_strmap_set(size_t iterations)
+{
+    capy_arena *arena = capy_arena_init(0, GiB(1));
+    capy_string keys[BENCH_STRMAP_KEYS];
+    bench_strmap_keys(arena, keys, "X-Header-Name");
+
+    void *mark = capy_arena_end(arena);
+    capy_strkvmap *map = NULL;
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        if (i % BENCH_STRMAP_KEYS == 0)
+        {
+            Assert(ok, capy_arena_free(arena, mark));
+            map = capy_strkvmap_init(arena, 8);
+        }
+
+        Assert(ok, capy_strkvmap_set(map, keys[i % BENCH_STRMAP_KEYS], keys[i % BENCH_STRMAP_KEYS]));
+    }
+
+    bench_sink += map->size;
+    capy_arena_destroy(arena);
+}
+
+static void bench_strmap_get(size_t iterations, const char *prefix, bool hashed)
+{
+    capy_arena *arena = capy_arena_init(0, GiB(1));
+    capy_string keys[BENCH_STRMAP_KEYS];
+    capy_string lookups[BENCH_STRMAP_KEYS];
+    capy_strkey hashes[BENCH_STRMAP_KEYS];
+    bench_strmap_keys(arena, keys, "X-Header-Name");
+    bench_strmap_keys(arena, lookups, prefix);
+
+    capy_strkvmap *map = capy_strkvmap_init(arena, 8);
+
+    for (size_t i = 0; i < BENCH_STRMAP_KEYS; i++)
+    {
+        Assert(ok, capy_strkvmap_set(map, keys[i], keys[i]));
+        hashes[i] = capy_strkey_init(lookups[i]);
+    }
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        if (hashed)
+        {
+            bench_sink += (capy_strmap_get_hashed(&map->strmap, hashes[i % BENCH_STRMAP_KEYS]) != NULL);
+        }
+        else
+        {
+            bench_sink += (capy_strkvmap_get(map, lookups[i % BENCH_STRMAP_KEYS]) != NULL);
+        }
+    }
+
+    capy_arena_destroy(arena);
+}
+
+static void bench_strmap_get_hit(size_t iterations)
+{
+    bench_strmap_get(iterations, "X-Header-Name", false);
+}
+
+static void bench_strmap_get_miss(size_t iterations)
+{
+    bench_strmap_get(iterations, "X-Header-Miss", false);
+}
+
+static void bench_strmap_get_hashed(size_t iterations)
+{
+    bench_strmap_get(iterations, "X-Header-Name", true);
+}
+
+static void bench_strmap_request(size_t iterations)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+    void *mark = capy_arena_end(arena);
+
+    capy_string keys[] = {
+        Str("Host"), Str("User-Agent"), Str("Accept"), Str("Accept-Encoding"), Str("Connection"), Str("Content-Length"),
+    };
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        // a keep-alive request: headers, trailers, params and query maps, mostly empty
+        capy_strkvnmap *headers = capy_strkvnmap_init(arena, 16);
+        capy_strkvnmap *trailers = capy_strkvnmap_init(arena, 4);
+        capy_strkvnmap *params = capy_strkvnmap_init(arena, 8);
+        capy_strkvnmap *query = capy_strkvnmap_init(arena, 8);
+
+        for (size_t j = 0; j < ArrLen(keys); j++)
+        {
+            Assert(ok, capy_strkvnmap_add(headers, keys[j], keys[j]));
+        }
+
+        bench_sink += (capy_strkvnmap_get(headers, Str("Content-Length")) != NULL);
+        bench_sink += (capy_strkvnmap_get(headers, Str("Transfer-Encoding")) != NULL);
+        bench_sink += trailers->size + params->size + query->size;
+
+        Assert(ok, capy_arena_free(arena, mark));
+    }
+
+    capy_arena_destroy(arena);
+}
+
+// Fills a map with BENCH_STRMAP_KEYS keys, stopping at the first rejected one, as a request carrying that many
+// header names would.
+static void bench_strmap_flood(size_t iterations, bool colliding)
+{
+    capy_arena *arena = capy_arena_init(0, GiB(1));
+    capy_string keys[BENCH_STRMAP_KEYS];
+    char buffer[32];
+
+    for (size_t i = 0, n = 0; i < BENCH_STRMAP_KEYS; n++)
+    {
+        int size = snprintf(buffer, sizeof(buffer), "X-Flood-%zu", n);
+        capy_string key = capy_string_bytes(Cast(size_t, size), buffer);
+
+        // colliding keys share the first probed group in indexes of up to 256 groups
+        if (colliding && ((capy_hash(key.data, key.size) >> 7) & 0xff) != 0)
+        {
+            continue;
+        }
+
+        Assert(ok, capy_string_copy(arena, &keys[i], key));
+        i += 1;
+    }
+
+    void *mark = capy_arena_end(arena);
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        capy_strkvnmap *map = capy_strkvnmap_init(arena, 16);
+
+        for (size_t j = 0; j < BENCH_STRMAP_KEYS && !capy_strkvnmap_set(map, keys[j], keys[j]).code; j++)
+        {
+            bench_sink += 1;
+        }
+
+        Assert(ok, capy_arena_free(arena, mark));
+    }
+
+    capy_arena_destroy(arena);
+}
+
+static void bench_strmap_flood_random(size_t iterations)
+{
+    bench_strmap_flood(iterations, false);
+}
+
+static void bench_strmap_flood_colliding(size_t iterations)
+{
+    bench_strmap_flood(iterations, true);
+}
+
+static void bench_cmap_get(size_t iterations)
+{
+    capy_arena *arena = capy_arena_init(0, GiB(1));
+    capy_string keys[BENCH_STRMAP_KEYS];
+    bench_strmap_keys(arena, keys, "X-Header-Name");
+
+    capy_cmap *map = capy_cmap_init(arena, 0, 0);
+    AssertNotNull(map);
+
+    for (size_t i = 0; i < BENCH_STRMAP_KEYS; i++)
+    {
+        Assert(ok, capy_cmap_set(map, keys[i], keys[i]));
+    }
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        bench_sink += (capy_cmap_get(map, keys[i % BENCH_STRMAP_KEYS]) != NULL);
+    }
+
+    capy_cmap_quiescent();
+    capy_cmap_destroy(map);
+    capy_arena_destroy(arena);
+}
+
+static void bench_cmap_get_locked(size_t iterations)
+{
+    capy_arena *arena = capy_arena_init(0, GiB(1));
+    capy_string keys[BENCH_STRMAP_KEYS];
+    bench_strmap_keys(arena, keys, "X-Header-Name");
+
+    // the alternative to capy_cmap: one map behind a mutex shared by all workers
+    mtx_t lock;
+    AssertEqS(mtx_init(&lock, mtx_plain), thrd_success);
+    capy_strkvmap *map = capy_strkvmap_init(arena, 8);
+
+    for (size_t i = 0; i < BENCH_STRMAP_KEYS; i++)
+    {
+        Assert(ok, capy_strkvmap_set(map, keys[i], keys[i]));
+    }
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        mtx_lock(&lock);
+        bench_sink += (capy_strkvmap_get(map, keys[i % BENCH_STRMAP_KEYS]) != NULL);
+        mtx_unlock(&lock);
+    }
+
+    mtx_destroy(&lock);
+    capy_arena_destroy(arena);
+}
+
+// ARENAS
+
+// A keep-alive connection alternating large and small requests, rewinding after each one.
+static void bench_arena_alternating(size_t iterations, capy_arenapolicy policy)
+{
+    capy_arena *arena = capy_arena_init(KiB(12), MiB(2));
+    capy_arena_set_policy(arena, policy);
+    void *mark = capy_arena_end(arena);
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        size_t size = (i % 2) ? KiB(1) : KiB(256);
+        char *data = capy_arena_alloc(arena, size, 0, false);
+        AssertNotNull(data);
+
+        for (size_t j = 0; j < size; j += KiB(4))
+        {
+            data[j] = 1;
+        }
+
+        Assert(ok, capy_arena_free(arena, mark));
+    }
+
+    bench_sink += capy_arena_stats(arena).syscalls;
+    capy_arena_destroy(arena);
+}
+
+static void bench_arena_protect(size_t iterations)
+{
+    bench_arena_alternating(iterations, (capy_arenapolicy){.decommit = CAPY_ARENA_PROTECT});
+}
+
+static void bench_arena_madvise(size_t iterations)
+{
+    bench_arena_alternating(iterations, (capy_arenapolicy){.decommit = CAPY_ARENA_MADV_FREE});
+}
+
+static void bench_arena_decay(size_t iterations)
+{
+    bench_arena_alternating(iterations, (capy_arenapolicy){.decommit = CAPY_ARENA_MADV_FREE, .shrink_ratio = 8, .decay = Seconds(1)});
+}
+
+#define BENCH_ARENA_SIZE MiB(256)
+
+// Allocates BENCH_ARENA_SIZE in 64 KiB blocks, touching every page, then does `iterations` random reads.
+static void bench_arena_touch(size_t iterations, int flags, bool reads)
+{
+    capy_arena *arena = capy_arena_init_flags(0, BENCH_ARENA_SIZE + MiB(2), flags);
+    AssertNotNull(arena);
+
+    char *begin = capy_arena_end(arena);
+
+    for (size_t i = 0; i < BENCH_ARENA_SIZE / KiB(64); i++)
+    {
+        char *block = capy_arena_alloc(arena, KiB(64), 0, false);
+        AssertNotNull(block);
+
+        for (size_t j = 0; j < KiB(64); j += KiB(4))
+        {
+            block[j] = Cast(char, j);
+        }
+    }
+
+    uint64_t state = 0x9e3779b97f4a7c15;
+    size_t sum = 0;
+
+    for (size_t i = 0; reads && i < iterations; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        sum += Cast(size_t, begin[state % BENCH_ARENA_SIZE]);
+    }
+
+    bench_sink += sum;
+    capy_arena_destroy(arena);
+}
+
+static void bench_arena_touch_pages(Unused size_t iterations)
+{
+    bench_arena_touch(0, 0, false);
+}
+
+static void bench_arena_touch_hugepages(Unused size_t iterations)
+{
+    bench_arena_touch(0, CAPY_ARENA_HUGEPAGES, false);
+}
+
+static void bench_arena_reads_pages(size_t iterations)
+{
+    bench_arena_touch(iterations, 0, true);
+}
+
+static void bench_arena_reads_hugepages(size_t iterations)
+{
+    bench_arena_touch(iterations, CAPY_ARENA_HUGEPAGES, true);
+}
+
+// BUFFERS
+
+// Accumulates a 64 KiB body in 100-byte writes while other allocations interleave in the same arena.
+static void bench_body_buffer(size_t iterations)
+{
+    char chunk[100] = {0};
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        capy_arena *arena = capy_arena_init(0, MiB(1));
+        capy_buffer *body = capy_buffer_init(arena, 256);
+
+        while (body->size < KiB(64))
+        {
+            AssertOk(capy_buffer_write_bytes(body, sizeof(chunk), chunk));
+            AssertNotNull(Make(arena, char, 16));
+        }
+
+        bench_sink += capy_arena_used(arena);
+        capy_arena_destroy(arena);
+    }
+}
+
+static void bench_body_segbuf(size_t iterations)
+{
+    char chunk[100] = {0};
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        capy_arena *arena = capy_arena_init(0, MiB(1));
+        capy_segbuf *body = capy_segbuf_init(arena, 256);
+
+        while (body->size < KiB(64))
+        {
+            AssertOk(capy_segbuf_write_bytes(body, sizeof(chunk), chunk));
+            AssertNotNull(Make(arena, char, 16));
+        }
+
+        bench_sink += capy_arena_used(arena);
+        capy_arena_destroy(arena);
+    }
+}
+
+// POOLS
+
+#define BENCH_POOL_LIVE 64
+
+// Replaces one of BENCH_POOL_LIVE live 48-byte objects per iteration, like a cache evicting entries.
+static void bench_pool(size_t iterations, int mode)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+    capy_pool *pool = capy_pool_init(arena, 48, 0);
+    AssertNotNull(pool);
+
+    capy_poolcache cache = capy_poolcache_init(pool);
+    void *live[BENCH_POOL_LIVE] = {0};
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        void **slot = live + (i % BENCH_POOL_LIVE);
+
+        switch (mode)
+        {
+            case 0:
+                capy_pool_free(pool, *slot);
+                *slot = capy_pool_alloc(pool, false);
+                break;
+
+            case 1:
+                capy_poolcache_free(&cache, *slot);
+                *slot = capy_poolcache_alloc(&cache, false);
+                break;
+
+            default:
+                free(*slot);
+                *slot = malloc(48);
+                break;
+        }
+
+        AssertNotNull(*slot);
+        bench_sink += Cast(uintptr_t, *slot) & 1;
+    }
+
+    for (size_t i = 0; mode == 2 && i < BENCH_POOL_LIVE; i++)
+    {
+        free(live[i]);
+    }
+
+    capy_pool_destroy(pool);
+    capy_arena_destroy(arena);
+}
+
+static void bench_pool_owner(size_t iterations)
+{
+    bench_pool(iterations, 0);
+}
+
+static void bench_pool_cache(size_t iterations)
+{
+    bench_pool(iterations, 1);
+}
+
+static void bench_pool_malloc(size_t iterations)
+{
+    bench_pool(iterations, 2);
+}
+
+// LOGGING
+
+// Logs a request line per iteration to an unbuffered /dev/null, as stderr would be.
+static void bench_log(size_t iterations, capy_logmode mode)
+{
+    FILE *file = fopen("/dev/null", "w");
+    AssertNotNull(file);
+    setvbuf(file, NULL, _IONBF, 0);
+
+    Assert(ok, capy_logger_init(file, mode));
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        LogInf("GET /orders/%zu 200 %zu bytes", i, i % 4096);
+    }
+
+    capy_logger_flush();
+    bench_sink += capy_logger_dropped();
+
+    Assert(ok, capy_logger_init(file, CAPY_LOG_SYNC));
+    logger.mask = 0;
+    fclose(file);
+}
+
+static void bench_log_sync(size_t iterations)
+{
+    bench_log(iterations, CAPY_LOG_SYNC);
+}
+
+static void bench_log_async(size_t iterations)
+{
+    bench_log(iterations, CAPY_LOG_ASYNC_BLOCK);
+}
+
+static void bench_log_deferred(size_t iterations)
+{
+    bench_log(iterations, CAPY_LOG_ASYNC_BLOCK | CAPY_LOG_DEFERRED);
+}
+
+Format(3) static size_t bench_log_record(char *buffer, bool deferred, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t n = (deferred) ? logrecord_encode(buffer, CAPY_LOG_INFO, format, args)
+                          : logger_format(buffer, CAPY_LOG_INFO, format, args);
+    va_end(args);
+
+    return n;
+}
+
+// Cost paid by the logging thread alone, without the ring and the flusher.
+static void bench_log_capture(size_t iterations, bool deferred)
+{
+    char buffer[LOG_RECORD_MAX];
+    logger.timefmt = "%F %T";
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        bench_sink += bench_log_record(buffer, deferred, "GET /orders/%zu 200 %zu bytes", i, i % 4096);
+    }
+}
+
+static void bench_log_format(size_t iterations)
+{
+    bench_log_capture(iterations, false);
+}
+
+static void bench_log_encode(size_t iterations)
+{
+    bench_log_capture(iterations, true);
+}
+
+// HISTOGRAMS
+
+static void bench_histogram_record(size_t iterations)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+    capy_histogram *histogram = capy_histogram_init(arena);
+    AssertNotNull(histogram);
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        capy_histogram_record(histogram, (i * 2654435761u) % SecondsNano(1));
+    }
+
+    bench_sink += capy_histogram_percentile(histogram, 99);
+    capy_arena_destroy(arena);
+}
+
+int main(void)
+{
+    printf("Running benchmarks...\n\n");
+
+    // JSON
+    runbench(bench_json_deserialize, 200000, "capy_json_deserialize + capy_json_object_get");
+    runbench(bench_json_decode, 200000, "capy_json_decode");
+    runbench(bench_json_serialize, 200000, "capy_json_serialize");
+    runbench(bench_json_encode, 200000, "capy_json_encode");
+    runbench(bench_json_deserialize_value, 200000, "capy_json_deserialize");
+    runbench(bench_cbor_decode, 200000, "capy_cbor_decode");
+    runbench(bench_cbor_encode, 200000, "capy_cbor_encode");
+    runbench(bench_ndjson_sequential, 200000, "NDJSON parsed on a single thread");
+    runbench(bench_ndjson_pipeline, 200000, "capy_ndjson pipeline");
+
+
+    // STRING MAPS
+    runbench(bench_strmap_set, 2000000, "capy_strkvmap_set (1000 keys)");
+    runbench(bench_strmap_get_hit, 2000000, "capy_strkvmap_get hit (1000 keys)");
+    runbench(bench_strmap_get_miss, 2000000, "capy_strkvmap_get miss (1000 keys)");
+    runbench(bench_strmap_get_hashed, 2000000, "capy_strmap_get_hashed hit (1000 keys)");
+    runbench(bench_strmap_request, 1000000, "per-request maps (6 headers, 2 lookups)");
+    runbench(bench_strmap_flood_random, 20000, "map of 1000 random keys");
+    runbench(bench_strmap_flood_colliding, 20000, "map of 1000 colliding keys (rejected at probe limit)");
+    runbench(bench_cmap_get, 2000000, "capy_cmap_get hit (1000 keys)");
+    runbench(bench_cmap_get_locked, 2000000, "capy_strkvmap_get hit behind a mutex (1000 keys)");
+
+    // Arenas
+    runbench(bench_arena_protect, 20000, "alternating 256/1 KiB requests, mprotect decommit");
+    runbench(bench_arena_madvise, 20000, "alternating 256/1 KiB requests, MADV_FREE decommit");
+    runbench(bench_arena_decay, 20000, "alternating 256/1 KiB requests, MADV_FREE + 1s decay");
+    runbench(bench_arena_touch_pages, BENCH_ARENA_SIZE / KiB(4), "256 MiB alloc + touch, 4 KiB pages (per page)");
+    runbench(bench_arena_touch_hugepages, BENCH_ARENA_SIZE / KiB(4), "256 MiB alloc + touch, huge pages (per 4 KiB)");
+    runbench(bench_arena_reads_pages, 50000000, "random reads over 256 MiB, 4 KiB pages");
+    runbench(bench_arena_reads_hugepages, 50000000, "random reads over 256 MiB, huge pages");
+
+    // BUFFERS
+    runbench(bench_body_buffer, 5000, "64 KiB body in 100-byte writes, capy_buffer");
+    runbench(bench_body_segbuf, 5000, "64 KiB body in 100-byte writes, capy_segbuf");
+
+    // POOLS
+    runbench(bench_pool_owner, 10000000, "capy_pool_(free|alloc) (64 live objects)");
+    runbench(bench_pool_cache, 10000000, "capy_poolcache_(free|alloc) (64 live objects)");
+    runbench(bench_pool_malloc, 10000000, "free/malloc (64 live objects)");
+
+    // LOGGING
+    runbench(bench_log_sync, 1000000, "capy_log, synchronous");
+    runbench(bench_log_async, 1000000, "capy_log, asynchronous (ring + flush thread)");
+    runbench(bench_log_deferred, 1000000, "capy_log, asynchronous with deferred formatting");
+    runbench(bench_log_format, 1000000, "record formatted by the logging thread");
+    runbench(bench_log_encode, 1000000, "record captured by the logging thread (deferred)");
+
+    // HISTOGRAMS
+    runbench(bench_histogram_record, 10000000, "capy_histogram_record");
+
+    return 0;
+}
@@ -282,6 +282,276 @@ static int test_capy_arena_realloc(void)
     return true;
 }
 
+static int test_capy_arena_hugepages(void)
+{
+    int flags[] = {CAPY_ARENA_HUGEPAGES, CAPY_ARENA_HUGETLB};
+
+    for (size_t i = 0; i < ArrLen(flags); i++)
+    {
+        capy_arena *arena = capy_arena_init_flags(0, MiB(7), flags[i]);
+        ExpectNotNull(arena);
+        ExpectEqU(Cast(uintptr_t, arena) % MiB(2), 0);
+        ExpectEqU(capy_arena_stats(arena).committed, MiB(2));
+        ExpectEqU(capy_arena_available(arena), MiB(8) - capy_arena_used(arena));
+
+        char *data = capy_arena_alloc(arena, MiB(3), 0, true);
+        ExpectNotNull(data);
+        data[MiB(3) - 1] = 1;
+        ExpectEqU(capy_arena_stats(arena).committed, MiB(4));
+
+        capy_arena_destroy(arena);
+    }
+
+    return true;
+}
+
+static int test_capy_arena_policy(void)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+    void *end = capy_arena_end(arena);
+
+    // default policy decommits with mprotect as soon as usage drops to a quarter
+    ExpectNotNull(capy_arena_alloc(arena, KiB(256), 0, false));
+    ExpectOk(capy_arena_free(arena, end));
+
+    capy_arenastats stats = capy_arena_stats(arena);
+    ExpectEqU(stats.grows, 1);
+    ExpectEqU(stats.shrinks, 1);
+    ExpectEqU(stats.syscalls, 2);
+    ExpectLtU(stats.committed, KiB(256));
+    ExpectGteU(stats.peak, KiB(256));
+
+    // madvise keeps pages mapped, growing back doesn't need a syscall
+    capy_arena_set_policy(arena, (capy_arenapolicy){.decommit = CAPY_ARENA_MADV_DONTNEED});
+    ExpectNotNull(capy_arena_alloc(arena, KiB(256), 0, true));
+    ExpectOk(capy_arena_free(arena, end));
+    ExpectNotNull(capy_arena_alloc(arena, KiB(256), 0, true));
+    ExpectOk(capy_arena_free(arena, end));
+
+    stats = capy_arena_stats(arena);
+    ExpectEqU(stats.grows, 3);
+    ExpectEqU(stats.shrinks, 3);
+    ExpectEqU(stats.syscalls, 5);
+
+    // retained memory and decay keep capacity committed
+    capy_arena_set_policy(arena, (capy_arenapolicy){.decommit = CAPY_ARENA_MADV_FREE, .retain = KiB(128), .decay = Seconds(60)});
+    ExpectNotNull(capy_arena_alloc(arena, KiB(256), 0, false));
+    ExpectOk(capy_arena_free(arena, end));
+    ExpectEqU(capy_arena_stats(arena).shrinks, 3);
+
+    capy_arena_set_policy(arena, (capy_arenapolicy){.decommit = CAPY_ARENA_MADV_FREE, .retain = KiB(128)});
+    ExpectNotNull(capy_arena_alloc(arena, KiB(1), 0, false));
+    ExpectOk(capy_arena_free(arena, end));
+    ExpectEqU(capy_arena_stats(arena).shrinks, 4);
+    ExpectEqU(capy_arena_stats(arena).committed, KiB(128));
+
+    capy_arena_destroy(arena);
+    return true;
+}
+
+static int test_capy_membudget(void)
+{
+    capy_arena *arena = capy_arena_init(0, KiB(64));
+
+    capy_membudget *process = capy_membudget_init(arena, KiB(256), NULL);
+    capy_membudget *worker = capy_membudget_init(arena, KiB(192), process);
+    ExpectNotNull(process);
+    ExpectNotNull(worker);
+
+    capy_arena *a = capy_arena_init(0, MiB(1));
+    capy_arena *b = capy_arena_init(0, MiB(1));
+    size_t base = capy_arena_stats(a).committed;
+
+    capy_arena_set_budget(a, worker);
+    capy_arena_set_budget(b, process);
+    capy_arena_set_policy(a, (capy_arenapolicy){.decommit = CAPY_ARENA_MADV_FREE, .decay = Seconds(60)});
+    ExpectEqU(capy_membudget_stats(worker).used, base);
+    ExpectEqU(capy_membudget_stats(process).used, base * 2);
+    ExpectFalse(capy_membudget_pressure(worker));
+
+    // the worker limit refuses growth before the process one
+    ExpectNotNull(capy_arena_alloc(a, KiB(100), 0, false));
+    ExpectNull(capy_arena_alloc(a, KiB(200), 0, false));
+    ExpectEqU(capy_membudget_stats(worker).used, capy_arena_stats(a).committed);
+    ExpectEqU(capy_membudget_stats(worker).rejected, 1);
+    ExpectEqU(capy_membudget_stats(process).rejected, 0);
+
+    ExpectNotNull(capy_arena_alloc(b, KiB(100), 0, false));
+    ExpectNull(capy_arena_alloc(b, KiB(60), 0, false));
+    ExpectEqU(capy_membudget_stats(process).rejected, 1);
+    ExpectTrue(capy_membudget_pressure(worker));
+    ExpectLtU(capy_membudget_available(worker), KiB(16));
+    ExpectGteU(capy_membudget_stats(process).peak, KiB(256) - KiB(16));
+
+    // decommitted and destroyed memory is refunded
+    ExpectOk(capy_arena_free(a, Cast(char *, a) + KiB(1)));
+    ExpectGtU(capy_arena_stats(a).committed, KiB(100));
+    ExpectOk(capy_arena_trim(a));
+    ExpectEqU(capy_arena_stats(a).committed, base);
+    ExpectEqU(capy_membudget_stats(worker).used, base);
+
+    capy_arena_destroy(a);
+    capy_arena_destroy(b);
+    ExpectEqU(capy_membudget_stats(worker).used, 0);
+    ExpectEqU(capy_membudget_stats(process).used, 0);
+
+    httpconn conn = {.budget = worker, .request = {.content_length = KiB(512)}};
+    ExpectFalse(httpconn_admit_content(&conn));
+
+    capy_arena_destroy(arena);
+    return true;
+}
+
+static int test_capy_arena_mark(void)
+{
+    capy_arena *arena = capy_arena_init(0, KiB(32));
+
+    void *end = capy_arena_end(arena);
+    capy_arenamark mark = capy_arena_mark(arena);
+    ExpectNotNull(capy_arena_alloc(arena, KiB(16), 0, false));
+    ExpectOk(capy_arena_rewind(mark));
+    ExpectEqPtr(capy_arena_end(arena), end);
+
+    capy_arenamark outer = capy_scratch_begin(NULL);
+    ExpectNotNull(outer.arena);
+    ExpectNotNull(Make(outer.arena, char, KiB(8)));
+
+    capy_arenamark inner = capy_scratch_begin(outer.arena);
+    ExpectNotNull(inner.arena);
+    ExpectNePtr(inner.arena, outer.arena);
+    ExpectNotNull(Make(inner.arena, char, KiB(8)));
+    capy_scratch_end(inner);
+    ExpectEqU(capy_arena_used(inner.arena), inner.used);
+
+    capy_scratch_end(outer);
+    ExpectEqU(capy_arena_used(outer.arena), outer.used);
+
+    capy_arena_destroy(arena);
+    return true;
+}
+
+static int test_capy_allocprof(void)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+
+    capy_allocprof_enable(true);
+    capy_allocprof_phase("test");
+
+    for (int i = 0; i < 3; i++)
+    {
+        ExpectNotNull(capy_arena_alloc_at(arena, 100, 8, false, "test.c", 1));
+    }
+
+    ExpectNotNull(capy_arena_alloc_at(arena, 1000, 8, false, "test.c", 2));
+
+    capy_allocprof_phase(NULL);
+    ExpectNotNull(capy_arena_alloc_at(arena, 10, 8, false, "test.c", 1));
+
+    capy_allocprof_enable(false);
+    ExpectNotNull(capy_arena_alloc_at(arena, 10, 8, false, "test.c", 1));
+
+    capy_allocsite *sites;
+    size_t size;
+    uint64_t dropped;
+
+    ExpectOk(capy_allocprof_sites(arena, &sites, &size, &dropped));
+    ExpectEqU(dropped, 0);
+
+    capy_allocsite *first = NULL;
+    capy_allocsite *second = NULL;
+    capy_allocsite *unphased = NULL;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        ExpectTrue(i == 0 || sites[i - 1].bytes >= sites[i].bytes);
+
+        if (strcmp(sites[i].file, "test.c") != 0)
+        {
+            continue;
+        }
+
+        if (sites[i].phase == NULL)
+        {
+            unphased = sites + i;
+        }
+        else if (sites[i].line == 1)
+        {
+            first = sites + i;
+        }
+        else
+        {
+            second = sites + i;
+        }
+    }
+
+    ExpectNotNull(first);
+    ExpectNotNull(second);
+    ExpectNotNull(unphased);
+
+    ExpectEqCstr(first->phase, "test");
+    ExpectEqU(first->count, 3);
+    ExpectEqU(first->bytes, 300);
+    ExpectEqU(second->count, 1);
+    ExpectEqU(second->bytes, 1000);
+    ExpectEqU(unphased->count, 1);
+    ExpectEqU(unphased->bytes, 10);
+    ExpectTrue(second < first && first < unphased);
+
+    capy_buffer *buffer = capy_buffer_init(arena, 1024);
+    ExpectOk(capy_allocprof_write(arena, buffer));
+    ExpectOk(capy_buffer_write_null(buffer));
+    ExpectNotNull(strstr(buffer->data, "           300          3  test     test.c:1\n"));
+    ExpectNotNull(strstr(buffer->data, "            10          1  -        test.c:1\n"));
+
+    capy_arena_destroy(arena);
+    return true;
+}
+
+static capy_err test_scratch_handler(capy_arena *arena, Unused capy_httpreq *request, capy_httpresp *response)
+{
+    // borrowed and never returned
+    capy_arenamark scratch = capy_scratch_begin(arena);
+
+    if (Make(scratch.arena, char, KiB(16)) == NULL)
+    {
+        return ErrStd(ENOMEM);
+    }
+
+    response->status = CAPY_HTTP_OK;
+    return Ok;
+}
+
+static int test_httprouter_scratch(void)
+{
+    capy_arena *arena = capy_arena_init(0, KiB(64));
+
+    capy_httproute routes[] = {{.method = CAPY_HTTP_GET, .path = Str("/scratch"), .handler = test_scratch_handler}};
+    httprouter *router = httprouter_init(arena, ArrLen(routes), routes);
+    ExpectNotNull(router);
+
+    capy_httpreq request = {
+        .method = CAPY_HTTP_GET,
+        .uri = {.path = Str("/scratch")},
+        .params = capy_strkvnmap_init(arena, 8),
+    };
+
+    capy_httpresp response = {.headers = capy_strkvnmap_init(arena, 8), .body = capy_buffer_init(arena, 256)};
+
+    capy_arenamark scratch = capy_scratch_begin(arena);
+    capy_scratch_end(scratch);
+
+    size_t id;
+
+    ExpectOk(httprouter_handle_request(arena, router, &request, &response, &id));
+    ExpectEqS(response.status, CAPY_HTTP_OK);
+    ExpectEqU(id, 1);
+    ExpectEqU(capy_arena_used(scratch.arena), scratch.used);
+    ExpectEqU(scratch_depth, 0);
+
+    capy_arena_destroy(arena);
+    return true;
+}
+
 static int test_http_parse_method(void)
 {
     ExpectEqS(http_parse_method(Str("GET")), CAPY_HTTP_GET);
@@ -430,6 +700,532 @@ static int test_http_parse_field(void)
     return true;
 }
 
+static int test_capy_pool(void)
+{
+    capy_arena *arena = capy_arena_init(0, KiB(64));
+    capy_pool *pool = capy_pool_init(arena, 3, 16);
+    ExpectNotNull(pool);
+
+    char *a = capy_pool_alloc(pool, true);
+    char *b = capy_pool_alloc(pool, false);
+    ExpectNotNull(a);
+    ExpectNotNull(b);
+    ExpectEqU(Cast(uintptr_t, a) % 16, 0);
+    ExpectEqU(Cast(uintptr_t, b) % 16, 0);
+    ExpectNePtr(a, b);
+
+    // freed objects are reused before the arena grows
+    size_t used = capy_arena_used(arena);
+    capy_pool_free(pool, a);
+    ExpectEqU(capy_pool_available(pool), 1);
+    ExpectEqPtr(capy_pool_alloc(pool, false), a);
+    ExpectEqU(capy_arena_used(arena), used);
+
+    capy_poolcache cache = capy_poolcache_init(pool);
+    char *c = capy_poolcache_alloc(&cache, true);
+    ExpectNotNull(c);
+    ExpectEqU(cache.size, POOL_BATCH - 1);
+
+    for (size_t i = 0; i < 3; i++)
+    {
+        ExpectEqS(c[i], 0);
+    }
+
+    capy_poolcache_free(&cache, a);
+    capy_poolcache_free(&cache, b);
+    capy_poolcache_free(&cache, c);
+    ExpectEqU(cache.size, POOL_BATCH + 2);
+
+    capy_poolcache_flush(&cache);
+    ExpectEqU(cache.size, 0);
+    ExpectEqU(capy_pool_available(pool), POOL_BATCH + 2);
+
+    // exhausted arenas fail allocations
+    capy_pool *large = capy_pool_init(arena, KiB(8), 0);
+    ExpectNotNull(large);
+
+    size_t count = 0;
+
+    while (capy_pool_alloc(large, false) != NULL)
+    {
+        count += 1;
+    }
+
+    ExpectGteU(count, 1);
+    ExpectLtU(count, 8);
+
+    // caches take fewer objects when a full batch doesn't fit
+    capy_arena *small = capy_arena_init(0, KiB(64));
+    capy_pool *partial = capy_pool_init(small, KiB(4), 0);
+    ExpectNotNull(partial);
+
+    capy_poolcache refill = capy_poolcache_init(partial);
+    ExpectNotNull(capy_poolcache_alloc(&refill, false));
+    ExpectGteU(refill.size, 1);
+    ExpectLtU(refill.size, POOL_BATCH - 1);
+
+    capy_pool_destroy(partial);
+    capy_arena_destroy(small);
+    capy_pool_destroy(large);
+    capy_pool_destroy(pool);
+    capy_arena_destroy(arena);
+    return true;
+}
+
+static int test_capy_pool_worker(void *data)
+{
+    capy_pool *pool = data;
+    capy_poolcache cache = capy_poolcache_init(pool);
+    uint64_t *objects[100];
+
+    for (int round = 0; round < 200; round++)
+    {
+        for (size_t i = 0; i < ArrLen(objects); i++)
+        {
+            objects[i] = capy_poolcache_alloc(&cache, false);
+
+            if (objects[i] == NULL)
+            {
+                return false;
+            }
+
+            *objects[i] = Cast(uint64_t, round) * 1000 + i;
+        }
+
+        for (size_t i = 0; i < ArrLen(objects); i++)
+        {
+            if (*objects[i] != Cast(uint64_t, round) * 1000 + i)
+            {
+                return false;
+            }
+
+            capy_poolcache_free(&cache, objects[i]);
+        }
+    }
+
+    capy_poolcache_flush(&cache);
+    return true;
+}
+
+static int test_capy_pool_threads(void)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+    capy_pool *pool = capy_pool_init(arena, sizeof(uint64_t), 0);
+    ExpectNotNull(pool);
+
+    thrd_t workers[4];
+
+    for (size_t i = 0; i < ArrLen(workers); i++)
+    {
+        ExpectEqS(thrd_create(workers + i, test_capy_pool_worker, pool), thrd_success);
+    }
+
+    for (size_t i = 0; i < ArrLen(workers); i++)
+    {
+        int result = false;
+        ExpectEqS(thrd_join(workers[i], &result), thrd_success);
+        ExpectTrue(result);
+    }
+
+    // every object carved by the workers is back in the pool, at most 100 plus a cached batch per worker
+    size_t available = capy_pool_available(pool);
+    ExpectLtU(available, ArrLen(workers) * (100 + (2 * POOL_BATCH)) + 1);
+    ExpectGtU(capy_arena_used(arena) / sizeof(uint64_t), available);
+
+    capy_pool_destroy(pool);
+    capy_arena_destroy(arena);
+    return true;
+}
+
+static int test_capy_logger_worker(Unused void *data)
+{
+    for (int i = 0; i < 500; i++)
+    {
+        LogInf("record %d", i);
+    }
+
+    return true;
+}
+
+static size_t test_capy_logger_count(FILE *file)
+{
+    char line[LOG_RECORD_MAX];
+    size_t count = 0;
+
+    rewind(file);
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        count += (strstr(line, "[INF] record ") != NULL);
+    }
+
+    return count;
+}
+
+static int test_capy_logger(void)
+{
+    capy_logmode modes[] = {CAPY_LOG_ASYNC_BLOCK, CAPY_LOG_ASYNC_DROP, CAPY_LOG_ASYNC_BLOCK | CAPY_LOG_DEFERRED};
+
+    for (size_t m = 0; m < ArrLen(modes); m++)
+    {
+        FILE *file = tmpfile();
+        AssertNotNull(file);
+
+        atomic_store(&logflusher.dropped, 0);
+        logflusher.reported = 0;
+
+        AssertOk(capy_logger_init(file, modes[m]));
+
+        thrd_t workers[4];
+
+        for (size_t i = 0; i < ArrLen(workers); i++)
+        {
+            ExpectEqS(thrd_create(workers + i, test_capy_logger_worker, NULL), thrd_success);
+        }
+
+        for (size_t i = 0; i < ArrLen(workers); i++)
+        {
+            ExpectEqS(thrd_join(workers[i], NULL), thrd_success);
+        }
+
+        capy_logger_flush();
+
+        // blocking producers never lose records, dropped ones are accounted for
+        size_t dropped = capy_logger_dropped();
+        ExpectEqU(test_capy_logger_count(file) + dropped, ArrLen(workers) * 500);
+
+        if (modes[m] != CAPY_LOG_ASYNC_DROP)
+        {
+            ExpectEqU(dropped, 0);
+        }
+
+        logflusher_stop();
+        fclose(file);
+    }
+
+    // records that can't be written are counted as dropped instead of blocking producers
+    FILE *file = fopen("/dev/null", "r");
+    AssertNotNull(file);
+
+    atomic_store(&logflusher.dropped, 0);
+    logflusher.reported = 0;
+
+    AssertOk(capy_logger_init(file, CAPY_LOG_ASYNC_BLOCK));
+
+    test_capy_logger_worker(NULL);
+    capy_logger_flush();
+
+    ExpectEqU(capy_logger_dropped(), 500);
+
+    logflusher_stop();
+    fclose(file);
+
+    logger.file = NULL;
+    logger.mask = 0;
+    return true;
+}
+
+Format(2) static void test_capy_logrecord_encode(char *record, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    logrecord_encode(record, CAPY_LOG_INFO, format, args);
+    va_end(args);
+}
+
+Format(3) static int test_capy_logrecord_expect(char *record, char *message, const char *format, ...)
+{
+    char expected[LOG_RECORD_MAX];
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(expected, sizeof(expected), format, args);
+    va_end(args);
+
+    va_start(args, format);
+    logrecord_encode(record, CAPY_LOG_INFO, format, args);
+    va_end(args);
+
+    size_t n = logrecord_message(record, message, LOG_RECORD_MAX);
+    message[n] = 0;
+
+    ExpectEqStr(capy_string_cstr(message), capy_string_cstr(expected));
+    return true;
+}
+
+static int test_capy_logrecord(void)
+{
+    char record[LOG_RECORD_MAX];
+    char message[LOG_RECORD_MAX];
+    capy_string name = Str("capybara-name");
+    long double ratio = 0.25L;
+
+    ExpectTrue(test_capy_logrecord_expect(record, message, "no arguments, 100%% literal"));
+    ExpectTrue(test_capy_logrecord_expect(record, message, "%d %i %5d %-5d| %+d %05d", -1, 2, 3, 4, 5, -6));
+    ExpectTrue(test_capy_logrecord_expect(record, message, "%hhd %hd %ld %lld %jd %zd %td", 300, 70000, -7L, -8LL, Cast(intmax_t, 9), Cast(size_t, 10), Cast(ptrdiff_t, -11)));
+    ExpectTrue(test_capy_logrecord_expect(record, message, "%u %x %#X %o %hhu %zu %-8zu|", 1u, 255u, 255u, 8u, 511u, SIZE_MAX, Cast(size_t, 42)));
+    ExpectTrue(test_capy_logrecord_expect(record, message, "%3" PRIi64 " %" PRIu64, INT64_MIN, UINT64_MAX));
+    ExpectTrue(test_capy_logrecord_expect(record, message, "%f %.2f %10.3e %g %Lf", 1.5, 2.125, 31415.9, 1e-9, ratio));
+    ExpectTrue(test_capy_logrecord_expect(record, message, "%c%c %p %p", 'o', 'k', Cast(void *, record), NULL));
+    ExpectTrue(test_capy_logrecord_expect(record, message, "%s|%-21s|%8s|%.3s", "text", "left", "right", "truncated"));
+    ExpectTrue(test_capy_logrecord_expect(record, message, "%.*s %*d %-*.*s|", Cast(int, name.size - 5), name.data, 6, 7, 8, 2, "abc"));
+
+    // strings are copied, the record outlives them
+    char scratch[] = "original";
+    test_capy_logrecord_encode(record, "%s", scratch);
+    scratch[0] = 'X';
+    size_t n = logrecord_message(record, message, LOG_RECORD_MAX);
+    message[n] = 0;
+    ExpectEqStr(capy_string_cstr(message), Str("original"));
+
+    // arguments that don't fit are left out
+    char large[LOG_RECORD_MAX + 100];
+    memset(large, 'a', sizeof(large) - 1);
+    large[sizeof(large) - 1] = 0;
+    test_capy_logrecord_encode(record, "%s %d!", large, 1);
+    n = logrecord_message(record, message, LOG_RECORD_MAX);
+    message[n] = 0;
+    ExpectLtU(n, LOG_RECORD_MAX);
+    ExpectEqS(message[0], 'a');
+    ExpectNull(strchr(message, '!'));
+
+    return true;
+}
+
+static int test_capy_histogram(void)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+    capy_histogram *histogram = capy_histogram_init(arena);
+    capy_histogram *merged = capy_histogram_init(arena);
+    AssertNotNull(histogram);
+    AssertNotNull(merged);
+
+    ExpectEqU(capy_histogram_percentile(histogram, 50), 0);
+
+    for (uint64_t i = 1; i <= 1000; i++)
+    {
+        capy_histogram_record(histogram, i * 1000);
+    }
+
+    ExpectEqU(capy_histogram_count(histogram), 1000);
+    ExpectEqU(capy_histogram_sum(histogram), 500500000);
+    ExpectEqU(capy_histogram_max(histogram), 1000000);
+
+    // buckets are within 1/16 of the values they hold
+    uint64_t p50 = capy_histogram_percentile(histogram, 50);
+    uint64_t p99 = capy_histogram_percentile(histogram, 99);
+    ExpectGteU(p50, 500000);
+    ExpectLtU(p50, 500000 + (500000 / 16));
+    ExpectGteU(p99, 990000);
+    ExpectLtU(p99, 990000 + (990000 / 16));
+    ExpectEqU(capy_histogram_percentile(histogram, 100), 1000000);
+
+    // counts below bucket bounds are exact, others leave out the bucket holding the bound
+    ExpectEqU(capy_histogram_below(histogram, (UINT64_C(1) << 19) - 1), 524);
+    ExpectLtU(capy_histogram_below(histogram, 500000), 500);
+    ExpectGteU(capy_histogram_below(histogram, 500000), 500 - (500 / 16));
+    ExpectEqU(capy_histogram_below(histogram, 0), 0);
+
+    // small values are exact, huge ones land in the last bucket
+    capy_histogram_record(merged, 3);
+    capy_histogram_record(merged, UINT64_MAX);
+    ExpectEqU(capy_histogram_percentile(merged, 50), 3);
+    ExpectEqU(capy_histogram_percentile(merged, 100), UINT64_MAX);
+
+    capy_histogram_merge(merged, histogram);
+    ExpectEqU(capy_histogram_count(merged), 1002);
+    ExpectEqU(capy_histogram_max(merged), UINT64_MAX);
+    ExpectEqU(capy_histogram_percentile(merged, 0), 3);
+    ExpectEqU(capy_histogram_below(merged, UINT64_MAX), 1001);
+
+    capy_arena_destroy(arena);
+    return true;
+}
+
+static int test_httpconn_clock(void)
+{
+    httpconn conn = {.idle = true, .clocked = STATE_READ_REQUEST, .timestamp = capy_now()};
+
+    // the read that receives the first bytes of a request only marks its start
+    ExpectGteS(httpconn_clock(&conn, true), 0);
+    ExpectFalse(conn.idle);
+    ExpectEqS(conn.phases[PHASE_READ], 0);
+
+    conn.clocked = STATE_PARSE_HEADERS;
+    conn.state = STATE_ROUTE_REQUEST;
+    conn.timestamp.tv_sec -= 1;
+    httpconn_clock(&conn, true);
+    ExpectGteS(conn.phases[PHASE_PARSE], SecondsNano(INT64_C(1)));
+    ExpectEqS(conn.clocked, STATE_ROUTE_REQUEST);
+
+    conn.timestamp.tv_sec -= 2;
+    httpconn_clock(&conn, true);
+    ExpectGteS(conn.phases[PHASE_HANDLER], SecondsNano(INT64_C(2)));
+    ExpectLtS(conn.phases[PHASE_PARSE], SecondsNano(INT64_C(2)));
+
+    conn.timestamp.tv_sec -= 1;
+    httpconn_clock(&conn, true);
+    ExpectGteS(conn.phases[PHASE_HANDLER], SecondsNano(INT64_C(3)));
+    ExpectEqS(conn.phases[PHASE_WRITE], 0);
+
+    return true;
+}
+
+static int test_httpserver_metrics(void)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+
+    capy_httproute routes[] = {{.method = CAPY_HTTP_GET, .path = Str("/users/^id"), .handler = test_scratch_handler}};
+    capy_httpserveropt options = {.workers = 2, .routes_size = 1, .routes = routes, .metrics_path = "/metrics"};
+
+    httpserver workers[2];
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        workers[i] = (httpserver){.options = &options, .workers = workers};
+        workers[i].budget = capy_membudget_init(arena, 0, NULL);
+        workers[i].metrics = httpmetrics_init(arena, 3);
+        AssertNotNull(workers[i].metrics);
+    }
+
+    capy_arena *conn_arena = capy_arena_init(0, KiB(64));
+    httpconn conn = {.server = workers + 1, .arena = conn_arena, .conn_id = 1, .route = 1, .response = {.status = CAPY_HTTP_OK}, .queued = -1};
+    workers[1].metrics->connections = 1;
+
+    httpconn_count(&conn, MillisecondsNano(INT64_C(2)));
+    httpconn_gauge(&conn, false);
+    ExpectEqS(workers[1].metrics->active, 1);
+
+    conn.server = workers;
+    conn.route = 0;
+    conn.response.status = CAPY_HTTP_NOT_FOUND;
+    conn.queued = MillisecondsNano(INT64_C(3));
+    httpconn_count(&conn, 0);
+
+    capy_httpresp response = {.headers = capy_strkvnmap_init(arena, 4), .body = capy_buffer_init(arena, 256)};
+
+    ExpectOk(httpserver_write_metrics(workers, arena, &response));
+    ExpectOk(capy_buffer_write_null(response.body));
+    ExpectEqS(response.status, CAPY_HTTP_OK);
+
+    const char *text = response.body->data;
+    ExpectNotNull(strstr(text, "capy_http_responses_total{route=\"GET /users/^id\",code=\"2xx\"} 1\n"));
+    ExpectNotNull(strstr(text, "capy_http_responses_total{route=\"-\",code=\"4xx\"} 1\n"));
+    ExpectNotNull(strstr(text, "# TYPE capy_http_response_seconds histogram\n"));
+    ExpectNotNull(strstr(text, "capy_http_response_seconds_bucket{route=\"GET /users/^id\",code=\"2xx\",le=\"0.001\"} 0\n"));
+    ExpectNotNull(strstr(text, "capy_http_response_seconds_bucket{route=\"GET /users/^id\",code=\"2xx\",le=\"0.0025\"} 1\n"));
+    ExpectNotNull(strstr(text, "capy_http_response_seconds_bucket{route=\"GET /users/^id\",code=\"2xx\",le=\"+Inf\"} 1\n"));
+    ExpectNotNull(strstr(text, "capy_http_response_seconds_count{route=\"GET /users/^id\",code=\"2xx\"} 1\n"));
+    ExpectNotNull(strstr(text, "capy_http_response_seconds_count{route=\"-\",code=\"4xx\"} 1\n"));
+    ExpectNull(strstr(text, "capy_http_response_seconds_count{route=\"GET /users/^id\",code=\"4xx\"}"));
+    ExpectNotNull(strstr(text, "capy_http_connections{state=\"active\"} 1\n"));
+    ExpectNull(strstr(text, "route=\"GET /metrics\""));
+    ExpectNull(strstr(text, "capy_http_stalls_total{"));
+    ExpectNotNull(strstr(text, "capy_http_queue_seconds_bucket{route=\"-\",le=\"0.005\"} 1\n"));
+    ExpectNotNull(strstr(text, "capy_http_queue_seconds_count{route=\"-\"} 1\n"));
+    ExpectNull(strstr(text, "capy_http_queue_seconds_count{route=\"GET /users/^id\"}"));
+
+    // closing connections removes them from the gauges of the worker that counted them
+    conn.server = workers + 1;
+    httpconn_gauge(&conn, true);
+    ExpectEqS(workers[1].metrics->connections, 0);
+    ExpectEqS(workers[1].metrics->active, 0);
+    ExpectEqS(workers[1].metrics->memory, 0);
+
+    capy_arena_destroy(conn_arena);
+    capy_arena_destroy(arena);
+    return true;
+}
+
+static int test_httpserver_trim_idle(void)
+{
+    httpserver server = {0};
+    httpconn conns[2] = {{.server = &server}, {.server = &server}};
+
+    for (size_t i = 0; i < ArrLen(conns); i++)
+    {
+        conns[i].arena = capy_arena_init(0, MiB(1));
+        AssertNotNull(conns[i].arena);
+
+        // capacity is kept after requests, as connection arenas do
+        capy_arena_set_policy(conns[i].arena, (capy_arenapolicy){.decommit = CAPY_ARENA_MADV_FREE, .shrink_ratio = 8, .decay = Seconds(60)});
+
+        void *mark = capy_arena_end(conns[i].arena);
+        ExpectNotNull(Make(conns[i].arena, char, KiB(256)));
+        ExpectOk(capy_arena_free(conns[i].arena, mark));
+        ExpectGteU(capy_arena_stats(conns[i].arena).committed, KiB(256));
+
+        httpconn_idle_add(conns + i);
+    }
+
+    // only connections still waiting for their next request are trimmed
+    httpconn_idle_remove(conns);
+    ExpectEqPtr(server.idle, conns + 1);
+    ExpectOk(httpserver_trim_idle(&server));
+
+    ExpectGteU(capy_arena_stats(conns[0].arena).committed, KiB(256));
+    ExpectLtU(capy_arena_stats(conns[1].arena).committed, KiB(256));
+
+    httpconn_idle_remove(conns + 1);
+    ExpectNull(server.idle);
+
+    capy_arena_destroy(conns[0].arena);
+    capy_arena_destroy(conns[1].arena);
+    return true;
+}
+
+static int test_capy_tcp_timestamping(void)
+{
+    capy_arena *arena = capy_arena_init(0, KiB(64));
+
+    capy_tcp *server = capy_tcp_init(arena);
+    capy_tcp *client = capy_tcp_init(arena);
+    capy_tcp *conn = capy_tcp_init(arena);
+    AssertNotNull(server);
+    AssertNotNull(client);
+    AssertNotNull(conn);
+
+    AssertOk(capy_tcp_listen(server, "127.0.0.1", "0", 16));
+    ExpectOk(capy_tcp_timestamping(server, true));
+
+    struct sockaddr_in address;
+    socklen_t address_size = sizeof(address);
+    AssertEqS(getsockname(capy_tcp_fd(server), ReinterpretCast(struct sockaddr *, &address), &address_size), 0);
+
+    char port[8];
+    snprintf(port, sizeof(port), "%d", ntohs(address.sin_port));
+
+    AssertOk(capy_tcp_connect(client, "127.0.0.1", port));
+
+    capy_buffer *request = capy_buffer_init(arena, 16);
+    ExpectOk(capy_buffer_write_cstr(request, "ping"));
+    ExpectOk(capy_tcp_send(client, request, 1000));
+
+    // the request waits in the accept backlog and the receive queue
+    thrd_sleep(&(struct timespec){.tv_nsec = MillisecondsNano(20)}, NULL);
+
+    AssertOk(capy_tcp_accept(server, conn));
+    ExpectEqS(capy_tcp_rx_delay(conn), -1);
+
+    capy_buffer *received = capy_buffer_init(arena, 16);
+    ExpectOk(capy_tcp_recv(conn, received, 1000));
+    ExpectEqU(received->size, 4);
+    ExpectGteS(capy_tcp_rx_delay(conn), MillisecondsNano(20));
+    ExpectLtS(capy_tcp_rx_delay(conn), SecondsNano(INT64_C(10)));
+
+    // sockets without timestamps never report a delay
+    ExpectOk(capy_buffer_write_cstr(request, "pong"));
+    ExpectOk(capy_tcp_send(conn, request, 1000));
+    ExpectOk(capy_tcp_recv(client, received, 1000));
+    ExpectEqS(capy_tcp_rx_delay(client), -1);
+
+    capy_tcp_close(conn);
+    capy_tcp_close(client);
+    capy_tcp_close(server);
+    capy_arena_destroy(arena);
+    return true;
+}
+
 static int test_capy_http_request_validate(void)
 {
     capy_arena *arena = capy_arena_init(0, KiB(4));
@@ -548,7 +1344,7 @@ static int test_capy_http_request_validate(void)
 
 static int test_http_write_response(void)
 {
-    capy_arena *arena = capy_arena_init(0, KiB(4));
+    capy_arena *arena = capy_arena_init(0, KiB(8));
 
     capy_strkvnmap *fields = capy_strkvnmap_init(arena, 16);
 
@@ -565,7 +1361,7 @@ static int test_http_write_response(void)
 
     ExpectOk(capy_buffer_write_cstr(body, "foobar"));
 
-    capy_buffer *buffer = capy_buffer_init(arena, 1024);
+    capy_segbuf *buffer = capy_segbuf_init(arena, 1024);
 
     capy_httpresp response = {
         .status = 200,
@@ -575,6 +1371,10 @@ static int test_http_write_response(void)
 
     ExpectOk(http_write_response(buffer, &response, false));
 
+    // the body is referenced, not copied
+    ExpectEqPtr(buffer->tail->items, body->data);
+    ExpectEqU(buffer->tail->size, 6);
+
     // char expected_response[] =
     //     "HTTP/1.1 200\r\n"
     //     "Content-Length: 6\r\n"
@@ -605,76 +1405,438 @@ static int test_http_parse_uriparams(void)
     ExpectEqStr(param->key, Str("id"));
     ExpectEqStr(param->value, Str("fe037abd-a9b8-4881-b875-a2f667e2e4ed"));
 
-    param = capy_strkvnmap_get(params, Str("file"));
-    ExpectNotNull(param);
-    ExpectEqStr(param->key, Str("file"));
-    ExpectEqStr(param->value, Str("test"));
+    param = capy_strkvnmap_get(params, Str("file"));
+    ExpectNotNull(param);
+    ExpectEqStr(param->key, Str("file"));
+    ExpectEqStr(param->value, Str("test"));
+
+    param = capy_strkvnmap_get(params, Str("other"));
+    ExpectNull(param);
+
+    capy_arena_destroy(arena);
+    return true;
+}
+
+static int test_capy_json_deserialize(void)
+{
+    capy_arena *arena = capy_arena_init(0, KiB(4));
+
+    capy_jsonval value;
+
+    ExpectOk(capy_json_deserialize(arena, &value, "null"));
+    ExpectEqS(value.kind, CAPY_JSON_NULL);
+
+    ExpectOk(capy_json_deserialize(arena, &value, "true"));
+    ExpectEqS(value.kind, CAPY_JSON_BOOL);
+    ExpectTrue(value.boolean);
+
+    ExpectOk(capy_json_deserialize(arena, &value, "false"));
+    ExpectEqS(value.kind, CAPY_JSON_BOOL);
+    ExpectFalse(value.boolean);
+
+    ExpectOk(capy_json_deserialize(arena, &value, "[\"abcd𐐷\\uD801\\uDC37\",true,null,{},[]]"));
+    ExpectEqS(value.kind, CAPY_JSON_ARRAY);
+    ExpectEqU(value.array->size, 5);
+    ExpectEqS(value.array->data[0].kind, CAPY_JSON_STRING);
+    ExpectEqCstr(value.array->data[0].string, "abcd𐐷𐐷");
+    ExpectEqS(value.array->data[1].kind, CAPY_JSON_BOOL);
+    ExpectTrue(value.array->data[1].boolean);
+    ExpectEqS(value.array->data[2].kind, CAPY_JSON_NULL);
+
+    capy_buffer *buffer = capy_buffer_init(arena, KiB(1));
+    capy_json_serialize(buffer, value, 3);
+    // printf("%s\n", buffer->data);
+
+    ExpectOk(capy_json_deserialize(arena, &value, "300 "));
+
+    return true;
+}
+
+static int test_capy_json_serialize(void)
+{
+    capy_arena *arena = capy_arena_init(0, KiB(4));
+    capy_buffer *buffer = capy_buffer_init(arena, KiB(1));
+
+    capy_jsonval arr = capy_json_array(arena);
+    ExpectOk(capy_json_array_push(arr.array, capy_json_bool(true)));
+    ExpectOk(capy_json_array_push(arr.array, capy_json_bool(false)));
+    ExpectOk(capy_json_array_push(arr.array, capy_json_null()));
+
+    capy_jsonval obj = capy_json_object(arena);
+    ExpectOk(capy_json_object_set(obj.object, "a", capy_json_string("teste")));
+    ExpectOk(capy_json_object_set(obj.object, "b", capy_json_number(10)));
+    ExpectOk(capy_json_object_set(obj.object, "c", capy_json_number(16.32)));
+    ExpectOk(capy_json_object_set(obj.object, "d", arr));
+
+    ExpectOk(capy_json_serialize(buffer, obj, 0));
+    ExpectEqStr(capy_string_bytes(buffer->size, buffer->data), Str("{\"a\":\"teste\",\"b\":10,\"c\":16.32,\"d\":[true,false,null]}"));
+    buffer->size = 0;
+
+    capy_json_serialize(buffer, obj, 3);
+    // printf("%s\n", buffer->data);
+    buffer->size = 0;
+
+    capy_strmap_delete(&obj.object->strmap, Str("b"));
+    ExpectOk(capy_json_serialize(buffer, obj, 0));
+    ExpectEqStr(capy_string_bytes(buffer->size, buffer->data), Str("{\"a\":\"teste\",\"c\":16.32,\"d\":[true,false,null]}"));
+    buffer->size = 0;
+
+    // strings and keys are escaped, numbers keep their precision
+    capy_jsonval escaped = capy_json_object(arena);
+    ExpectOk(capy_json_object_set(escaped.object, "q\"k", capy_json_string("a\"b\\c\n\x01")));
+    ExpectOk(capy_json_object_set(escaped.object, "n", capy_json_number(0.1 + 0.2)));
+    ExpectOk(capy_json_serialize(buffer, escaped, 0));
+    ExpectEqStr(capy_string_bytes(buffer->size, buffer->data), Str("{\"q\\\"k\":\"a\\\"b\\\\c\\n\\u0001\",\"n\":0.30000000000000004}"));
+    buffer->size = 0;
+
+    ExpectEqS(capy_json_serialize(buffer, capy_json_number(NAN), 0).code, EINVAL);
+    ExpectEqS(capy_json_serialize(buffer, capy_json_number(INFINITY), 0).code, EINVAL);
+
+    return true;
+}
+
+typedef struct test_jsonpoint
+{
+    double x;
+    double y;
+} test_jsonpoint;
+
+typedef struct test_jsonuser
+{
+    const char *name;
+    int64_t age;
+    bool admin;
+    test_jsonpoint position;
+    capy_jsonval tags;
+} test_jsonuser;
+
+static const capy_jsonfield test_jsonpoint_fields[] = {
+    JsonField(test_jsonpoint, x, NUMBER, true),
+    JsonField(test_jsonpoint, y, NUMBER, true),
+};
+
+static const capy_jsonschema test_jsonpoint_schema = JsonSchema(test_jsonpoint, test_jsonpoint_fields);
+
+static const capy_jsonfield test_jsonuser_fields[] = {
+    JsonField(test_jsonuser, name, STRING, true),
+    JsonField(test_jsonuser, age, INTEGER, false),
+    JsonField(test_jsonuser, admin, BOOL, false),
+    JsonFieldObject(test_jsonuser, position, &test_jsonpoint_schema, false),
+    JsonField(test_jsonuser, tags, VALUE, false),
+};
+
+static const capy_jsonschema test_jsonuser_schema = JsonSchema(test_jsonuser, test_jsonuser_fields);
+
+static int test_capy_json_decode(void)
+{
+    capy_arena *arena = capy_arena_init(0, KiB(8));
+
+    test_jsonuser user;
+
+    ExpectOk(capy_json_decode(arena, &test_jsonuser_schema, &user,
+                              "{\"id\": {\"a\": [1, \"x\", null]}, \"name\": \"capy\\n\", \"age\": 42,"
+                              " \"admin\": true, \"position\": {\"x\": 1.5, \"y\": -2}, \"tags\": [\"a\", \"b\"]}"));
+    ExpectEqCstr(user.name, "capy\n");
+    ExpectEqS(user.age, 42);
+    ExpectTrue(user.admin);
+    ExpectLteF(user.position.x, 1.5);
+    ExpectGteF(user.position.x, 1.5);
+    ExpectLteF(user.position.y, -2);
+    ExpectEqS(user.tags.kind, CAPY_JSON_ARRAY);
+    ExpectEqU(user.tags.array->size, 2);
+
+    ExpectOk(capy_json_decode(arena, &test_jsonuser_schema, &user, "{\"name\": \"capy\", \"age\": null}"));
+    ExpectEqCstr(user.name, "capy");
+    ExpectEqS(user.age, 0);
+    ExpectFalse(user.admin);
+    ExpectEqS(user.tags.kind, CAPY_JSON_NULL);
+
+    ExpectErr(capy_json_decode(arena, &test_jsonuser_schema, &user, "{\"age\": 42}"));
+    ExpectErr(capy_json_decode(arena, &test_jsonuser_schema, &user, "{\"name\": null}"));
+    ExpectErr(capy_json_decode(arena, &test_jsonuser_schema, &user, "{\"name\": 42}"));
+    ExpectErr(capy_json_decode(arena, &test_jsonuser_schema, &user, "{\"name\": \"capy\", \"age\": 4.2}"));
+    ExpectErr(capy_json_decode(arena, &test_jsonuser_schema, &user, "{\"name\": \"capy\", \"position\": {\"x\": 1}}"));
+    ExpectErr(capy_json_decode(arena, &test_jsonuser_schema, &user, "{\"name\": \"capy\", \"other\": [1, }"));
+    ExpectErr(capy_json_decode(arena, &test_jsonuser_schema, &user, "{\"name\": \"capy\"} {}"));
+    ExpectErr(capy_json_decode(arena, &test_jsonuser_schema, &user, "[]"));
+
+    capy_arena_destroy(arena);
+    return true;
+}
+
+static int test_capy_json_encode(void)
+{
+    capy_arena *arena = capy_arena_init(0, KiB(8));
+    capy_buffer *buffer = capy_buffer_init(arena, 256);
+
+    test_jsonuser user = {
+        .name = "capy",
+        .age = 42,
+        .admin = true,
+        .position = {.x = 1.5, .y = -2},
+        .tags = capy_json_null(),
+    };
+
+    ExpectOk(capy_json_encode(buffer, &test_jsonuser_schema, &user));
+    ExpectEqStr(capy_string_bytes(buffer->size, buffer->data),
+                Str("{\"name\":\"capy\",\"age\":42,\"admin\":true,\"position\":{\"x\":1.5,\"y\":-2},\"tags\":null}"));
+
+    ExpectOk(capy_buffer_write_null(buffer));
+
+    test_jsonuser decoded;
+
+    ExpectOk(capy_json_decode(arena, &test_jsonuser_schema, &decoded, buffer->data));
+    ExpectEqCstr(decoded.name, user.name);
+    ExpectEqS(decoded.age, user.age);
+
+    buffer->size = 0;
+    user.name = "say \"hi\"\\\n\x01";
+    user.position = (test_jsonpoint){.x = 1234567, .y = 0.1};
+
+    ExpectOk(capy_json_encode(buffer, &test_jsonuser_schema, &user));
+    ExpectEqStr(capy_string_bytes(buffer->size, buffer->data),
+                Str("{\"name\":\"say \\\"hi\\\"\\\\\\n\\u0001\",\"age\":42,\"admin\":true,"
+                    "\"position\":{\"x\":1234567,\"y\":0.1},\"tags\":null}"));
+
+    ExpectOk(capy_buffer_write_null(buffer));
+    ExpectOk(capy_json_decode(arena, &test_jsonuser_schema, &decoded, buffer->data));
+    ExpectEqCstr(decoded.name, user.name);
+
+    // VALUE fields go through the same escaping and number formatting
+    buffer->size = 0;
+    user.name = "capy";
+    user.position = (test_jsonpoint){0};
+    user.tags = capy_json_array(arena);
+    ExpectOk(capy_json_array_push(user.tags.array, capy_json_string("a\"b")));
+    ExpectOk(capy_json_array_push(user.tags.array, capy_json_number(1234567.125)));
+
+    ExpectOk(capy_json_encode(buffer, &test_jsonuser_schema, &user));
+    ExpectEqStr(capy_string_bytes(buffer->size, buffer->data),
+                Str("{\"name\":\"capy\",\"age\":42,\"admin\":true,"
+                    "\"position\":{\"x\":0,\"y\":0},\"tags\":[\"a\\\"b\",1234567.125]}"));
+
+    ExpectOk(capy_json_array_push(user.tags.array, capy_json_number(NAN)));
+    ExpectEqS(capy_json_encode(buffer, &test_jsonuser_schema, &user).code, EINVAL);
+    user.tags = capy_json_null();
+
+    user.position.x = NAN;
+    ExpectEqS(capy_json_encode(buffer, &test_jsonuser_schema, &user).code, EINVAL);
+    user.position.x = INFINITY;
+    ExpectEqS(capy_json_encode(buffer, &test_jsonuser_schema, &user).code, EINVAL);
+
+    capy_arena_destroy(arena);
+    return true;
+}
+
+static int test_capy_ndjson(void)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+    capy_buffer *buffer = capy_buffer_init(arena, KiB(64));
+
+    for (int i = 0; i < 1000; i++)
+    {
+        ExpectOk(capy_buffer_write_fmt(buffer, 0, "{\"id\": %d, \"name\": \"item\"}\r\n", i));
+
+        if (i % 100 == 0)
+        {
+            ExpectOk(capy_buffer_write_cstr(buffer, "\n"));
+        }
+    }
+
+    capy_string input = capy_string_bytes(buffer->size, buffer->data);
+    capy_ndjson *ndjson = capy_ndjson_init(arena, input, 64, KiB(256));
+    ExpectNotNull(ndjson);
+
+    capy_jsonbatch *batch;
+    size_t index = 0;
+    size_t values = 0;
+
+    for (;;)
+    {
+        ExpectOk(capy_ndjson_next(ndjson, &batch));
+
+        if (batch == NULL)
+        {
+            break;
+        }
+
+        ExpectEqU(batch->index, index);
+
+        for (size_t i = 0; i < batch->size; i++)
+        {
+            capy_jsonval *id = capy_json_object_get(batch->values[i].object, "id");
+            ExpectNotNull(id);
+            ExpectEqU(Cast(size_t, id->number), values + i);
+        }
+
+        index += 1;
+        values += batch->size;
+    }
+
+    ExpectEqU(values, 1000);
+    ExpectOk(capy_ndjson_destroy(ndjson));
+
+    ndjson = capy_ndjson_init(arena, Str("{\"id\": 1}\n\n{\"id\": 2}\n{\"id\": 3}\n{\"id\": }\n{\"id\": 5}\n"), 2, 0);
+    ExpectNotNull(ndjson);
+
+    ExpectOk(capy_ndjson_next(ndjson, &batch));
+    ExpectNotNull(batch);
+    ExpectEqU(batch->size, 1);
+
+    ExpectOk(capy_ndjson_next(ndjson, &batch));
+    ExpectNotNull(batch);
+    ExpectEqU(batch->line, 3);
+    ExpectEqU(batch->size, 2);
+
+    capy_err err = capy_ndjson_next(ndjson, &batch);
+    ExpectErr(err);
+    ExpectNull(batch);
+    ExpectNotNull(strstr(err.msg, "line 5"));
+
+    ExpectOk(capy_ndjson_destroy(ndjson));
 
-    param = capy_strkvnmap_get(params, Str("other"));
-    ExpectNull(param);
+    ndjson = capy_ndjson_init(arena, input, 1, 0);
+    ExpectNotNull(ndjson);
+    ExpectOk(capy_ndjson_next(ndjson, &batch));
+    ExpectOk(capy_ndjson_destroy(ndjson));
 
     capy_arena_destroy(arena);
     return true;
 }
 
-static int test_capy_json_deserialize(void)
+static int test_capy_cbor(void)
 {
-    capy_arena *arena = capy_arena_init(0, KiB(4));
+    capy_arena *arena = capy_arena_init(0, KiB(64));
+    capy_buffer *buffer = capy_buffer_init(arena, 256);
+
+    ExpectOk(capy_cbor_encode(buffer, capy_json_number(23)));
+    ExpectOk(capy_cbor_encode(buffer, capy_json_number(1000)));
+    ExpectOk(capy_cbor_encode(buffer, capy_json_number(-500)));
+    ExpectOk(capy_cbor_encode(buffer, capy_json_number(1.5)));
+    ExpectOk(capy_cbor_encode(buffer, capy_json_number(-0.0)));
+    ExpectOk(capy_cbor_encode(buffer, capy_json_number(-0x1p-24)));
+    ExpectOk(capy_cbor_encode(buffer, capy_json_number(INFINITY)));
+    ExpectOk(capy_cbor_encode(buffer, capy_json_number(0x1p-25)));
+    ExpectOk(capy_cbor_encode(buffer, capy_json_number(100000.5)));
+    ExpectOk(capy_cbor_encode(buffer, capy_json_number(1.1)));
+    ExpectOk(capy_cbor_encode(buffer, capy_json_bool(true)));
+    ExpectOk(capy_cbor_encode(buffer, capy_json_null()));
+    ExpectOk(capy_cbor_encode(buffer, capy_json_string("capy")));
+    ExpectEqMem(buffer->data,
+                "\x17"
+                "\x19\x03\xe8"
+                "\x39\x01\xf3"
+                "\xf9\x3e\x00"
+                "\xf9\x80\x00"
+                "\xf9\x80\x01"
+                "\xf9\x7c\x00"
+                "\xfa\x33\x00\x00\x00"
+                "\xfa\x47\xc3\x50\x40"
+                "\xfb\x3f\xf1\x99\x99\x99\x99\x99\x9a"
+                "\xf5"
+                "\xf6"
+                "\x64" "capy",
+                buffer->size);
 
     capy_jsonval value;
 
-    ExpectOk(capy_json_deserialize(arena, &value, "null"));
-    ExpectEqS(value.kind, CAPY_JSON_NULL);
-
-    ExpectOk(capy_json_deserialize(arena, &value, "true"));
-    ExpectEqS(value.kind, CAPY_JSON_BOOL);
-    ExpectTrue(value.boolean);
-
-    ExpectOk(capy_json_deserialize(arena, &value, "false"));
-    ExpectEqS(value.kind, CAPY_JSON_BOOL);
-    ExpectFalse(value.boolean);
+    ExpectOk(capy_json_deserialize(arena, &value, "{\"name\": \"capy\", \"tags\": [1, -2, 3.25, null, false, {}], \"nested\": {\"x\": 1e300}}"));
 
-    ExpectOk(capy_json_deserialize(arena, &value, "[\"abcd𐐷\\uD801\\uDC37\",true,null,{},[]]"));
-    ExpectEqS(value.kind, CAPY_JSON_ARRAY);
-    ExpectEqU(value.array->size, 5);
-    ExpectEqS(value.array->data[0].kind, CAPY_JSON_STRING);
-    ExpectEqCstr(value.array->data[0].string, "abcd𐐷𐐷");
-    ExpectEqS(value.array->data[1].kind, CAPY_JSON_BOOL);
-    ExpectTrue(value.array->data[1].boolean);
-    ExpectEqS(value.array->data[2].kind, CAPY_JSON_NULL);
+    buffer->size = 0;
+    ExpectOk(capy_cbor_encode(buffer, value));
+
+    capy_jsonval decoded;
+    ExpectOk(capy_cbor_decode(arena, &decoded, capy_string_bytes(buffer->size, buffer->data)));
+    ExpectEqU(decoded.kind, CAPY_JSON_OBJECT);
+    ExpectEqU(decoded.object->size, 3);
+    ExpectEqCstr(capy_json_object_get(decoded.object, "name")->string, "capy");
+
+    capy_jsonval *tags = capy_json_object_get(decoded.object, "tags");
+    ExpectNotNull(tags);
+    ExpectEqU(tags->array->size, 6);
+    ExpectEqS(Cast(int64_t, tags->array->data[1].number), -2);
+    ExpectTrue(tags->array->data[2].number == 3.25);
+    ExpectEqU(tags->array->data[3].kind, CAPY_JSON_NULL);
+    ExpectEqU(tags->array->data[4].kind, CAPY_JSON_BOOL);
+    ExpectEqU(tags->array->data[5].kind, CAPY_JSON_OBJECT);
+    ExpectTrue(capy_json_object_get(capy_json_object_get(decoded.object, "nested")->object, "x")->number == 1e300);
+
+    // deleted entries are left out of the map and its length
+    capy_strmap_delete(&value.object->strmap, Str("tags"));
 
-    capy_buffer *buffer = capy_buffer_init(arena, KiB(1));
-    capy_json_serialize(buffer, value, 3);
-    // printf("%s\n", buffer->data);
+    buffer->size = 0;
+    ExpectOk(capy_cbor_encode(buffer, value));
+    ExpectOk(capy_cbor_decode(arena, &decoded, capy_string_bytes(buffer->size, buffer->data)));
+    ExpectEqU(decoded.object->size, 2);
+    ExpectNull(capy_json_object_get(decoded.object, "tags"));
+
+    ExpectOk(capy_cbor_decode(arena, &decoded, Str("\xf9\x3c\x00")));
+    ExpectTrue(decoded.number == 1.0);
+    ExpectOk(capy_cbor_decode(arena, &decoded, Str("\xf9\x80\x01")));
+    ExpectTrue(decoded.number == -0x1p-24);
+    ExpectOk(capy_cbor_decode(arena, &decoded, Str("\xc1\x1a\x51\x4b\x67\xb0")));
+    ExpectTrue(decoded.number == 1363896240);
+    ExpectOk(capy_cbor_decode(arena, &decoded, Str("\x60")));
+    ExpectEqCstr(decoded.string, "");
+    ExpectOk(capy_cbor_decode(arena, &decoded, Str("\xa1\x60\x01")));
+    ExpectNotNull(capy_json_object_get(decoded.object, ""));
+
+    ExpectErr(capy_cbor_decode(arena, &decoded, Str("")));
+    ExpectErr(capy_cbor_decode(arena, &decoded, Str("\x19\x03")));
+    ExpectErr(capy_cbor_decode(arena, &decoded, Str("\x64" "cap")));
+    ExpectErr(capy_cbor_decode(arena, &decoded, Str("\x9b\xff\xff\xff\xff\xff\xff\xff\xff")));
+    ExpectErr(capy_cbor_decode(arena, &decoded, Str("\xa1\x01\x02")));
+    ExpectErr(capy_cbor_decode(arena, &decoded, Str("\x42" "ab")));
+    ExpectErr(capy_cbor_decode(arena, &decoded, Str("\x9f\xff")));
+    ExpectErr(capy_cbor_decode(arena, &decoded, Str("\xf6\xf6")));
 
-    ExpectOk(capy_json_deserialize(arena, &value, "300 "));
 
+    capy_arena_destroy(arena);
     return true;
 }
 
-static int test_capy_json_serialize(void)
+static int test_capy_http_jsonval(void)
 {
-    capy_arena *arena = capy_arena_init(0, KiB(4));
-    capy_buffer *buffer = capy_buffer_init(arena, KiB(1));
+    capy_arena *arena = capy_arena_init(0, KiB(64));
 
-    capy_jsonval arr = capy_json_array(arena);
-    ExpectOk(capy_json_array_push(arr.array, capy_json_bool(true)));
-    ExpectOk(capy_json_array_push(arr.array, capy_json_bool(false)));
-    ExpectOk(capy_json_array_push(arr.array, capy_json_null()));
+    capy_httpreq request = {.headers = capy_strkvnmap_init(arena, 8)};
+    capy_httpresp response = {.headers = capy_strkvnmap_init(arena, 8), .body = capy_buffer_init(arena, 256)};
 
-    capy_jsonval obj = capy_json_object(arena);
-    ExpectOk(capy_json_object_set(obj.object, "a", capy_json_string("teste")));
-    ExpectOk(capy_json_object_set(obj.object, "b", capy_json_number(10)));
-    ExpectOk(capy_json_object_set(obj.object, "c", capy_json_number(16.32)));
-    ExpectOk(capy_json_object_set(obj.object, "d", arr));
+    capy_jsonval value;
 
-    capy_json_serialize(buffer, obj, 0);
-    // printf("%s\n", buffer->data);
-    buffer->size = 0;
+    request.content = Str("{\"id\": 7}");
+    ExpectOk(capy_http_read_jsonval(arena, &request, &value));
+    ExpectEqU(value.kind, CAPY_JSON_OBJECT);
 
-    capy_json_serialize(buffer, obj, 3);
-    // printf("%s\n", buffer->data);
+    ExpectOk(capy_strkvnmap_set(request.headers, Str("Content-Type"), Str("application/CBOR; charset=binary")));
+    request.content = Str("\xa1\x62id\x07");
+    ExpectOk(capy_http_read_jsonval(arena, &request, &value));
+    ExpectTrue(capy_json_object_get(value.object, "id")->number == 7);
+
+    ExpectOk(capy_strkvnmap_set(request.headers, Str("Content-Type"), Str("text/plain")));
+    ExpectEqS(capy_http_read_jsonval(arena, &request, &value).code, ENOTSUP);
+
+    ExpectOk(capy_http_write_jsonval(&request, &response, value));
+    ExpectEqStr(capy_strkvnmap_get(response.headers, Str("Content-Type"))->value, Str("application/json"));
+    ExpectEqStr(capy_string_bytes(response.body->size, response.body->data), Str("{\"id\":7}"));
+
+    ExpectOk(capy_strkvnmap_set(request.headers, Str("Accept"), Str("application/json;q=0.5, application/cbor")));
+    response.body->size = 0;
+    ExpectOk(capy_http_write_jsonval(&request, &response, value));
+    ExpectEqStr(capy_strkvnmap_get(response.headers, Str("Content-Type"))->value, Str("application/cbor"));
+    ExpectEqStr(capy_string_bytes(response.body->size, response.body->data), Str("\xa1\x62id\x07"));
+
+    ExpectEqS(http_accept_quality(capy_strkvnmap_get(request.headers, Str("Accept")), Str("application/json")), 500);
+
+    ExpectOk(capy_strkvnmap_set(request.headers, Str("Accept"), Str("application/*;q=0.8, application/json")));
+    ExpectEqS(http_accept_quality(capy_strkvnmap_get(request.headers, Str("Accept")), Str("application/cbor")), 800);
+    ExpectEqS(http_accept_quality(capy_strkvnmap_get(request.headers, Str("Accept")), Str("application/json")), 1000);
+
+    ExpectOk(capy_strkvnmap_set(request.headers, Str("Accept"), Str("*/*;q=0.1")));
+    ExpectEqS(http_accept_quality(capy_strkvnmap_get(request.headers, Str("Accept")), Str("application/cbor")), 100);
+    ExpectEqS(http_accept_quality(capy_strkvnmap_get(request.headers, Str("Accept")), Str("text/html")), 100);
 
+    capy_arena_destroy(arena);
     return true;
 }
 
@@ -869,8 +2031,9 @@ static int test_capy_strset(void)
     ExpectEqS(capy_strset_has(strset, Str("foo")), false);
 
     ExpectOk(capy_strset_add(strset, Str("foo")));
+    ExpectOk(capy_strset_add(strset, Str("bar")));
     ExpectNotNull(Make(arena, char, capy_arena_available(arena)));
-    ExpectErr(capy_strset_add(strset, Str("bar")));
+    ExpectErr(capy_strset_add(strset, Str("baz")));
 
     capy_arena_destroy(arena);
     return true;
@@ -904,9 +2067,10 @@ static int test_capy_strkvmap(void)
     ExpectNull(capy_strkvmap_get(strkvmap, Str("foo")));
 
     ExpectOk(capy_strkvmap_set(strkvmap, Str("foo"), Str("bar")));
+    ExpectOk(capy_strkvmap_set(strkvmap, Str("bar"), Str("foo")));
 
     ExpectNotNull(Make(arena, char, capy_arena_available(arena)));
-    ExpectErr(capy_strkvmap_set(strkvmap, Str("bar"), Str("foo")));
+    ExpectErr(capy_strkvmap_set(strkvmap, Str("baz"), Str("foo")));
 
     capy_arena_destroy(arena);
     return true;
@@ -954,6 +2118,97 @@ static int test_capy_strkvnmap(void)
     strkvn = capy_strkvnmap_get(strkvnmap, Str("foo"));
     ExpectNull(strkvn);
 
+    const char *keys[] = {"k0", "k1", "k2", "k3", "k4", "k5", "k6", "k7", "k8", "k9"};
+
+    capy_strkvnmap *ordered = capy_strkvnmap_init(arena, 2);
+    ExpectNotNull(ordered);
+
+    for (size_t i = 0; i < ArrLen(keys); i++)
+    {
+        // small maps are scanned linearly until they outgrow 8 entries
+        if (i < 8)
+        {
+            ExpectNull(ordered->strmap.ctrl);
+        }
+
+        ExpectOk(capy_strkvnmap_set(ordered, capy_string_cstr(keys[i]), Str("v")));
+    }
+
+    ExpectNotNull(ordered->strmap.ctrl);
+
+    // deleted entries stay in place, so pointers to other entries remain valid
+    capy_strkvn *k9 = capy_strkvnmap_get(ordered, Str("k9"));
+
+    capy_strkvnmap_delete(ordered, Str("k3"));
+    capy_strkvnmap_delete(ordered, Str("k0"));
+    ExpectEqU(ordered->size, 10);
+    ExpectEqU(ordered->strmap.dead, 2);
+    ExpectEqPtr(capy_strkvnmap_get(ordered, Str("k9")), k9);
+    ExpectNull(capy_strkvnmap_at(ordered, 0));
+    ExpectNull(capy_strkvnmap_at(ordered, 3));
+
+    for (size_t i = 0; i < ordered->size; i++)
+    {
+        if (i == 0 || i == 3)
+        {
+            continue;
+        }
+
+        ExpectEqStr(capy_strkvnmap_at(ordered, i)->key, capy_string_cstr(keys[i]));
+        ExpectNotNull(capy_strkvnmap_get(ordered, capy_string_cstr(keys[i])));
+    }
+
+    ExpectNull(capy_strkvnmap_at(ordered, ordered->size));
+    ExpectNull(capy_strkvnmap_get(ordered, Str("k3")));
+
+    // a full map drops deleted entries instead of growing when that frees a quarter of it
+    const char *more[] = {"m0", "m1", "m2", "m3", "m4", "m5", "m6"};
+    ExpectEqU(ordered->capacity, 16);
+
+    capy_strkvnmap_delete(ordered, Str("k1"));
+    capy_strkvnmap_delete(ordered, Str("k2"));
+
+    for (size_t i = 0; i < ArrLen(more); i++)
+    {
+        ExpectOk(capy_strkvnmap_set(ordered, capy_string_cstr(more[i]), Str("v")));
+    }
+
+    ExpectEqU(ordered->capacity, 16);
+    ExpectEqU(ordered->size, 13);
+    ExpectEqU(ordered->strmap.dead, 0);
+    ExpectEqStr(capy_strkvnmap_at(ordered, 0)->key, Str("k4"));
+    ExpectEqStr(capy_strkvnmap_at(ordered, 5)->key, Str("k9"));
+    ExpectEqStr(capy_strkvnmap_at(ordered, 12)->key, Str("m6"));
+
+    for (size_t i = 0; i < ArrLen(more); i++)
+    {
+        ExpectNotNull(capy_strkvnmap_get(ordered, capy_string_cstr(more[i])));
+    }
+
+    ExpectNull(capy_strkvnmap_get(ordered, Str("k1")));
+
+    capy_strkvnmap_clear(ordered);
+    ExpectEqU(ordered->size, 0);
+    ExpectNull(capy_strkvnmap_get(ordered, Str("k1")));
+
+    // prehashed keys must agree with plain lookups with and without index
+    capy_strkey key = capy_strkey_init(Str("k5"));
+    ExpectEqU(key.hash, capy_hash("k5", 2));
+
+    for (size_t i = 0; i < ArrLen(keys); i++)
+    {
+        ExpectOk(capy_strkvnmap_set_hashed(ordered, key, capy_string_cstr(keys[i])));
+        ExpectEqStr(capy_strkvnmap_get(ordered, Str("k5"))->value, capy_string_cstr(keys[i]));
+        ExpectOk(capy_strkvnmap_set(ordered, capy_string_cstr(keys[i]), Str("v")));
+        ExpectEqStr(capy_strkvnmap_get_hashed(ordered, capy_strkey_init(capy_string_cstr(keys[i])))->value, Str("v"));
+    }
+
+    ExpectNotNull(ordered->strmap.ctrl);
+    capy_strkvnmap_delete_hashed(ordered, key);
+    ExpectNull(capy_strkvnmap_get(ordered, Str("k5")));
+    ExpectNull(capy_strkvnmap_get_hashed(ordered, key));
+    ExpectNotNull(capy_strkvnmap_get_hashed(ordered, capy_strkey_init(Str("k6"))));
+
     ExpectOk(capy_strkvnmap_add(strkvnmap, Str("bar"), Str("foo")));
     ExpectOk(capy_strkvnmap_add(strkvnmap, Str("foo"), Str("bar")));
     ExpectOk(capy_strkvnmap_add(strkvnmap, Str("foo"), Str("baz")));
@@ -966,6 +2221,160 @@ static int test_capy_strkvnmap(void)
     return true;
 }
 
+static int test_capy_strmap_flood(void)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+    char buffer[32];
+
+    // keys crafted to share the first probed group, as an attacker knowing the seed would send them,
+    // rejected without growing the map even when it is full
+    size_t capacities[] = {512, 128};
+
+    for (size_t c = 0; c < ArrLen(capacities); c++)
+    {
+        capy_strkvnmap *map = capy_strkvnmap_init(arena, capacities[c]);
+        ExpectNotNull(map);
+
+        size_t capacity = map->capacity;
+        capy_err err = Ok;
+
+        for (uint64_t n = 0; !err.code && n < 1000000; n++)
+        {
+            int size = snprintf(buffer, sizeof(buffer), "X-Flood-%" PRIu64, n);
+            capy_string key = capy_string_bytes(Cast(size_t, size), buffer);
+
+            if (((capy_hash(key.data, key.size) >> 7) & 63) != 0)
+            {
+                continue;
+            }
+
+            ExpectOk(capy_string_copy(arena, &key, key));
+            err = capy_strkvnmap_set(map, key, key);
+        }
+
+        ExpectEqS(err.code, EOVERFLOW);
+        ExpectEqU(map->size, 8 * 16);
+        ExpectEqU(map->capacity, capacity);
+    }
+
+    capy_strkvnmap *random = capy_strkvnmap_init(arena, 8);
+    ExpectNotNull(random);
+
+    for (int n = 0; n < 4096; n++)
+    {
+        capy_string key;
+        ExpectOk(capy_string_copy(arena, &key, capy_string_bytes(Cast(size_t, snprintf(buffer, sizeof(buffer), "X-Key-%d", n)), buffer)));
+        ExpectOk(capy_strkvnmap_set(random, key, key));
+    }
+
+    capy_arena_destroy(arena);
+
+    return true;
+}
+
+static int test_capy_cmap_reader(void *data)
+{
+    capy_cmap *map = data;
+    int failures = 0;
+
+    for (int i = 0; i < 20000; i++)
+    {
+        char key[8];
+        int size = snprintf(key, sizeof(key), "k%d", i % 16);
+
+        capy_strkv *kv = capy_cmap_get(map, capy_string_bytes(Cast(size_t, size), key));
+
+        // values are "<key>:<generation>", a torn or freed snapshot would break the prefix
+        if (kv != NULL && (kv->value.size <= kv->key.size || strncmp(kv->value.data, key, Cast(size_t, size)) != 0))
+        {
+            failures += 1;
+        }
+
+        capy_cmap_quiescent();
+    }
+
+    return failures;
+}
+
+static int test_capy_cmap(void)
+{
+    capy_arena *arena = capy_arena_init(0, KiB(64));
+    capy_cmap *map = capy_cmap_init(arena, 4, KiB(64));
+    ExpectNotNull(map);
+
+    ExpectNull(capy_cmap_get(map, Str("foo")));
+    ExpectOk(capy_cmap_delete(map, Str("foo")));
+
+    ExpectOk(capy_cmap_set(map, Str("foo"), Str("bar")));
+    ExpectEqStr(capy_cmap_get(map, Str("foo"))->value, Str("bar"));
+    ExpectOk(capy_cmap_set(map, Str("foo"), Str("baz")));
+    ExpectEqStr(capy_cmap_get(map, Str("foo"))->value, Str("baz"));
+    ExpectOk(capy_cmap_delete(map, Str("foo")));
+    ExpectNull(capy_cmap_get(map, Str("foo")));
+
+    thrd_t readers[2];
+
+    for (size_t i = 0; i < ArrLen(readers); i++)
+    {
+        ExpectEqS(thrd_create(readers + i, test_capy_cmap_reader, map), thrd_success);
+    }
+
+    for (int i = 0; i < 2000; i++)
+    {
+        char key[8];
+        char value[32];
+        int key_size = snprintf(key, sizeof(key), "k%d", i % 16);
+        int value_size = snprintf(value, sizeof(value), "k%d:%d", i % 16, i);
+
+        capy_string k = capy_string_bytes(Cast(size_t, key_size), key);
+        capy_string v = capy_string_bytes(Cast(size_t, value_size), value);
+
+        ExpectOk(capy_cmap_set(map, k, v));
+        ExpectEqStr(capy_cmap_get(map, k)->value, v);
+        capy_cmap_quiescent();
+    }
+
+    for (size_t i = 0; i < ArrLen(readers); i++)
+    {
+        int failures = -1;
+        ExpectEqS(thrd_join(readers[i], &failures), thrd_success);
+        ExpectEqS(failures, 0);
+    }
+
+    // readers exited and this thread is quiescent, so only the snapshot retired by this write is kept
+    capy_cmap_quiescent();
+    ExpectOk(capy_cmap_set(map, Str("k0"), Str("k0:last")));
+
+    struct cmapshard *shard = cmap_shard(map, capy_strkey_init(Str("k0")).hash);
+    size_t retired = 0;
+
+    for (struct cmapversion *version = shard->retired; version != NULL; version = version->next)
+    {
+        retired += 1;
+    }
+
+    ExpectEqU(retired, 1);
+    ExpectLteU(shard->free_size, CMAP_FREE);
+
+    // reclaimed snapshot arenas are reused by later writes
+    int arenas = atomic_load(&arena_allocs);
+
+    for (int i = 0; i < 100; i++)
+    {
+        capy_cmap_quiescent();
+        ExpectOk(capy_cmap_set(map, Str("k0"), Str("k0:last")));
+    }
+
+    ExpectEqS(atomic_load(&arena_allocs), arenas);
+    ExpectEqStr(capy_cmap_get(map, Str("k0"))->value, Str("k0:last"));
+    ExpectEqStr(capy_cmap_get(map, Str("k15"))->value, Str("k15:1999"));
+
+    capy_cmap_destroy(map);
+    capy_arena_destroy(arena);
+
+    return true;
+}
+
 static int test_capy_vec_insert(void)
 {
     capy_arena *arena = capy_arena_init(0, KiB(4));
@@ -1033,8 +2442,237 @@ static int test_capy_vec_delete(void)
     return true;
 }
 
+static int test_capy_segvec(void)
+{
+    capy_arena *arena = capy_arena_init(0, KiB(64));
+
+    capy_segvec vec = {.element_size = sizeof(int)};
+
+    for (int i = 0; i < 100; i++)
+    {
+        ExpectOk(capy_segvec_push(arena, &vec, 1, &i));
+
+        // interleaved allocations don't make the vector copy its elements
+        ExpectNotNull(Make(arena, char, 8));
+    }
+
+    ExpectEqU(vec.size, 100);
+    ExpectEqU(vec.head->capacity, 16);
+    ExpectEqU(vec.head->next->capacity, 16);
+    ExpectEqU(vec.head->next->next->capacity, 32);
+    ExpectEqU(vec.capacity, 128);
+
+    for (int i = 0; i < 100; i++)
+    {
+        ExpectEqS(*Cast(int *, capy_segvec_at(&vec, Cast(size_t, i))), i);
+    }
+
+    ExpectNull(capy_segvec_at(&vec, 100));
+
+    int *reserved = capy_segvec_reserve(arena, &vec, 40);
+    ExpectNotNull(reserved);
+    ExpectEqPtr(reserved, vec.tail->items);
+    ExpectEqU(vec.size, 140);
+
+    capy_segvec_shl(&vec, 20);
+    ExpectEqU(vec.size, 120);
+    ExpectEqS(*Cast(int *, capy_segvec_at(&vec, 0)), 20);
+
+    capy_segvec_shl(&vec, 1000);
+    ExpectEqU(vec.size, 0);
+    ExpectEqPtr(vec.head, vec.tail);
+
+    capy_segvec empty = {.element_size = sizeof(int)};
+    ExpectErr(capy_segvec_push(NULL, &empty, 1, Arr(int, 1)));
+    ExpectNull(capy_segvec_reserve(arena, &empty, MiB(1)));
+
+    capy_arena_destroy(arena);
+    return true;
+}
+
+static int test_capy_segbuf(void)
+{
+    capy_arena *arena = capy_arena_init(0, KiB(4));
+
+    capy_segbuf *buffer = capy_segbuf_init(arena, 8);
+    ExpectNotNull(buffer);
+
+    ExpectOk(capy_segbuf_write_string(buffer, Str("foobar\n")));
+    ExpectOk(capy_segbuf_write_cstr(buffer, "baz"));
+    ExpectOk(capy_segbuf_write_ref(buffer, 2, "baz"));
+    ExpectOk(capy_segbuf_write_fmt(buffer, 50, " %d %.1f", 5, 1.3f));
+    ExpectOk(capy_segbuf_write_fmt(buffer, 4, "%d", 123456));
+    ExpectEqU(buffer->size, 22);
+
+    char output[32];
+    size_t size = 0;
+    size_t segments = 0;
+
+    for (capy_segment *segment = buffer->head; segment != NULL; segment = segment->next)
+    {
+        memcpy(output + size, segment->items, segment->size);
+        size += segment->size;
+        segments += 1;
+    }
+
+    ExpectEqU(segments, 3);
+    ExpectEqMem(output, "foobar\nbazba 5 1.31234", size);
+
+    capy_segbuf_shl(buffer, 11);
+    ExpectEqU(buffer->size, 11);
+    ExpectEqU(buffer->head->size, 1);
+    ExpectEqMem(buffer->head->items, "a", 1);
+    ExpectEqMem(buffer->head->next->items, " 5 1.31234", buffer->head->next->size);
+
+    capy_arena_destroy(arena);
+    return true;
+}
+
 // Task
 
+static void test_capy_profiler_spin(Unused void *data)
+{
+    capy_task_label("spin");
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+
+    volatile uint64_t sum = 0;
+
+    do
+    {
+        for (uint64_t i = 0; i < 10000; i++)
+        {
+            sum += i;
+        }
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1000000000 + (now.tv_nsec - start.tv_nsec) < 200000000);
+}
+
+static int test_capy_profiler_worker(Unused void *data)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+
+    if (capy_task_init(arena, KiB(64), test_capy_profiler_spin, NULL, NULL).code)
+    {
+        return false;
+    }
+
+    int result = !capy_shutdown(1).code;
+
+    capy_arena_destroy(arena);
+    return result;
+}
+
+static int test_capy_profiler(void)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(8));
+    capy_buffer *buffer = capy_buffer_init(arena, KiB(4));
+
+    ExpectOk(capy_profiler_start(1000));
+    ExpectEqS(capy_profiler_start(1000).code, EBUSY);
+
+    thrd_t worker;
+    int result = false;
+    ExpectEqS(thrd_create(&worker, test_capy_profiler_worker, NULL), thrd_success);
+    ExpectEqS(thrd_join(worker, &result), thrd_success);
+    ExpectTrue(result);
+
+    capy_profiler_stop();
+
+    ExpectOk(capy_profiler_write(arena, buffer));
+    ExpectOk(capy_buffer_write_null(buffer));
+
+    // samples of the labeled task are attributed to its label, walked down to the task entrypoint
+    const char *line = strstr(buffer->data, "spin;");
+    ExpectNotNull(line);
+    ExpectTrue(line == buffer->data || line[-1] == '\n');
+
+    size_t frames = 0;
+
+    for (; *line != '\n'; line++)
+    {
+        frames += (*line == ';');
+    }
+
+    ExpectGtU(frames, 1);
+
+    capy_arena_destroy(arena);
+    return true;
+}
+
+struct test_watchdog_result
+{
+    uint64_t stalled;
+    uint64_t resumed;
+    uint64_t reported;
+};
+
+static void test_capy_watchdog_stall(void *data)
+{
+    struct test_watchdog_result *result = data;
+
+    capy_task_label("stall");
+
+    struct timespec start = capy_now();
+
+    while (capy_timespec_diff(capy_now(), start) < MillisecondsNano(60))
+    {
+    }
+
+    // the run is charged when the task yields
+    if (capy_sleep(0).code)
+    {
+        return;
+    }
+
+    result->stalled = capy_task_stalled();
+    result->resumed = capy_task_stalled();
+    result->reported = task_watch->reported;
+}
+
+static int test_capy_watchdog_worker(void *data)
+{
+    capy_arena *arena = capy_arena_init(0, MiB(1));
+
+    if (capy_task_init(arena, KiB(64), test_capy_watchdog_stall, NULL, data).code)
+    {
+        return false;
+    }
+
+    // the task runs again before the scheduler shuts down
+    int result = !capy_shutdown(100).code;
+
+    capy_arena_destroy(arena);
+    return result;
+}
+
+static int test_capy_watchdog(void)
+{
+    struct test_watchdog_result result = {0};
+
+    ExpectOk(capy_watchdog_start(20));
+    ExpectEqS(capy_watchdog_start(20).code, EBUSY);
+
+    thrd_t worker;
+    int ok = false;
+    ExpectEqS(thrd_create(&worker, test_capy_watchdog_worker, &result), thrd_success);
+    ExpectEqS(thrd_join(worker, &ok), thrd_success);
+    ExpectTrue(ok);
+
+    capy_watchdog_stop();
+
+    ExpectGtU(result.stalled, MillisecondsNano(UINT64_C(60)) - 1);
+    ExpectEqU(result.resumed, 0);
+    ExpectGtU(result.reported, 0);
+
+    // the watchdog is stopped, runs are no longer measured
+    ExpectEqU(capy_task_stalled(), 0);
+
+    return true;
+}
+
 static int test_taskqueue(void)
 {
     capy_arena *arena = capy_arena_init(0, KiB(4));
@@ -1471,6 +3109,21 @@ int main(void)
     runtest(&t, test_capy_arena_alloc, "capy_arena_alloc");
     runtest(&t, test_capy_arena_free, "capy_arena_free");
     runtest(&t, test_capy_arena_realloc, "capy_arena_realloc");
+    runtest(&t, test_capy_arena_hugepages, "capy_arena_init_flags");
+    runtest(&t, test_capy_arena_policy, "capy_arena_(set_policy|stats)");
+    runtest(&t, test_capy_membudget, "capy_membudget_(init|pressure|available|stats), capy_arena_(set_budget|trim)");
+    runtest(&t, test_capy_arena_mark, "capy_arena_(mark|rewind), capy_scratch_(begin|end)");
+    runtest(&t, test_httprouter_scratch, "httprouter_handle_request: should rewind scratch arenas");
+    runtest(&t, test_capy_allocprof, "capy_allocprof_(enable|phase|sites|write)");
+    runtest(&t, test_capy_pool, "capy_pool_(init|alloc|free), capy_poolcache_(alloc|free|flush)");
+    runtest(&t, test_capy_pool_threads, "capy_poolcache: should recycle objects across threads");
+    runtest(&t, test_capy_logger, "capy_logger_init: should write records of every thread");
+    runtest(&t, test_capy_logrecord, "logrecord_(encode|message): should format deferred records as printf does");
+    runtest(&t, test_capy_histogram, "capy_histogram_(record|merge|percentile)");
+    runtest(&t, test_httpconn_clock, "httpconn_clock: should charge elapsed time to request phases");
+    runtest(&t, test_httpserver_metrics, "httpserver_write_metrics: should sum the metrics of every worker");
+    runtest(&t, test_httpserver_trim_idle, "httpserver_trim_idle: should trim the arenas of idle connections");
+    runtest(&t, test_capy_tcp_timestamping, "capy_tcp_(timestamping|rx_delay): should measure time queued in the kernel");
     runtest(&t, test_capy_http_request_validate, "capy_http_request_validate");
     runtest(&t, test_http_parse_method, "http_parse_method");
     runtest(&t, test_http_parse_version, "http_parse_version");
@@ -1480,6 +3133,11 @@ int main(void)
     runtest(&t, test_http_parse_uriparams, "http_parse_uriparams");
     runtest(&t, test_capy_json_serialize, "capy_json_serialize");
     runtest(&t, test_capy_json_deserialize, "capy_json_deserialize");
+    runtest(&t, test_capy_json_decode, "capy_json_decode");
+    runtest(&t, test_capy_json_encode, "capy_json_encode");
+    runtest(&t, test_capy_ndjson, "capy_ndjson");
+    runtest(&t, test_capy_cbor, "capy_cbor_(encode|decode)");
+    runtest(&t, test_capy_http_jsonval, "capy_http_(read|write)_jsonval");
     runtest(&t, test_capy_string_cstr, "capy_string_cstr");
     runtest(&t, test_capy_string_eq, "capy_string_eq");
     runtest(&t, test_capy_string_slice, "capy_string_(slice|shl|shr)");
@@ -1493,8 +3151,12 @@ int main(void)
     runtest(&t, test_capy_strset, "capy_strset_(init|has|add)");
     runtest(&t, test_capy_strkvmap, "capy_strset_(init|get|set)");
     runtest(&t, test_capy_strkvnmap, "capy_strset_(init|get|set|add)");
+    runtest(&t, test_capy_strmap_flood, "capy_strmap_set: should bound probes of colliding keys");
+    runtest(&t, test_capy_cmap, "capy_cmap_(init|get|set|delete)");
     runtest(&t, test_capy_vec_insert, "capy_vec_insert");
     runtest(&t, test_capy_vec_delete, "capy_vec_delete");
+    runtest(&t, test_capy_segvec, "capy_segvec_(push|reserve|at|shl)");
+    runtest(&t, test_capy_segbuf, "capy_segbuf_(w*|shl): should produce expected segments");
 
     // URI
     runtest(&t, test_uri_parse, "capy_uri_parse");
@@ -1502,6 +3164,8 @@ int main(void)
 
     // Tasks
     runtest(&t, test_taskqueue, "taskqueue");
+    runtest(&t, test_capy_profiler, "capy_profiler_(start|stop|write): should sample labeled tasks");
+    runtest(&t, test_capy_watchdog, "capy_watchdog_(start|stop), capy_task_stalled: should charge and report stalls");
 
     printf("\nSummary - %d of %d tests succeeded\n", t.succeded, t.succeded + t.failed);
 